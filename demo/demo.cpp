@@ -17,6 +17,7 @@
 #include "module/vo/module_rtspServer.hpp"
 #include "module/vp/module_mppdec.hpp"
 #include "module/vp/module_mppenc.hpp"
+#include "module/vp/module_passthrough.hpp"
 #include "module/vp/module_rga.hpp"
 #include "utils.hpp"
 
@@ -69,6 +70,7 @@ typedef struct DemoConfig {
     bool push_enabled = false;
     bool savetofile_enabled = false;
     bool aplay_enable = false;
+    bool passthrough = false;
 } DemoConfig;
 
 typedef struct DemoData {
@@ -120,6 +122,8 @@ static void usage(char** argv)
             "                               e.g. -s | --sync=video | --sync=abs\n"
             "-A, --aplay                  Enable play audio, default disabled. e.g. --aplay plughw:3,0\n"
             "-l, --loop                   Loop reads the media file.\n"
+            "-n, --passthrough            Record or push the compressed source as it is, without decoding and encoding.\n"
+            "                               Display, rotation and encoding are ignored. default disabled\n"
             "-r, --rotate                 Image rotation degree, default 0\n"
             "                               0:   none\n"
             "                               1:   vertical mirror\n"
@@ -131,7 +135,7 @@ static void usage(char** argv)
             argv[0]);
 }
 
-static const char* short_options = "i:o:a:b:c:d:z:e:f:p:m:r:s::A:M:xl";
+static const char* short_options = "i:o:a:b:c:d:z:e:f:p:m:r:s::A:M:xln";
 
 // clang-format off
 static struct option long_options[] = {
@@ -156,6 +160,7 @@ static struct option long_options[] = {
     {"x11", no_argument, NULL, 'x'},
 #endif
     {"loop", no_argument, NULL, 'l'},
+    {"passthrough", no_argument, NULL, 'n'},
     {NULL, 0, NULL, 0}
 };
 // clang-format on
@@ -432,12 +437,35 @@ SOURCE_CREATED:
             || (source_module_output_para.v4l2Fmt == V4L2_PIX_FMT_HEVC)) {
             inst_conf->dec_enabled = true;
         }
+
+        if (inst_conf->passthrough) {
+            if (!v4l2fmtIsCompressed(source_module_output_para.v4l2Fmt)) {
+                ff_error("passthrough needs a compressed source\n");
+                goto FAILED;
+            }
+            inst_conf->dec_enabled = false;
+        }
     } else {
         goto FAILED;
     }
 
     inst->last_module = inst->source_module;
 
+    if (inst_conf->passthrough) {
+        // no decoder, rga or encoder, the source packets go to the writer and the servers
+        shared_ptr<ModulePassthrough> passthrough = make_shared<ModulePassthrough>();
+        passthrough->setProductor(inst->last_module);
+        passthrough->setBufferCount(8);
+        passthrough->setTimestampRebase(true);
+        ret = passthrough->init();
+        if (ret < 0) {
+            ff_error("passthrough init failed\n");
+            goto FAILED;
+        }
+        inst->last_module = passthrough;
+        goto PASSTHROUGH_CREATED;
+    }
+
     // inst->dec_enabled = false;
     if (inst_conf->dec_enabled) {
         shared_ptr<ModuleMppDec> dec = make_shared<ModuleMppDec>();
@@ -556,6 +584,8 @@ SOURCE_CREATED:
         inst->last_module = enc;
     }
 
+PASSTHROUGH_CREATED:
+
     if (inst_conf->file_w_enabled) {
         shared_ptr<ModuleFileWriter> file_writer = make_shared<ModuleFileWriter>(inst_conf->output_filename);
         file_writer->setProductor(inst->last_module);
@@ -609,6 +639,7 @@ SOURCE_CREATED:
 			 "Decoder:        %s\n"
 			 "Rga:            %s\n"
 			 "Encoder:        %s\n"
+			 "Passthrough:    %s\n"
 			 "RtspClient:     %s\n"
              "File writer:    %s\n"
 			 "File:           %s\n"
@@ -619,7 +650,8 @@ SOURCE_CREATED:
 			 inst_conf->encode_type == ENCODE_TYPE_H264 ? "H264" : "H265",
 			 inst_conf->dec_enabled ? "enable" : "disable",
 			 inst_conf->rga_enabled ? "enable" : "disable",
-			 inst_conf->enc_enabled ? "enable" : "disable",
+			 inst_conf->enc_enabled && !inst_conf->passthrough ? "enable" : "disable",
+			 inst_conf->passthrough ? "enable" : "disable",
 			 inst_conf->rtsp_c_enabled ? "enable" : "disable",
 			 inst_conf->file_w_enabled ? inst_conf->output_filename : "disable",
  			 inst_conf->savetofile_enabled ? inst_conf->dump_filename : "disable",
@@ -667,6 +699,9 @@ static int parse_config(int argc, char** argv, DemoConfig* config)
             case 'l':
                 config->loop = true;
                 break;
+            case 'n':
+                config->passthrough = true;
+                break;
             case 'z':
                 config->drm_display_plane_zpos = atoi(optarg);
                 break;
@@ -0,0 +1,167 @@
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+#include "base/ff_async_writer.hpp"
+#include "base/ff_clock.hpp"
+#include "base/ff_log.h"
+
+using namespace std;
+using namespace FFMedia;
+
+struct StreamResult {
+    AsyncWriter::Stats stats;
+    uint64_t packets;
+    int64_t max_call_us;
+    int ret;
+};
+
+static void usage(char** argv)
+{
+    ff_info("Usage: %s <Output dir> [Options]\n\n"
+            "Write synthetic encoded streams concurrently through AsyncWriter.\n\n"
+            "Options:\n"
+            "-n, --streams                Stream count, default 32\n"
+            "-m, --megabytes              Megabytes written per stream, default 64\n"
+            "-p, --packet                 Average packet size in bytes, default 16384\n"
+            "-b, --block                  Block size in KB, default 1024\n"
+            "-q, --queue                  Queue size in MB per stream, default 16\n"
+            "-d, --direct                 Use O_DIRECT\n"
+            "-u, --uring                  Use io_uring\n"
+            "-s, --sync                   fdatasync interval in ms, default only on close\n"
+            "\n",
+            argv[0]);
+}
+
+// clang-format off
+static struct option long_options[] = {
+    {"streams", required_argument, NULL, 'n'},
+    {"megabytes", required_argument, NULL, 'm'},
+    {"packet", required_argument, NULL, 'p'},
+    {"block", required_argument, NULL, 'b'},
+    {"queue", required_argument, NULL, 'q'},
+    {"direct", no_argument, NULL, 'd'},
+    {"uring", no_argument, NULL, 'u'},
+    {"sync", required_argument, NULL, 's'},
+    {NULL, 0, NULL, 0}
+};
+// clang-format on
+
+//./demo_async_writer /dev/shm -n 32 -u
+int main(int argc, char** argv)
+{
+    int c;
+    int streams = 32;
+    uint64_t bytes_per_stream = 64ull << 20;
+    size_t packet_size = 16384;
+    AsyncWriter::Config config;
+
+    while ((c = getopt_long(argc, argv, "n:m:p:b:q:dus:", long_options, NULL)) != -1) {
+        switch (c) {
+            case 'n':
+                streams = atoi(optarg);
+                break;
+            case 'm':
+                bytes_per_stream = strtoull(optarg, NULL, 10) << 20;
+                break;
+            case 'p':
+                packet_size = strtoul(optarg, NULL, 10);
+                break;
+            case 'b':
+                config.block_size = strtoul(optarg, NULL, 10) << 10;
+                break;
+            case 'q':
+                config.queue_size = strtoul(optarg, NULL, 10) << 20;
+                break;
+            case 'd':
+                config.direct_io = true;
+                break;
+            case 'u':
+                config.backend = AsyncWriter::BACKEND_IO_URING;
+                break;
+            case 's':
+                config.sync_policy = AsyncWriter::SYNC_INTERVAL;
+                config.sync_interval_ms = atoi(optarg);
+                break;
+            default:
+                usage(argv);
+                return -1;
+        }
+    }
+
+    if (optind >= argc || streams <= 0 || packet_size == 0) {
+        usage(argv);
+        return -1;
+    }
+
+    vector<StreamResult> results(streams);
+    vector<std::thread> threads;
+    string dir = argv[optind];
+    int64_t start = monotonicUs();
+
+    for (int i = 0; i < streams; i++) {
+        threads.emplace_back([&, i] {
+            StreamResult& r = results[i];
+            AsyncWriter writer(config);
+            vector<uint8_t> packet(packet_size * 2);
+            unsigned seed = i;
+            uint64_t written = 0;
+
+            for (size_t k = 0; k < packet.size(); k++)
+                packet[k] = rand_r(&seed);
+
+            r.packets = 0;
+            r.max_call_us = 0;
+            r.ret = writer.open(dir + "/stream_" + to_string(i) + ".h264");
+            while (r.ret == 0 && written < bytes_per_stream) {
+                // 1/2 .. 3/2 of the average, like a stream with a few large key frames
+                size_t size = packet_size / 2 + rand_r(&seed) % packet_size;
+                int64_t t = monotonicUs();
+                r.ret = writer.write(packet.data(), size) < 0 ? -1 : 0;
+                r.max_call_us = std::max(r.max_call_us, monotonicUs() - t);
+                written += size;
+                r.packets++;
+            }
+            if (writer.close() < 0)
+                r.ret = -1;
+            r.stats = writer.getStats();
+        });
+    }
+    for (auto& t : threads)
+        t.join();
+
+    int64_t elapsed = monotonicUs() - start;
+    uint64_t total = 0;
+    int64_t max_call = 0, max_write = 0, avg_write = 0, blocked = 0;
+    uint32_t max_depth = 0;
+    int failed = 0;
+    for (auto& r : results) {
+        total += r.stats.bytes_written;
+        max_call = std::max(max_call, r.max_call_us);
+        max_write = std::max(max_write, r.stats.max_write_us);
+        max_depth = std::max(max_depth, r.stats.max_queue_depth);
+        avg_write += r.stats.avg_write_us;
+        blocked += r.stats.blocked_us;
+        failed += r.ret < 0;
+    }
+
+    ff_print("\nstreams:              %d (%d failed)\n"
+             "written:              %.1f MB in %.3f s, %.1f MB/s\n"
+             "write() call max:     %.3f ms\n"
+             "write() blocked:      %.3f ms per stream\n"
+             "block latency avg:    %.3f ms\n"
+             "block latency max:    %.3f ms\n"
+             "max queue depth:      %u blocks\n\n",
+             streams, failed, total / 1048576.0, elapsed / 1000000.0, total / 1048576.0 / (elapsed / 1000000.0),
+             max_call / 1000.0, blocked / 1000.0 / streams, avg_write / 1000.0 / streams, max_write / 1000.0, max_depth);
+
+    for (int i = 0; i < streams; i++)
+        unlink((dir + "/stream_" + to_string(i) + ".h264").c_str());
+    return failed ? -1 : 0;
+}
@@ -0,0 +1,358 @@
+#include <arpa/inet.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <memory>
+#include <thread>
+
+#include "base/ff_clock.hpp"
+#include "base/ff_cmaf_segmenter.hpp"
+#include "base/ff_cmaf_server.hpp"
+#include "base/ff_log.h"
+
+using namespace std;
+using namespace FFMedia;
+
+static void usage(char** argv)
+{
+    ff_info("Usage: %s [Options]\n\n"
+            "Package a synthetic h264 stream as LL-HLS/DASH with CmafSegmenter, serve it with CmafHttpServer\n"
+            "to a growing number of local low latency hls viewers, and report the cost of the encode thread\n"
+            "for each viewer count. The viewers follow the preload hints, so every part is held by the server\n"
+            "until it exists and is sent as soon as it is cut.\n\n"
+            "Options:\n"
+            "-v, --viewers               Viewers of the last step, the steps double from 1, default 64\n"
+            "-b, --bitrate               Stream bitrate in kbps, default 4000\n"
+            "-f, --fps                   Stream frame rate, default 30\n"
+            "-g, --gop                   Key frame interval in frames, default 60\n"
+            "-s, --segment               Segment duration in ms, default 2000\n"
+            "-P, --part                  Part duration in ms, 0 for plain hls/dash, default 500\n"
+            "-d, --duration              Seconds measured per step, default 5\n"
+            "-p, --port                  Http port, default 8080\n"
+            "-o, --output                Also write the segments and playlists to this directory\n"
+            "-w, --wait                  Keep serving n seconds after the steps, for real players, default 0\n"
+            "\n",
+            argv[0]);
+}
+
+// clang-format off
+static struct option long_options[] = {
+    {"viewers", required_argument, NULL, 'v'},
+    {"bitrate", required_argument, NULL, 'b'},
+    {"fps", required_argument, NULL, 'f'},
+    {"gop", required_argument, NULL, 'g'},
+    {"segment", required_argument, NULL, 's'},
+    {"part", required_argument, NULL, 'P'},
+    {"duration", required_argument, NULL, 'd'},
+    {"port", required_argument, NULL, 'p'},
+    {"output", required_argument, NULL, 'o'},
+    {"wait", required_argument, NULL, 'w'},
+    {NULL, 0, NULL, 0}
+};
+// clang-format on
+
+// 1920x1080 high profile parameter sets
+static const uint8_t synthetic_sps[] = {0x67, 0x64, 0x00, 0x28, 0xac, 0xd9, 0x40, 0x78, 0x02, 0x27, 0xe5, 0x84, 0x00,
+                                        0x00, 0x03, 0x00, 0x04, 0x00, 0x00, 0x03, 0x00, 0xf0, 0x3c, 0x60, 0xc6, 0x58};
+static const uint8_t synthetic_pps[] = {0x68, 0xeb, 0xe3, 0xcb, 0x22, 0xc0};
+
+static void makeFrame(vector<uint8_t>& frame, bool key, size_t size)
+{
+    static const uint8_t start_code[4] = {0, 0, 0, 1};
+
+    frame.clear();
+    if (key) {
+        frame.insert(frame.end(), start_code, start_code + 4);
+        frame.insert(frame.end(), synthetic_sps, synthetic_sps + sizeof(synthetic_sps));
+        frame.insert(frame.end(), start_code, start_code + 4);
+        frame.insert(frame.end(), synthetic_pps, synthetic_pps + sizeof(synthetic_pps));
+    }
+    frame.insert(frame.end(), start_code, start_code + 4);
+    frame.push_back(key ? 0x65 : 0x41);
+    for (size_t i = 0; i < size; i++)
+        frame.push_back((uint8_t)(i * 131) | 0x80);
+}
+
+static int64_t threadCpuUs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int connectLocal(int port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    timeval timeout = {10, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(fd, (sockaddr*)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// One keep-alive GET with a Content-Length reply. Return the status, -1 when the connection failed.
+static int httpGet(int fd, const string& path, const string& range, string& head, vector<uint8_t>& body)
+{
+    string request = "GET " + path + " HTTP/1.1\r\nHost: 127.0.0.1\r\n";
+    if (!range.empty())
+        request += "Range: bytes=" + range + "\r\n";
+    request += "\r\n";
+    if (send(fd, request.data(), request.size(), MSG_NOSIGNAL) < 0)
+        return -1;
+
+    char buf[16384];
+    head.clear();
+    body.clear();
+    size_t end;
+    while ((end = head.find("\r\n\r\n")) == string::npos) {
+        ssize_t n = recv(fd, buf, sizeof(buf), 0);
+        if (n <= 0)
+            return -1;
+        head.append(buf, n);
+    }
+    body.assign(head.begin() + end + 4, head.end());
+    head.resize(end + 2);
+    const char* length = strcasestr(head.c_str(), "Content-Length:");
+    size_t size = length ? strtoul(length + 15, NULL, 10) : 0;
+    while (body.size() < size) {
+        ssize_t n = recv(fd, buf, std::min(sizeof(buf), size - body.size()), 0);
+        if (n <= 0)
+            return -1;
+        body.insert(body.end(), buf, buf + n);
+    }
+    return head.compare(0, 5, "HTTP/") == 0 ? atoi(head.c_str() + 9) : -1;
+}
+
+struct Viewer {
+    std::thread thread;
+    std::atomic<uint64_t> parts{0};
+    std::atomic<uint64_t> bytes{0};
+    std::atomic<uint64_t> hold_us{0};
+    std::atomic<uint64_t> errors{0};
+};
+
+// A low latency hls client without the player: ask for the preload hint and then for the
+// bytes after each response, the server holds each request until the next part is cut.
+static void viewerLoop(Viewer* viewer, int port, const std::atomic<bool>& running)
+{
+    string head;
+    vector<uint8_t> body;
+    uint32_t number = 0;
+    size_t offset = 0;
+    int fd = -1;
+
+    while (running) {
+        if (fd < 0 && (fd = connectLocal(port)) < 0) {
+            viewer->errors++;
+            usleep(100000);
+            continue;
+        }
+        if (number == 0) {
+            int status = httpGet(fd, "/live/0/index.m3u8", "", head, body);
+            string playlist(body.begin(), body.end());
+            size_t hint = playlist.find("#EXT-X-PRELOAD-HINT:TYPE=PART,URI=\"seg");
+            if (status == 200 && hint != string::npos) {
+                number = strtoul(playlist.c_str() + hint + 38, NULL, 10);
+                size_t start = playlist.find("BYTERANGE-START=", hint);
+                offset = start == string::npos ? 0 : strtoul(playlist.c_str() + start + 16, NULL, 10);
+            } else if (status < 0) {
+                close(fd);
+                fd = -1;
+            } else {
+                usleep(100000);
+            }
+            continue;
+        }
+
+        int64_t start = monotonicUs();
+        int status = httpGet(fd, "/live/0/" + CmafSegmenter::segmentName(number), to_string(offset) + "-", head, body);
+        if (status == 206) {
+            viewer->parts++;
+            viewer->bytes += body.size();
+            viewer->hold_us += monotonicUs() - start;
+            offset += body.size();
+        } else if (status == 416) {
+            // the segment is complete, the next part starts the next one
+            number++;
+            offset = 0;
+        } else {
+            viewer->errors++;
+            number = 0;
+            if (status < 0) {
+                close(fd);
+                fd = -1;
+            }
+        }
+    }
+    if (fd >= 0)
+        close(fd);
+}
+
+//./demo_cmaf_server -v 64
+//./demo_cmaf_server -v 8 -P 200 -s 1000 -g 30
+//./demo_cmaf_server -v 1 -o /tmp/cmaf -w 600
+int main(int argc, char** argv)
+{
+    int c;
+    int viewers = 64, bitrate = 4000, fps = 30, gop = 60, duration = 5, port = 8080, wait = 0;
+    CmafSegmenter::Config config;
+
+    while ((c = getopt_long(argc, argv, "v:b:f:g:s:P:d:p:o:w:", long_options, NULL)) != -1) {
+        switch (c) {
+            case 'v':
+                viewers = atoi(optarg);
+                break;
+            case 'b':
+                bitrate = atoi(optarg);
+                break;
+            case 'f':
+                fps = atoi(optarg);
+                break;
+            case 'g':
+                gop = atoi(optarg);
+                break;
+            case 's':
+                config.segment_duration_ms = atoi(optarg);
+                break;
+            case 'P':
+                config.part_duration_ms = atoi(optarg);
+                break;
+            case 'd':
+                duration = atoi(optarg);
+                break;
+            case 'p':
+                port = atoi(optarg);
+                break;
+            case 'o':
+                config.dir = optarg;
+                break;
+            case 'w':
+                wait = atoi(optarg);
+                break;
+            default:
+                usage(argv);
+                return -1;
+        }
+    }
+    if (viewers <= 0 || fps <= 0 || bitrate <= 0 || gop <= 0 || config.segment_duration_ms <= 0) {
+        usage(argv);
+        return -1;
+    }
+
+    // 1. the segmenter and the server, like ModuleCmafSegmenter sets them up
+    config.block_reload = true;
+    shared_ptr<CmafSegmenter> segmenter = make_shared<CmafSegmenter>(config);
+    if (segmenter->open(MEDIA_CODEC_VIDEO_H264, 1920, 1080) < 0)
+        return -1;
+    CmafHttpServer::Config server_config;
+    server_config.port = port;
+    server_config.max_clients = viewers + 16;
+    CmafHttpServer server(server_config);
+    if (server.start() < 0 || server.addStream("/live/0", segmenter) < 0)
+        return -1;
+    ff_info("http://<ip>:%d/live/0/%s, http://<ip>:%d/live/0/%s\n", port, CmafSegmenter::HLS_PLAYLIST, port,
+            CmafSegmenter::DASH_MANIFEST);
+
+    // 2. the encode thread
+    std::atomic<bool> running(true);
+    std::atomic<int64_t> push_cpu_us(0);
+    std::atomic<uint64_t> frames(0);
+    std::thread generator([&] {
+        size_t p_size = (size_t)bitrate * 125 / (fps + 3);
+        vector<uint8_t> key_frame, p_frame;
+        makeFrame(key_frame, true, p_size * 4);
+        makeFrame(p_frame, false, p_size);
+        int64_t interval = 1000000 / fps, next = monotonicUs();
+        for (int64_t n = 0; running; n++) {
+            vector<uint8_t>& frame = n % gop == 0 ? key_frame : p_frame;
+            int64_t start = threadCpuUs();
+            segmenter->writeFrame(frame.data(), frame.size(), n * interval);
+            push_cpu_us += threadCpuUs() - start;
+            frames++;
+            next += interval;
+            int64_t sleep_us = next - monotonicUs();
+            if (sleep_us > 0)
+                usleep(sleep_us);
+        }
+    });
+
+    // wait for the first segment, the viewers start at the preload hint
+    while (segmenter->getLiveSegment() == 0)
+        usleep(10000);
+
+    // 3. the viewers
+    std::atomic<bool> viewers_running(true);
+    vector<unique_ptr<Viewer>> list;
+    ff_info("%8s %10s %10s %12s %14s %10s %12s %8s\n", "viewers", "Mbps", "parts/s", "hold avg ms", "encode us/frame",
+            "encode cpu", "io queue", "errors");
+    for (int count = 0;; count = count == 0 ? 1 : std::min(count * 2, viewers)) {
+        while ((int)list.size() < count) {
+            list.emplace_back(new Viewer());
+            Viewer* viewer = list.back().get();
+            viewer->thread = std::thread(viewerLoop, viewer, port, std::cref(viewers_running));
+        }
+        sleep(1);
+
+        uint64_t last_parts = 0, last_hold = 0, last_errors = 0;
+        for (auto& viewer : list) {
+            last_parts += viewer->parts;
+            last_hold += viewer->hold_us;
+            last_errors += viewer->errors;
+        }
+        CmafHttpServer::Stats last = server.getStats();
+        int64_t last_cpu = push_cpu_us;
+        uint64_t last_frames = frames;
+        sleep(duration);
+        CmafHttpServer::Stats now = server.getStats();
+        int64_t cpu = push_cpu_us - last_cpu;
+        uint64_t step_frames = frames - last_frames;
+        uint64_t parts = 0, hold = 0, errors = 0;
+        for (auto& viewer : list) {
+            parts += viewer->parts;
+            hold += viewer->hold_us;
+            errors += viewer->errors;
+        }
+        parts -= last_parts;
+        hold -= last_hold;
+        errors -= last_errors;
+
+        ff_info("%8zu %10.2f %10.1f %12.1f %14.1f %9.2f%% %12u %8" PRIu64 "\n", list.size(),
+                (now.bytes_sent - last.bytes_sent) * 8 / 1e6 / duration, (double)parts / duration,
+                parts ? hold / 1000.0 / parts : 0.0, step_frames ? (double)cpu / step_frames : 0.0,
+                cpu / 10000.0 / duration, segmenter->getStats().io_queue, errors);
+        if (count == viewers)
+            break;
+    }
+
+    viewers_running = false;
+    for (auto& viewer : list)
+        viewer->thread.join();
+
+    if (wait > 0) {
+        ff_info("serving for %d s\n", wait);
+        sleep(wait);
+    }
+    running = false;
+    generator.join();
+    segmenter->close();
+
+    CmafHttpServer::Stats total = server.getStats();
+    CmafSegmenter::Stats segments = segmenter->getStats();
+    ff_info("segments %u, parts %u, requests %" PRIu64 ", held %" PRIu64 ", not found %" PRIu64 ", io errors %" PRIu64
+            "\n",
+            segments.segments, segments.parts, total.requests, total.held, total.not_found, segments.io_errors);
+    return 0;
+}
@@ -0,0 +1,289 @@
+#include <fcntl.h>
+#include <getopt.h>
+#include <linux/dma-heap.h>
+#include <linux/udmabuf.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <atomic>
+
+#include "base/ff_clock.hpp"
+#include "module/module_pipeline.hpp"
+#include "module/vi/module_dmaBufImport.hpp"
+#include "module/vo/module_fileWriter.hpp"
+#include "module/vp/module_mppenc.hpp"
+#include "module/vp/module_rga.hpp"
+
+using namespace FFMedia;
+
+static void usage(char** argv)
+{
+    ff_info("Usage: %s [Options]\n\n"
+            "Draw NV12 frames into dma-buf fds the way an external producer would, hand them to\n"
+            "ModuleDmaBufImport without copying and encode them (ModuleRga -> ModuleMppEnc ->\n"
+            "ModuleFileWriter), or with -c only check them on the cpu, which needs no hardware.\n"
+            "The buffers come from /dev/dma_heap/system, /dev/udmabuf over a memfd, or a plain memfd.\n\n"
+            "Options:\n"
+            "-s, --size                  Frame size, default 1280x720\n"
+            "-n, --frames                Frames, default 300\n"
+            "-b, --buffers               Buffers of the producer, default 4\n"
+            "-a, --alloc                 heap, udmabuf, memfd or auto, default auto\n"
+            "-r, --resize                Scale with rga to WxH before encoding\n"
+            "-o, --output                Output file, default dmabuf.h264\n"
+            "-c, --cpu                   Check the frames on the cpu instead of encoding them\n"
+            "\n",
+            argv[0]);
+}
+
+// clang-format off
+static struct option long_options[] = {
+    {"size", required_argument, NULL, 's'},
+    {"frames", required_argument, NULL, 'n'},
+    {"buffers", required_argument, NULL, 'b'},
+    {"alloc", required_argument, NULL, 'a'},
+    {"resize", required_argument, NULL, 'r'},
+    {"output", required_argument, NULL, 'o'},
+    {"cpu", no_argument, NULL, 'c'},
+    {NULL, 0, NULL, 0}
+};
+// clang-format on
+
+static int allocHeap(size_t size)
+{
+    int heap = open("/dev/dma_heap/system", O_RDWR | O_CLOEXEC);
+    if (heap < 0)
+        return -1;
+    struct dma_heap_allocation_data data;
+    memset(&data, 0, sizeof(data));
+    data.len = size;
+    data.fd_flags = O_RDWR | O_CLOEXEC;
+    int ret = ioctl(heap, DMA_HEAP_IOCTL_ALLOC, &data);
+    close(heap);
+    return ret < 0 ? -1 : (int)data.fd;
+}
+
+static int allocMemfd(size_t size, bool seal)
+{
+    int fd = memfd_create("ff_dmabuf", MFD_CLOEXEC | (seal ? MFD_ALLOW_SEALING : 0));
+    if (fd < 0)
+        return -1;
+    if (ftruncate(fd, size) < 0 || (seal && fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK) < 0)) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// A dma-buf over a memfd, works on a stock kernel with CONFIG_UDMABUF.
+static int allocUdmabuf(size_t size)
+{
+    int dev = open("/dev/udmabuf", O_RDWR | O_CLOEXEC);
+    if (dev < 0)
+        return -1;
+    int memfd = allocMemfd(size, true);
+    if (memfd < 0) {
+        close(dev);
+        return -1;
+    }
+    struct udmabuf_create create;
+    memset(&create, 0, sizeof(create));
+    create.memfd = memfd;
+    create.flags = UDMABUF_FLAGS_CLOEXEC;
+    create.offset = 0;
+    create.size = size;
+    int fd = ioctl(dev, UDMABUF_CREATE, &create);
+    close(memfd);
+    close(dev);
+    return fd;
+}
+
+static int allocBuffer(const string& alloc, size_t size, const char** kind)
+{
+    int fd = -1;
+    if ((alloc == "heap" || alloc == "auto") && (fd = allocHeap(size)) >= 0)
+        *kind = "dma heap";
+    else if ((alloc == "udmabuf" || alloc == "auto") && (fd = allocUdmabuf(size)) >= 0)
+        *kind = "udmabuf";
+    else if ((alloc == "memfd" || alloc == "auto") && (fd = allocMemfd(size, false)) >= 0)
+        *kind = "memfd";
+    return fd;
+}
+
+// Moving bars, the frame number in the first bytes of the luma.
+static void drawFrame(uint8_t* data, const ImagePara& para, uint32_t n)
+{
+    for (uint32_t y = 0; y < para.height; y++) {
+        uint8_t* row = data + (size_t)y * para.hstride;
+        for (uint32_t x = 0; x < para.width; x++)
+            row[x] = ((x + n * 4) / 64) & 1 ? 200 : 40;
+    }
+    uint8_t* uv = data + (size_t)para.hstride * para.vstride;
+    memset(uv, 128, (size_t)para.hstride * para.height / 2);
+    memcpy(data, &n, sizeof(n));
+}
+
+struct CheckCtx {
+    std::atomic<uint32_t> frames{0};
+    std::atomic<uint32_t> bad{0};
+};
+
+static void callback_check(void* ctx, shared_ptr<MediaBuffer> buffer)
+{
+    CheckCtx* check = (CheckCtx*)ctx;
+    shared_ptr<VideoBuffer> vb = static_pointer_cast<VideoBuffer>(buffer);
+    if (vb == NULL || vb->getEos() || vb->getActiveData() == NULL)
+        return;
+    uint32_t n;
+    memcpy(&n, vb->getActiveData(), sizeof(n));
+    if (n != check->frames || vb->getBufFd() < 0)
+        check->bad++;
+    check->frames++;
+}
+
+//./demo_dmabuf_import -c
+//./demo_dmabuf_import -s 1920x1080 -n 600 -o out.h264
+//./demo_dmabuf_import -r 640x360 -a udmabuf
+int main(int argc, char** argv)
+{
+    int c;
+    uint32_t width = 1280, height = 720, out_w = 0, out_h = 0;
+    int frames = 300, count = 4;
+    string alloc = "auto", output = "dmabuf.h264";
+    bool cpu = false;
+
+    while ((c = getopt_long(argc, argv, "s:n:b:a:r:o:c", long_options, NULL)) != -1) {
+        switch (c) {
+            case 's':
+                sscanf(optarg, "%ux%u", &width, &height);
+                break;
+            case 'n':
+                frames = atoi(optarg);
+                break;
+            case 'b':
+                count = atoi(optarg);
+                break;
+            case 'a':
+                alloc = optarg;
+                break;
+            case 'r':
+                sscanf(optarg, "%ux%u", &out_w, &out_h);
+                break;
+            case 'o':
+                output = optarg;
+                break;
+            case 'c':
+                cpu = true;
+                break;
+            default:
+                usage(argv);
+                return -1;
+        }
+    }
+    if (width < 16 || height < 16 || frames <= 0 || count <= 0) {
+        usage(argv);
+        return -1;
+    }
+
+    ImagePara para(width, height, ALIGN(width, 16), ALIGN(height, 16), V4L2_PIX_FMT_NV12);
+    auto import = make_shared<ModuleDmaBufImport>(para);
+    if (import->init() < 0) {
+        ff_error("dmabuf import init failed\n");
+        return -1;
+    }
+
+    // 1. the producer's buffers, registered once
+    size_t size = ALIGN((size_t)para.hstride * para.vstride * 3 / 2, 4096);
+    const char* kind = "";
+    vector<int> handles;
+    for (int i = 0; i < count; i++) {
+        int fd = allocBuffer(alloc, size, &kind);
+        if (fd < 0) {
+            ff_error("allocating a %s buffer of %zu bytes failed\n", alloc.c_str(), size);
+            return -1;
+        }
+        int handle = import->addBuffer(fd, size);
+        close(fd);
+        if (handle < 0 || import->getBufferData(handle) == NULL)
+            return -1;
+        handles.push_back(handle);
+    }
+    ff_info("%d %s buffers of %zu bytes\n", count, kind, size);
+
+    // 2. the consumers
+    CheckCtx check;
+    shared_ptr<ModuleMedia> last = import;
+    if (cpu) {
+        import->addExternalConsumer("dmabuf_check", &check, callback_check);
+    } else {
+        if (out_w && out_h) {
+            ImagePara out(out_w, out_h, ALIGN(out_w, 16), ALIGN(out_h, 16), V4L2_PIX_FMT_NV12);
+            auto rga = make_shared<ModuleRga>(para, out, RGA_ROTATE_NONE);
+            rga->setProductor(last);
+            if (rga->init() < 0) {
+                ff_error("rga init failed\n");
+                return -1;
+            }
+            last = rga;
+        }
+        auto enc = make_shared<ModuleMppEnc>(ENCODE_TYPE_H264);
+        enc->setProductor(last);
+        enc->setDuration(0);
+        if (enc->init() < 0) {
+            ff_error("Enc init failed\n");
+            return -1;
+        }
+        auto writer = make_shared<ModuleFileWriter>(output);
+        writer->setProductor(enc);
+        if (writer->init() < 0) {
+            ff_error("ModuleFileWriter init failed\n");
+            return -1;
+        }
+    }
+
+    // 3. the buffers come back through the release callback
+    std::mutex mtx;
+    std::condition_variable cond;
+    std::deque<int> free_handles(handles.begin(), handles.end());
+    import->setReleaseCallback([&](int handle, bool) {
+        std::lock_guard<std::mutex> lk(mtx);
+        free_handles.push_back(handle);
+        cond.notify_one();
+    });
+
+    import->start();
+    int64_t start = monotonicUs();
+    for (int n = 0; n < frames; n++) {
+        int handle;
+        {
+            std::unique_lock<std::mutex> lk(mtx);
+            cond.wait(lk, [&] { return !free_handles.empty(); });
+            handle = free_handles.front();
+            free_handles.pop_front();
+        }
+        import->beginCpuAccess(handle);
+        drawFrame((uint8_t*)import->getBufferData(handle), para, n);
+        import->endCpuAccess(handle);
+        if (import->submit(handle, n * 33333ll) < 0) {
+            ff_error("submit failed\n");
+            break;
+        }
+    }
+    import->endOfStream();
+    if (cpu)
+        import->waitIdle(5000);
+    else
+        waitPipelineEos(import, 10000);
+    double seconds = (monotonicUs() - start) / 1e6;
+
+    ff_info("%" PRIu64 " frames in %.2f s, %.1f fps, no copies into the pipeline\n", import->getCompletedCount(),
+            seconds, import->getCompletedCount() / seconds);
+    if (cpu)
+        ff_info("checked %u frames, %u wrong\n", check.frames.load(), check.bad.load());
+    import->stop();
+    return cpu && check.bad ? 1 : 0;
+}
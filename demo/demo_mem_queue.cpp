@@ -0,0 +1,261 @@
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+#include <atomic>
+
+#include "base/ff_annexb_reader.hpp"
+#include "base/ff_clock.hpp"
+#include "module/vi/module_memQueue.hpp"
+#include "module/vi/module_memReader.hpp"
+#include "module/vo/module_drmDisplay.hpp"
+#include "module/vp/module_mppdec.hpp"
+
+using namespace FFMedia;
+
+static void usage(char** argv)
+{
+    ff_info("Usage: %s [Options]\n\n"
+            "Decode an annex-b h264/h265 file from memory, fed through ModuleMemReader's\n"
+            "setInputBuffer()/waitProcess() handshake and through ModuleMemQueue's submission queue\n"
+            "with borrowed (zero copy) buffers, and compare the feed and decode rates. The file is\n"
+            "loaded first, so the disk is not measured.\n\n"
+            "Options:\n"
+            "-i, --input                 Input file (.h264, .h265, .hevc)\n"
+            "-m, --mode                  handshake, queue or both, default both\n"
+            "-l, --loop                  Feed the file that many times, default 1\n"
+            "-q, --queue_depth           Queued submissions, default 16\n"
+            "-b, --buffers               Buffers of the queue with the decoder, default 8\n"
+            "-d, --display               Show the frames on the drm display\n"
+            "\n",
+            argv[0]);
+}
+
+// clang-format off
+static struct option long_options[] = {
+    {"input", required_argument, NULL, 'i'},
+    {"mode", required_argument, NULL, 'm'},
+    {"loop", required_argument, NULL, 'l'},
+    {"queue_depth", required_argument, NULL, 'q'},
+    {"buffers", required_argument, NULL, 'b'},
+    {"display", no_argument, NULL, 'd'},
+    {NULL, 0, NULL, 0}
+};
+// clang-format on
+
+struct DecodeStats {
+    std::atomic<uint64_t> frames{0};
+    std::atomic<int64_t> last_us{0};
+};
+
+static void callback_decoded(void* ctx, shared_ptr<MediaBuffer> buffer)
+{
+    DecodeStats* stats = (DecodeStats*)ctx;
+    if (buffer == NULL || buffer->getEos())
+        return;
+    stats->frames++;
+    stats->last_us = monotonicUs();
+}
+
+static bool endsWith(const string& s, const char* suffix)
+{
+    size_t n = strlen(suffix);
+    return s.size() >= n && strcasecmp(s.c_str() + s.size() - n, suffix) == 0;
+}
+
+static int attachDecoder(shared_ptr<ModuleMedia> source, bool display, DecodeStats* stats,
+                         shared_ptr<ModuleMppDec>& dec, shared_ptr<ModuleDrmDisplay>& drm_display)
+{
+    dec = make_shared<ModuleMppDec>(source->getOutputImagePara());
+    dec->setProductor(source);
+    if (dec->init() < 0) {
+        ff_error("Dec init failed\n");
+        return -1;
+    }
+    dec->addExternalConsumer("decode_stats", stats, callback_decoded);
+
+    if (!display)
+        return 0;
+    ImagePara para = dec->getOutputImagePara();
+    drm_display = make_shared<ModuleDrmDisplay>(para);
+    drm_display->setPlanePara(V4L2_PIX_FMT_NV12);
+    drm_display->setProductor(dec);
+    if (drm_display->init() < 0) {
+        ff_error("drm display init failed\n");
+        return -1;
+    }
+    uint32_t t_w, t_h;
+    drm_display->getPlaneSize(&t_w, &t_h);
+    uint32_t w = std::min(t_w / 2, para.width);
+    uint32_t h = std::min(t_h / 2, para.height);
+    drm_display->setWindowRect((t_w - w) / 2, (t_h - h) / 2, w, h);
+    return 0;
+}
+
+// The decoder has no eos to wait for on the handshake path, it is done once the frames stop.
+static void waitDecoded(DecodeStats* stats, uint64_t expected)
+{
+    uint64_t last = stats->frames;
+    for (int idle_ms = 0; stats->frames < expected && idle_ms < 500; idle_ms += 10) {
+        usleep(10 * 1000);
+        if (stats->frames != last) {
+            last = stats->frames;
+            idle_ms = 0;
+        }
+    }
+}
+
+static void report(const char* mode, size_t aus, int64_t start_us, int64_t fed_us, DecodeStats* stats)
+{
+    double feed_s = (fed_us - start_us) / 1e6;
+    double decode_s = (stats->last_us - start_us) / 1e6;
+    ff_info("%-10s fed %zu access units in %.3f s, %.1f/s, decoded %" PRIu64 " frames, %.1f fps\n", mode, aus, feed_s,
+            aus / feed_s, stats->frames.load(), decode_s > 0 ? stats->frames / decode_s : 0);
+}
+
+static int runHandshake(const ImagePara& para, const vector<vector<uint8_t>>& aus, int loops, bool display)
+{
+    shared_ptr<ModuleMppDec> dec;
+    shared_ptr<ModuleDrmDisplay> drm_display;
+    DecodeStats stats;
+
+    auto mem_r = make_shared<ModuleMemReader>(para);
+    if (mem_r->init() < 0) {
+        ff_error("memory reader init failed\n");
+        return -1;
+    }
+    if (attachDecoder(mem_r, display, &stats, dec, drm_display) < 0)
+        return -1;
+
+    mem_r->start();
+    int64_t start = monotonicUs();
+    for (int l = 0; l < loops; l++) {
+        for (auto& au : aus) {
+            // the reader copies the data, then the next one waits until it is processed
+            if (mem_r->setInputBuffer((void*)au.data(), au.size()) != 0) {
+                ff_error("Failed to set the input buf\n");
+                break;
+            }
+            if (mem_r->waitProcess(2000) != 0 && mem_r->waitProcess(2000) != 0) {
+                ff_warn("Wait timeout\n");
+                break;
+            }
+        }
+    }
+    int64_t fed = monotonicUs();
+    waitDecoded(&stats, aus.size() * loops);
+    report("handshake", aus.size() * loops, start, fed, &stats);
+
+    mem_r->setProcessStatus(ModuleMemReader::DATA_PROCESS_STATUS::PROCESS_STATUS_EXIT);
+    mem_r->stop();
+    return 0;
+}
+
+static int runQueue(const ImagePara& para, const vector<vector<uint8_t>>& aus, int loops, bool display, int depth,
+                    int buffers)
+{
+    shared_ptr<ModuleMppDec> dec;
+    shared_ptr<ModuleDrmDisplay> drm_display;
+    DecodeStats stats;
+    std::atomic<uint64_t> released{0};
+
+    auto queue = make_shared<ModuleMemQueue>(para);
+    queue->setQueueDepth(depth);
+    queue->setBufferCount(buffers);
+    if (queue->init() < 0) {
+        ff_error("memory queue init failed\n");
+        return -1;
+    }
+    if (attachDecoder(queue, display, &stats, dec, drm_display) < 0)
+        return -1;
+
+    // the access units stay loaded, so they are lent to the decoder as they are
+    auto release = [&released](const void*, size_t) { released++; };
+
+    queue->start();
+    int64_t start = monotonicUs();
+    for (int l = 0; l < loops; l++) {
+        for (auto& au : aus) {
+            if (queue->submit(au.data(), au.size(), release) < 0) {
+                ff_error("submit failed\n");
+                break;
+            }
+        }
+    }
+    queue->endOfStream();
+    queue->waitIdle(5000);
+    int64_t fed = monotonicUs();
+    waitDecoded(&stats, aus.size() * loops);
+    report("queue", aus.size() * loops, start, fed, &stats);
+    if (released != queue->getSubmittedCount())
+        ff_warn("%" PRIu64 " of %" PRIu64 " buffers released\n", released.load(), queue->getSubmittedCount());
+
+    queue->stop();
+    return 0;
+}
+
+//./demo_mem_queue -i test.h264
+//./demo_mem_queue -i test.h265 -m queue -l 10 -d
+int main(int argc, char** argv)
+{
+    int c;
+    string input, mode = "both";
+    int loops = 1, depth = 16, buffers = 8;
+    bool display = false;
+
+    while ((c = getopt_long(argc, argv, "i:m:l:q:b:d", long_options, NULL)) != -1) {
+        switch (c) {
+            case 'i':
+                input = optarg;
+                break;
+            case 'm':
+                mode = optarg;
+                break;
+            case 'l':
+                loops = atoi(optarg);
+                break;
+            case 'q':
+                depth = atoi(optarg);
+                break;
+            case 'b':
+                buffers = atoi(optarg);
+                break;
+            case 'd':
+                display = true;
+                break;
+            default:
+                usage(argv);
+                return -1;
+        }
+    }
+    if (input.empty() || loops <= 0 || depth <= 0 || buffers <= 0
+        || (mode != "handshake" && mode != "queue" && mode != "both")) {
+        usage(argv);
+        return -1;
+    }
+
+    bool hevc = endsWith(input, ".h265") || endsWith(input, ".hevc") || endsWith(input, ".265");
+    AnnexBReader reader(hevc ? MEDIA_CODEC_VIDEO_H265 : MEDIA_CODEC_VIDEO_H264);
+    vector<vector<uint8_t>> aus;
+    vector<uint8_t> au;
+    SpsInfo sps;
+    if (reader.open(input) < 0)
+        return -1;
+    while (reader.read(au))
+        aus.push_back(au);
+    if (aus.empty() || !reader.getSpsInfo(&sps)) {
+        ff_error("%s has no sps\n", input.c_str());
+        return -1;
+    }
+    ff_info("%zu access units, %dx%d\n", aus.size(), sps.width, sps.height);
+
+    ImagePara para(sps.width, sps.height, sps.width, sps.height, hevc ? V4L2_PIX_FMT_HEVC : V4L2_PIX_FMT_H264);
+    if (mode != "queue" && runHandshake(para, aus, loops, display) < 0)
+        return -1;
+    if (mode != "handshake" && runQueue(para, aus, loops, display, depth, buffers) < 0)
+        return -1;
+    return 0;
+}
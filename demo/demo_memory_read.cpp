@@ -1,77 +1,65 @@
 #include <stdio.h>
 #include <stdarg.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/stat.h>
 
+#include "base/ff_annexb_reader.hpp"
 #include "module/vi/module_memReader.hpp"
 #include "module/vp/module_mppdec.hpp"
 #include "module/vo/module_drmDisplay.hpp"
 
 
-int H264ReadFrame(FILE* fp, char* in_buf, int in_buf_size)
+static bool endsWith(const std::string& s, const char* suffix)
 {
-    int bytes_used = 0, block_size = 4096;
-    size_t seek = ftell(fp);
-    bool is_find_end = false;
-    int i = 5;  // Skip the first startcode
-
-    while (!is_find_end) {
-        if (in_buf_size < bytes_used + block_size)
-            break;
-        size_t bytes_read = fread(&in_buf[bytes_used], 1, block_size, fp);
-        if (bytes_read == 0) {
-            return bytes_used;
-        }
-
-        bytes_used += bytes_read;
-
-        for (; i < bytes_used - 4; i++) {
-            if (in_buf[i] == 0 && in_buf[i + 1] == 0 && in_buf[i + 2] == 0 && in_buf[i + 3] == 1) {
-                is_find_end = true;
-                break;
-            }
-        }
-    }
-
-    fseek(fp, seek + i, SEEK_SET);
-    return i;
+    size_t n = strlen(suffix);
+    return s.size() >= n && strcasecmp(s.c_str() + s.size() - n, suffix) == 0;
 }
 
-
-//./demo_memory_read xxxxx.h264 width height
+//./demo_memory_read xxxxx.h264|xxxxx.h265 [width height]
 int main(int argc, char** argv)
 {
     int ret = -1;
     shared_ptr<ModuleMemReader> mem_r = NULL;
     shared_ptr<ModuleMppDec> dec = NULL;
     shared_ptr<ModuleDrmDisplay> drm_display = NULL;
-    uint32_t width, height;
-    char* buf = nullptr;
-    uint32_t buf_size;
-    FILE* fp = nullptr;
+    uint32_t width = 0, height = 0;
+    std::vector<uint8_t> au;
+    FFMedia::SpsInfo sps;
 
-    if (argc < 4) {
+    if (argc < 2) {
         ff_error("The number of parameters is incorrect\n");
         return -1;
     }
 
     do {
-        fp = fopen(argv[1], "rb");
-        if (!fp) {
-            ff_error("open file %s failed, reason = %s \n", argv[0], strerror(errno));
+        std::string path = argv[1];
+        bool hevc = endsWith(path, ".h265") || endsWith(path, ".hevc") || endsWith(path, ".265");
+        FFMedia::AnnexBReader reader(hevc ? MEDIA_CODEC_VIDEO_H265 : MEDIA_CODEC_VIDEO_H264);
+        if (reader.open(path) < 0)
+            break;
+
+        // the first access unit carries the sps, the size is taken from it unless given
+        if (!reader.read(au)) {
+            ff_error("%s is empty\n", argv[1]);
             break;
         }
-        width = atoi(argv[2]);
-        height = atoi(argv[3]);
-        buf_size = width * height;
-        if (buf_size == 0 || buf_size > 128 * 1024 * 1024) {
-            ff_error("Image size error\n");
+        if (argc >= 4) {
+            width = atoi(argv[2]);
+            height = atoi(argv[3]);
+        } else if (reader.getSpsInfo(&sps)) {
+            width = sps.width;
+            height = sps.height;
+            ff_info("sps: %dx%d profile %d level %d fps %.2f\n", sps.width, sps.height, sps.profile, sps.level,
+                    sps.fps);
+        }
+        if (width == 0 || height == 0 || width * height > 128 * 1024 * 1024) {
+            ff_error("Image size error, no sps in the first access unit, pass width and height\n");
             break;
         }
-        buf = new char[buf_size];
 
         // 1. memory reader module
-        ImagePara input_para = ImagePara(width, height, width, height, V4L2_PIX_FMT_H264);
+        ImagePara input_para = ImagePara(width, height, width, height, hevc ? V4L2_PIX_FMT_HEVC : V4L2_PIX_FMT_H264);
         mem_r = make_shared<ModuleMemReader>(input_para);
         ret = mem_r->init();
         if (ret < 0) {
@@ -113,12 +101,9 @@ int main(int argc, char** argv)
         // 4. start origin producer
         mem_r->start();
 
-        while (true) {
-            int bytes = H264ReadFrame(fp, buf, buf_size);
-            if (bytes == 0)
-                break;
-
-            ret = mem_r->setInputBuffer(buf, bytes);
+        // one access unit per buffer, 3 and 4 byte start codes, any size
+        do {
+            ret = mem_r->setInputBuffer(au.data(), au.size());
             if (ret != 0) {
                 ff_error("Failed to set the input buf\n");
                 break;
@@ -129,16 +114,12 @@ int main(int argc, char** argv)
                 if (mem_r->waitProcess(2000))
                     break;
             }
-        }
+        } while (reader.read(au));
 
         mem_r->setProcessStatus(ModuleMemReader::DATA_PROCESS_STATUS::PROCESS_STATUS_EXIT);
         mem_r->stop();
 
     } while (0);
 
-    if (buf)
-        delete[] buf;
-    if (fp)
-        fclose(fp);
     return ret;
 }
@@ -0,0 +1,200 @@
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+#include <string>
+#include <vector>
+
+#include "base/ff_annexb_reader.hpp"
+#include "base/ff_clock.hpp"
+#include "base/ff_log.h"
+
+using namespace std;
+using namespace FFMedia;
+
+static void usage(char** argv)
+{
+    ff_info("Usage: %s [Options]\n\n"
+            "Index an annex-b h264/h265 file: the access units, their key frames and the gop, and the\n"
+            "sps (size, profile, level, frame rate). Then measure the start code scan on the file, or\n"
+            "on a synthetic buffer without -i, against a byte loop.\n\n"
+            "Options:\n"
+            "-i, --input                 Input file (.h264, .h265, .hevc)\n"
+            "-c, --codec                 h264 or h265, default from the file name\n"
+            "-l, --list                  Print every access unit\n"
+            "-s, --size                  Synthetic buffer size in MB, default 64\n"
+            "-r, --rounds                Benchmark rounds, default 10\n"
+            "\n",
+            argv[0]);
+}
+
+// clang-format off
+static struct option long_options[] = {
+    {"input", required_argument, NULL, 'i'},
+    {"codec", required_argument, NULL, 'c'},
+    {"list", no_argument, NULL, 'l'},
+    {"size", required_argument, NULL, 's'},
+    {"rounds", required_argument, NULL, 'r'},
+    {NULL, 0, NULL, 0}
+};
+// clang-format on
+
+static bool endsWith(const string& s, const char* suffix)
+{
+    size_t n = strlen(suffix);
+    return s.size() >= n && strcasecmp(s.c_str() + s.size() - n, suffix) == 0;
+}
+
+// The way the start codes were searched before, one byte at a time.
+static const uint8_t* scanBytes(const uint8_t* p, const uint8_t* end)
+{
+    for (; p + 2 < end; p++) {
+        if (p[0] == 0 && p[1] == 0 && p[2] == 1)
+            return p;
+    }
+    return end;
+}
+
+template <typename Scan>
+static void benchmark(const char* what, Scan scan, const vector<uint8_t>& data, int rounds, size_t* found)
+{
+    const uint8_t* end = data.data() + data.size();
+    size_t count = 0;
+    int64_t start = monotonicUs();
+    for (int r = 0; r < rounds; r++) {
+        for (const uint8_t* p = scan(data.data(), end); p < end; p = scan(p + 3, end))
+            count++;
+    }
+    double seconds = (monotonicUs() - start) / 1e6;
+    *found = count / rounds;
+    ff_info("%-24s %8.2f GB/s %10zu start codes\n", what, data.size() * (double)rounds / seconds / 1e9, *found);
+}
+
+static int indexFile(const string& path, media_codec_t codec, bool list, vector<uint8_t>& data)
+{
+    AnnexBReader reader(codec);
+    vector<AnnexBReader::Entry> index;
+    vector<uint8_t> au;
+    SpsInfo sps;
+
+    if (reader.open(path) < 0)
+        return -1;
+
+    int64_t start = monotonicUs();
+    if (reader.buildIndex(index) < 0) {
+        ff_error("index %s failed\n", path.c_str());
+        return -1;
+    }
+    int64_t us = monotonicUs() - start;
+
+    // read again for the sps and the data of the benchmark
+    while (reader.read(au))
+        data.insert(data.end(), au.begin(), au.end());
+
+    if (reader.getSpsInfo(&sps))
+        ff_info("sps: %dx%d profile %d level %d fps %.2f\n", sps.width, sps.height, sps.profile, sps.level, sps.fps);
+    else
+        ff_warn("no sps found\n");
+
+    size_t keys = 0, gop = 0, max_gop = 0, last_key = 0;
+    for (size_t n = 0; n < index.size(); n++) {
+        if (list) {
+            ff_info("%6zu offset %10" PRIu64 " size %8u%s\n", n, index[n].offset, index[n].size,
+                    index[n].key ? " key" : "");
+        }
+        if (!index[n].key)
+            continue;
+        if (keys > 0) {
+            gop = n - last_key;
+            max_gop = max_gop > gop ? max_gop : gop;
+        }
+        last_key = n;
+        keys++;
+    }
+    ff_info("%zu access units, %zu key frames, gop %zu (max %zu), %.1f MB indexed in %.1f ms\n", index.size(), keys,
+            gop, max_gop, data.size() / 1e6, us / 1e3);
+    return 0;
+}
+
+// Slice like data with the start codes of 20 KB access units and zero runs in between.
+static void makeBuffer(vector<uint8_t>& data, size_t size)
+{
+    uint32_t seed = 1;
+    data.resize(size);
+    for (size_t i = 0; i < size; i++) {
+        seed = seed * 1103515245 + 12345;
+        uint8_t v = seed >> 16;
+        data[i] = v < 8 ? 0 : v;
+    }
+    for (size_t i = 0; i + 4 < size; i += 20000) {
+        data[i] = data[i + 1] = data[i + 2] = 0;
+        data[i + 3] = 1;
+    }
+}
+
+//./demo_nal_index -i test.h264
+//./demo_nal_index -i test.h265 -l
+//./demo_nal_index -s 256
+int main(int argc, char** argv)
+{
+    int c;
+    string input;
+    media_codec_t codec = MEDIA_CODEC_VIDEO_H264;
+    bool codec_set = false, list = false;
+    size_t size_mb = 64;
+    int rounds = 10;
+
+    while ((c = getopt_long(argc, argv, "i:c:ls:r:", long_options, NULL)) != -1) {
+        switch (c) {
+            case 'i':
+                input = optarg;
+                break;
+            case 'c':
+                codec = strcasecmp(optarg, "h265") == 0 || strcasecmp(optarg, "hevc") == 0 ? MEDIA_CODEC_VIDEO_H265
+                                                                                              : MEDIA_CODEC_VIDEO_H264;
+                codec_set = true;
+                break;
+            case 'l':
+                list = true;
+                break;
+            case 's':
+                size_mb = atoi(optarg);
+                break;
+            case 'r':
+                rounds = atoi(optarg);
+                break;
+            default:
+                usage(argv);
+                return -1;
+        }
+    }
+    if (size_mb == 0 || rounds <= 0) {
+        usage(argv);
+        return -1;
+    }
+
+    vector<uint8_t> data;
+    if (!input.empty()) {
+        if (!codec_set && (endsWith(input, ".h265") || endsWith(input, ".hevc") || endsWith(input, ".265")))
+            codec = MEDIA_CODEC_VIDEO_H265;
+        if (indexFile(input, codec, list, data) < 0)
+            return -1;
+    } else {
+        makeBuffer(data, size_mb << 20);
+        ff_info("synthetic buffer of %zu MB\n", size_mb);
+    }
+    if (data.size() < 3)
+        return 0;
+
+    size_t simd_found = 0, byte_found = 0;
+    benchmark("findStartCode()", findStartCode, data, rounds, &simd_found);
+    benchmark("byte loop", scanBytes, data, rounds, &byte_found);
+    if (simd_found != byte_found) {
+        ff_error("start code count differs: %zu != %zu\n", simd_found, byte_found);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,388 @@
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <vector>
+
+#include "base/ff_bitstream.hpp"
+#include "base/ff_clock.hpp"
+#include "base/ff_log.h"
+
+using namespace std;
+using namespace FFMedia;
+
+static void usage(char** argv)
+{
+    ff_info("Usage: %s [Options]\n\n"
+            "Check the bitstream helpers of the passthrough path (ModulePassthrough, demo -n) on synthetic\n"
+            "h264 and h265 streams, then measure their throughput on one core: key frame detection, annex-b\n"
+            "to length prefixed and back, parameter sets from an avcC/hvcC record. Returns 0 when all\n"
+            "checks pass.\n\n"
+            "Options:\n"
+            "-n, --frames                Frames per benchmark, default 20000\n"
+            "-s, --size                  Average frame size in bytes, default 20000\n"
+            "-g, --gop                   Gop, default 60\n"
+            "-c, --check                 Only run the checks\n"
+            "\n",
+            argv[0]);
+}
+
+// clang-format off
+static struct option long_options[] = {
+    {"frames", required_argument, NULL, 'n'},
+    {"size", required_argument, NULL, 's'},
+    {"gop", required_argument, NULL, 'g'},
+    {"check", no_argument, NULL, 'c'},
+    {NULL, 0, NULL, 0}
+};
+// clang-format on
+
+// 1920x1080 parameter sets, h264 high and h265 main
+static const uint8_t h264_sps[] = {0x67, 0x64, 0x00, 0x28, 0xac, 0xd9, 0x40, 0x78, 0x02, 0x27, 0xe5, 0x84, 0x00,
+                                   0x00, 0x03, 0x00, 0x04, 0x00, 0x00, 0x03, 0x00, 0xf0, 0x3c, 0x60, 0xc6, 0x58};
+static const uint8_t h264_pps[] = {0x68, 0xeb, 0xe3, 0xcb, 0x22, 0xc0};
+static const uint8_t h265_vps[] = {0x40, 0x01, 0x0c, 0x01, 0xff, 0xff, 0x01, 0x60, 0x00, 0x00, 0x03, 0x00,
+                                   0x90, 0x00, 0x00, 0x03, 0x00, 0x00, 0x03, 0x00, 0x78, 0x97, 0x02, 0x40};
+static const uint8_t h265_sps[] = {0x42, 0x01, 0x01, 0x01, 0x60, 0x00, 0x00, 0x03, 0x00, 0x90,
+                                   0x00, 0x00, 0x03, 0x00, 0x00, 0x03, 0x00, 0x78, 0xa0, 0x03,
+                                   0xc0, 0x80, 0x11, 0x07, 0xcb, 0x96, 0x5e, 0x49, 0x36, 0xb2};
+static const uint8_t h265_pps[] = {0x44, 0x01, 0xc0, 0x70, 0x01, 0x24};
+
+struct Stream {
+    media_codec_t codec;
+    vector<vector<uint8_t>> params;  // nal units without start codes
+    vector<vector<uint8_t>> frames;  // annex-b access units, key frames with the parameter sets
+    vector<bool> key;
+    size_t bytes;
+};
+
+static int failures = 0;
+
+static void check(bool ok, const char* codec, const char* what)
+{
+    ff_info("%-5s %-52s %s\n", codec, what, ok ? "ok" : "FAILED");
+    if (!ok)
+        failures++;
+}
+
+// Slice payload like an encoder writes it: no start code emulation, but emulation
+// prevention bytes and zero runs the scanner has to step over.
+static void appendSlice(vector<uint8_t>& frame, const uint8_t* header, size_t header_size, size_t size,
+                        uint32_t* seed, bool short_start_code)
+{
+    static const uint8_t start_code[4] = {0, 0, 0, 1};
+    frame.insert(frame.end(), start_code + (short_start_code ? 1 : 0), start_code + 4);
+    frame.insert(frame.end(), header, header + header_size);
+    for (size_t i = 0; i < size; i++) {
+        *seed = *seed * 1103515245 + 12345;
+        uint8_t v = *seed >> 16;
+        if (v < 4 && i + 3 < size) {
+            const uint8_t ep[4] = {0, 0, 3, (uint8_t)(v + 1)};
+            frame.insert(frame.end(), ep, ep + 4);
+            i += 3;
+        } else {
+            frame.push_back(v == 0 ? 0x80 : v);
+        }
+    }
+}
+
+static void makeStream(Stream& s, media_codec_t codec, int count, size_t size, int gop)
+{
+    static const uint8_t start_code[4] = {0, 0, 0, 1};
+    uint32_t seed = 1;
+
+    s.codec = codec;
+    s.params.clear();
+    if (codec == MEDIA_CODEC_VIDEO_H265) {
+        s.params.push_back(vector<uint8_t>(h265_vps, h265_vps + sizeof(h265_vps)));
+        s.params.push_back(vector<uint8_t>(h265_sps, h265_sps + sizeof(h265_sps)));
+        s.params.push_back(vector<uint8_t>(h265_pps, h265_pps + sizeof(h265_pps)));
+    } else {
+        s.params.push_back(vector<uint8_t>(h264_sps, h264_sps + sizeof(h264_sps)));
+        s.params.push_back(vector<uint8_t>(h264_pps, h264_pps + sizeof(h264_pps)));
+    }
+
+    s.frames.assign(count, vector<uint8_t>());
+    s.key.assign(count, false);
+    s.bytes = 0;
+    for (int n = 0; n < count; n++) {
+        vector<uint8_t>& frame = s.frames[n];
+        bool key = n % gop == 0;
+        if (key) {
+            for (auto& nal : s.params) {
+                frame.insert(frame.end(), start_code, start_code + 4);
+                frame.insert(frame.end(), nal.begin(), nal.end());
+            }
+        }
+        // idr / trail_r slices, the key frames eight times the size
+        const uint8_t h264_idr[2] = {0x65, 0x88}, h264_p[2] = {0x41, 0x9a};
+        const uint8_t h265_idr[3] = {0x26, 0x01, 0xaf}, h265_p[3] = {0x02, 0x01, 0xd0};
+        size_t slice_size = key ? size * 8 : size * 7 / 8;
+        if (codec == MEDIA_CODEC_VIDEO_H265)
+            appendSlice(frame, key ? h265_idr : h265_p, 3, slice_size, &seed, n % 7 == 3);
+        else
+            appendSlice(frame, key ? h264_idr : h264_p, 2, slice_size, &seed, n % 7 == 3);
+        s.key[n] = key;
+        s.bytes += frame.size();
+    }
+}
+
+static void runChecks(const Stream& s)
+{
+    const char* name = s.codec == MEDIA_CODEC_VIDEO_H265 ? "h265" : "h264";
+    vector<NalUnit> nals;
+    vector<uint8_t> sets, record, lp, annexb, back;
+
+    // the parameter sets as annex-b with 4 byte start codes, the way they are injected
+    vector<uint8_t> expected_sets;
+    for (auto& nal : s.params) {
+        const uint8_t start_code[4] = {0, 0, 0, 1};
+        expected_sets.insert(expected_sets.end(), start_code, start_code + 4);
+        expected_sets.insert(expected_sets.end(), nal.begin(), nal.end());
+    }
+
+    bool ok = true;
+    for (size_t n = 0; n < s.frames.size() && n < 200; n++)
+        ok = ok && isKeyFrame(s.frames[n].data(), s.frames[n].size(), s.codec) == s.key[n];
+    check(ok, name, "key frames found");
+
+    ok = splitNalUnits(s.frames[0].data(), s.frames[0].size(), nals) == s.params.size() + 1;
+    for (size_t i = 0; ok && i < s.params.size(); i++)
+        ok = nals[i].size == s.params[i].size() && memcmp(nals[i].data, s.params[i].data(), nals[i].size) == 0;
+    check(ok, name, "nal units of a key frame split");
+
+    getParameterSets(s.frames[0].data(), s.frames[0].size(), s.codec, sets);
+    check(sets == expected_sets, name, "parameter sets of a key frame");
+
+    int width = 0, height = 0;
+    const vector<uint8_t>& sps = s.params[s.codec == MEDIA_CODEC_VIDEO_H265 ? 1 : 0];
+    ok = parseSpsSize(sps.data(), sps.size(), s.codec, &width, &height) && width == 1920 && height == 1080;
+    check(ok, name, "picture size from the sps");
+
+    SpsInfo info;
+    ok = parseSps(sps.data(), sps.size(), s.codec, &info);
+    if (s.codec == MEDIA_CODEC_VIDEO_H265)
+        ok = ok && info.profile == 1 && info.level == 120 && info.fps == 0;
+    else
+        ok = ok && info.profile == 100 && info.level == 40 && info.fps == 30;
+    check(ok, name, "profile, level and vui frame rate from the sps");
+
+    AccessUnitInfo au;
+    ok = parseAccessUnit(s.frames[0].data(), s.frames[0].size(), s.codec, &au) && au.key && au.idr && au.has_sps
+         && au.has_pps && au.has_vps == (s.codec == MEDIA_CODEC_VIDEO_H265) && au.slice_type == SLICE_TYPE_I
+         && au.slices == 1 && au.nal_count == s.params.size() + 1;
+    ok = ok && parseAccessUnit(s.frames[1].data(), s.frames[1].size(), s.codec, &au) && !au.key && !au.has_sps
+         && au.slice_type == SLICE_TYPE_P && au.nal_count == 1;
+    check(ok, name, "access unit parsed: key, parameter sets, slice type");
+
+    // the simd scanner against a byte loop, at every alignment and tail length, on a key
+    // frame and on a buffer of 0, 1 and 2 bytes with start codes and near misses everywhere
+    ok = true;
+    uint32_t seed = 7;
+    vector<uint8_t> dense(4096);
+    for (auto& v : dense) {
+        seed = seed * 1103515245 + 12345;
+        v = (seed >> 16) % 3;
+    }
+    for (const vector<uint8_t>* buffer : {&s.frames[0], (const vector<uint8_t>*)&dense}) {
+        const vector<uint8_t>& big = *buffer;
+        for (size_t align = 0; ok && align < 64 && align < big.size(); align++) {
+            const uint8_t* end = big.data() + big.size() - (align % 19);
+            for (const uint8_t* p = big.data() + align; ok && p < end;) {
+                const uint8_t* q = p;
+                while (q + 2 < end && !(q[0] == 0 && q[1] == 0 && q[2] == 1))
+                    q++;
+                if (q + 2 >= end)
+                    q = end;
+                ok = findStartCode(p, end) == q;
+                p = q + 1;
+            }
+        }
+    }
+    check(ok, name, "simd start code scan equals a byte loop");
+
+    // access units back out of the concatenated stream
+    vector<uint8_t> stream;
+    size_t count = s.frames.size() < 200 ? s.frames.size() : 200;
+    for (size_t n = 0; n < count; n++)
+        stream.insert(stream.end(), s.frames[n].begin(), s.frames[n].end());
+    ok = true;
+    size_t offset = 0;
+    for (size_t n = 0; ok && n < count; n++) {
+        size_t size = findAccessUnitEnd(stream.data() + offset, stream.size() - offset, s.codec);
+        if (n + 1 == count)
+            ok = size == 0;  // the last one needs more data or the end of the stream
+        else
+            ok = size == s.frames[n].size();
+        offset += s.frames[n].size();
+    }
+    check(ok, name, "access units split from the stream");
+
+    // avcC/hvcC record, as videoExtraData() of a mp4 or flv source
+    vector<uint8_t> empty;
+    if (s.codec == MEDIA_CODEC_VIDEO_H265)
+        ok = buildDecoderConfig(s.codec, s.params[0], s.params[1], s.params[2], record);
+    else
+        ok = buildDecoderConfig(s.codec, empty, s.params[0], s.params[1], record);
+    int length_size = 0;
+    ok = ok && isDecoderConfig(record.data(), record.size()) && !isDecoderConfig(s.frames[0].data(), s.frames[0].size());
+    ok = ok && parseDecoderConfig(record.data(), record.size(), s.codec, sets, &length_size) > 0;
+    check(ok && sets == expected_sets && length_size == 4, name, "parameter sets from the decoder config record");
+    getParameterSets(record.data(), record.size(), s.codec, sets);
+    check(sets == expected_sets, name, "getParameterSets() takes the record too");
+    ok = parseDecoderConfig(record.data(), record.size() - 3, s.codec, sets) < expected_sets.size();
+    check(ok, name, "a truncated record stops at the broken set");
+
+    // round trips, the 3 byte start codes come back as 4 byte ones
+    ok = true;
+    for (size_t n = 0; ok && n < s.frames.size() && n < 200; n++) {
+        const vector<uint8_t>& frame = s.frames[n];
+        lp.clear();
+        annexb.clear();
+        annexBToLengthPrefixed(frame.data(), frame.size(), lp);
+        lengthPrefixedToAnnexB(lp.data(), lp.size(), 4, annexb);
+        ok = !isAnnexB(lp.data(), lp.size()) && isAnnexB(annexb.data(), annexb.size());
+        vector<NalUnit> a, b;
+        splitNalUnits(frame.data(), frame.size(), a);
+        splitNalUnits(annexb.data(), annexb.size(), b);
+        ok = ok && a.size() == b.size() && annexb.size() == frame.size() + (n % 7 == 3 ? 1 : 0);
+        for (size_t i = 0; ok && i < a.size(); i++)
+            ok = a[i].size == b[i].size && memcmp(a[i].data, b[i].data, a[i].size) == 0;
+        // the length prefixed sample splits the same way
+        splitNalUnits(lp.data(), lp.size(), b);
+        ok = ok && a.size() == b.size();
+    }
+    check(ok, name, "annex-b -> length prefixed -> annex-b");
+
+    // 2 and 1 byte lengths, from records with lengthSizeMinusOne 1 or 0
+    ok = true;
+    for (int size : {1, 2}) {
+        vector<uint8_t> short_lp;
+        splitNalUnits(expected_sets.data(), expected_sets.size(), nals);
+        for (auto& nal : nals) {
+            if (size == 2)
+                short_lp.push_back(nal.size >> 8);
+            short_lp.push_back(nal.size);
+            short_lp.insert(short_lp.end(), nal.data, nal.data + nal.size);
+        }
+        back.clear();
+        lengthPrefixedToAnnexB(short_lp.data(), short_lp.size(), size, back);
+        ok = ok && back == expected_sets;
+    }
+    check(ok, name, "1 and 2 byte nal lengths");
+
+    lp.clear();
+    back.clear();
+    annexBToLengthPrefixed(s.frames[1].data(), s.frames[1].size(), lp);
+    lp.resize(lp.size() - 1);
+    check(lengthPrefixedToAnnexB(lp.data(), lp.size(), 4, back) == 0, name, "a truncated nal unit is not passed on");
+    back.clear();
+    check(lengthPrefixedToAnnexB(lp.data(), lp.size(), 3, back) == 0, name, "3 byte nal lengths are refused");
+}
+
+static void runBenchmark(const Stream& s)
+{
+    const char* name = s.codec == MEDIA_CODEC_VIDEO_H265 ? "h265" : "h264";
+    size_t count = s.frames.size();
+    vector<vector<uint8_t>> lp(count);
+    vector<uint8_t> out, sets;
+    int64_t start;
+    size_t keys = 0;
+
+    // the per frame work of ModulePassthrough, output buffers reused like its pool
+    auto report = [&](const char* what, int64_t us, size_t bytes) {
+        double seconds = us / 1e6;
+        ff_info("%-5s %-40s %9.0f fps %8.1f MB/s\n", name, what, count / seconds, bytes / seconds / 1e6);
+    };
+
+    start = monotonicUs();
+    for (size_t n = 0; n < count; n++)
+        keys += isKeyFrame(s.frames[n].data(), s.frames[n].size(), s.codec);
+    report("key frame detection", monotonicUs() - start, s.bytes);
+
+    start = monotonicUs();
+    for (size_t n = 0; n < count; n++) {
+        if (s.key[n])
+            getParameterSets(s.frames[n].data(), s.frames[n].size(), s.codec, sets);
+    }
+    report("parameter sets of the key frames", monotonicUs() - start, s.bytes);
+
+    size_t lp_bytes = 0;
+    start = monotonicUs();
+    for (size_t n = 0; n < count; n++) {
+        lp[n].clear();
+        lp_bytes += annexBToLengthPrefixed(s.frames[n].data(), s.frames[n].size(), lp[n]);
+    }
+    report("annex-b -> length prefixed", monotonicUs() - start, s.bytes);
+
+    start = monotonicUs();
+    for (size_t n = 0; n < count; n++) {
+        out.clear();
+        lengthPrefixedToAnnexB(lp[n].data(), lp[n].size(), 4, out);
+    }
+    report("length prefixed -> annex-b", monotonicUs() - start, lp_bytes);
+
+    start = monotonicUs();
+    for (size_t n = 0; n < count; n++) {
+        const uint8_t* data = s.frames[n].data();
+        size_t size = s.frames[n].size();
+        out.clear();
+        if (isKeyFrame(data, size, s.codec) && getParameterSets(data, size, s.codec, sets) == 0)
+            out.insert(out.end(), sets.begin(), sets.end());
+        out.insert(out.end(), data, data + size);
+    }
+    report("annex-b copy with key frame checks", monotonicUs() - start, s.bytes);
+
+    if (keys == 0)
+        ff_warn("no key frames\n");
+}
+
+//./demo_passthrough
+//./demo_passthrough -n 50000 -s 5000
+//./demo_passthrough -c
+int main(int argc, char** argv)
+{
+    int c;
+    int frames = 20000, gop = 60;
+    size_t size = 20000;
+    bool check_only = false;
+
+    while ((c = getopt_long(argc, argv, "n:s:g:c", long_options, NULL)) != -1) {
+        switch (c) {
+            case 'n':
+                frames = atoi(optarg);
+                break;
+            case 's':
+                size = atoi(optarg);
+                break;
+            case 'g':
+                gop = atoi(optarg);
+                break;
+            case 'c':
+                check_only = true;
+                break;
+            default:
+                usage(argv);
+                return -1;
+        }
+    }
+    if (frames < 2 || size < 16 || gop <= 0) {
+        usage(argv);
+        return -1;
+    }
+
+    Stream stream;
+    for (media_codec_t codec : {MEDIA_CODEC_VIDEO_H264, MEDIA_CODEC_VIDEO_H265}) {
+        makeStream(stream, codec, check_only ? 200 : frames, size, gop);
+        runChecks(stream);
+        if (check_only)
+            continue;
+        ff_info("%d frames, %.1f MB\n", frames, stream.bytes / 1e6);
+        runBenchmark(stream);
+    }
+
+    ff_info("%s\n", failures ? "some checks FAILED" : "all checks passed");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,240 @@
+#include <getopt.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "base/ff_clock.hpp"
+#include "base/ff_log.h"
+#include "base/ff_roi.hpp"
+
+using namespace std;
+using namespace FFMedia;
+
+static void usage(char** argv)
+{
+    ff_info("Usage: %s [Options]\n\n"
+            "Compare the coded size of a synthetic surveillance scene, a static noisy background with a few\n"
+            "moving objects, for three ways of spending the bits, with the software reference estimate\n"
+            "FFMedia::estimateFrameBits():\n"
+            "  uniform   one qp for the whole picture\n"
+            "  qp map    background +delta, detections -delta, for an encoder that takes a qp map\n"
+            "  prefilter ModuleRoiFilter in front of an encoder without one, the background is low passed\n"
+            "The detections are the object boxes of every n-th frame, like ModuleInference with an interval.\n\n"
+            "Options:\n"
+            "-W, --width                 Picture width, default 1280\n"
+            "-H, --height                Picture height, default 720\n"
+            "-n, --frames                Frames, default 150\n"
+            "-q, --qp                    Base qp, default 26\n"
+            "-g, --gop                   Intra frame interval, default 60\n"
+            "-b, --background            Background qp delta, default 6\n"
+            "-r, --roi                   Detection qp delta, default -2\n"
+            "-i, --interval              Frames between detections, default 5\n"
+            "-N, --noise                 Sensor noise amplitude, default 4\n"
+            "\n",
+            argv[0]);
+}
+
+// clang-format off
+static struct option long_options[] = {
+    {"width", required_argument, NULL, 'W'},
+    {"height", required_argument, NULL, 'H'},
+    {"frames", required_argument, NULL, 'n'},
+    {"qp", required_argument, NULL, 'q'},
+    {"gop", required_argument, NULL, 'g'},
+    {"background", required_argument, NULL, 'b'},
+    {"roi", required_argument, NULL, 'r'},
+    {"interval", required_argument, NULL, 'i'},
+    {"noise", required_argument, NULL, 'N'},
+    {NULL, 0, NULL, 0}
+};
+// clang-format on
+
+struct Object {
+    int x, y, w, h, dx, dy;
+};
+
+// A scene of a static textured background, sensor noise and objects moving over it.
+class Scene
+{
+public:
+    Scene(const ImagePara& para, int noise, int count)
+        : para(para), noise(noise), seed(12345)
+    {
+        background.resize(para.hstride * para.vstride * 3 / 2);
+        for (uint32_t y = 0; y < para.height; y++) {
+            for (uint32_t x = 0; x < para.width; x++) {
+                int v = 90 + 40 * sin(x / 37.0) * cos(y / 23.0) + ((x / 8 + y / 8) % 2) * 12 + (x * 7 + y * 13) % 9;
+                background[y * para.hstride + x] = std::max(0, std::min(255, v));
+            }
+        }
+        uint8_t* uv = background.data() + para.hstride * para.vstride;
+        for (uint32_t y = 0; y < para.height / 2; y++) {
+            for (uint32_t x = 0; x < para.width; x += 2) {
+                uv[y * para.hstride + x] = 120 + (x / 16) % 8;
+                uv[y * para.hstride + x + 1] = 132 - (y / 16) % 8;
+            }
+        }
+        for (int i = 0; i < count; i++) {
+            Object o;
+            o.w = para.width / 12 + i * 8;
+            o.h = para.height / 4 + i * 6;
+            o.x = (i * 2 + 1) * para.width / (count * 2 + 1);
+            o.y = para.height / 3 + i * 20;
+            o.dx = (i % 2 ? -3 : 4) + i;
+            o.dy = i % 2 ? 1 : -1;
+            objects.push_back(o);
+        }
+    }
+
+    void render(vector<uint8_t>& frame)
+    {
+        frame = background;
+        for (uint32_t y = 0; y < para.height; y++) {
+            uint8_t* p = frame.data() + y * para.hstride;
+            for (uint32_t x = 0; x < para.width; x++) {
+                seed = seed * 1103515245 + 12345;
+                int v = p[x] + (int)((seed >> 16) % (2 * noise + 1)) - noise;
+                p[x] = std::max(0, std::min(255, v));
+            }
+        }
+        for (auto& o : objects) {
+            for (int y = std::max(0, o.y); y < std::min((int)para.height, o.y + o.h); y++) {
+                uint8_t* p = frame.data() + y * para.hstride;
+                for (int x = std::max(0, o.x); x < std::min((int)para.width, o.x + o.w); x++)
+                    p[x] = 60 + ((x - o.x) * 5 + (y - o.y) * 3 + (x - o.x) * (y - o.y) / 7) % 120;
+            }
+        }
+    }
+
+    void move()
+    {
+        for (auto& o : objects) {
+            o.x += o.dx;
+            o.y += o.dy;
+            if (o.x < 0 || o.x + o.w > (int)para.width)
+                o.dx = -o.dx;
+            if (o.y < 0 || o.y + o.h > (int)para.height)
+                o.dy = -o.dy;
+        }
+    }
+
+    vector<Object> objects;
+
+private:
+    ImagePara para;
+    vector<uint8_t> background;
+    int noise;
+    uint32_t seed;
+};
+
+static double psnr(const vector<uint8_t>& a, const vector<uint8_t>& b, const ImagePara& para)
+{
+    double sse = 0;
+    for (uint32_t y = 0; y < para.height; y++) {
+        for (uint32_t x = 0; x < para.width; x++) {
+            int d = a[y * para.hstride + x] - b[y * para.hstride + x];
+            sse += d * d;
+        }
+    }
+    double mse = sse / (para.width * para.height);
+    return mse > 0 ? 10 * log10(255.0 * 255.0 / mse) : 99.0;
+}
+
+//./demo_roi_encode
+//./demo_roi_encode -b 8 -r -4 -i 10
+//./demo_roi_encode -W 1920 -H 1080 -N 6
+int main(int argc, char** argv)
+{
+    int c;
+    int width = 1280, height = 720, frames = 150, qp = 26, gop = 60, background_delta = 6, roi_delta = -2, interval = 5;
+    int noise = 4;
+
+    while ((c = getopt_long(argc, argv, "W:H:n:q:g:b:r:i:N:", long_options, NULL)) != -1) {
+        switch (c) {
+            case 'W':
+                width = atoi(optarg);
+                break;
+            case 'H':
+                height = atoi(optarg);
+                break;
+            case 'n':
+                frames = atoi(optarg);
+                break;
+            case 'q':
+                qp = atoi(optarg);
+                break;
+            case 'g':
+                gop = atoi(optarg);
+                break;
+            case 'b':
+                background_delta = atoi(optarg);
+                break;
+            case 'r':
+                roi_delta = atoi(optarg);
+                break;
+            case 'i':
+                interval = atoi(optarg);
+                break;
+            case 'N':
+                noise = atoi(optarg);
+                break;
+            default:
+                usage(argv);
+                return -1;
+        }
+    }
+    if (width < 64 || height < 64 || frames <= 0 || gop <= 0 || interval <= 0 || noise < 0) {
+        usage(argv);
+        return -1;
+    }
+
+    ImagePara para(width & ~15, height & ~15, width & ~15, height & ~15, V4L2_PIX_FMT_NV12);
+    Scene scene(para, noise, 3);
+    vector<uint8_t> raw, last_raw, filtered, last_filtered;
+    QpMap map(para.width, para.height, background_delta);
+    size_t uniform_bits = 0, map_bits = 0, filter_bits = 0;
+    int64_t filter_us = 0;
+    double background_psnr = 0;
+
+    for (int n = 0; n < frames; n++) {
+        scene.render(raw);
+        if (n % interval == 0) {
+            map.fill(background_delta);
+            for (auto& o : scene.objects)
+                map.addRegion({o.x, o.y, o.w, o.h, roi_delta}, 16);
+        }
+        filtered.resize(raw.size());
+        int64_t start = monotonicUs();
+        filterNv12Roi(raw.data(), filtered.data(), para, map);
+        filter_us += monotonicUs() - start;
+        background_psnr += psnr(raw, filtered, para);
+
+        // intra frames against flat grey for all three
+        bool intra = n % gop == 0;
+        const uint8_t* ref = intra ? NULL : last_raw.data();
+        uniform_bits += estimateFrameBits(raw.data(), ref, para, qp, NULL);
+        map_bits += estimateFrameBits(raw.data(), ref, para, qp, &map);
+        filter_bits += estimateFrameBits(filtered.data(), intra ? NULL : last_filtered.data(), para, qp, NULL);
+
+        last_raw.swap(raw);
+        last_filtered.swap(filtered);
+        scene.move();
+    }
+
+    double seconds = frames / 30.0;
+    ff_info("%ux%u, %d frames, gop %d, qp %d, background %+d, detections %+d every %d frames, noise %d\n",
+            para.width, para.height, frames, gop, qp, background_delta, roi_delta, interval, noise);
+    ff_info("%10s %12s %10s\n", "mode", "kbps@30fps", "saving");
+    ff_info("%10s %12.0f %9s\n", "uniform", uniform_bits / seconds / 1000, "-");
+    ff_info("%10s %12.0f %9.1f%%\n", "qp map", map_bits / seconds / 1000, 100.0 - 100.0 * map_bits / uniform_bits);
+    ff_info("%10s %12.0f %9.1f%%\n", "prefilter", filter_bits / seconds / 1000,
+            100.0 - 100.0 * filter_bits / uniform_bits);
+    ff_info("prefilter %.2f ms/frame, psnr against the input %.1f dB (background only, detections are copied)\n",
+            filter_us / 1000.0 / frames, background_psnr / frames);
+    return 0;
+}
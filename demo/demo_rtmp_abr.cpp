@@ -0,0 +1,411 @@
+#include <arpa/inet.h>
+#include <getopt.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "base/ff_clock.hpp"
+#include "base/ff_log.h"
+#include "base/ff_rtmp.hpp"
+#include "base/ff_rtmp_publisher.hpp"
+
+using namespace std;
+using namespace FFMedia;
+
+static void usage(char** argv)
+{
+    ff_info("Usage: %s [Options]\n\n"
+            "Publish a synthetic h264 stream with RtmpPublisher to a local rtmp sink that reads at the rate of\n"
+            "a link schedule, like a shaped uplink, and report each second how the target bitrate, the queue\n"
+            "and the end to end latency follow the link. The synthetic encoder takes the bitrate changes\n"
+            "like ModuleIdrEnc: each starts with a key frame, increases come at most every 2 s.\n"
+            "With -u the stream goes to a real server instead and the link is not shaped.\n\n"
+            "Options:\n"
+            "-l, --link                  Link rates in kbps, one per step, default 8000,2000,8000\n"
+            "-d, --duration              Seconds per step, default 15\n"
+            "-b, --bitrate               Start bitrate in kbps, default 4000\n"
+            "-m, --max                   Max bitrate in kbps, default 8000\n"
+            "-n, --min                   Min bitrate in kbps, default 300\n"
+            "-f, --fps                   Stream frame rate, default 30\n"
+            "-g, --gop                   Key frame interval in frames, default 120\n"
+            "-p, --port                  Port of the local sink, default 19350\n"
+            "-u, --url                   Publish to this url instead, rtmp://host[:port]/app/stream\n"
+            "\n",
+            argv[0]);
+}
+
+// clang-format off
+static struct option long_options[] = {
+    {"link", required_argument, NULL, 'l'},
+    {"duration", required_argument, NULL, 'd'},
+    {"bitrate", required_argument, NULL, 'b'},
+    {"max", required_argument, NULL, 'm'},
+    {"min", required_argument, NULL, 'n'},
+    {"fps", required_argument, NULL, 'f'},
+    {"gop", required_argument, NULL, 'g'},
+    {"port", required_argument, NULL, 'p'},
+    {"url", required_argument, NULL, 'u'},
+    {NULL, 0, NULL, 0}
+};
+// clang-format on
+
+// 1920x1080 high profile parameter sets
+static const uint8_t synthetic_sps[] = {0x67, 0x64, 0x00, 0x28, 0xac, 0xd9, 0x40, 0x78, 0x02, 0x27, 0xe5, 0x84, 0x00,
+                                        0x00, 0x03, 0x00, 0x04, 0x00, 0x00, 0x03, 0x00, 0xf0, 0x3c, 0x60, 0xc6, 0x58};
+static const uint8_t synthetic_pps[] = {0x68, 0xeb, 0xe3, 0xcb, 0x22, 0xc0};
+
+// The capture time goes into the slice as 16 hex digits, so the sink can tell the latency.
+static void makeFrame(vector<uint8_t>& frame, bool key, size_t size, int64_t capture_us)
+{
+    static const uint8_t start_code[4] = {0, 0, 0, 1};
+    char stamp[17];
+
+    frame.clear();
+    if (key) {
+        frame.insert(frame.end(), start_code, start_code + 4);
+        frame.insert(frame.end(), synthetic_sps, synthetic_sps + sizeof(synthetic_sps));
+        frame.insert(frame.end(), start_code, start_code + 4);
+        frame.insert(frame.end(), synthetic_pps, synthetic_pps + sizeof(synthetic_pps));
+    }
+    frame.insert(frame.end(), start_code, start_code + 4);
+    frame.push_back(key ? 0x65 : 0x41);
+    snprintf(stamp, sizeof(stamp), "%016" PRIx64, capture_us);
+    frame.insert(frame.end(), stamp, stamp + 16);
+    for (size_t i = 0; i < size; i++)
+        frame.push_back((uint8_t)(i * 131) | 0x80);
+}
+
+struct Sink {
+    std::atomic<int> link_kbps{0};
+    std::atomic<uint64_t> bytes{0};
+    std::mutex mtx;
+    uint64_t frames = 0;
+    int64_t latency_sum_us = 0;
+    int64_t latency_max_us = 0;
+};
+
+static bool sendMessage(int fd, uint8_t type, uint32_t stream_id, const vector<uint8_t>& payload)
+{
+    vector<uint8_t> out;
+    writeRtmpChunks(out, 3, type, stream_id, 0, payload.data(), payload.size(), RTMP_DEFAULT_CHUNK_SIZE);
+    return send(fd, out.data(), out.size(), MSG_NOSIGNAL) == (ssize_t)out.size();
+}
+
+static bool answerCommand(int fd, const RtmpMessage& msg)
+{
+    vector<Amf0Value> values;
+    if (!parseAmf0(msg.payload.data(), msg.payload.size(), values) || values.size() < 2
+        || values[0].type != Amf0Value::STRING)
+        return true;
+    const string& name = values[0].string;
+    vector<uint8_t> amf;
+    Amf0Writer w(amf);
+    if (name == "publish") {
+        w.string("onStatus");
+        w.number(0);
+        w.null();
+        w.objectBegin();
+        w.key("level");
+        w.string("status");
+        w.key("code");
+        w.string("NetStream.Publish.Start");
+        w.objectEnd();
+        return sendMessage(fd, RTMP_MSG_AMF0_COMMAND, msg.stream_id, amf);
+    }
+    w.string("_result");
+    w.number(values[1].number);
+    if (name == "connect") {
+        w.objectBegin();
+        w.key("fmsVer");
+        w.string("FMS/3,0,1,123");
+        w.objectEnd();
+        w.objectBegin();
+        w.key("level");
+        w.string("status");
+        w.key("code");
+        w.string("NetConnection.Connect.Success");
+        w.objectEnd();
+    } else {
+        w.null();
+        if (name == "createStream")
+            w.number(1);
+    }
+    return sendMessage(fd, RTMP_MSG_AMF0_COMMAND, 0, amf);
+}
+
+static bool recvAll(int fd, uint8_t* data, size_t size)
+{
+    for (size_t pos = 0; pos < size;) {
+        ssize_t n = recv(fd, data + pos, size - pos, 0);
+        if (n <= 0)
+            return false;
+        pos += n;
+    }
+    return true;
+}
+
+// A rtmp server that takes one publisher and reads its socket at link_kbps with a token
+// bucket. The small receive buffer makes the publisher see the link within a few rtts.
+static void sinkLoop(Sink* sink, int listen_fd, const std::atomic<bool>& running)
+{
+    while (running) {
+        pollfd pfd = {listen_fd, POLLIN, 0};
+        if (poll(&pfd, 1, 200) <= 0)
+            continue;
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0)
+            continue;
+
+        vector<uint8_t> c0c1(1 + RTMP_HANDSHAKE_SIZE), c2(RTMP_HANDSHAKE_SIZE);
+        if (!recvAll(fd, c0c1.data(), c0c1.size())) {
+            close(fd);
+            continue;
+        }
+        vector<uint8_t> s0s1s2(1 + 2 * RTMP_HANDSHAKE_SIZE, 0);
+        s0s1s2[0] = 3;
+        std::copy(c0c1.begin() + 1, c0c1.end(), s0s1s2.begin() + 1 + RTMP_HANDSHAKE_SIZE);
+        if (send(fd, s0s1s2.data(), s0s1s2.size(), MSG_NOSIGNAL) < 0 || !recvAll(fd, c2.data(), c2.size())) {
+            close(fd);
+            continue;
+        }
+
+        RtmpChunkReader reader;
+        vector<uint8_t> rx;
+        vector<RtmpMessage> messages;
+        double tokens = 0;
+        int64_t last = monotonicUs();
+        uint8_t buf[65536];
+        while (running) {
+            int64_t now = monotonicUs();
+            int kbps = sink->link_kbps;
+            if (kbps > 0) {
+                // at most 20 ms of burst
+                tokens = std::min(tokens + (now - last) * kbps / 8000.0, kbps * 20 / 8.0);
+            } else {
+                tokens = sizeof(buf);
+            }
+            last = now;
+            size_t want = std::min(sizeof(buf), (size_t)tokens);
+            if (want < 1024) {
+                usleep(2000);
+                continue;
+            }
+            pfd = {fd, POLLIN, 0};
+            if (poll(&pfd, 1, 200) <= 0)
+                continue;
+            ssize_t n = recv(fd, buf, want, 0);
+            if (n <= 0)
+                break;
+            tokens -= n;
+            sink->bytes += n;
+            rx.insert(rx.end(), buf, buf + n);
+            messages.clear();
+            int used = reader.feed(rx.data(), rx.size(), messages);
+            if (used < 0)
+                break;
+            rx.erase(rx.begin(), rx.begin() + used);
+
+            bool ok = true;
+            for (auto& msg : messages) {
+                if (msg.type == RTMP_MSG_AMF0_COMMAND) {
+                    ok = ok && answerCommand(fd, msg);
+                } else if (msg.type == RTMP_MSG_VIDEO && msg.payload.size() >= 26 && msg.payload[1] == 1) {
+                    // avc nalu tag: 5 byte header, 4 byte length, the slice header byte, the stamp
+                    string stamp(msg.payload.begin() + 10, msg.payload.begin() + 26);
+                    int64_t latency = monotonicUs() - (int64_t)strtoull(stamp.c_str(), NULL, 16);
+                    std::lock_guard<std::mutex> lock(sink->mtx);
+                    sink->frames++;
+                    sink->latency_sum_us += latency;
+                    sink->latency_max_us = std::max(sink->latency_max_us, latency);
+                }
+            }
+            if (!ok)
+                break;
+        }
+        close(fd);
+    }
+}
+
+static int listenLocal(int port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1, rcvbuf = 8 << 10;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    // inherited by the accepted socket
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(fd, (sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, 4) < 0) {
+        ff_error("Failed to listen on port %d\n", port);
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+//./demo_rtmp_abr
+//./demo_rtmp_abr -l 6000,1500,500,6000 -d 20
+//./demo_rtmp_abr -u rtmp://192.168.1.10/live/test
+int main(int argc, char** argv)
+{
+    int c;
+    int duration = 15, fps = 30, gop = 120, port = 19350;
+    vector<int> link = {8000, 2000, 8000};
+    RtmpPublisher::Config config;
+
+    while ((c = getopt_long(argc, argv, "l:d:b:m:n:f:g:p:u:", long_options, NULL)) != -1) {
+        switch (c) {
+            case 'l':
+                link.clear();
+                for (char* p = optarg; *p;) {
+                    link.push_back(strtol(p, &p, 10));
+                    if (*p == ',')
+                        p++;
+                    else if (*p)
+                        break;
+                }
+                break;
+            case 'd':
+                duration = atoi(optarg);
+                break;
+            case 'b':
+                config.start_kbps = atoi(optarg);
+                break;
+            case 'm':
+                config.max_kbps = atoi(optarg);
+                break;
+            case 'n':
+                config.min_kbps = atoi(optarg);
+                break;
+            case 'f':
+                fps = atoi(optarg);
+                break;
+            case 'g':
+                gop = atoi(optarg);
+                break;
+            case 'p':
+                port = atoi(optarg);
+                break;
+            case 'u':
+                config.url = optarg;
+                break;
+            default:
+                usage(argv);
+                return -1;
+        }
+    }
+    if (link.empty() || duration <= 0 || fps <= 0 || gop <= 0 || config.start_kbps <= 0) {
+        usage(argv);
+        return -1;
+    }
+
+    // 1. the local sink
+    std::atomic<bool> running(true);
+    Sink sink;
+    std::thread sink_thread;
+    int listen_fd = -1;
+    if (config.url.empty()) {
+        if ((listen_fd = listenLocal(port)) < 0)
+            return -1;
+        sink.link_kbps = link[0];
+        sink_thread = std::thread(sinkLoop, &sink, listen_fd, std::cref(running));
+        config.url = "rtmp://127.0.0.1:" + to_string(port) + "/live/abr";
+    } else {
+        link.assign(1, 0);
+    }
+
+    // 2. the publisher, its callbacks drive the synthetic encoder
+    std::atomic<int> pending_kbps(0);
+    std::atomic<bool> key_requested(false);
+    RtmpPublisher publisher(config);
+    publisher.setBitrateCallback([&](int kbps) { pending_kbps = kbps; });
+    publisher.setKeyFrameCallback([&](bool congestion) {
+        (void)congestion;
+        key_requested = true;
+    });
+    if (publisher.start() < 0)
+        return -1;
+
+    // 3. the encode thread
+    std::atomic<int> encoder_kbps(config.start_kbps);
+    std::thread encoder([&] {
+        vector<uint8_t> frame;
+        int64_t interval = 1000000 / fps, next = monotonicUs(), last_change = 0;
+        for (int64_t n = 0, gop_pos = 0; running; n++, gop_pos++) {
+            int64_t now = monotonicUs();
+            int kbps = pending_kbps.exchange(0);
+            if (kbps > encoder_kbps && now - last_change < 2000000) {
+                int expected = 0;
+                pending_kbps.compare_exchange_strong(expected, kbps);
+            } else if (kbps && kbps != encoder_kbps) {
+                // changeEncodeParameter() restarts the encoder with a key frame
+                encoder_kbps = kbps;
+                last_change = now;
+                gop_pos = 0;
+            }
+            if (key_requested.exchange(false))
+                gop_pos = 0;
+            gop_pos %= gop;
+            size_t p_size = (size_t)encoder_kbps * 125 * gop / fps / (gop + 3);
+            makeFrame(frame, gop_pos == 0, gop_pos == 0 ? p_size * 4 : p_size, now);
+            publisher.pushFrame(MEDIA_CODEC_VIDEO_H264, frame.data(), frame.size(), now);
+            next += interval;
+            int64_t sleep_us = next - monotonicUs();
+            if (sleep_us > 0)
+                usleep(sleep_us);
+        }
+    });
+
+    // 4. each second
+    ff_info("%5s %8s %8s %8s %8s %8s %8s %8s %10s %8s\n", "sec", "link", "target", "encoder", "recv", "queue ms",
+            "rtt ms", "lat avg", "lat max ms", "dropped");
+    uint64_t last_bytes = 0;
+    for (int sec = 1; sec <= duration * (int)link.size(); sec++) {
+        sink.link_kbps = link[(sec - 1) / duration];
+        sleep(1);
+        RtmpPublisher::Stats stats = publisher.getStats();
+        uint64_t bytes = sink.bytes;
+        uint64_t frames;
+        int64_t latency_sum, latency_max;
+        {
+            std::lock_guard<std::mutex> lock(sink.mtx);
+            frames = sink.frames;
+            latency_sum = sink.latency_sum_us;
+            latency_max = sink.latency_max_us;
+            sink.frames = 0;
+            sink.latency_sum_us = 0;
+            sink.latency_max_us = 0;
+        }
+        ff_info("%5d %8d %8d %8d %8" PRIu64 " %8d %8d %8.0f %10.0f %8" PRIu64 "\n", sec, (int)sink.link_kbps,
+                stats.target_kbps, (int)encoder_kbps, (bytes - last_bytes) * 8 / 1000, stats.queue_ms, stats.rtt_ms,
+                frames ? latency_sum / 1000.0 / frames : 0.0, latency_max / 1000.0, stats.frames_dropped);
+        last_bytes = bytes;
+    }
+
+    running = false;
+    encoder.join();
+    RtmpPublisher::Stats stats = publisher.getStats();
+    publisher.stop();
+    if (sink_thread.joinable())
+        sink_thread.join();
+    if (listen_fd >= 0)
+        close(listen_fd);
+    ff_info("sent %" PRIu64 " frames, %" PRIu64 " bytes, dropped %" PRIu64 ", congestion events %" PRIu64
+            ", connects %" PRIu64 "\n",
+            stats.frames_sent, stats.bytes_sent, stats.frames_dropped, stats.congestion_events, stats.connects);
+    return 0;
+}
@@ -0,0 +1,359 @@
+#include <arpa/inet.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <thread>
+
+#include "base/ff_clock.hpp"
+#include "base/ff_log.h"
+#include "base/ff_rtsp_engine.hpp"
+#include "base/ff_rtsp_server.hpp"
+
+using namespace std;
+using namespace FFMedia;
+
+static void usage(char** argv)
+{
+    ff_info("Usage: %s [Options]\n\n"
+            "Serve synthetic h264 streams from one RtspServer to a growing number of local viewers\n"
+            "and report the cost of the sending thread for each viewer count, and the time to the first frame\n"
+            "of the viewers that joined in the step.\n\n"
+            "Options:\n"
+            "-s, --streams               Number of mounts, default 16\n"
+            "-v, --viewers               Viewers per stream of the last step, the steps double from 1, default 8\n"
+            "-b, --bitrate               Stream bitrate in kbps, default 4000\n"
+            "-f, --fps                   Stream frame rate, default 25\n"
+            "-d, --duration              Seconds measured per step, default 5\n"
+            "-p, --port                  Server port, default 8554\n"
+            "-T, --tcp                   Viewers use rtsp over tcp\n"
+            "-M, --multicast             Viewers join a multicast group per stream, 239.255.42.<n>:<port + 2>\n"
+            "-i, --interface             Local ipv4 address for multicast, default the default route\n"
+            "-S, --slow                  Add n tcp viewers that stop reading, to see them evicted\n"
+            "-G, --gop-cache             New viewers start 0: at the next key frame, 1: from the cached gop,\n"
+            "                            2: from the cached gop shown at once, default 1\n"
+            "-K, --key-on-demand         Gop of n seconds, and a key frame whenever the server asks for one,\n"
+            "                            at most one a second, like ModuleIdrEnc. Try it with -G 0\n"
+            "\n",
+            argv[0]);
+}
+
+// clang-format off
+static struct option long_options[] = {
+    {"streams", required_argument, NULL, 's'},
+    {"viewers", required_argument, NULL, 'v'},
+    {"bitrate", required_argument, NULL, 'b'},
+    {"fps", required_argument, NULL, 'f'},
+    {"duration", required_argument, NULL, 'd'},
+    {"port", required_argument, NULL, 'p'},
+    {"tcp", no_argument, NULL, 'T'},
+    {"multicast", no_argument, NULL, 'M'},
+    {"interface", required_argument, NULL, 'i'},
+    {"slow", required_argument, NULL, 'S'},
+    {"gop-cache", required_argument, NULL, 'G'},
+    {"key-on-demand", required_argument, NULL, 'K'},
+    {NULL, 0, NULL, 0}
+};
+// clang-format on
+
+// 1920x1080 high profile parameter sets, so the viewers can read the picture size
+static const uint8_t synthetic_sps[] = {0x67, 0x64, 0x00, 0x28, 0xac, 0xd9, 0x40, 0x78, 0x02, 0x27, 0xe5, 0x84, 0x00,
+                                        0x00, 0x03, 0x00, 0x04, 0x00, 0x00, 0x03, 0x00, 0xf0, 0x3c, 0x60, 0xc6, 0x58};
+static const uint8_t synthetic_pps[] = {0x68, 0xeb, 0xe3, 0xcb, 0x22, 0xc0};
+
+static void makeFrame(vector<uint8_t>& frame, bool key, size_t size)
+{
+    static const uint8_t start_code[4] = {0, 0, 0, 1};
+
+    frame.clear();
+    if (key) {
+        frame.insert(frame.end(), start_code, start_code + 4);
+        frame.insert(frame.end(), synthetic_sps, synthetic_sps + sizeof(synthetic_sps));
+        frame.insert(frame.end(), start_code, start_code + 4);
+        frame.insert(frame.end(), synthetic_pps, synthetic_pps + sizeof(synthetic_pps));
+    }
+    frame.insert(frame.end(), start_code, start_code + 4);
+    frame.push_back(key ? 0x65 : 0x41);
+    for (size_t i = 0; i < size; i++)
+        frame.push_back((uint8_t)(i * 131) | 0x80);
+}
+
+static int64_t threadCpuUs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// A tcp viewer that plays a mount and then never reads, its socket buffer is kept small.
+static int openSlowViewer(int port, const string& path)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int rcvbuf = 4096;
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(fd, (sockaddr*)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    string url = "rtsp://127.0.0.1:" + to_string(port) + path;
+    string setup = "SETUP " + url + "/track0 RTSP/1.0\r\nCSeq: 1\r\nTransport: RTP/AVP/TCP;unicast;interleaved=0-1\r\n\r\n";
+    char reply[1024];
+    ssize_t n = -1;
+    if (send(fd, setup.data(), setup.size(), 0) > 0)
+        n = recv(fd, reply, sizeof(reply) - 1, 0);
+    if (n <= 0) {
+        close(fd);
+        return -1;
+    }
+    reply[n] = 0;
+    const char* session = strstr(reply, "Session: ");
+    if (session == NULL) {
+        close(fd);
+        return -1;
+    }
+    string id(session + 9, strcspn(session + 9, ";\r"));
+    string play = "PLAY " + url + " RTSP/1.0\r\nCSeq: 2\r\nSession: " + id + "\r\n\r\n";
+    if (send(fd, play.data(), play.size(), 0) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+//./demo_rtsp_fanout -s 16 -v 8
+//./demo_rtsp_fanout -s 4 -v 32 -T
+//./demo_rtsp_fanout -s 4 -v 32 -M -S 2
+//./demo_rtsp_fanout -s 4 -v 8 -G 0
+//./demo_rtsp_fanout -s 4 -v 8 -G 0 -K 10
+int main(int argc, char** argv)
+{
+    int c;
+    int streams = 16, viewers = 8, bitrate = 4000, fps = 25, duration = 5, port = 8554, slow = 0;
+    int gop_cache = RtspServer::GOP_CACHE_BURST, key_on_demand = 0;
+    string interface;
+    RTSP_STREAM_TYPE transport = RTSP_STREAM_TYPE_UDP;
+
+    while ((c = getopt_long(argc, argv, "s:v:b:f:d:p:TMi:S:G:K:", long_options, NULL)) != -1) {
+        switch (c) {
+            case 's':
+                streams = atoi(optarg);
+                break;
+            case 'v':
+                viewers = atoi(optarg);
+                break;
+            case 'b':
+                bitrate = atoi(optarg);
+                break;
+            case 'f':
+                fps = atoi(optarg);
+                break;
+            case 'd':
+                duration = atoi(optarg);
+                break;
+            case 'p':
+                port = atoi(optarg);
+                break;
+            case 'T':
+                transport = RTSP_STREAM_TYPE_TCP;
+                break;
+            case 'M':
+                transport = RTSP_STREAM_TYPE_MULTICAST;
+                break;
+            case 'i':
+                interface = optarg;
+                break;
+            case 'S':
+                slow = atoi(optarg);
+                break;
+            case 'G':
+                gop_cache = atoi(optarg);
+                break;
+            case 'K':
+                key_on_demand = atoi(optarg);
+                break;
+            default:
+                usage(argv);
+                return -1;
+        }
+    }
+    if (streams <= 0 || viewers <= 0 || fps <= 0 || bitrate <= 0 || gop_cache < RtspServer::GOP_CACHE_OFF
+        || gop_cache > RtspServer::GOP_CACHE_LIVE) {
+        usage(argv);
+        return -1;
+    }
+
+    // 1. the server and one pushing thread for all mounts, like a single encoder thread would
+    RtspServer::Config server_config;
+    server_config.port = port;
+    server_config.max_clients = streams * viewers + slow + 16;
+    server_config.multicast_interface = interface;
+    if (slow > 0) {
+        // small enough for the slow viewers to fall behind within a step
+        server_config.max_tcp_backlog = 256 << 10;
+        server_config.slow_client_timeout_ms = 2000;
+    }
+    server_config.gop_cache = (RtspServer::GopCache)gop_cache;
+    RtspServer server(server_config);
+    if (server.start() < 0)
+        return -1;
+    for (int i = 0; i < streams; i++) {
+        server.addMount("/live/" + to_string(i), MEDIA_CODEC_VIDEO_H264);
+        if (transport == RTSP_STREAM_TYPE_MULTICAST)
+            server.setMulticast("/live/" + to_string(i), "239.255.42." + to_string(i + 1), port + 2);
+    }
+
+    // the generator stands in for the encoders, a request gives a key frame on all streams
+    std::atomic<bool> key_wanted(false);
+    std::atomic<uint64_t> key_forced(0);
+    if (key_on_demand > 0) {
+        for (int i = 0; i < streams; i++)
+            server.setKeyFrameCallback("/live/" + to_string(i), [&](RtspServer::KeyRequest) { key_wanted = true; });
+    }
+
+    std::atomic<bool> running(true);
+    std::atomic<int64_t> push_cpu_us(0);
+    std::thread generator([&] {
+        size_t p_size = (size_t)bitrate * 125 / (fps + 3);
+        vector<uint8_t> key_frame, p_frame;
+        makeFrame(key_frame, true, p_size * 4);
+        makeFrame(p_frame, false, p_size);
+        int64_t pts = 0, interval = 1000000 / fps, gop = key_on_demand > 0 ? (int64_t)key_on_demand * fps : fps;
+        int64_t last_key = -fps;
+        for (int64_t n = 0; running; n++) {
+            bool key = n - last_key >= gop;
+            if (!key && key_wanted && n - last_key >= fps) {
+                key = true;
+                key_forced++;
+            }
+            if (key) {
+                last_key = n;
+                key_wanted = false;
+            }
+            vector<uint8_t>& frame = key ? key_frame : p_frame;
+            int64_t start = threadCpuUs();
+            for (int i = 0; i < streams; i++)
+                server.pushFrame("/live/" + to_string(i), frame.data(), frame.size(), pts);
+            push_cpu_us += threadCpuUs() - start;
+            pts += interval;
+            usleep(interval);
+        }
+    });
+
+    // 2. the viewers, drained like ingest modules would
+    RtspEngine::Config engine_config;
+    engine_config.threads = 2;
+    engine_config.multicast_interface = interface;
+    RtspEngine engine(engine_config);
+    vector<shared_ptr<RtspSession>> list;
+    vector<int64_t> open_us, first_frame_us;
+    std::mutex list_mtx;
+    std::thread consumer([&] {
+        FrameRing::Frame frame;
+        while (running) {
+            bool idle = true;
+            {
+                std::lock_guard<std::mutex> lock(list_mtx);
+                for (size_t i = 0; i < list.size(); i++) {
+                    while (list[i]->getRing().pop(frame, 0)) {
+                        if (first_frame_us[i] == 0)
+                            first_frame_us[i] = monotonicUs();
+                        idle = false;
+                    }
+                }
+            }
+            if (idle)
+                usleep(2000);
+        }
+    });
+
+    vector<int> slow_viewers;
+    for (int i = 0; i < slow; i++) {
+        int fd = openSlowViewer(port, "/live/" + to_string(i % streams));
+        if (fd >= 0)
+            slow_viewers.push_back(fd);
+    }
+
+    ff_info("%8s %10s %10s %12s %12s %10s %10s %12s %8s %16s\n", "viewers", "Mbps", "pkt/s", "send calls/s",
+            "pkt/call", "push cpu", "us/frame", "viewer fps", "lost", "ttff avg/max ms");
+    for (int per_stream = 1;; per_stream = std::min(per_stream * 2, viewers)) {
+        size_t joined;
+        {
+            std::lock_guard<std::mutex> lock(list_mtx);
+            joined = list.size();
+            while ((int)list.size() < streams * per_stream) {
+                int index = list.size() % streams;
+                int64_t start = monotonicUs();
+                auto session = engine.open("rtsp://127.0.0.1:" + to_string(port) + "/live/" + to_string(index), transport);
+                if (session == nullptr)
+                    break;
+                list.push_back(session);
+                open_us.push_back(start);
+                first_frame_us.push_back(0);
+            }
+        }
+        for (auto& session : list)
+            session->waitPlaying(5000);
+        // without the gop cache the viewers wait for a key frame first
+        sleep(1);
+
+        RtspServer::Stats last = server.getStats();
+        RtspEngine::Stats last_engine = engine.getStats();
+        int64_t last_cpu = push_cpu_us;
+        sleep(duration);
+        RtspServer::Stats now = server.getStats();
+        RtspEngine::Stats now_engine = engine.getStats();
+        int64_t cpu = push_cpu_us - last_cpu;
+
+        uint64_t packets = now.packets_sent - last.packets_sent, calls = now.send_calls - last.send_calls;
+        uint64_t frames = now.frames - last.frames;
+
+        int64_t ttff_sum = 0, ttff_max = 0, started = 0;
+        {
+            std::lock_guard<std::mutex> lock(list_mtx);
+            for (size_t i = joined; i < list.size(); i++) {
+                if (first_frame_us[i] == 0)
+                    continue;
+                int64_t ttff = first_frame_us[i] - open_us[i];
+                ttff_sum += ttff;
+                ttff_max = std::max(ttff_max, ttff);
+                started++;
+            }
+        }
+        char ttff[32];
+        snprintf(ttff, sizeof(ttff), "%.1f/%.1f", started ? ttff_sum / 1000.0 / started : 0.0, ttff_max / 1000.0);
+        ff_info("%8u %10.2f %10.0f %12.0f %12.1f %9.1f%% %10.1f %12.1f %8" PRIu64 " %16s\n", now.playing,
+                (now.bytes_sent - last.bytes_sent) * 8 / 1e6 / duration, (double)packets / duration,
+                (double)calls / duration, calls ? (double)packets / calls : 0.0, cpu / 10000.0 / duration,
+                frames ? (double)cpu / frames : 0.0, (double)(now_engine.frames - last_engine.frames) / duration,
+                now_engine.lost - last_engine.lost, ttff);
+        if (per_stream == viewers)
+            break;
+    }
+
+    RtspServer::Stats total = server.getStats();
+    ff_info("tcp frames dropped for slow viewers %" PRIu64 ", slow viewers evicted %" PRIu64 "/%zu\n",
+            total.frames_dropped, total.evicted, slow_viewers.size());
+    ff_info("viewers started from the gop cache %" PRIu64 ", key frame requests %" PRIu64 ", forced key frames %" PRIu64
+            "\n",
+            total.cache_starts, total.key_requests, key_forced.load());
+
+    running = false;
+    generator.join();
+    for (int fd : slow_viewers)
+        close(fd);
+    consumer.join();
+    for (auto& session : list)
+        engine.close(session);
+    return 0;
+}
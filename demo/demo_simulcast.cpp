@@ -0,0 +1,217 @@
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <mutex>
+#include <set>
+
+#include "base/ff_bitstream.hpp"
+#include "module/module_control.hpp"
+#include "module/module_pipeline.hpp"
+#include "module/vi/module_fileReader.hpp"
+#include "module/vo/module_fileWriter.hpp"
+#include "module/vp/module_mppdec.hpp"
+#include "module/vp/module_nullcodec.hpp"
+#include "module/vp/module_simulcastEnc.hpp"
+
+using namespace FFMedia;
+
+static void usage(char** argv)
+{
+    ff_info("Usage: %s <Input file> [Options]\n\n"
+            "Decode a file once and encode it into several renditions with ModuleSimulcastEnc, as fast as\n"
+            "possible. Key frames are requested from the renditions in turn, like viewers joining, and the\n"
+            "key frames of all renditions are compared at the end.\n\n"
+            "Options:\n"
+            "-r, --renditions            Renditions as WxH:kbps,..., default 1920x1080:4000,640x360:800\n"
+            "-e, --encodetype            Encode type, h264 or h265, default h264\n"
+            "-g, --gop                   Gop, default 60\n"
+            "-k, --keyframe              Request a key frame every n ms, 0 never, default 700\n"
+            "-o, --output                Write rendition i to the file, %%d is replaced by i, e.g. out_%%d.mp4\n"
+            "-s, --software              Use the software scaler and null codecs instead of mpp/rga\n"
+            "\n",
+            argv[0]);
+}
+
+// clang-format off
+static struct option long_options[] = {
+    {"renditions", required_argument, NULL, 'r'},
+    {"encodetype", required_argument, NULL, 'e'},
+    {"gop", required_argument, NULL, 'g'},
+    {"keyframe", required_argument, NULL, 'k'},
+    {"output", required_argument, NULL, 'o'},
+    {"software", no_argument, NULL, 's'},
+    {NULL, 0, NULL, 0}
+};
+// clang-format on
+
+struct RenditionStats {
+    std::mutex mtx;
+    media_codec_t codec;
+    uint64_t frames = 0;
+    uint64_t bytes = 0;
+    std::set<int64_t> key_pts;
+};
+
+static void callback_rendition(void* ctx, shared_ptr<MediaBuffer> buffer)
+{
+    RenditionStats* stats = (RenditionStats*)ctx;
+    if (buffer == NULL || buffer->getActiveSize() == 0)
+        return;
+    std::lock_guard<std::mutex> lock(stats->mtx);
+    stats->frames++;
+    stats->bytes += buffer->getActiveSize();
+    if (isKeyFrame((const uint8_t*)buffer->getActiveData(), buffer->getActiveSize(), stats->codec))
+        stats->key_pts.insert(buffer->getPUstimestamp());
+}
+
+static bool parse_renditions(const char* arg, vector<SimulcastRendition>& renditions)
+{
+    renditions.clear();
+    while (*arg) {
+        SimulcastRendition r;
+        int n = 0;
+        if (sscanf(arg, "%ux%u:%d%n", &r.width, &r.height, &r.bps, &n) != 3)
+            return false;
+        renditions.push_back(r);
+        arg += n;
+        if (*arg == ',')
+            arg++;
+    }
+    return !renditions.empty();
+}
+
+//./demo_simulcast test.mp4
+//./demo_simulcast test.mp4 -r 1920x1080:4000,1280x720:2000,640x360:800 -o out_%d.mp4
+//./demo_simulcast test.mp4 -s -g 30 -k 300
+int main(int argc, char** argv)
+{
+    int ret, c;
+    vector<SimulcastRendition> renditions = {{1920, 1080, 4000}, {640, 360, 800}};
+    EncodeType encode_type = ENCODE_TYPE_H264;
+    int gop = 60, keyframe_ms = 700;
+    const char* output = NULL;
+    bool software = false;
+
+    while ((c = getopt_long(argc, argv, "r:e:g:k:o:s", long_options, NULL)) != -1) {
+        switch (c) {
+            case 'r':
+                if (!parse_renditions(optarg, renditions)) {
+                    ff_error("set renditions like 1280x720:2000,640x360:800\n");
+                    return -1;
+                }
+                break;
+            case 'e':
+                encode_type = strstr(optarg, "265") ? ENCODE_TYPE_H265 : ENCODE_TYPE_H264;
+                break;
+            case 'g':
+                gop = atoi(optarg);
+                break;
+            case 'k':
+                keyframe_ms = atoi(optarg);
+                break;
+            case 'o':
+                output = optarg;
+                break;
+            case 's':
+                software = true;
+                break;
+            default:
+                usage(argv);
+                return -1;
+        }
+    }
+
+    if (argc - optind < 1 || gop <= 0) {
+        usage(argv);
+        return -1;
+    }
+
+    // 1. file reader and decoder module
+    auto file_reader = make_shared<ModuleFileReader>(argv[optind]);
+    file_reader->setBufferCount(20);
+    ret = file_reader->init();
+    if (ret < 0) {
+        ff_error("file reader init failed\n");
+        return ret;
+    }
+
+    shared_ptr<ModuleMedia> dec;
+    if (software)
+        dec = make_shared<ModuleNullDec>();
+    else
+        dec = make_shared<ModuleMppDec>();
+    dec->setProductor(file_reader);
+    dec->setBufferCount(10);
+    ret = dec->init();
+    if (ret < 0) {
+        ff_error("Dec init failed\n");
+        return ret;
+    }
+
+    // 2. one simulcast module instead of a rga and an encoder per rendition
+    auto simulcast = make_shared<ModuleProfiled<ModuleSimulcastEnc>>(encode_type, renditions, 30, gop, software);
+    simulcast->setProductor(dec);
+    ret = simulcast->init();
+    if (ret < 0) {
+        ff_error("simulcast init failed\n");
+        return ret;
+    }
+
+    // 3. one output per rendition
+    media_codec_t codec = encode_type == ENCODE_TYPE_H265 ? MEDIA_CODEC_VIDEO_H265 : MEDIA_CODEC_VIDEO_H264;
+    vector<shared_ptr<ModuleMedia>> outputs;
+    vector<RenditionStats> stats(renditions.size());
+    for (size_t i = 0; i < renditions.size(); i++) {
+        auto out = make_shared<ModuleSimulcastOutput>(i);
+        out->setProductor(simulcast);
+        ret = out->init();
+        if (ret < 0) {
+            ff_error("output %zu init failed\n", i);
+            return ret;
+        }
+        stats[i].codec = codec;
+        out->addExternalConsumer("rendition_stats", &stats[i], callback_rendition);
+
+        if (output) {
+            char path[256];
+            snprintf(path, sizeof(path), output, (int)i);
+            auto writer = make_shared<ModuleFileWriter>(path);
+            writer->setProductor(out);
+            ret = writer->init();
+            if (ret < 0) {
+                ff_error("file writer %s init failed\n", path);
+                return ret;
+            }
+        }
+        outputs.push_back(out);
+    }
+
+    // 4. run free, request key frames from the renditions in turn
+    setPipelineMode(file_reader, PIPELINE_MODE_FREE_RUN);
+    file_reader->start();
+    file_reader->dumpPipe();
+
+    size_t next = 0;
+    while (!waitPipelineEos(file_reader, keyframe_ms > 0 ? keyframe_ms : 1000)) {
+        if (keyframe_ms > 0)
+            requestKeyFrame(outputs[next++ % outputs.size()], KEY_FRAME_USER);
+    }
+
+    file_reader->dumpPipeSummary();
+    dumpPipelineProfile(file_reader);
+    file_reader->stop();
+
+    bool aligned = true;
+    for (size_t i = 0; i < renditions.size(); i++) {
+        ImagePara para = simulcast->getRenditionPara(i);
+        ff_info("rendition %zu: %ux%u, %" PRIu64 " frames, %" PRIu64 " bytes, %zu key frames\n", i, para.width,
+                para.height, stats[i].frames, stats[i].bytes, stats[i].key_pts.size());
+        if (stats[i].key_pts != stats[0].key_pts)
+            aligned = false;
+    }
+    ff_info("key frame requests %" PRIu64 ", aligned key frames %" PRIu64 ", misaligned %" PRIu64 ", %s\n",
+            simulcast->getKeyFrameRequests(), simulcast->getAlignedKeyFrames(), simulcast->getMisalignedKeyFrames(),
+            aligned ? "all renditions switch at the same frames" : "the key frames differ");
+    return 0;
+}
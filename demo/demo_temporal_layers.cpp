@@ -0,0 +1,312 @@
+#include <arpa/inet.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "base/ff_clock.hpp"
+#include "base/ff_log.h"
+#include "base/ff_rtsp_server.hpp"
+
+using namespace std;
+using namespace FFMedia;
+
+static void usage(char** argv)
+{
+    ff_info("Usage: %s [Options]\n\n"
+            "Serve a synthetic h264 stream with hierarchical-p temporal layers from one RtspServer to a fast\n"
+            "and a throttled tcp viewer. The link of the throttled viewer steps through the given rates, the\n"
+            "server drops the upper temporal layers for it alone, and each second the frame rates both viewers\n"
+            "receive are printed: the encoder runs once, the slow viewer gets 15 or 7.5 fps of the same stream.\n\n"
+            "Options:\n"
+            "-l, --layers                Temporal layers, 1 to 3, default 3\n"
+            "-f, --fps                   Stream frame rate, default 30\n"
+            "-b, --bitrate               Stream bitrate in kbps, default 4000\n"
+            "-g, --gop                   Gop in frames, default 60\n"
+            "-r, --rates                 Link rates of the slow viewer in kbps, default 8000,3000,2000,8000\n"
+            "-d, --duration              Seconds per rate, default 8\n"
+            "-p, --port                  Server port, default 8556\n"
+            "\n",
+            argv[0]);
+}
+
+// clang-format off
+static struct option long_options[] = {
+    {"layers", required_argument, NULL, 'l'},
+    {"fps", required_argument, NULL, 'f'},
+    {"bitrate", required_argument, NULL, 'b'},
+    {"gop", required_argument, NULL, 'g'},
+    {"rates", required_argument, NULL, 'r'},
+    {"duration", required_argument, NULL, 'd'},
+    {"port", required_argument, NULL, 'p'},
+    {NULL, 0, NULL, 0}
+};
+// clang-format on
+
+// 1920x1080 high profile parameter sets, so the viewers can read the picture size
+static const uint8_t synthetic_sps[] = {0x67, 0x64, 0x00, 0x28, 0xac, 0xd9, 0x40, 0x78, 0x02, 0x27, 0xe5, 0x84, 0x00,
+                                        0x00, 0x03, 0x00, 0x04, 0x00, 0x00, 0x03, 0x00, 0xf0, 0x3c, 0x60, 0xc6, 0x58};
+static const uint8_t synthetic_pps[] = {0x68, 0xeb, 0xe3, 0xcb, 0x22, 0xc0};
+
+// An access unit of a hierarchical-p stream: svc prefix nal with the temporal id, then
+// the slice, not referenced on the top layer.
+static void makeFrame(vector<uint8_t>& frame, bool key, int layer, bool top, size_t size)
+{
+    static const uint8_t start_code[4] = {0, 0, 0, 1};
+
+    frame.clear();
+    if (key) {
+        frame.insert(frame.end(), start_code, start_code + 4);
+        frame.insert(frame.end(), synthetic_sps, synthetic_sps + sizeof(synthetic_sps));
+        frame.insert(frame.end(), start_code, start_code + 4);
+        frame.insert(frame.end(), synthetic_pps, synthetic_pps + sizeof(synthetic_pps));
+    }
+    const uint8_t prefix[4] = {(uint8_t)(top ? 0x0e : 0x6e), (uint8_t)(key ? 0xc0 : 0x80), 0x80,
+                               (uint8_t)((layer << 5) | 0x07)};
+    frame.insert(frame.end(), start_code, start_code + 4);
+    frame.insert(frame.end(), prefix, prefix + 4);
+    frame.insert(frame.end(), start_code, start_code + 4);
+    frame.push_back(key ? 0x65 : top ? 0x01 : 0x41);
+    for (size_t i = 0; i < size; i++)
+        frame.push_back((uint8_t)(i * 131) | 0x80);
+}
+
+// A tcp viewer that reads at most rate_kbps, 0 for unlimited, and counts the frames.
+struct Viewer {
+    int fd = -1;
+    std::atomic<int> rate_kbps{0};
+    std::atomic<uint64_t> frames{0};
+    std::atomic<uint64_t> bytes{0};
+};
+
+static int openViewer(int port, const string& path)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    // small, so the backlog builds up in the server where it can be seen
+    int rcvbuf = 8192;
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    struct timeval tv = {0, 50000};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(fd, (sockaddr*)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    string url = "rtsp://127.0.0.1:" + to_string(port) + path;
+    string setup = "SETUP " + url + "/track0 RTSP/1.0\r\nCSeq: 1\r\nTransport: RTP/AVP/TCP;unicast;interleaved=0-1\r\n\r\n";
+    char reply[1024];
+    ssize_t n = -1;
+    if (send(fd, setup.data(), setup.size(), 0) > 0)
+        n = recv(fd, reply, sizeof(reply) - 1, 0);
+    if (n <= 0) {
+        close(fd);
+        return -1;
+    }
+    reply[n] = 0;
+    const char* session = strstr(reply, "Session: ");
+    if (session == NULL) {
+        close(fd);
+        return -1;
+    }
+    string id(session + 9, strcspn(session + 9, ";\r"));
+    string play = "PLAY " + url + " RTSP/1.0\r\nCSeq: 2\r\nSession: " + id + "\r\n\r\n";
+    if (send(fd, play.data(), play.size(), 0) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void viewerLoop(Viewer* viewer, std::atomic<bool>* running)
+{
+    vector<uint8_t> buf;
+    uint8_t chunk[16384];
+    double tokens = 0;
+    int64_t last = monotonicUs();
+
+    while (*running) {
+        size_t want = sizeof(chunk);
+        int rate = viewer->rate_kbps;
+        if (rate > 0) {
+            int64_t now = monotonicUs();
+            tokens = std::min(tokens + (now - last) * rate / 8000.0, 16384.0);
+            last = now;
+            if (tokens < 1) {
+                usleep(2000);
+                continue;
+            }
+            want = std::min(want, (size_t)tokens);
+        }
+        ssize_t n = recv(viewer->fd, chunk, want, 0);
+        if (n <= 0) {
+            if (n == 0)
+                break;
+            continue;
+        }
+        if (rate > 0)
+            tokens -= n;
+        viewer->bytes += n;
+        buf.insert(buf.end(), chunk, chunk + n);
+
+        // interleaved rtp, the marker bit ends a frame; rtsp replies are skipped
+        size_t pos = 0;
+        while (buf.size() - pos >= 4) {
+            const uint8_t* p = buf.data() + pos;
+            if (p[0] == '$') {
+                size_t len = (p[2] << 8) | p[3];
+                if (buf.size() - pos < 4 + len)
+                    break;
+                if (p[1] == 0 && len >= 12 && (p[5] & 0x80))
+                    viewer->frames++;
+                pos += 4 + len;
+            } else {
+                const uint8_t* end = (const uint8_t*)memmem(p, buf.size() - pos, "\r\n\r\n", 4);
+                if (end == NULL)
+                    break;
+                pos = end + 4 - buf.data();
+            }
+        }
+        buf.erase(buf.begin(), buf.begin() + pos);
+    }
+}
+
+//./demo_temporal_layers
+//./demo_temporal_layers -r 6000,2500,1200,6000 -d 10
+//./demo_temporal_layers -l 1
+int main(int argc, char** argv)
+{
+    int c;
+    int layers = 3, fps = 30, bitrate = 4000, gop = 60, duration = 8, port = 8556;
+    vector<int> rates = {8000, 3000, 2000, 8000};
+
+    while ((c = getopt_long(argc, argv, "l:f:b:g:r:d:p:", long_options, NULL)) != -1) {
+        switch (c) {
+            case 'l':
+                layers = std::max(1, std::min(3, atoi(optarg)));
+                break;
+            case 'f':
+                fps = atoi(optarg);
+                break;
+            case 'b':
+                bitrate = atoi(optarg);
+                break;
+            case 'g':
+                gop = atoi(optarg);
+                break;
+            case 'r': {
+                rates.clear();
+                for (char* s = optarg; *s;) {
+                    rates.push_back(strtol(s, &s, 10));
+                    if (*s == ',')
+                        s++;
+                    else if (*s)
+                        break;
+                }
+                break;
+            }
+            case 'd':
+                duration = atoi(optarg);
+                break;
+            case 'p':
+                port = atoi(optarg);
+                break;
+            default:
+                usage(argv);
+                return -1;
+        }
+    }
+    if (fps <= 0 || bitrate <= 0 || gop <= 0 || duration <= 0 || rates.empty()) {
+        usage(argv);
+        return -1;
+    }
+
+    RtspServer::Config server_config;
+    server_config.port = port;
+    server_config.gop_cache = RtspServer::GOP_CACHE_OFF;
+    RtspServer server(server_config);
+    if (server.start() < 0) {
+        ff_error("rtsp server start failed\n");
+        return -1;
+    }
+    string path = "/live/0";
+    server.addMount(path, MEDIA_CODEC_VIDEO_H264);
+
+    Viewer viewers[2];
+    std::atomic<bool> running(true);
+    vector<std::thread> threads;
+    for (auto& viewer : viewers) {
+        viewer.fd = openViewer(port, path);
+        if (viewer.fd < 0) {
+            ff_error("viewer failed to connect\n");
+            return -1;
+        }
+        threads.emplace_back(viewerLoop, &viewer, &running);
+    }
+
+    // frame sizes of a hierarchical-p gop: a key frame of 8 average frames, the layer 0 p frames
+    // twice the size of the top layer ones, which nothing references
+    size_t average = (size_t)bitrate * 1000 / 8 / fps;
+    string steps;
+    for (int rate : rates)
+        steps += " " + to_string(rate);
+    ff_info("%d layers, %d fps, %d kbps, gop %d, the slow viewer steps through%s kbps every %d s\n", layers, fps,
+            bitrate, gop, steps.c_str(), duration);
+    ff_info("%4s %10s %9s %9s %14s %13s\n", "t", "link kbps", "fast fps", "slow fps", "layer dropped", "key skipped");
+
+    vector<uint8_t> frame;
+    int64_t start = monotonicUs();
+    int64_t next_report = start + 1000000;
+    uint64_t last_frames[2] = {0, 0};
+    RtspServer::Stats last_stats = server.getStats();
+    int period = 1 << (layers - 1);
+    for (int64_t n = 0;; n++) {
+        int64_t due = start + n * 1000000 / fps;
+        int64_t now = monotonicUs();
+        if (due > now)
+            usleep(due - now);
+        int second = (due - start) / 1000000;
+        if (second >= duration * (int)rates.size())
+            break;
+        viewers[1].rate_kbps = rates[second / duration];
+
+        int pos = (n % gop) % period;
+        int layer = pos == 0 ? 0 : layers - 1 - __builtin_ctz(pos);
+        bool key = n % gop == 0;
+        bool top = layers > 1 && layer == layers - 1;
+        size_t size = key ? average * 8 : top ? average * 2 / 3 : average * 4 / 3;
+        makeFrame(frame, key, layer, top, size);
+        server.pushFrame(path, frame.data(), frame.size(), due - start, layer);
+
+        if (monotonicUs() >= next_report) {
+            RtspServer::Stats stats = server.getStats();
+            uint64_t frames[2] = {viewers[0].frames, viewers[1].frames};
+            ff_info("%4d %10d %9" PRIu64 " %9" PRIu64 " %14" PRIu64 " %13" PRIu64 "\n", second + 1,
+                    (int)viewers[1].rate_kbps, frames[0] - last_frames[0], frames[1] - last_frames[1],
+                    stats.layer_dropped - last_stats.layer_dropped, stats.frames_dropped - last_stats.frames_dropped);
+            last_frames[0] = frames[0];
+            last_frames[1] = frames[1];
+            last_stats = stats;
+            next_report += 1000000;
+        }
+    }
+
+    running = false;
+    for (auto& t : threads)
+        t.join();
+    for (auto& viewer : viewers)
+        close(viewer.fd);
+    server.stop();
+    return 0;
+}
@@ -0,0 +1,205 @@
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "module/module_chunkedTranscode.hpp"
+#include "module/module_pipeline.hpp"
+#include "module/vi/module_fileReader.hpp"
+#include "module/vo/module_asyncFileWriter.hpp"
+#include "module/vo/module_fileWriter.hpp"
+#include "module/vp/module_mppdec.hpp"
+#include "module/vp/module_mppenc.hpp"
+#include "module/vp/module_nullcodec.hpp"
+#include "module/vp/module_rga.hpp"
+#include "module/vp/module_swscale.hpp"
+
+using namespace FFMedia;
+
+static void usage(char** argv)
+{
+    ff_info("Usage: %s <Input file> <Output file> [Options]\n\n"
+            "Transcode a file as fast as possible and report fps and per stage utilisation.\n\n"
+            "Options:\n"
+            "-o, --output                 Output image size, default same as input\n"
+            "-e, --encodetype             Encode type, h264 or h265, default h264\n"
+            "-k, --chunks                 Split the file at idr frames and transcode the chunks in parallel, default 1\n"
+            "-s, --software               Use the software scaler and null codecs instead of mpp/rga\n"
+            "-f, --fragment               Write fragmented mp4 with a fragment every n ms (0: every gop), readable while recording\n"
+            "\n",
+            argv[0]);
+}
+
+// clang-format off
+static struct option long_options[] = {
+    {"output", required_argument, NULL, 'o'},
+    {"encodetype", required_argument, NULL, 'e'},
+    {"chunks", required_argument, NULL, 'k'},
+    {"software", no_argument, NULL, 's'},
+    {"fragment", required_argument, NULL, 'f'},
+    {NULL, 0, NULL, 0}
+};
+// clang-format on
+
+struct TranscodeConfig {
+    ImagePara output_para = {0, 0, 0, 0, V4L2_PIX_FMT_NV12};
+    EncodeType encode_type = ENCODE_TYPE_H264;
+    bool software = false;
+    int chunks = 1;
+    int fragment_ms = -1;
+};
+
+// dec -> scale -> enc on top of productor, return the encoder
+static shared_ptr<ModuleMedia> build_transcode_pipe(shared_ptr<ModuleMedia> productor, TranscodeConfig* conf)
+{
+    int ret;
+    shared_ptr<ModuleMedia> last_module = productor;
+    ImagePara output_para = conf->output_para;
+
+    // 1. dec module
+    {
+        shared_ptr<ModuleMedia> dec;
+        if (conf->software)
+            dec = make_shared<ModuleProfiled<ModuleNullDec>>();
+        else
+            dec = make_shared<ModuleProfiled<ModuleMppDec>>();
+        dec->setProductor(last_module);
+        dec->setBufferCount(10);
+        ret = dec->init();
+        if (ret < 0) {
+            ff_error("Dec init failed\n");
+            return nullptr;
+        }
+        last_module = dec;
+    }
+
+    // 2. scale module
+    if (output_para.width == 0 || output_para.height == 0) {
+        output_para.width = last_module->getOutputImagePara().width;
+        output_para.height = last_module->getOutputImagePara().height;
+    }
+    output_para.hstride = output_para.width;
+    output_para.vstride = output_para.height;
+    {
+        shared_ptr<ModuleMedia> scale;
+        if (conf->software)
+            scale = make_shared<ModuleProfiled<ModuleSwScale>>(output_para);
+        else
+            scale = make_shared<ModuleProfiled<ModuleRga>>(output_para, RGA_ROTATE_NONE);
+        scale->setProductor(last_module);
+        scale->setBufferCount(4);
+        ret = scale->init();
+        if (ret < 0) {
+            ff_error("scale init failed\n");
+            return nullptr;
+        }
+        last_module = scale;
+    }
+
+    // 3. enc module
+    {
+        shared_ptr<ModuleMedia> enc;
+        if (conf->software)
+            enc = make_shared<ModuleProfiled<ModuleNullEnc>>(conf->encode_type);
+        else
+            enc = make_shared<ModuleProfiled<ModuleMppEnc>>(conf->encode_type);
+        enc->setProductor(last_module);
+        enc->setBufferCount(8);
+        ret = enc->init();
+        if (ret < 0) {
+            ff_error("Enc init failed\n");
+            return nullptr;
+        }
+        last_module = enc;
+    }
+
+    return last_module;
+}
+
+//./demo_transcode in.mp4 out.mp4 -o 1280x720 -e h265 -k 4
+int main(int argc, char** argv)
+{
+    int ret, c;
+    TranscodeConfig conf;
+
+    while ((c = getopt_long(argc, argv, "o:e:k:sf:", long_options, NULL)) != -1) {
+        switch (c) {
+            case 'o':
+                if (sscanf(optarg, "%ux%u", &conf.output_para.width, &conf.output_para.height) != 2) {
+                    ff_error("set size format like 640x480\n");
+                    return -1;
+                }
+                break;
+            case 'e':
+                conf.encode_type = strstr(optarg, "265") ? ENCODE_TYPE_H265 : ENCODE_TYPE_H264;
+                break;
+            case 'k':
+                conf.chunks = atoi(optarg);
+                break;
+            case 's':
+                conf.software = true;
+                break;
+            case 'f':
+                conf.fragment_ms = atoi(optarg);
+                break;
+            default:
+                usage(argv);
+                return -1;
+        }
+    }
+
+    if (argc - optind < 2) {
+        usage(argv);
+        return -1;
+    }
+
+    if (conf.chunks > 1) {
+        ChunkedTranscodeJob job(argv[optind], argv[optind + 1], conf.chunks);
+        job.setPipeBuilder([&conf](shared_ptr<ModuleMedia> productor, int chunk_index) {
+            (void)chunk_index;
+            return build_transcode_pipe(productor, &conf);
+        });
+        return job.run();
+    }
+
+    // 1. file reader module, no loop and no synchronize
+    auto file_reader = make_shared<ModuleProfiled<ModuleFileReader>>(argv[optind]);
+    file_reader->setBufferCount(20);
+    ret = file_reader->init();
+    if (ret < 0) {
+        ff_error("file reader init failed\n");
+        return ret;
+    }
+
+    // 2. dec -> scale -> enc
+    shared_ptr<ModuleMedia> last_module = build_transcode_pipe(file_reader, &conf);
+    if (last_module == nullptr)
+        return -1;
+
+    // 3. file writer module, fragmented mp4 goes through the async writer
+    shared_ptr<ModuleMedia> file_writer;
+    if (conf.fragment_ms >= 0) {
+        auto fmp4_writer = make_shared<ModuleProfiled<ModuleAsyncFileWriter>>(argv[optind + 1]);
+        fmp4_writer->setFragmentDuration(conf.fragment_ms);
+        file_writer = fmp4_writer;
+    } else {
+        file_writer = make_shared<ModuleProfiled<ModuleFileWriter>>(argv[optind + 1]);
+    }
+    file_writer->setProductor(last_module);
+    ret = file_writer->init();
+    if (ret < 0) {
+        ff_error("file writer init failed\n");
+        return ret;
+    }
+
+    // 4. run free, keep the source pts
+    setPipelineMode(file_reader, PIPELINE_MODE_FREE_RUN);
+    file_reader->start();
+    file_reader->dumpPipe();
+
+    waitPipelineEos(file_reader);
+
+    file_reader->dumpPipeSummary();
+    dumpPipelineProfile(file_reader);
+    file_reader->stop();
+    return 0;
+}
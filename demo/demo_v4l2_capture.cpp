@@ -0,0 +1,323 @@
+#include <dirent.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+
+#include "base/ff_buffer_flags.hpp"
+#include "base/ff_clock.hpp"
+#include "module/module_pipeline.hpp"
+#include "module/vi/module_v4l2Capture.hpp"
+#include "module/vo/module_fileWriter.hpp"
+#include "module/vp/module_mppenc.hpp"
+#include "module/vp/module_rga.hpp"
+
+using namespace FFMedia;
+
+static void usage(char** argv)
+{
+    ff_info("Usage: %s [Options]\n\n"
+            "Capture with ModuleV4l2Capture, the frames stay in the driver's buffers and go to rga and the\n"
+            "encoder as dma-bufs. Without -o the frames are only checked on the cpu: the sequence numbers\n"
+            "and the driver timestamps must increase, and every gap in the sequence, frames the driver\n"
+            "dropped, must be counted and flagged. -t runs that check on every node of the vivid test\n"
+            "driver, with a fast and with a slow consumer, which needs no camera.\n\n"
+            "Options:\n"
+            "-d, --device                Video device, default the first vivid capture node\n"
+            "-s, --size                  Frame size, default the device's\n"
+            "-f, --format                Pixel format, e.g. NV12, default the device's\n"
+            "-r, --rate                  Frame rate\n"
+            "-q, --queue                 Driver buffers, default 6\n"
+            "-b, --buffers               Frames the pipe may hold, default 4\n"
+            "-i, --import                Capture into dma heap buffers (V4L2_MEMORY_DMABUF)\n"
+            "-n, --frames                Frames, default 300\n"
+            "-x, --hold                  Hold every frame n ms, a slow consumer\n"
+            "-o, --output                Encode to this h264 file\n"
+            "-t, --test                  Check all vivid nodes\n"
+            "\n",
+            argv[0]);
+}
+
+// clang-format off
+static struct option long_options[] = {
+    {"device", required_argument, NULL, 'd'},
+    {"size", required_argument, NULL, 's'},
+    {"format", required_argument, NULL, 'f'},
+    {"rate", required_argument, NULL, 'r'},
+    {"queue", required_argument, NULL, 'q'},
+    {"buffers", required_argument, NULL, 'b'},
+    {"import", no_argument, NULL, 'i'},
+    {"frames", required_argument, NULL, 'n'},
+    {"hold", required_argument, NULL, 'x'},
+    {"output", required_argument, NULL, 'o'},
+    {"test", no_argument, NULL, 't'},
+    {NULL, 0, NULL, 0}
+};
+// clang-format on
+
+struct CaptureConfig {
+    string device;
+    ImagePara para;
+    uint32_t fps = 0;
+    uint32_t queue = 6;
+    uint32_t buffers = 4;
+    bool import = false;
+    int frames = 300;
+    int hold_ms = 0;
+    string output;
+    bool need_fd = false;  // every frame must come with a dma-buf
+};
+
+struct CheckCtx {
+    int hold_ms = 0;
+    bool need_fd = false;
+    std::atomic<uint32_t> frames{0};
+    std::atomic<uint64_t> gaps{0};
+    std::atomic<uint32_t> bad{0};
+    int64_t last_sequence = -1;
+    int64_t last_pts = 0;
+    int64_t first_sequence = -1;
+};
+
+static void callback_check(void* ctx, shared_ptr<MediaBuffer> buffer)
+{
+    CheckCtx* check = (CheckCtx*)ctx;
+    shared_ptr<VideoBuffer> vb = static_pointer_cast<VideoBuffer>(buffer);
+    if (vb == NULL || vb->getEos())
+        return;
+
+    int64_t sequence = getBufferSequence(vb.get());
+    bool gap_flag = getBufferFlags(vb.get()) & BUFFER_FLAG_DISCONTINUITY;
+    if (sequence < 0 || vb->getActiveData() == NULL || vb->getActiveSize() == 0 || (check->need_fd && vb->getBufFd() < 0))
+        check->bad++;
+    if (check->last_sequence >= 0) {
+        if (sequence <= check->last_sequence || vb->getPUstimestamp() <= check->last_pts)
+            check->bad++;
+        // the module flags exactly the frames after a gap
+        if ((sequence > check->last_sequence + 1) != gap_flag)
+            check->bad++;
+        if (sequence > check->last_sequence + 1)
+            check->gaps += sequence - check->last_sequence - 1;
+    } else {
+        check->first_sequence = sequence;
+    }
+    check->last_sequence = sequence;
+    check->last_pts = vb->getPUstimestamp();
+    check->frames++;
+    if (check->hold_ms)
+        usleep(check->hold_ms * 1000);
+}
+
+static int runCapture(const CaptureConfig& config, bool* passed)
+{
+    auto cap = make_shared<ModuleV4l2Capture>(config.device, config.para);
+    cap->setQueueDepth(config.queue);
+    cap->setBufferCount(config.buffers);
+    cap->setFrameRate(config.fps);
+    if (config.import)
+        cap->setIoMode(ModuleV4l2Capture::IO_DMABUF_IMPORT);
+    if (cap->init() < 0) {
+        ff_error("v4l2 capture init failed\n");
+        return -1;
+    }
+
+    CheckCtx check;
+    check.hold_ms = config.hold_ms;
+    check.need_fd = config.need_fd;
+    shared_ptr<ModuleMedia> last = cap;
+    if (config.output.empty()) {
+        cap->addExternalConsumer("capture_check", &check, callback_check);
+    } else {
+        ImagePara para = cap->getOutputImagePara();
+        if (para.v4l2Fmt != V4L2_PIX_FMT_NV12) {
+            ImagePara out(para.width, para.height, ALIGN(para.width, 16), ALIGN(para.height, 16), V4L2_PIX_FMT_NV12);
+            auto rga = make_shared<ModuleRga>(para, out, RGA_ROTATE_NONE);
+            rga->setProductor(last);
+            if (rga->init() < 0) {
+                ff_error("rga init failed\n");
+                return -1;
+            }
+            last = rga;
+        }
+        auto enc = make_shared<ModuleMppEnc>(ENCODE_TYPE_H264);
+        enc->setProductor(last);
+        if (enc->init() < 0) {
+            ff_error("Enc init failed\n");
+            return -1;
+        }
+        enc->addExternalConsumer("capture_count", &check, [](void* ctx, shared_ptr<MediaBuffer> buffer) {
+            if (buffer && !buffer->getEos())
+                ((CheckCtx*)ctx)->frames++;
+        });
+        auto writer = make_shared<ModuleFileWriter>(config.output);
+        writer->setProductor(enc);
+        if (writer->init() < 0) {
+            ff_error("ModuleFileWriter init failed\n");
+            return -1;
+        }
+    }
+
+    cap->start();
+    int64_t start = monotonicUs();
+    int64_t timeout = 10000000 + (int64_t)config.frames * (100000 + config.hold_ms * 1000);
+    while (check.frames < (uint32_t)config.frames && monotonicUs() - start < timeout)
+        usleep(10000);
+    cap->stop();
+    double seconds = (monotonicUs() - start) / 1e6;
+
+    ff_info("%s: %u frames in %.2f s, %.1f fps, captured %" PRIu64 ", dropped by the driver %" PRIu64
+            ", errors %" PRIu64 "\n",
+            config.device.c_str(), check.frames.load(), seconds, check.frames / seconds, cap->getCapturedFrames(),
+            cap->getDroppedFrames(), cap->getErrorFrames());
+    if (config.output.empty()) {
+        // the gaps the consumer saw are the ones the module counted, but for frames stop() took
+        // from the pipe before they reached the consumer
+        uint64_t captured = cap->getCapturedFrames(), dropped = cap->getDroppedFrames();
+        bool ok = check.frames >= (uint32_t)config.frames && check.bad == 0 && check.gaps <= dropped
+                  && (check.gaps == dropped || captured > check.frames);
+        // a slow consumer must have made the driver drop frames
+        ok = ok && (config.hold_ms == 0 || dropped > 0);
+        ff_info("%s: sequence %" PRId64 "-%" PRId64 ", %" PRIu64 " gaps seen, %u wrong frames: %s\n",
+                config.device.c_str(), check.first_sequence, check.last_sequence, check.gaps.load(),
+                check.bad.load(), ok ? "passed" : "FAILED");
+        *passed = ok;
+    } else {
+        *passed = check.frames > 0;
+    }
+    return 0;
+}
+
+// Capture nodes of the vivid driver, single and multi-planar.
+static vector<string> findVivid()
+{
+    vector<string> nodes;
+    DIR* dir = opendir("/dev");
+    if (dir == NULL)
+        return nodes;
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strncmp(entry->d_name, "video", 5) != 0)
+            continue;
+        string path = string("/dev/") + entry->d_name;
+        int fd = open(path.c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC);
+        if (fd < 0)
+            continue;
+        struct v4l2_capability cap;
+        memset(&cap, 0, sizeof(cap));
+        if (ioctl(fd, VIDIOC_QUERYCAP, &cap) == 0 && strcmp((const char*)cap.driver, "vivid") == 0) {
+            uint32_t caps = (cap.capabilities & V4L2_CAP_DEVICE_CAPS) ? cap.device_caps : cap.capabilities;
+            if (caps & (V4L2_CAP_VIDEO_CAPTURE | V4L2_CAP_VIDEO_CAPTURE_MPLANE))
+                nodes.push_back(path);
+        }
+        close(fd);
+    }
+    closedir(dir);
+    std::sort(nodes.begin(), nodes.end());
+    return nodes;
+}
+
+static int runTest(CaptureConfig config)
+{
+    vector<string> nodes = config.device.empty() ? findVivid() : vector<string>{config.device};
+    if (nodes.empty()) {
+        ff_error("No vivid capture node, modprobe vivid n_devs=2 multiplanar=1,2\n");
+        return -1;
+    }
+
+    int failed = 0, runs = 0;
+    config.output.clear();
+    config.need_fd = true;
+    if (config.fps == 0)
+        config.fps = 30;
+    int frames = std::min(config.frames, 120);
+    for (auto& node : nodes) {
+        config.device = node;
+        // a fast consumer, then one that holds every frame for 3 frame times, so the driver runs
+        // out of buffers and drops frames
+        for (int hold : {0, 100}) {
+            config.hold_ms = hold;
+            config.frames = hold ? frames / 4 : frames;
+            bool passed = false;
+            if (runCapture(config, &passed) < 0 || !passed)
+                failed++;
+            runs++;
+        }
+    }
+    ff_info("%d/%d runs passed\n", runs - failed, runs);
+    return failed ? 1 : 0;
+}
+
+//./demo_v4l2_capture -t
+//./demo_v4l2_capture -d /dev/video0 -s 1920x1080 -f NV12 -o cam.h264
+//./demo_v4l2_capture -d /dev/video0 -q 8 -b 2 -x 100
+//./demo_v4l2_capture -d /dev/video0 -i
+int main(int argc, char** argv)
+{
+    int c;
+    CaptureConfig config;
+    bool test = false;
+
+    while ((c = getopt_long(argc, argv, "d:s:f:r:q:b:in:x:o:t", long_options, NULL)) != -1) {
+        switch (c) {
+            case 'd':
+                config.device = optarg;
+                break;
+            case 's':
+                sscanf(optarg, "%ux%u", &config.para.width, &config.para.height);
+                break;
+            case 'f':
+                config.para.v4l2Fmt = v4l2GetFmtByName(optarg);
+                break;
+            case 'r':
+                config.fps = atoi(optarg);
+                break;
+            case 'q':
+                config.queue = atoi(optarg);
+                break;
+            case 'b':
+                config.buffers = atoi(optarg);
+                break;
+            case 'i':
+                config.import = true;
+                break;
+            case 'n':
+                config.frames = atoi(optarg);
+                break;
+            case 'x':
+                config.hold_ms = atoi(optarg);
+                break;
+            case 'o':
+                config.output = optarg;
+                break;
+            case 't':
+                test = true;
+                break;
+            default:
+                usage(argv);
+                return -1;
+        }
+    }
+    if (config.frames <= 0 || config.queue < 2 || config.buffers == 0) {
+        usage(argv);
+        return -1;
+    }
+
+    if (test)
+        return runTest(config);
+
+    if (config.device.empty()) {
+        vector<string> nodes = findVivid();
+        config.device = nodes.empty() ? "/dev/video0" : nodes[0];
+    }
+    bool passed = false;
+    if (runCapture(config, &passed) < 0)
+        return -1;
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,63 @@
+#ifndef __FF_ANNEXB_READER_HPP__
+#define __FF_ANNEXB_READER_HPP__
+
+#include <inttypes.h>
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+
+#include "ff_bitstream.hpp"
+
+namespace FFMedia
+{
+/*
+ * Read an annex-b elementary stream file (.h264/.h265 dumps) access unit by access unit,
+ * e.g. to feed ModuleMemReader. The file is read in blocks of block_size, an access unit
+ * ends where findAccessUnitEnd() sees the next one start, so 3 and 4 byte start codes,
+ * parameter sets and multi slice pictures all work.
+ * buildIndex() scans the file once for the offsets of the access units and their key
+ * frames, seek() to one of them continues reading there, for splitting a file or
+ * starting at an idr.
+ */
+class AnnexBReader
+{
+public:
+    struct Entry {
+        uint64_t offset;
+        uint32_t size;
+        bool key;
+    };
+
+    AnnexBReader(media_codec_t codec = MEDIA_CODEC_VIDEO_H264, size_t block_size = 1 << 20);
+    ~AnnexBReader();
+
+    int open(const std::string& path);
+    void close();
+    // The next access unit with its start codes, false at the end of the file.
+    bool read(std::vector<uint8_t>& au, Entry* entry = NULL);
+    // Continue at the offset of an access unit.
+    bool seek(uint64_t offset);
+    // All access units of the file, the read position is kept. Returns the count, -1 on error.
+    int buildIndex(std::vector<Entry>& index);
+    // Parameters of the first sps read so far.
+    bool getSpsInfo(SpsInfo* info) const;
+    media_codec_t getCodec() const { return codec; }
+
+private:
+    bool fill();
+
+    media_codec_t codec;
+    size_t block_size;
+    FILE* fp;
+    std::vector<uint8_t> buf;
+    size_t pos;            // first unread byte of buf
+    uint64_t buf_offset;   // file offset of buf[0]
+    bool eof;
+    bool has_sps;
+    SpsInfo sps_info;
+};
+
+}  // namespace FFMedia
+
+#endif
@@ -0,0 +1,136 @@
+#ifndef __FF_ASYNC_WRITER_HPP__
+#define __FF_ASYNC_WRITER_HPP__
+
+#include <inttypes.h>
+#include <sys/types.h>
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace FFMedia
+{
+/*
+ * Write a file from a background thread.
+ * write() copies the data into fixed size aligned blocks, a full block is queued
+ * and written by the io thread, so the caller only pays a memcpy. The queue holds
+ * queue_size / block_size blocks. When it is full write() waits for a free block,
+ * or drops the whole packet if drop_when_full is set.
+ */
+class AsyncWriter
+{
+public:
+    enum Backend {
+        BACKEND_PWRITE,    // pwrite() per block
+        BACKEND_IO_URING,  // batch the queued blocks into one io_uring submit, fall back to pwrite if unavailable
+                           // or the kernel has no IORING_OP_WRITE (before 5.6)
+    };
+
+    enum SyncPolicy {
+        SYNC_NONE,      // leave it to the page cache
+        SYNC_ON_CLOSE,  // fdatasync once in close()
+        SYNC_INTERVAL,  // fdatasync from the io thread every sync_interval_ms
+    };
+
+    struct Config {
+        size_t block_size = 1 << 20;   // multiple of 4096
+        size_t queue_size = 16 << 20;  // bytes of blocks, at least 2 blocks
+        Backend backend = BACKEND_PWRITE;
+        bool direct_io = false;  // O_DIRECT, fall back to buffered io if the file system refuses it
+        SyncPolicy sync_policy = SYNC_ON_CLOSE;
+        uint32_t sync_interval_ms = 1000;
+        bool drop_when_full = false;
+        // fallocate() this many bytes ahead of the written size, 0 disables.
+        // The file size is kept, so readers never see the reserved tail.
+        uint64_t preallocate_size = 0;
+    };
+
+    struct Stats {
+        uint64_t bytes_written;
+        uint64_t blocks_written;
+        uint64_t dropped_packets;
+        uint64_t dropped_bytes;
+        uint32_t queue_depth;  // blocks queued or in flight
+        uint32_t max_queue_depth;
+        int64_t avg_write_us;  // from queueing a block to its completion
+        int64_t max_write_us;
+        int64_t blocked_us;  // time write() waited for a free block
+        uint64_t syncs;
+        uint64_t preallocated_bytes;
+    };
+
+public:
+    AsyncWriter();
+    AsyncWriter(const Config& config);
+    ~AsyncWriter();
+
+    int open(const std::string& path);
+    // Return 0 when queued, 1 when dropped, -1 on io error.
+    int write(const void* data, size_t size);
+    // Wait until everything written so far reached the file.
+    int flush();
+    // Queue the partial block without waiting, so readers see all data written so far
+    // once the io thread gets to it. No effect with O_DIRECT, whose writes must stay aligned.
+    int commit();
+    int close();
+
+    bool isOpen() const { return fd >= 0; }
+    const std::string& getPath() const { return path; }
+    uint64_t getSize() const { return total_bytes; }
+    Stats getStats();
+    const Config& getConfig() const { return config; }
+
+private:
+    struct Block {
+        uint8_t* data;
+        size_t used;
+        off_t offset;
+        int64_t queued_us;
+    };
+
+    struct Uring;
+
+    void ioLoop();
+    void writeBatch(std::vector<Block*>& batch);
+    int writeBlockSync(Block* block);
+    int writePartial();
+    void completeBlock(Block* block, int64_t now_us);
+    Block* acquireBlock(std::unique_lock<std::mutex>& lock, bool wait);
+    void releaseBlocks();
+    void queueBlock(Block* block);
+    void preallocate(off_t end);
+
+private:
+    Config config;
+    std::string path;
+    int fd;
+    bool direct;
+    Uring* uring;
+
+    std::vector<Block> blocks;
+    std::deque<Block*> free_blocks;
+    std::deque<Block*> pending;
+    uint32_t inflight;
+    Block* cur;
+    off_t allocated;
+    uint64_t total_bytes;
+    int io_error;
+
+    std::mutex mtx;
+    std::condition_variable free_cv;
+    std::condition_variable pending_cv;
+    std::thread* io_thread;
+    bool running;
+
+    Stats stats;
+    uint64_t latency_count;
+    int64_t latency_total_us;
+    int64_t last_sync_us;
+};
+
+}  // namespace FFMedia
+
+#endif
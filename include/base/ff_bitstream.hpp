@@ -0,0 +1,116 @@
+#ifndef __FF_BITSTREAM_HPP__
+#define __FF_BITSTREAM_HPP__
+
+#include <inttypes.h>
+#include <stddef.h>
+
+#include <vector>
+
+#include "ff_type.hpp"
+
+namespace FFMedia
+{
+// One nal unit, without start code or length prefix, data[0] is the nal header.
+struct NalUnit {
+    const uint8_t* data;
+    size_t size;
+};
+
+enum SliceType {
+    SLICE_TYPE_UNKNOWN = -1,
+    SLICE_TYPE_P = 0,  // and SP
+    SLICE_TYPE_B,
+    SLICE_TYPE_I,  // and SI
+};
+
+struct SpsInfo {
+    int width = 0;  // cropped
+    int height = 0;
+    int profile = 0;  // profile_idc, h265 general_profile_idc
+    int level = 0;
+    double fps = 0;  // from the vui timing info, 0 when the sps has none
+};
+
+struct AccessUnitInfo {
+    bool key = false;  // h264 idr, h265 irap
+    bool idr = false;
+    bool cra = false;  // h265 only
+    bool has_vps = false;
+    bool has_sps = false;
+    bool has_pps = false;
+    int slice_type = SLICE_TYPE_UNKNOWN;  // of the first slice
+    size_t slices = 0;
+    size_t nal_count = 0;
+};
+
+// Return the first 00 00 01 at or after data, end if there is none.
+// 16 positions per step with SSE2 or NEON.
+const uint8_t* findStartCode(const uint8_t* data, const uint8_t* end);
+
+// True when data starts with a 3 or 4 byte start code.
+bool isAnnexB(const uint8_t* data, size_t size);
+
+// Split an access unit into nal units.
+// Both annex-b and 4 byte length prefixed (avcc/hvcc) payloads are accepted.
+size_t splitNalUnits(const uint8_t* data, size_t size, std::vector<NalUnit>& nals);
+
+// nal_unit_type of the nal header byte(s)
+int nalUnitType(const uint8_t* nal, media_codec_t codec);
+
+// True when the access unit holds an H.264 IDR or an H.265 IRAP picture.
+bool isKeyFrame(const uint8_t* data, size_t size, media_codec_t codec);
+
+// True when no other picture references the access unit (h264 nal_ref_idc 0, h265 sub-layer
+// non-reference), it can be dropped without breaking the decoding of the rest.
+bool isDisposable(const uint8_t* data, size_t size, media_codec_t codec);
+
+// Temporal id of the access unit: h265 nuh_temporal_id_plus1 - 1 of its slices, h264 the
+// temporal_id of a svc/mvc prefix nal unit. 0 when the stream carries none.
+int temporalLayerId(const uint8_t* data, size_t size, media_codec_t codec);
+
+// Copy the VPS/SPS/PPS nal units of an access unit to sets, with 4 byte start codes.
+// An avcC/hvcC record, as videoExtraData() of a mp4/flv source, is accepted too.
+size_t getParameterSets(const uint8_t* data, size_t size, media_codec_t codec, std::vector<uint8_t>& sets);
+
+// True when data is an avcC/hvcC record rather than annex-b or length prefixed nal units.
+bool isDecoderConfig(const uint8_t* data, size_t size);
+
+// Parameter sets of an avcC/hvcC record as annex-b with 4 byte start codes. *length_size gets
+// the size of the nal length prefix of the samples, 1, 2 or 4. 0 when the record is broken.
+size_t parseDecoderConfig(const uint8_t* data, size_t size, media_codec_t codec, std::vector<uint8_t>& sets,
+                          int* length_size = NULL);
+
+// Append an annex-b access unit to out as 4 byte length prefixed nal units (mp4/flv samples).
+// Returns the bytes appended.
+size_t annexBToLengthPrefixed(const uint8_t* data, size_t size, std::vector<uint8_t>& out);
+
+// Append length_size prefixed nal units to out as annex-b with 4 byte start codes. A
+// truncated nal unit ends the conversion. Returns the bytes appended.
+size_t lengthPrefixedToAnnexB(const uint8_t* data, size_t size, int length_size, std::vector<uint8_t>& out);
+
+// Picture size, profile, level and frame rate from a sps nal unit (with its nal header).
+bool parseSps(const uint8_t* sps, size_t size, media_codec_t codec, SpsInfo* info);
+
+// Cropped picture size from a sps nal unit (with its nal header).
+bool parseSpsSize(const uint8_t* sps, size_t size, media_codec_t codec, int* width, int* height);
+
+// SliceType of a slice nal unit. For h265 only the first segment of a picture is read,
+// the later ones return SLICE_TYPE_UNKNOWN.
+int sliceType(const uint8_t* nal, size_t size, media_codec_t codec);
+
+// Nal unit types and the slice type of an access unit, false when it has no slice.
+bool parseAccessUnit(const uint8_t* data, size_t size, media_codec_t codec, AccessUnitInfo* info);
+
+// Length of the first access unit of an annex-b byte stream, up to the start code of the
+// next one. 0 when that start code is not in data yet, at the end of the stream the rest
+// is the last access unit.
+size_t findAccessUnitEnd(const uint8_t* data, size_t size, media_codec_t codec);
+
+// The AVCDecoderConfigurationRecord (avcC) or HEVCDecoderConfigurationRecord (hvcC) of one
+// parameter set each, nal units with their headers and without start codes. vps is h265 only.
+bool buildDecoderConfig(media_codec_t codec, const std::vector<uint8_t>& vps, const std::vector<uint8_t>& sps,
+                        const std::vector<uint8_t>& pps, std::vector<uint8_t>& record);
+
+}  // namespace FFMedia
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef __FF_BUFFER_FLAGS_HPP__
+#define __FF_BUFFER_FLAGS_HPP__
+
+#include <inttypes.h>
+
+#include "media_buffer.hpp"
+
+/*
+ * Per buffer flags for compressed video, kept beside the MediaBuffer since its
+ * layout is fixed by the library. The producer sets them on every buffer it
+ * produces, downstream modules read them to skip damaged frames or to thin out
+ * the stream. Set them after the pts of the frame: a value belongs to the pts the
+ * buffer had when it was set, a buffer filled again without one reads as unset.
+ */
+namespace FFMedia
+{
+enum BUFFER_FLAG {
+    BUFFER_FLAG_CORRUPT = 1 << 0,        // packets of this frame are missing
+    BUFFER_FLAG_REF_LOST = 1 << 1,       // complete, but predicted from a corrupt frame
+    BUFFER_FLAG_DISCONTINUITY = 1 << 2,  // frames before this one were dropped
+};
+
+void setBufferFlags(const MediaBuffer* buffer, uint32_t flags);
+uint32_t getBufferFlags(const MediaBuffer* buffer);
+
+// Temporal layer of a compressed frame, 0 for the base layer. A frame only references
+// frames of its own or lower layers, so a sink may drop every layer above some n and the
+// rest still decodes, at a half, a quarter ... of the frame rate. Set by the encoder on
+// each buffer it produces, buffers without one are on the base layer.
+void setBufferTemporalLayer(const MediaBuffer* buffer, int layer);
+int getBufferTemporalLayer(const MediaBuffer* buffer);
+
+// Sequence number the capture driver gave the frame (v4l2_buffer.sequence), -1 for buffers
+// without one. Consecutive frames differ by one, a larger step is frames the driver dropped.
+void setBufferSequence(const MediaBuffer* buffer, int64_t sequence);
+int64_t getBufferSequence(const MediaBuffer* buffer);
+
+}  // namespace FFMedia
+
+#endif
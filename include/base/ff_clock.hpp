@@ -0,0 +1,25 @@
+#ifndef __FF_CLOCK_HPP__
+#define __FF_CLOCK_HPP__
+
+#include <stdint.h>
+#include <time.h>
+
+namespace FFMedia
+{
+// CLOCK_MONOTONIC, the clock of the pts the sources take when the caller gives none, of the
+// pipeline statistics and of the timeouts and deadlines in base/. Not the wall clock.
+inline int64_t monotonicUs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+inline int64_t monotonicMs()
+{
+    return monotonicUs() / 1000;
+}
+
+}  // namespace FFMedia
+
+#endif
@@ -0,0 +1,163 @@
+#ifndef __FF_CMAF_SEGMENTER_HPP__
+#define __FF_CMAF_SEGMENTER_HPP__
+
+#include <inttypes.h>
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ff_fmp4_muxer.hpp"
+#include "ff_type.hpp"
+
+namespace FFMedia
+{
+/*
+ * Live CMAF packager for one h264/h265 stream: an init segment, media segments that
+ * start at key frames, and for low latency the parts (fragments) they are made of.
+ * It keeps a window of segments in memory and publishes a LL-HLS playlist and a DASH
+ * manifest (SegmentTimeline, chunked segments for low latency DASH) for them.
+ *
+ * Output goes to a directory, for a static http server or a CDN, and/or is read by
+ * CmafHttpServer. Every part is kept as the refcounted buffers the muxer wrote it to,
+ * the directory writes and every http response send from them, so the encode thread
+ * pays one copy per frame and nothing per viewer. Hls parts are byte ranges of their
+ * segment, the data is written once.
+ * Directory io runs on a thread of its own, the playlists are replaced by rename.
+ */
+class CmafSegmenter
+{
+public:
+    typedef std::shared_ptr<const std::vector<uint8_t>> Blob;
+
+    struct Config {
+        std::string dir;                     // empty keeps the output in memory only
+        int64_t segment_duration_ms = 2000;  // cut at the first key frame after it
+        int64_t part_duration_ms = 500;      // 0 for plain hls/dash without parts
+        int window_segments = 6;             // segments in the playlists
+        int keep_segments = 8;               // segments kept in memory and on disk, at least window_segments
+        bool hls = true;
+        bool dash = true;
+        bool block_reload = false;  // the playlist advertises CAN-BLOCK-RELOAD, for CmafHttpServer
+    };
+
+    struct Part {
+        std::vector<Blob> data;  // moof, mdat
+        size_t size;
+        int64_t start_us;
+        int64_t duration_us;
+        bool independent;
+    };
+
+    struct Segment {
+        uint32_t number;
+        int64_t start_us;
+        int64_t duration_us;
+        size_t size;
+        bool complete;
+        std::vector<Part> parts;
+    };
+
+    struct Stats {
+        uint32_t segments;
+        uint32_t parts;
+        uint64_t bytes;
+        uint64_t io_errors;
+        uint32_t io_queue;
+    };
+
+    // Called after every new part or segment, from the thread that calls writeFrame().
+    typedef std::function<void()> UpdateCallback;
+
+public:
+    CmafSegmenter(const Config& config);
+    ~CmafSegmenter();
+
+    int open(media_codec_t codec, int width, int height);
+    // Annex-b parameter sets, for encoders that do not repeat them in band.
+    void setExtraData(const uint8_t* data, size_t size);
+    // One annex-b access unit. Return < 0 on error.
+    int writeFrame(const uint8_t* data, size_t size, int64_t pts_us);
+    // Finish the last segment and mark the playlists ended.
+    void close();
+
+    void setUpdateCallback(UpdateCallback callback);
+
+    // The readers below are thread safe.
+    Blob getInit();
+    Blob getHlsPlaylist();
+    Blob getDashManifest();
+    // A copy of the segment, with shared part data. False when it is not in the window.
+    bool getSegment(uint32_t number, Segment& segment);
+    // True once segment number has part (or is complete when part < 0).
+    bool hasPart(uint32_t number, int part);
+    // Number of the segment being written, 0 before the first.
+    uint32_t getLiveSegment();
+    bool isEnded();
+    int64_t getSegmentDurationMs() const { return config.segment_duration_ms; }
+    Stats getStats();
+
+    static const char* HLS_PLAYLIST;
+    static const char* DASH_MANIFEST;
+    static const char* INIT_SEGMENT;
+    // "seg<number>.m4s"
+    static std::string segmentName(uint32_t number);
+
+private:
+    struct IoJob {
+        enum Type {
+            IO_APPEND,
+            IO_REPLACE,
+            IO_UNLINK,
+        };
+        Type type;
+        std::string path;
+        std::vector<Blob> data;
+        bool first = false;  // IO_APPEND of the first part, a file left by an earlier run is truncated
+    };
+
+    int onFragment(std::vector<uint8_t>& moof, std::vector<uint8_t>& mdat, int64_t start_us, int64_t duration_us,
+                   bool key);
+    void publish();
+    Blob buildHlsPlaylist();
+    Blob buildDashManifest();
+    std::string codecString();
+    void queueIo(IoJob::Type type, const std::string& name, const std::vector<Blob>& data, bool first = false);
+    void ioLoop();
+
+private:
+    Config config;
+    media_codec_t codec;
+    int width;
+    int height;
+    std::unique_ptr<Fmp4Muxer> muxer;
+    std::vector<uint8_t> extra_data;
+    std::vector<uint8_t> init_data;
+    int64_t base_pts_us;
+    int64_t availability_start_ms;  // wall clock of base_pts_us
+    uint32_t next_number;
+
+    std::mutex mtx;
+    Blob init;
+    Blob hls_playlist;
+    Blob dash_manifest;
+    std::deque<Segment> segments;
+    bool ended;
+    UpdateCallback update_cb;
+    Stats stats;
+
+    std::thread* io_thread;
+    std::mutex io_mtx;
+    std::condition_variable io_cv;
+    std::deque<IoJob> io_jobs;
+    bool io_running;
+};
+
+}  // namespace FFMedia
+
+#endif
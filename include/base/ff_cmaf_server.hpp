@@ -0,0 +1,141 @@
+#ifndef __FF_CMAF_SERVER_HPP__
+#define __FF_CMAF_SERVER_HPP__
+
+#include <atomic>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "ff_cmaf_segmenter.hpp"
+#include "ff_rtsp.hpp"
+
+namespace FFMedia
+{
+/*
+ * Small http/1.1 server for the output of CmafSegmenter, so a board can serve LL-HLS
+ * and LL-DASH players without a web server in front.
+ * Every stream lives under a path prefix, for example "/live/0/index.m3u8".
+ * Responses are sent from the refcounted buffers of the segmenter with writev, nothing
+ * is copied or packaged per viewer, and all viewers run on one epoll thread apart from
+ * the encoder: a new part only costs the segmenter thread an eventfd write.
+ * Low latency requests are held until their data exists:
+ *   - blocking playlist reload, index.m3u8?_HLS_msn=<m>&_HLS_part=<p>
+ *   - byte ranges of a part that is not finished, such as the preload hint
+ *   - a segment being written is sent with chunked transfer, part by part, for LL-DASH
+ * A held request gives up after three segment durations.
+ */
+class CmafHttpServer
+{
+public:
+    struct Config {
+        uint16_t port = 8080;
+        int max_clients = 256;
+        int idle_timeout_s = 30;  // keep-alive connections without a request
+    };
+
+    struct Stats {
+        uint32_t clients;
+        uint64_t requests;
+        uint64_t held;  // requests that waited for a part or a segment
+        uint64_t not_found;
+        uint64_t bytes_sent;
+    };
+
+public:
+    CmafHttpServer();
+    CmafHttpServer(const Config& config);
+    ~CmafHttpServer();
+
+    int start();
+    void stop();
+    uint16_t getPort() const { return config.port; }
+
+    // prefix is the url path of the stream, for example "/live/0". The server takes the
+    // update callback of the segmenter.
+    int addStream(const std::string& prefix, std::shared_ptr<CmafSegmenter> segmenter);
+    void removeStream(const std::string& prefix);
+
+    Stats getStats();
+
+private:
+    struct Chunk {
+        CmafSegmenter::Blob blob;
+        size_t pos;
+        size_t end;
+    };
+
+    struct Request {
+        bool head;
+        std::shared_ptr<CmafSegmenter> stream;
+        std::string name;
+        int64_t msn;   // _HLS_msn, -1 without
+        int64_t part;  // _HLS_part, -1 without
+        bool range;
+        size_t range_start;
+        size_t range_end;  // inclusive, SIZE_MAX when open
+        bool keep_alive;
+    };
+
+    struct Client {
+        int fd;
+        std::vector<uint8_t> rx;
+        size_t rx_len;
+        std::deque<Chunk> tx;
+        bool want_write;
+        int64_t last_active_us;
+        bool close_after;
+
+        // a held request, or a segment sent with chunked transfer
+        bool waiting;
+        bool streaming;
+        Request request;
+        uint32_t segment;
+        size_t parts_sent;
+        int64_t deadline_us;
+    };
+
+    void loop();
+    void acceptClients(int64_t now_us);
+    void closeClient(Client* client);
+    void onClientReadable(Client* client, int64_t now_us);
+    // Parse and answer the buffered requests, one at a time.
+    void processRequests(Client* client, int64_t now_us);
+    void onRequest(Client* client, const RtspMessage& msg, int64_t now_us);
+    // Answer the request of the client, false while it has to wait.
+    bool serve(Client* client, int64_t now_us);
+    bool serveSegment(Client* client, uint32_t number);
+    // Queue the bytes [start, end) of the segment.
+    void queueRange(Client* client, const CmafSegmenter::Segment& segment, size_t start, size_t end);
+    // Queue the parts not sent yet, as http chunks. True once the segment is complete.
+    bool sendChunkedParts(Client* client);
+    void progress(Client* client, int64_t now_us);
+    void reply(Client* client, int status, const char* reason, const std::string& headers);
+    void replyEmpty(Client* client, int status, const char* reason);
+    void replyBlob(Client* client, const char* type, const char* cache, const CmafSegmenter::Blob& blob);
+    void queue(Client* client, const CmafSegmenter::Blob& blob, size_t pos, size_t end);
+    void queue(Client* client, const std::string& text);
+    // Return -1 when the client should be closed.
+    int flushClient(Client* client);
+    void finishRequest(Client* client);
+    void wake();
+
+private:
+    Config config;
+    int listen_fd;
+    int epfd;
+    int evfd;
+    std::thread* thread;
+    std::atomic<bool> running;
+    std::mutex streams_mtx;
+    std::map<std::string, std::shared_ptr<CmafSegmenter>> streams;
+    std::map<int, std::shared_ptr<Client>> clients;  // server thread only
+    std::mutex stats_mtx;
+    Stats stats;
+};
+
+}  // namespace FFMedia
+
+#endif
@@ -0,0 +1,108 @@
+#ifndef __FF_FMP4_MUXER_HPP__
+#define __FF_FMP4_MUXER_HPP__
+
+#include <inttypes.h>
+#include <stddef.h>
+
+#include <functional>
+#include <vector>
+
+#include "ff_bitstream.hpp"
+#include "ff_type.hpp"
+
+namespace FFMedia
+{
+/*
+ * Fragmented mp4 (CMAF) muxer for a single h264/h265 track.
+ * The init segment (ftyp + moov) is emitted before the first fragment, after that
+ * every fragment is a self contained moof + mdat, so the output is playable while
+ * it is still being written and a crash only loses the fragment in progress.
+ * Only the samples of the current fragment are buffered, the memory does not grow
+ * with the recording length.
+ * Fragments start at key frames. Samples are stored in decode order with pts as the
+ * decode time, which matches encoders without b-frames.
+ * The sample entry holds the parameter sets of the first key frame. When the stream
+ * changes them later, e.g. an encoder restarted at a new size, the new sets are kept in
+ * band in every key frame, the fragments stay decodable on their own.
+ */
+class Fmp4Muxer
+{
+public:
+    // Return < 0 to abort the muxer.
+    typedef std::function<int(const uint8_t* data, size_t size)> WriteCallback;
+    // A finished fragment, the receiver may swap the buffers out to keep them without a copy.
+    // Return < 0 to abort the muxer.
+    typedef std::function<int(std::vector<uint8_t>& moof, std::vector<uint8_t>& mdat, int64_t start_us,
+                              int64_t duration_us, bool key)>
+        FragmentCallback;
+
+public:
+    Fmp4Muxer(media_codec_t codec, int width, int height);
+
+    void setWriteCallback(WriteCallback callback) { write_cb = callback; }
+    // When set the fragments go to it instead of the write callback, the init segment does not.
+    void setFragmentCallback(FragmentCallback callback) { fragment_cb = callback; }
+    // Cut at the first key frame after duration_us, 0 cuts at every key frame (one gop per fragment).
+    void setFragmentDuration(int64_t duration_us) { fragment_duration_us = duration_us; }
+    // Also cut between key frames so no fragment is longer than duration_us, for the parts of
+    // low latency hls/dash. 0 disables.
+    void setPartDuration(int64_t duration_us) { part_duration_us = duration_us; }
+    // Safeguard for long gops, the fragment is cut at the next frame once its payload reaches max_size.
+    void setMaxFragmentSize(size_t max_size) { max_fragment_size = max_size; }
+    // Annex-b or length prefixed parameter sets, or an avcC/hvcC record. Without them the first key frame
+    // must carry them in band.
+    int setExtraData(const uint8_t* data, size_t size);
+
+    // Return 1 when a fragment was emitted, 0 when the frame was buffered or dropped, -1 on error.
+    int writeFrame(const uint8_t* data, size_t size, int64_t pts_us);
+    // Emit the buffered samples as the last fragment.
+    int flush();
+
+    bool isInitialized() const { return init_written; }
+    uint32_t getFragmentCount() const { return sequence; }
+    uint64_t getBytesWritten() const { return bytes_written; }
+
+    static const uint32_t TIMESCALE = 90000;
+
+private:
+    struct Sample {
+        int64_t pts_us;
+        uint32_t size;
+        bool key;
+    };
+
+    std::vector<uint8_t>* parameterSetSlot(const uint8_t* nal);
+    bool keepInBand(const std::vector<NalUnit>& nals);
+    int writeInitSegment();
+    int writeFragment(int64_t end_pts_us);
+    int output(const uint8_t* data, size_t size);
+    int64_t toTicks(int64_t pts_us) const;
+
+private:
+    media_codec_t codec;
+    int width;
+    int height;
+    WriteCallback write_cb;
+    FragmentCallback fragment_cb;
+    int64_t fragment_duration_us;
+    int64_t part_duration_us;
+    size_t max_fragment_size;
+
+    std::vector<uint8_t> vps;
+    std::vector<uint8_t> sps;
+    std::vector<uint8_t> pps;
+    std::vector<uint8_t> band_sets;  // length prefixed, the changed sets the key frames carry
+    bool init_written;
+
+    std::vector<Sample> samples;
+    std::vector<uint8_t> mdat;
+    std::vector<uint8_t> box;
+    int64_t base_pts_us;
+    int64_t last_duration_us;
+    uint32_t sequence;
+    uint64_t bytes_written;
+};
+
+}  // namespace FFMedia
+
+#endif
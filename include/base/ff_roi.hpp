@@ -0,0 +1,80 @@
+#ifndef __FF_ROI_HPP__
+#define __FF_ROI_HPP__
+
+#include <inttypes.h>
+#include <stddef.h>
+
+#include <memory>
+#include <vector>
+
+#include "media_buffer.hpp"
+#include "pixel_fmt.hpp"
+
+/*
+ * Region of interest QP maps for the encoder.
+ * A QpMap holds one qp delta per block of the picture: negative in regions that matter
+ * (people, vehicles from ModuleInference, motion), positive on the static background.
+ * It is attached to a raw frame with setBufferQpMap(), like the buffer flags, and read
+ * by the modules below it.
+ */
+namespace FFMedia
+{
+#define QP_MAP_BLOCK_SIZE 16
+#define QP_DELTA_MAX 12
+
+struct RoiRegion {
+    int x;
+    int y;
+    int width;
+    int height;
+    int qp_delta;
+};
+
+class QpMap
+{
+public:
+    QpMap(int width, int height, int background_delta = 0, int block_size = QP_MAP_BLOCK_SIZE);
+
+    // Set the blocks the region touches, grown by margin pixels. Where regions overlap
+    // the lowest delta, the best quality, wins over the others and the background.
+    void addRegion(const RoiRegion& region, int margin = 0);
+    void fill(int qp_delta);
+
+    int getWidth() const { return width; }
+    int getHeight() const { return height; }
+    int getBlockSize() const { return block_size; }
+    int getColumns() const { return columns; }
+    int getRows() const { return rows; }
+    int at(int column, int row) const { return deltas[row * columns + column]; }
+    const int8_t* getData() const { return deltas.data(); }
+
+private:
+    int width;
+    int height;
+    int block_size;
+    int columns;
+    int rows;
+    int background;
+    std::vector<int8_t> deltas;
+    std::vector<bool> in_region;
+};
+
+// The map is for the frame in the buffer: set it after the pts, a buffer filled again with
+// another pts has none. A producer that frees its buffers clears their maps with nullptr.
+void setBufferQpMap(const MediaBuffer* buffer, std::shared_ptr<const QpMap> map);
+std::shared_ptr<const QpMap> getBufferQpMap(const MediaBuffer* buffer);
+
+// Copy a NV12 frame and low pass the blocks with a positive delta, stronger for higher
+// deltas. For an encoder without a qp map input: the background loses the noise and fine
+// texture that cost the bits, the regions of interest are copied untouched.
+void filterNv12Roi(const uint8_t* src, uint8_t* dst, const ImagePara& para, const QpMap& map);
+
+// Software reference of the bits a qp map saves: the coded size of a frame estimated
+// from the 4x4 hadamard transform of the luma residual quantized at qp + delta. The
+// residual is against ref after a small full pel motion search per 16x16 block, or
+// against flat grey for an intra frame (ref NULL). Only for comparisons, not a rate model.
+size_t estimateFrameBits(const uint8_t* cur, const uint8_t* ref, const ImagePara& para, int qp, const QpMap* map);
+
+}  // namespace FFMedia
+
+#endif
@@ -0,0 +1,141 @@
+#ifndef __FF_RTMP_HPP__
+#define __FF_RTMP_HPP__
+
+#include <inttypes.h>
+#include <stddef.h>
+
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "ff_type.hpp"
+
+/*
+ * RTMP protocol pieces for the publisher: url, amf0, chunk stream and flv video tags.
+ */
+namespace FFMedia
+{
+#define RTMP_HANDSHAKE_SIZE 1536
+#define RTMP_DEFAULT_CHUNK_SIZE 128
+
+enum RtmpMessageType {
+    RTMP_MSG_SET_CHUNK_SIZE = 1,
+    RTMP_MSG_ABORT = 2,
+    RTMP_MSG_ACK = 3,
+    RTMP_MSG_USER_CONTROL = 4,
+    RTMP_MSG_WINDOW_ACK_SIZE = 5,
+    RTMP_MSG_SET_PEER_BANDWIDTH = 6,
+    RTMP_MSG_AUDIO = 8,
+    RTMP_MSG_VIDEO = 9,
+    RTMP_MSG_AMF0_DATA = 18,
+    RTMP_MSG_AMF0_COMMAND = 20,
+};
+
+// User control events
+#define RTMP_USER_STREAM_BEGIN 0
+#define RTMP_USER_PING_REQUEST 6
+#define RTMP_USER_PING_RESPONSE 7
+
+struct RtmpUrl {
+    std::string host;
+    uint16_t port;
+    std::string app;
+    std::string stream;  // with its query, for the servers that take a key there
+    std::string tc_url;  // rtmp://host[:port]/app
+};
+
+// rtmp://host[:port]/app[/inst]/stream, the last path element is the stream.
+bool parseRtmpUrl(const std::string& url, RtmpUrl* out);
+
+struct Amf0Value {
+    enum Type {
+        NUMBER,
+        BOOLEAN,
+        STRING,
+        OBJECT,  // also ecma arrays
+        NUL,
+        UNDEFINED,
+    };
+    Type type = UNDEFINED;
+    double number = 0;
+    bool boolean = false;
+    std::string string;
+    std::vector<std::pair<std::string, Amf0Value>> properties;
+
+    // Property of an object, NULL if missing.
+    const Amf0Value* get(const char* name) const;
+};
+
+// Decode the values of a command or data message. False when it is malformed.
+bool parseAmf0(const uint8_t* data, size_t size, std::vector<Amf0Value>& values);
+
+class Amf0Writer
+{
+public:
+    Amf0Writer(std::vector<uint8_t>& buf)
+        : buf(buf) {}
+
+    void number(double v);
+    void boolean(bool v);
+    void string(const std::string& v);
+    void null();
+    void objectBegin();
+    // The name of the next value of the object.
+    void key(const std::string& name);
+    void objectEnd();
+
+private:
+    std::vector<uint8_t>& buf;
+};
+
+struct RtmpMessage {
+    uint8_t type;
+    uint32_t stream_id;
+    uint32_t timestamp;
+    std::vector<uint8_t> payload;
+};
+
+// Append a message to out as chunks of chunk_size bytes on chunk stream csid (2..63).
+void writeRtmpChunks(std::vector<uint8_t>& out, uint32_t csid, uint8_t type, uint32_t stream_id, uint32_t timestamp,
+                     const uint8_t* payload, size_t size, size_t chunk_size);
+
+// Reassembles the messages of an incoming chunk stream.
+class RtmpChunkReader
+{
+public:
+    // Parse whole chunks from data and append the finished messages to messages.
+    // Return the bytes used, the rest is an incomplete chunk, -1 on a protocol error.
+    // Set Chunk Size is applied here and passed on as well.
+    int feed(const uint8_t* data, size_t size, std::vector<RtmpMessage>& messages);
+
+private:
+    struct Stream {
+        uint32_t timestamp = 0;
+        uint32_t delta = 0;
+        uint32_t length = 0;
+        uint8_t type = 0;
+        uint32_t stream_id = 0;
+        bool extended = false;
+        std::vector<uint8_t> payload;
+    };
+
+    size_t chunk_size = RTMP_DEFAULT_CHUNK_SIZE;
+    std::map<uint32_t, Stream> streams;
+};
+
+// The payload of a protocol control or user control message.
+std::vector<uint8_t> rtmpControlPayload(uint32_t value);
+std::vector<uint8_t> rtmpUserControlPayload(uint16_t event, uint32_t value);
+
+// Flv video tag body of a sequence header (avcC/hvcC record), h265 in the enhanced rtmp format.
+void buildFlvSequenceHeader(media_codec_t codec, const std::vector<uint8_t>& record, std::vector<uint8_t>& tag);
+// Flv video tag body of an annex-b access unit, length prefixed nal units without
+// parameter sets and access unit delimiters, cts_ms the composition time (pts - dts).
+// Return false when nothing is left.
+bool buildFlvVideoTag(media_codec_t codec, const uint8_t* data, size_t size, bool key, int32_t cts_ms,
+                      std::vector<uint8_t>& tag);
+
+}  // namespace FFMedia
+
+#endif
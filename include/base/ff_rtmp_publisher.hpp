@@ -0,0 +1,178 @@
+#ifndef __FF_RTMP_PUBLISHER_HPP__
+#define __FF_RTMP_PUBLISHER_HPP__
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ff_rtmp.hpp"
+
+namespace FFMedia
+{
+/*
+ * RTMP publisher of one h264/h265 stream that follows the capacity of the link.
+ * pushFrame() packs the access unit into flv and rtmp chunks once and queues it, the
+ * socket is written by the publisher thread, which also connects and reconnects.
+ * The kernel only keeps notsent_lowat bytes not yet sent (TCP_NOTSENT_LOWAT), so a
+ * backlog builds up in the own queue where it can be measured and dropped.
+ * Every interval_ms the thread looks at the link:
+ *   - throughput, the bytes acked by the peer (written - growth of SIOCOUTQ)
+ *   - queue delay, the age of the oldest queued frame plus the unacked bytes at that rate
+ *   - rtt from TCP_INFO against the lowest seen
+ * A queue delay over queue_high_ms or a rtt rise over rtt_rise_ms is congestion: the
+ * target bitrate drops to 85% of the lower of the target and the throughput (once per
+ * decrease_hold_ms), and comes back in 10% steps after increase_intervals clear intervals
+ * (AIMD). The target goes to the BitrateCallback, so the encoder follows it.
+ * While congested non-reference frames are dropped in pushFrame(); when the queue delay
+ * goes over drop_ms anyway the queued frames are dropped and sending resumes with the
+ * next key frame, asked for with the KeyFrameCallback.
+ * A temporally scalable stream also loses its top temporal layer with each decrease,
+ * 30 -> 15 -> 7.5 fps of the same frames, and the clear intervals give the layers back
+ * before the bitrate goes up again.
+ */
+class RtmpPublisher
+{
+public:
+    struct Config {
+        std::string url;
+        int connect_timeout_ms = 5000;
+        int reconnect_ms = 2000;  // 0 disables reconnecting
+        int notsent_lowat = 16 << 10;
+        int start_kbps = 4000;
+        int min_kbps = 300;
+        int max_kbps = 8000;
+        int interval_ms = 500;
+        int queue_high_ms = 400;
+        int rtt_rise_ms = 200;
+        int drop_ms = 2000;
+        int increase_intervals = 4;
+        int decrease_hold_ms = 1000;
+    };
+
+    struct Stats {
+        bool publishing;
+        int target_kbps;
+        int throughput_kbps;
+        int queue_ms;
+        int rtt_ms;
+        int min_rtt_ms;
+        size_t queued_bytes;  // own queue and not acked by the peer
+        uint64_t frames_sent;
+        uint64_t frames_dropped;
+        uint64_t bytes_sent;
+        uint64_t congestion_events;
+        uint64_t connects;
+        int max_layer;           // highest temporal layer sent, -1 for all
+        uint64_t layer_dropped;  // frames of the upper temporal layers, also in frames_dropped
+    };
+
+    using BitrateCallback = std::function<void(int kbps)>;
+    // congestion is false for the start of a session, true after dropped frames
+    using KeyFrameCallback = std::function<void(bool congestion)>;
+
+public:
+    RtmpPublisher(const Config& config);
+    ~RtmpPublisher();
+
+    int start();
+    void stop();
+
+    // Called on the publisher thread.
+    void setBitrateCallback(BitrateCallback callback) { bitrate_cb = callback; }
+    void setKeyFrameCallback(KeyFrameCallback callback) { key_frame_cb = callback; }
+
+    // Parameter sets, annex-b or an avcC/hvcC record, for the sequence header when the key frames do not carry them.
+    void setExtraData(media_codec_t codec, const uint8_t* data, size_t size);
+    // Queue an annex-b access unit, pts and dts in microseconds, with its temporal layer. The
+    // rtmp timestamp is the dts, the flv composition time pts - dts; dts_us < 0 is the pts, a
+    // stream without b-frames. Frames before the first key frame of a session, or dropped for
+    // congestion, return false.
+    bool pushFrame(media_codec_t codec, const uint8_t* data, size_t size, int64_t pts_us, int64_t dts_us = -1,
+                   int temporal_layer = 0);
+
+    bool isPublishing() const { return publishing; }
+    int getTargetBitrate() const { return target_kbps; }
+    Stats getStats();
+
+private:
+    struct Slab {
+        std::shared_ptr<std::vector<uint8_t>> data;
+        bool frame;  // false for sequence headers, metadata and protocol control, never dropped
+        int64_t queued_us;
+    };
+
+    void loop();
+    // Connect, handshake and publish. Blocking, bounded by connect_timeout_ms.
+    bool connectSession();
+    void closeSession();
+    bool sendAll(const std::vector<uint8_t>& data, int64_t deadline_us);
+    bool recvAll(uint8_t* data, size_t size, int64_t deadline_us);
+    // Read messages until a command matches, the others are handled on the way.
+    bool waitCommand(const std::function<bool(const std::vector<Amf0Value>&)>& match, std::vector<Amf0Value>& values,
+                     int64_t deadline_us);
+    // Read what the socket has into inbox, -1 when the session has to close.
+    int readMessages();
+    // Protocol control and status messages, false when the session has to close.
+    bool handleMessage(const RtmpMessage& msg);
+    // Send a message before the queued frames, after the one being written.
+    void queueControl(std::vector<uint8_t>&& data);
+    // -1 when the session has to close.
+    int writeQueue();
+    void control(int64_t now_us);
+    // Drop the queued frames up to the next key frame, false while waiting for one already.
+    bool dropQueue();
+
+private:
+    Config config;
+    RtmpUrl url;
+    int fd;
+    int evfd;
+    std::thread* thread;
+    std::atomic<bool> running;
+    std::atomic<bool> publishing;
+    std::atomic<bool> congested;
+    std::atomic<int> target_kbps;
+    std::atomic<int> top_layer;  // highest temporal layer seen
+    std::atomic<int> max_layer;
+    BitrateCallback bitrate_cb;
+    KeyFrameCallback key_frame_cb;
+
+    // publisher thread
+    RtmpChunkReader reader;
+    std::vector<uint8_t> rx;
+    std::deque<RtmpMessage> inbox;
+    uint64_t rx_bytes;
+    uint64_t rx_acked;
+    uint32_t ack_window;
+    std::deque<Slab> sending;
+    size_t sending_pos;
+    uint64_t written;
+    uint64_t written_mark;
+    size_t outq_mark;
+    int64_t interval_start_us;
+    int64_t last_decrease_us;
+    int clear_intervals;
+    int64_t min_rtt_us;
+
+    // shared with pushFrame()
+    std::mutex mtx;
+    std::deque<Slab> queue;
+    size_t queue_bytes;
+    uint32_t stream_id;
+    size_t chunk_size;
+    bool need_key;
+    bool need_header;
+    int64_t base_dts_us;
+    std::vector<uint8_t> sets;
+    std::vector<uint8_t> extra_sets;
+    Stats stats;
+};
+
+}  // namespace FFMedia
+
+#endif
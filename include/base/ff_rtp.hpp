@@ -0,0 +1,214 @@
+#ifndef __FF_RTP_HPP__
+#define __FF_RTP_HPP__
+
+#include <inttypes.h>
+#include <stddef.h>
+
+#include <deque>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "ff_type.hpp"
+
+namespace FFMedia
+{
+#define RTP_HEADER_SIZE 12
+#define RTP_VIDEO_CLOCK 90000
+
+struct RtpHeader {
+    uint8_t payload_type;
+    bool marker;
+    uint16_t seq;
+    uint32_t timestamp;
+    uint32_t ssrc;
+    const uint8_t* payload;
+    size_t payload_size;
+};
+
+// Skip csrc, header extension and padding. Return -1 if it is not a rtp v2 packet.
+int parseRtpHeader(const uint8_t* data, size_t size, RtpHeader* header);
+
+// Base64 as used by sprop-parameter-sets.
+std::string base64Encode(const uint8_t* data, size_t size);
+std::vector<uint8_t> base64Decode(const std::string& text);
+
+/*
+ * Rebuild annex-b access units from h264 (RFC 6184) or h265 (RFC 7798) rtp packets.
+ * Single nal, STAP-A/AP and FU-A/FU payloads are supported. A frame ends at the marker bit
+ * or when the timestamp changes. A sequence gap marks the frame in progress as corrupt.
+ * The payloads are copied once, straight into the frame storage; fragments are not
+ * collected first.
+ */
+class RtpDepacketizer
+{
+public:
+    // One access unit with 4 byte start codes. The callee may swap the storage out,
+    // for example with an empty vector of the right capacity, the content is cleared after the call.
+    typedef std::function<void(std::vector<uint8_t>& frame, uint32_t timestamp, bool key, bool corrupt)> FrameCallback;
+
+    struct Stats {
+        uint64_t packets;
+        uint64_t lost;        // never arrived, late arrivals are taken back
+        uint64_t reordered;   // arrived after a newer packet, dropped
+        uint64_t duplicates;
+        uint64_t frames;
+        uint64_t corrupt_frames;
+    };
+
+public:
+    RtpDepacketizer(media_codec_t codec);
+
+    void setFrameCallback(FrameCallback callback) { frame_cb = callback; }
+    void setMaxFrameSize(size_t size) { max_frame_size = size; }
+    void input(const RtpHeader& rtp);
+    void reset();
+    const Stats& getStats() const { return stats; }
+
+private:
+    void appendNal(const uint8_t* header, size_t header_size, const uint8_t* data, size_t size, bool start_code);
+    void emitFrame();
+
+private:
+    media_codec_t codec;
+    FrameCallback frame_cb;
+    size_t max_frame_size;
+    std::vector<uint8_t> frame;
+    uint32_t timestamp;
+    uint16_t expected_seq;
+    uint64_t seen_mask;  // bit n: expected_seq - 1 - n was received
+    bool started;
+    bool key;
+    bool corrupt;
+    bool fu_active;
+    Stats stats;
+};
+
+/*
+ * Put rtp packets back in sequence order before the depacketizer.
+ * A packet that continues the sequence passes straight through without a copy,
+ * only the packets that arrive after a gap are copied and held. A gap is given up
+ * once its oldest held packet waited depth_ms, then the held packets are released
+ * and the depacketizer sees the loss. A packet still missing after the nack delay is
+ * reported once through the nack callback, so the caller can ask the server for a
+ * retransmission; the delay keeps plain reordering from causing retransmissions.
+ */
+class RtpJitterBuffer
+{
+public:
+    typedef std::function<void(const RtpHeader& rtp)> PacketCallback;
+    typedef std::function<void(const std::vector<uint16_t>& seqs)> NackCallback;
+
+    struct Stats {
+        uint64_t packets;
+        uint64_t reordered;  // held and put back in order
+        uint64_t recovered;  // arrived after a nack
+        uint64_t late;       // arrived after its gap was given up or again after release, dropped
+        uint64_t duplicates;
+        uint64_t lost;       // given up
+        uint64_t nack_sent;
+    };
+
+public:
+    // capacity is rounded up to a power of two in 64..32768, so the slots divide the sequence space
+    RtpJitterBuffer(int depth_ms, size_t capacity = 1024);
+
+    void setPacketCallback(PacketCallback callback) { packet_cb = callback; }
+    void setNackCallback(NackCallback callback) { nack_cb = callback; }
+    // Default depth_ms / 4
+    void setNackDelay(int delay_ms) { nack_delay_us = delay_ms * 1000ll; }
+    void input(const RtpHeader& rtp, int64_t now_us);
+    // Send the due nacks and give up the gaps that are older than depth_ms.
+    void poll(int64_t now_us);
+    // Release everything that is held, in order.
+    void flush();
+    void reset();
+    size_t getHeldCount() const { return held; }
+    const Stats& getStats() const { return stats; }
+
+private:
+    struct Slot {
+        bool used;
+        bool nacked;
+        uint16_t seq;
+        int64_t arrival_us;
+        RtpHeader header;
+        std::vector<uint8_t> payload;
+    };
+
+    Slot& slot(uint16_t seq) { return slots[seq & (slots.size() - 1)]; }
+    void release();
+    void skipGap();
+
+private:
+    int64_t depth_us;
+    int64_t nack_delay_us;
+    std::vector<Slot> slots;
+    std::deque<std::pair<uint16_t, int64_t>> pending_nacks;  // seq, due time
+    PacketCallback packet_cb;
+    NackCallback nack_cb;
+    std::vector<uint16_t> nacks;
+    bool started;
+    uint16_t next_seq;     // the next packet to release
+    uint16_t highest_seq;  // the newest packet seen
+    size_t held;
+    Stats stats;
+};
+
+// Rtcp generic nack (RFC 4585) for the given sequence numbers, appended to out.
+void buildRtcpNack(uint32_t sender_ssrc, uint32_t media_ssrc, const std::vector<uint16_t>& seqs,
+                   std::vector<uint8_t>& out);
+// Sequence numbers asked for by a rtcp compound packet, false if it holds no nack.
+bool parseRtcpNack(const uint8_t* data, size_t size, std::vector<uint16_t>& seqs);
+
+enum RtcpKeyRequest {
+    RTCP_KEY_REQUEST_NONE,
+    RTCP_KEY_REQUEST_PLI,  // picture loss indication, RFC 4585
+    RTCP_KEY_REQUEST_FIR,  // full intra request, RFC 5104
+};
+
+// Rtcp picture loss indication, appended to out.
+void buildRtcpPli(uint32_t sender_ssrc, uint32_t media_ssrc, std::vector<uint8_t>& out);
+// The key frame request of a rtcp compound packet, a FIR wins over a PLI.
+RtcpKeyRequest parseRtcpKeyRequest(const uint8_t* data, size_t size);
+
+// Rtcp APP packet (RFC 3550) named "FFSK", sent by RtspServer to a tcp viewer before the key
+// frame it resumes at after frames were dropped for it. Its sequence numbers stay continuous,
+// so this is how the receiver learns of the skip. Other receivers ignore APP packets.
+void buildRtcpSkip(uint32_t sender_ssrc, uint32_t frames, std::vector<uint8_t>& out);
+// The frames skipped according to a rtcp compound packet, false if it has no skip notice.
+bool parseRtcpSkip(const uint8_t* data, size_t size, uint32_t* frames);
+
+struct RtpPacket {
+    uint8_t header[16];  // rtp header and the FU headers
+    uint32_t header_size;
+    const uint8_t* payload;  // points into the access unit
+    uint32_t payload_size;
+};
+
+// Split annex-b access units into rtp packets, single nal or FU-A/FU.
+class RtpPacketizer
+{
+public:
+    RtpPacketizer(media_codec_t codec, uint8_t payload_type, uint32_t ssrc, size_t mtu = 1400);
+
+    // The packets point into data, it must stay valid until they are sent.
+    size_t packetize(const uint8_t* data, size_t size, uint32_t timestamp, std::vector<RtpPacket>& packets);
+    uint16_t getSequence() const { return seq; }
+    uint32_t getSsrc() const { return ssrc; }
+    uint8_t getPayloadType() const { return payload_type; }
+
+private:
+    void writeHeader(RtpPacket& packet, uint32_t timestamp, bool marker);
+
+private:
+    media_codec_t codec;
+    uint8_t payload_type;
+    uint32_t ssrc;
+    size_t mtu;
+    uint16_t seq;
+};
+
+}  // namespace FFMedia
+
+#endif
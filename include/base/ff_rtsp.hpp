@@ -0,0 +1,88 @@
+#ifndef __FF_RTSP_HPP__
+#define __FF_RTSP_HPP__
+
+#include <inttypes.h>
+#include <stddef.h>
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "ff_type.hpp"
+
+/*
+ * RTSP protocol pieces shared by the ingest engine and the rtsp server.
+ */
+namespace FFMedia
+{
+struct RtspUrl {
+    std::string host;
+    uint16_t port;
+    std::string user;
+    std::string password;
+    std::string path;
+    std::string url;  // without the credentials
+};
+
+bool parseRtspUrl(const std::string& url, RtspUrl* out);
+
+struct RtspMessage {
+    bool is_request;
+    std::string method;  // request
+    std::string uri;     // request
+    int status;          // response
+    std::vector<std::pair<std::string, std::string>> headers;
+    std::string body;
+
+    // Case insensitive, NULL if missing.
+    const std::string* header(const char* name) const;
+    int cseq() const;
+};
+
+// Parse one message, return the bytes used, 0 when more data is needed, -1 when it is invalid.
+// Http/1.x requests have the same syntax and are accepted too.
+int parseRtspMessage(const char* data, size_t size, RtspMessage* msg);
+
+std::string md5Hex(const std::string& text);
+
+// Basic or digest (RFC 2617, md5) authorization.
+class RtspAuth
+{
+public:
+    void setCredentials(const std::string& user, const std::string& password);
+    bool hasCredentials() const { return !user.empty(); }
+    // From the WWW-Authenticate header of a 401 response, false if the scheme is not supported.
+    bool setChallenge(const std::string& www_authenticate);
+    bool ready() const { return scheme != SCHEME_NONE; }
+    // The Authorization header value for a request, empty before a challenge.
+    std::string header(const std::string& method, const std::string& uri) const;
+
+private:
+    enum Scheme {
+        SCHEME_NONE,
+        SCHEME_BASIC,
+        SCHEME_DIGEST,
+    };
+    Scheme scheme = SCHEME_NONE;
+    std::string user;
+    std::string password;
+    std::string realm;
+    std::string nonce;
+};
+
+struct SdpVideo {
+    media_codec_t codec;
+    int payload_type;
+    std::string control;
+    std::vector<uint8_t> extra_data;  // sprop parameter sets with start codes
+    bool nack;                        // a=rtcp-fb:<pt> nack, the server retransmits
+};
+
+// The first h264/h265 video media of the session description.
+bool parseSdpVideo(const std::string& sdp, SdpVideo* out);
+// Resolve a=control against the Content-Base or request url.
+std::string resolveControlUrl(const std::string& base, const std::string& control);
+
+}  // namespace FFMedia
+
+#endif
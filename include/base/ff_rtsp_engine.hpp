@@ -0,0 +1,332 @@
+#ifndef __FF_RTSP_ENGINE_HPP__
+#define __FF_RTSP_ENGINE_HPP__
+
+#include <sys/socket.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ff_buffer_flags.hpp"
+#include "ff_rtp.hpp"
+#include "ff_rtsp.hpp"
+#include "ff_type.hpp"
+
+namespace FFMedia
+{
+/*
+ * Fixed number of frame slots between a reactor thread and one consumer.
+ * The slots keep their capacity and pop() swaps the storage with the caller,
+ * so a steady stream does not allocate. When the ring is full the new frame is
+ * dropped and so is everything after it up to the next key frame.
+ */
+class FrameRing
+{
+public:
+    struct Frame {
+        std::vector<uint8_t> data;
+        int64_t pts_us;
+        bool key;
+        uint32_t flags;  // BUFFER_FLAG_*
+    };
+
+public:
+    FrameRing(size_t slots);
+
+    // Return false when the frame was dropped.
+    bool push(const uint8_t* data, size_t size, int64_t pts_us, bool key, uint32_t flags);
+    // Same, but swap the storage with the slot instead of copying, data gets the old slot storage.
+    bool push(std::vector<uint8_t>& data, int64_t pts_us, bool key, uint32_t flags);
+    // Wait up to timeout_ms, false on timeout or when the ring is closed and empty.
+    bool pop(Frame& frame, int timeout_ms);
+    void close();
+    void reopen();
+    bool isClosed();
+    size_t size();
+    uint64_t getDropped() const { return dropped; }
+
+private:
+    std::vector<Frame> slots;
+    size_t head;
+    size_t count;
+    bool closed;
+    bool wait_key;
+    std::atomic<uint64_t> dropped;
+    std::mutex mtx;
+    std::condition_variable cv;
+
+    Frame* reserve(bool key);
+};
+
+class RtspEngine;
+
+/*
+ * One rtsp pull, driven by a reactor thread of RtspEngine.
+ * It runs OPTIONS, DESCRIBE, SETUP and PLAY for the first h264/h265 track, receives
+ * RTP over UDP or interleaved TCP, and pushes the access units to its FrameRing.
+ * UDP packets are read in recvmmsg batches into the reactor's packet slab and
+ * reassembled straight into the ring slot storage.
+ * With jitter_ms the UDP packets go through a RtpJitterBuffer first, and missing packets
+ * are asked for again with rtcp nack when the server announces it. Corrupt frames and
+ * the frames predicted from them are flagged, or dropped up to the next key frame.
+ * Broken connections and data timeouts reconnect after reconnect_ms.
+ */
+class RtspSession : public std::enable_shared_from_this<RtspSession>
+{
+public:
+    enum Status {
+        STATUS_CLOSED,      // closed, or gave up after max_timeout_count failures
+        STATUS_CONNECTING,  // handshake or waiting for a reconnect
+        STATUS_PLAYING,
+    };
+
+    struct Stats {
+        uint64_t frames;
+        uint64_t bytes;
+        uint64_t packets;
+        uint64_t lost;
+        uint64_t reordered;  // arrived out of order
+        uint64_t recovered;  // retransmitted after a nack
+        uint64_t duplicates;
+        uint64_t truncated;  // larger than udp_packet_size
+        uint64_t receive_calls;
+        uint64_t nack_sent;
+        uint64_t corrupt_frames;
+        uint64_t skipped_frames;  // dropped until the next key frame
+        uint64_t dropped_frames;  // ring full
+        uint64_t reconnects;
+    };
+
+public:
+    ~RtspSession();
+
+    const std::string& getUrl() const { return url.url; }
+    RTSP_STREAM_TYPE getTransport() const { return transport; }
+    Status getStatus() const { return status; }
+    // Wait until the session plays, false on timeout or when it was closed.
+    bool waitPlaying(int timeout_ms);
+
+    // Valid once the session played.
+    media_codec_t getCodec();
+    void getVideoSize(int* width, int* height);
+    // Parameter sets from the sdp or the stream, with start codes.
+    std::vector<uint8_t> getExtraData();
+
+    FrameRing& getRing() { return ring; }
+    Stats getStats();
+
+private:
+    friend class RtspEngine;
+    struct Reactor;
+
+    enum Step {
+        STEP_IDLE,
+        STEP_RESOLVING,  // the host name, on the resolver thread of RtspEngine
+        STEP_CONNECTING,
+        STEP_OPTIONS,
+        STEP_DESCRIBE,
+        STEP_SETUP,
+        STEP_PLAY,
+        STEP_PLAYING,
+    };
+
+    enum FdKind {
+        FD_CONTROL,
+        FD_RTP,
+        FD_RTCP,
+    };
+
+    struct FdTag {
+        RtspSession* session;
+        FdKind kind;
+    };
+
+    RtspSession(const RtspUrl& url, RTSP_STREAM_TYPE transport, RtspEngine* engine);
+
+    void connect(int64_t now_us);
+    void onResolved(const sockaddr_storage& addr, socklen_t addr_len, int64_t now_us);
+    void connectControl(int64_t now_us);
+    void fail(const char* reason, int64_t now_us);
+    void closeSockets();
+    void teardown();
+    void tick(int64_t now_us);
+    void onEvent(FdKind kind, uint32_t events, int64_t now_us);
+    void onControlReadable(int64_t now_us);
+    void onResponse(const RtspMessage& msg, int64_t now_us);
+    void onRtp(const uint8_t* data, size_t size, int64_t now_us);
+    void onFrame(std::vector<uint8_t>& frame, uint32_t timestamp, bool key, bool corrupt);
+    void receiveUdp(int fd, bool rtp, int64_t now_us);
+    bool simulateNetwork(const uint8_t* data, size_t size, int64_t now_us);
+    void releaseSimulated(int64_t now_us);
+    void sendNack(const std::vector<uint16_t>& seqs);
+    void sendPli(int64_t now_us);
+    void sendRtcp();
+    void sendRequest(const std::string& method, const std::string& uri, const std::string& headers, int64_t now_us);
+    void sendReceiverReport(int64_t now_us);
+    int flushControl();
+    int openUdpPorts();
+    int openMulticastPorts(const std::string& group, uint16_t port);
+    void updateEpoll(int fd, FdTag* tag, uint32_t events, bool add);
+    void updateVideoInfo(const uint8_t* data, size_t size);
+    void setStatus(Status status);
+    void syncStats();
+
+private:
+    RtspEngine* engine;
+    Reactor* reactor;
+    int epfd;
+    RtspUrl url;
+    RTSP_STREAM_TYPE transport;
+    RtspAuth auth;
+    std::atomic<Status> status;
+    Step step;
+    int64_t step_start_us;
+    int64_t retry_at_us;
+    int timeout_count;
+
+    sockaddr_storage server_addr;
+    socklen_t server_addr_len;
+    int ctrl_fd;
+    int rtp_fd;
+    int rtcp_fd;
+    uint16_t client_port;
+    uint16_t server_rtcp_port;
+    FdTag ctrl_tag;
+    FdTag rtp_tag;
+    FdTag rtcp_tag;
+    bool want_write;
+
+    std::vector<uint8_t> rx;
+    size_t rx_len;
+    std::string tx;
+    int cseq;
+    std::string last_method;
+    std::string last_uri;
+    std::string last_headers;
+    bool auth_retried;
+    std::string session_id;
+    int session_timeout_s;
+    std::string content_base;
+    std::string track_url;
+    SdpVideo sdp;
+    std::unique_ptr<RtpDepacketizer> depacketizer;
+    std::unique_ptr<RtpJitterBuffer> jitter;
+    uint32_t media_ssrc;
+    bool broken;         // waiting for an intact key frame
+    bool discontinuity;  // frames were dropped before the next one
+    bool server_skip;    // the server dropped frames up to the next key frame (parseRtcpSkip())
+    std::multimap<int64_t, std::vector<uint8_t>> sim_queue;
+    std::vector<uint8_t> rtcp_out;
+
+    int64_t last_data_us;
+    int64_t last_keepalive_us;
+    int64_t last_report_us;
+    int64_t last_pli_us;
+    uint32_t local_ssrc;
+    uint64_t rx_packets;
+    uint64_t rx_bytes;
+    uint64_t rx_truncated;
+    uint64_t rx_calls;
+    bool ts_started;
+    uint32_t last_ts;
+    int64_t ts_base_us;
+    int64_t ts_unwrapped;
+
+    FrameRing ring;
+    std::mutex info_mtx;
+    std::condition_variable info_cv;
+    media_codec_t codec;
+    int width;
+    int height;
+    std::vector<uint8_t> extra_data;
+    Stats stats;
+    RtpDepacketizer::Stats base_rtp_stats;
+    RtpJitterBuffer::Stats base_jitter_stats;
+};
+
+/*
+ * Serve many rtsp pulls from a few epoll reactor threads instead of a receive
+ * thread per stream. Sessions are spread over the reactors by load.
+ * Host names are resolved on a thread of their own, a slow dns server never
+ * holds up the other sessions of a reactor.
+ */
+class RtspEngine
+{
+public:
+    struct Config {
+        int threads = 1;
+        int timeout_ms = 5000;       // handshake and data timeout
+        int reconnect_ms = 3000;     // delay before reconnecting
+        int max_timeout_count = 0;   // give up after this many failures in a row, 0 never
+        size_t ring_slots = 16;      // frames queued per session
+        size_t max_frame_size = 8 << 20;
+        int udp_recv_buffer = 2 << 20;
+        int udp_batch = 32;               // packets per recvmmsg, 1 reads them one by one
+        size_t udp_packet_size = 2048;    // larger datagrams are dropped
+        int jitter_ms = 0;                // udp reorder depth, 0 passes the packets as they come
+        bool nack = true;                 // ask for lost packets when the server supports it
+        bool drop_until_idr = true;       // drop damaged frames instead of flagging them
+        bool pli = true;                  // ask the server for a key frame over udp rtcp when a frame is damaged
+        float sim_loss_percent = 0;       // test only, drop udp packets at random
+        int sim_jitter_ms = 0;            // test only, delay udp packets at random
+        std::string multicast_interface;  // local ipv4 address to join groups on, empty for the default route
+    };
+
+    struct Stats {
+        uint32_t sessions;
+        uint32_t playing;
+        uint64_t frames;
+        uint64_t bytes;
+        uint64_t packets;
+        uint64_t lost;
+        uint64_t reordered;
+        uint64_t recovered;
+        uint64_t receive_calls;
+        uint64_t corrupt_frames;
+        uint64_t skipped_frames;
+        uint64_t dropped_frames;
+    };
+
+public:
+    RtspEngine();
+    RtspEngine(const Config& config);
+    ~RtspEngine();
+
+    // Shared by the modules that are not given an engine, two reactor threads.
+    static std::shared_ptr<RtspEngine> getDefault();
+
+    std::shared_ptr<RtspSession> open(const std::string& url, RTSP_STREAM_TYPE transport = RTSP_STREAM_TYPE_UDP);
+    void close(std::shared_ptr<RtspSession> session);
+
+    const Config& getConfig() const { return config; }
+    int getThreadCount() const { return reactors.size(); }
+    Stats getStats();
+
+private:
+    friend class RtspSession;
+    typedef RtspSession::Reactor Reactor;
+
+    void resolve(const std::shared_ptr<RtspSession>& session);
+    void resolveLoop();
+
+    Config config;
+    std::vector<Reactor*> reactors;
+    std::mutex sessions_mtx;
+    std::vector<std::shared_ptr<RtspSession>> sessions;
+
+    std::thread* resolver;
+    std::mutex resolve_mtx;
+    std::condition_variable resolve_cv;
+    std::deque<std::weak_ptr<RtspSession>> resolve_queue;
+    bool resolver_running;
+};
+
+}  // namespace FFMedia
+
+#endif
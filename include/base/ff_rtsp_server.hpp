@@ -0,0 +1,249 @@
+#ifndef __FF_RTSP_SERVER_HPP__
+#define __FF_RTSP_SERVER_HPP__
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ff_rtp.hpp"
+#include "ff_rtsp.hpp"
+#include "ff_type.hpp"
+
+namespace FFMedia
+{
+/*
+ * Small rtsp server for encoded h264/h265 streams.
+ * Every mount is one stream, fed with pushFrame(). Viewers play it over UDP, interleaved
+ * TCP or, on mounts with a group, UDP multicast.
+ * Each mount keeps the frames since its last key frame, a new unicast viewer is sent them
+ * right after PLAY instead of waiting up to a gop for the next key frame. With
+ * GOP_CACHE_LIVE the cached frames carry the time stamp of the newest one, so a player
+ * decodes them at once and shows the live picture. Multicast viewers start at the next
+ * key frame, they share the group and a packet is sent once however many watch.
+ * A TCP viewer has a send queue of at most max_tcp_backlog bytes, when it is full the
+ * viewer skips to the next key frame, and once it stays full for slow_client_timeout_ms
+ * the viewer is closed, so one slow link does not hold memory or time of the others.
+ * The frames a TCP viewer does not get are left out of its rtp sequence numbers, its
+ * stream has no gaps, and before the key frame it resumes at it gets a rtcp APP packet
+ * (buildRtcpSkip()) so a receiver can tell the skip from a loss.
+ * The rtp packets of a frame are built once per mount into a refcounted slab and every
+ * viewer sends from it: the UDP viewers with sendmmsg batches over all of them, the TCP
+ * viewers with writev, so a frame costs one packetize and one copy whatever the number
+ * of viewers. UDP viewers may ask for lost packets with rtcp nack, they are resent from
+ * the slabs of a short per mount history.
+ * Temporally scalable streams: pushFrame() takes the temporal layer of the frame. A TCP
+ * viewer whose queue, counting the unsent bytes of its socket buffer, grows over
+ * layer_shed_backlog stops getting the top layer still sent to it, e.g. 30 -> 15 -> 7.5
+ * fps, long before it has to skip to a key frame, and gets a layer back once its queue
+ * stayed under a quarter of that for layer_restore_ms.
+ * setMaxTemporalLayer() caps a mount for all viewers, multicast and UDP included.
+ * A mount may have a key frame callback, it is called when a viewer can not start from the
+ * cache and for rtcp PLI/FIR from the viewers, so the encoder can run long gops.
+ * The control connections run on one epoll thread, the media is sent from the thread that
+ * calls pushFrame(). Each mount has its own lock, so streams pushed from different threads
+ * do not wait for each other.
+ */
+class RtspServer
+{
+public:
+    enum GopCache {
+        GOP_CACHE_OFF,    // start at the next key frame
+        GOP_CACHE_BURST,  // send the cached frames as they are, the viewer starts a gop behind
+        GOP_CACHE_LIVE,   // send them with the time stamp of the newest, to be shown at once
+    };
+
+    enum KeyRequest {
+        KEY_REQUEST_NEW_VIEWER,
+        KEY_REQUEST_PLI,
+        KEY_REQUEST_FIR,
+    };
+
+    // Called from the control thread, without locks held. It should not block.
+    typedef std::function<void(KeyRequest reason)> KeyFrameCallback;
+
+    struct Config {
+        uint16_t port = 8554;
+        int max_clients = 256;
+        size_t mtu = 1400;
+        size_t max_tcp_backlog = 4 << 20;  // queued interleaved bytes before frames are dropped
+        int session_timeout_s = 60;
+        size_t nack_history = 512;  // packets kept per mount for rtcp nack, 0 disables
+        int slow_client_timeout_ms = 5000;  // close tcp viewers behind for this long, 0 never
+        std::string multicast_interface;    // local ipv4 address to send multicast from, empty for the default route
+        GopCache gop_cache = GOP_CACHE_BURST;
+        size_t gop_cache_max_bytes = 4 << 20;  // longer gops are not cached
+        size_t layer_shed_backlog = 512 << 10;  // queued bytes before a tcp viewer drops a temporal layer, 0 never
+        int layer_hold_ms = 500;                // between two layers dropped for a viewer
+        int layer_restore_ms = 2000;            // a short queue for this long gives a layer back
+    };
+
+    struct Stats {
+        uint32_t clients;
+        uint32_t playing;
+        uint64_t frames;
+        uint64_t packets_sent;
+        uint64_t bytes_sent;
+        uint64_t frames_dropped;  // tcp viewers that fell behind
+        uint64_t retransmits;
+        uint64_t send_calls;    // sendmmsg/writev calls for the media
+        uint64_t evicted;       // slow tcp viewers that were closed
+        uint64_t cache_starts;  // viewers started from the gop cache
+        uint64_t key_requests;  // key frame callbacks
+        uint64_t layer_dropped;  // frames of upper temporal layers not sent to a viewer
+    };
+
+public:
+    RtspServer();
+    RtspServer(const Config& config);
+    ~RtspServer();
+
+    int start();
+    void stop();
+    uint16_t getPort() const { return config.port; }
+
+    // path is the url path, for example "/live/0".
+    int addMount(const std::string& path, media_codec_t codec);
+    void removeMount(const std::string& path);
+    // Parameter sets for the sdp and for key frames without them, with start codes or an avcC/hvcC
+    // record. Found in the key frames when not set.
+    void setExtraData(const std::string& path, const uint8_t* data, size_t size);
+    // Offer multicast on a mount: group:port carries rtp, port + 1 is kept for rtcp.
+    int setMulticast(const std::string& path, const std::string& group, uint16_t port, int ttl = 16);
+    void setKeyFrameCallback(const std::string& path, KeyFrameCallback callback);
+    // Send only the temporal layers up to layer, -1 for all
+    void setMaxTemporalLayer(const std::string& path, int layer);
+    // One annex-b access unit. Return the number of viewers it was sent to, -1 if the mount is unknown.
+    int pushFrame(const std::string& path, const uint8_t* data, size_t size, int64_t pts_us, int temporal_layer = 0);
+
+    uint32_t getViewerCount(const std::string& path);
+    Stats getStats();
+
+private:
+    // The packets of one frame, each one behind its 4 byte interleaved prefix, so TCP
+    // viewers send the data as it is and UDP viewers skip the prefix.
+    // Rtsp replies are queued as slabs without packets.
+    struct Slab {
+        std::vector<uint8_t> data;
+        std::vector<uint32_t> packets;  // offset of the prefix
+    };
+
+    struct Chunk {
+        std::shared_ptr<const Slab> slab;
+        size_t pos;
+        std::vector<uint8_t> seqs;  // the viewer's rtp sequence numbers, 2 bytes a packet, empty for the slab's
+    };
+
+    struct Mount;
+
+    struct Client {
+        int fd;
+        std::vector<uint8_t> rx;
+        size_t rx_len;
+        std::string session_id;
+        std::shared_ptr<Mount> mount;
+        bool tcp;
+        bool playing;
+        int64_t last_active_us;
+        sockaddr_storage rtp_addr;
+        socklen_t rtp_addr_len;
+        bool multicast;
+        std::atomic<bool> evict;
+
+        // shared with the pushing thread
+        std::mutex tx_mtx;
+        std::deque<Chunk> tx;
+        size_t tx_bytes;
+        bool want_write;
+        bool wait_key;  // pushing thread only, once playing
+        int64_t behind_since_us;
+        int max_layer;
+        int64_t layer_change_us;
+        int64_t short_since_us;  // the queue is under a quarter of layer_shed_backlog
+        // a tcp viewer's packets are numbered without the ones it did not get
+        bool seq_started;
+        uint16_t seq_offset;
+        uint32_t skipped;  // frames dropped since the last one sent, for the resume notice
+    };
+
+    struct Mount {
+        Mount();
+        ~Mount();
+
+        std::mutex mtx;
+        media_codec_t codec;
+        std::atomic<bool> removed;
+        std::vector<uint8_t> extra_data;
+        std::vector<std::shared_ptr<Client>> viewers;
+        std::unique_ptr<RtpPacketizer> packetizer;
+        std::vector<std::pair<std::shared_ptr<const Slab>, uint32_t>> history;  // by seq % nack_history
+        std::vector<std::shared_ptr<const Slab>> gop;  // since the last key frame
+        size_t gop_bytes;
+        std::vector<uint8_t> sets;
+        std::vector<uint8_t> key_frame;
+        KeyFrameCallback key_cb;
+        int top_layer;  // highest temporal layer seen
+        int max_layer;  // -1 for all
+        int multicast_fd;
+        sockaddr_in multicast_addr;
+        int multicast_ttl;
+        uint32_t multicast_viewers;
+        std::vector<RtpPacket> packets;
+        std::vector<std::pair<const sockaddr*, socklen_t>> udp_targets;
+        std::vector<mmsghdr> msgs;
+        std::vector<iovec> iovs;
+        Stats stats;
+    };
+
+    void loop();
+    void acceptClients(int64_t now_us);
+    void closeClient(Client* client);
+    void onClientReadable(Client* client, int64_t now_us);
+    void onRequest(Client* client, const RtspMessage& msg, int64_t now_us);
+    void reply(Client* client, int status, const char* reason, int cseq, const std::string& headers,
+               const std::string& body = "");
+    int flushClient(Client* client);
+    static int chunkIov(const Chunk& chunk, iovec* iov, int max);
+    void queueSlab(Client* client, const std::shared_ptr<const Slab>& slab);
+    void skipSlab(Client* client, const Slab& slab, bool to_key);
+    std::string buildSdp(Mount& mount);
+    std::shared_ptr<Mount> findMount(const std::string& uri, bool track);
+    std::shared_ptr<const Slab> buildSlab(Mount& mount, const uint8_t* data, size_t size, uint32_t timestamp);
+    void sendUdp(Mount& mount, const Slab& slab, const std::vector<std::pair<const sockaddr*, socklen_t>>& targets,
+                 int fd);
+    void updateGopCache(Mount& mount, const std::shared_ptr<const Slab>& slab, bool key);
+    bool startFromCache(Mount& mount, Client* client);
+    void requestKeyFrame(const std::shared_ptr<Mount>& mount, KeyRequest reason);
+    void closeOrphans();
+    void onRtcp(int64_t now_us);
+
+private:
+    Config config;
+    int listen_fd;
+    int rtp_fd;
+    int rtcp_fd;
+    uint16_t server_rtp_port;
+    int epfd;
+    int evfd;
+    std::thread* thread;
+    std::atomic<bool> running;
+    std::shared_timed_mutex mounts_mtx;
+    std::map<std::string, std::shared_ptr<Mount>> mounts;
+    std::map<int, std::shared_ptr<Client>> clients;  // control thread only
+    std::atomic<uint32_t> client_count;
+    uint32_t next_session;
+};
+
+}  // namespace FFMedia
+
+#endif
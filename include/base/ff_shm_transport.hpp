@@ -0,0 +1,159 @@
+#ifndef __FF_SHM_TRANSPORT_HPP__
+#define __FF_SHM_TRANSPORT_HPP__
+
+#include <inttypes.h>
+#include <stddef.h>
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace FFMedia
+{
+/*
+ * Frames from one process to others on the same machine, e.g. a capture/decode process and
+ * several analytics processes that would otherwise each open the camera and decode it.
+ * The writer owns a pool of slots, dma-bufs from /dev/dma_heap/system or memfds, and a
+ * control block in a memfd. A reader connects to the writer's unix socket (a path, or an
+ * abstract name starting with '@') and gets all these fds once, with SCM_RIGHTS, then maps
+ * them: a frame is copied once into a slot by the writer, however many readers there are,
+ * and the readers use it in place.
+ * Publishing is lock free: the writer fills a free slot and puts its index into a ring of
+ * sequence numbers, a reader follows the ring at its own pace. A reader pins the slot of a
+ * frame while it uses it, one bit per reader, and the writer skips pinned slots, so a slow
+ * reader never blocks the writer: it loses the frames that went by (getDroppedCount()), and
+ * when every slot is pinned the writer drops its frame instead. The bits of a reader that
+ * disconnects or dies are cleared by the writer. A byte on the socket wakes the readers up
+ * per frame, the socket closing tells them the writer is gone.
+ */
+enum ShmFrameFlag {
+    SHM_FRAME_KEY = 1 << 16,
+    SHM_FRAME_EOS = 1 << 17,  // set on the control block, never on a frame
+    // the low 16 bits carry BUFFER_FLAG_* (ff_buffer_flags.hpp) of the frame
+};
+
+struct ShmStreamInfo {
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint32_t hstride = 0;
+    uint32_t vstride = 0;
+    uint32_t v4l2Fmt = 0;
+};
+
+struct ShmFrame {
+    uint64_t seq = 0;
+    uint32_t slot = 0;
+    const uint8_t* data = NULL;
+    int fd = -1;  // of the slot, a dma-buf or a memfd
+    size_t slot_size = 0;
+    size_t size = 0;
+    int64_t pts = 0;
+    uint32_t flags = 0;
+};
+
+class ShmTransportWriter
+{
+public:
+    struct Config {
+        uint32_t slot_count = 8;  // at most 64
+        size_t slot_size = 0;     // the largest frame
+        bool dma_heap = true;     // slots from /dev/dma_heap/system when there is one
+    };
+
+    ShmTransportWriter();
+    ~ShmTransportWriter();
+
+    int open(const std::string& path, const ShmStreamInfo& info, const Config& config);
+    void close();
+    bool isOpen() const { return control != NULL; }
+
+    // Copy a frame into a free slot and publish it. Never waits for the readers, false
+    // when the frame is too big or every slot is pinned.
+    bool write(const void* data, size_t size, int64_t pts, uint32_t flags);
+    // The readers get eos once they read what was written before.
+    void writeEos();
+
+    int getReaderCount();
+    uint64_t getWrittenCount() const { return written; }
+    uint64_t getDroppedCount() const { return dropped; }
+    bool isDmaBuf() const { return dma_buf; }
+
+private:
+    struct Client {
+        int fd;
+        int bit;
+    };
+
+    void acceptLoop();
+    int sendHello(int fd, int bit);
+    void dropClient(size_t index);
+
+    std::string path;
+    int listen_fd;
+    int control_fd;
+    size_t control_size;
+    uint8_t* control;
+    std::vector<int> slot_fds;
+    std::vector<uint8_t*> slot_data;
+    size_t slot_size;
+    uint32_t next_slot;
+    uint64_t seq;
+    bool dma_buf;
+    std::atomic<uint64_t> written;
+    std::atomic<uint64_t> dropped;
+    std::vector<Client> clients;
+    uint64_t used_bits;
+    std::mutex mtx;
+    std::thread accept_thread;
+    std::atomic<bool> running;
+};
+
+class ShmTransportReader
+{
+public:
+    enum ReadResult {
+        READ_FRAME,
+        READ_TIMEOUT,
+        READ_EOS,  // eos written, or the writer is gone
+    };
+
+    ShmTransportReader();
+    ~ShmTransportReader();
+
+    // Connect to the writer, waiting up to timeout_ms for it to listen.
+    int open(const std::string& path, int timeout_ms = 0);
+    void close();
+    bool isOpen() const { return control != NULL; }
+    const ShmStreamInfo& getStreamInfo() const { return info; }
+
+    // The next frame, pinned until release(). timeout_ms < 0 waits as long as it takes.
+    ReadResult read(ShmFrame* frame, int timeout_ms);
+    void release(const ShmFrame& frame);
+    // Skip to the newest frame when behind, instead of reading all the ring still holds.
+    void setLatestOnly(bool enable) { latest_only = enable; }
+    // Frames that went by before this reader got to them.
+    uint64_t getDroppedCount() const { return dropped; }
+
+private:
+    bool waitWriter(int timeout_ms);
+
+    int sock;
+    int control_fd;
+    size_t control_size;
+    uint8_t* control;
+    std::vector<int> slot_fds;
+    std::vector<uint8_t*> slot_data;
+    size_t slot_size;
+    uint64_t bit;
+    uint64_t next;
+    bool latest_only;
+    bool writer_gone;
+    uint64_t dropped;
+    ShmStreamInfo info;
+};
+
+}  // namespace FFMedia
+
+#endif
@@ -0,0 +1,246 @@
+#ifndef __FF_SUBMIT_QUEUE_HPP__
+#define __FF_SUBMIT_QUEUE_HPP__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+namespace FFMedia
+{
+/*
+ * The bookkeeping of a source module fed by submit() calls (ModuleMemQueue,
+ * ModuleDmaBufImport): the items the consumers have not taken yet, the item each output
+ * buffer holds in the slot of its index, and the counters behind waitIdle().
+ * Every pushed item is finished exactly once, outside the lock: consumed when its buffer
+ * came back from the consumers, not consumed when it was dropped before they took it.
+ * The finish callback runs before the item is counted, so waitIdle() also waits for it.
+ */
+template <class T>
+class SubmitQueue
+{
+public:
+    // id: the number of the item, counted from 0 in push() order
+    typedef std::function<void(uint64_t id, T& item, bool consumed)> FinishCallback;
+
+    enum {
+        PUSH_TIMEOUT = -1,  // the queue stayed full
+        PUSH_CLOSED = -2,   // after close()
+    };
+
+public:
+    SubmitQueue(FinishCallback finish)
+        : finish_cb(finish), depth(SIZE_MAX), pushed(0), completed(0), dropped(0), closed(false), eos(false)
+    {
+    }
+
+    // Queued items before push() waits, unlimited by default.
+    void setDepth(size_t queue_depth) { depth = queue_depth ? queue_depth : 1; }
+
+    // One slot per output buffer, before the first pop().
+    void setSlotCount(size_t count)
+    {
+        std::lock_guard<std::mutex> lk(mtx);
+        slots.clear();
+        slots.resize(count);
+        busy.assign(count, false);
+    }
+    size_t getSlotCount() const { return slots.size(); }
+
+    // Return the id of the item or PUSH_*. timeout_ms < 0 waits for room as long as it takes.
+    // A refused item is left in place.
+    int64_t push(T& item, int timeout_ms)
+    {
+        std::unique_lock<std::mutex> lk(mtx);
+        auto room = [this] { return closed || pending.size() < depth; };
+
+        if (timeout_ms < 0)
+            space_cond.wait(lk, room);
+        else if (!space_cond.wait_for(lk, std::chrono::milliseconds(timeout_ms), room))
+            return PUSH_TIMEOUT;
+        if (closed)
+            return PUSH_CLOSED;
+
+        pending.push_back(Item{pushed, std::move(item)});
+        produce_cond.notify_one();
+        return pushed++;
+    }
+
+    // The consumers get an eos after the queued items, later pushes are refused.
+    void close()
+    {
+        std::lock_guard<std::mutex> lk(mtx);
+        if (closed)
+            return;
+        closed = true;
+        eos = true;
+        produce_cond.notify_one();
+        space_cond.notify_all();
+    }
+
+    // Take the next item into slot, waiting up to timeout_ms. Return the item, which stays
+    // in the slot until release(), or NULL with *at_eos telling an eos from an empty queue.
+    // An item the slot still holds is finished first, its buffer is being produced again.
+    T* pop(size_t slot, int timeout_ms, bool* at_eos)
+    {
+        Item left;
+        *at_eos = false;
+        if (takeSlot(slot, left))
+            finish(left, true);
+
+        std::unique_lock<std::mutex> lk(mtx);
+        if (!produce_cond.wait_for(lk, std::chrono::milliseconds(timeout_ms), [this] { return !pending.empty() || eos; }))
+            return NULL;
+        if (pending.empty()) {
+            eos = false;
+            *at_eos = true;
+            return NULL;
+        }
+        slots[slot] = std::move(pending.front());
+        pending.pop_front();
+        busy[slot] = true;
+        space_cond.notify_one();
+        return &slots[slot].value;
+    }
+
+    // A buffer came back from the consumers: take the item out of its slot, recycle the
+    // buffer with recycle() and finish the item, in this order so the output buffer is free
+    // again before the item's owner hears of it and submits it anew.
+    void release(size_t slot, std::function<void()> recycle)
+    {
+        Item item;
+        bool held = takeSlot(slot, item);
+        recycle();
+        if (held)
+            finish(item, true);
+    }
+
+    // Drop the queued items, a pending eos is kept. With in_flight the items the consumers
+    // hold are finished too, as consumed, although their buffers have not come back.
+    void dropAll(bool in_flight)
+    {
+        std::deque<Item> queued;
+        std::vector<Item> taken;
+        {
+            std::lock_guard<std::mutex> lk(mtx);
+            queued.swap(pending);
+            for (size_t i = 0; in_flight && i < busy.size(); i++) {
+                if (busy[i]) {
+                    taken.push_back(std::move(slots[i]));
+                    slots[i] = Item();
+                    busy[i] = false;
+                }
+            }
+            space_cond.notify_all();
+        }
+
+        for (auto& item : queued)
+            finish(item, false);
+        for (auto& item : taken)
+            finish(item, true);
+    }
+
+    // Wait until the consumers released every buffer, return the number they still hold.
+    size_t waitInFlight(int timeout_ms)
+    {
+        std::unique_lock<std::mutex> lk(mtx);
+        inflight_cond.wait_for(lk, std::chrono::milliseconds(timeout_ms), [this] { return heldCount() == 0; });
+        return heldCount();
+    }
+
+    // Wait until every pushed item was finished, false on timeout.
+    bool waitIdle(int timeout_ms)
+    {
+        std::unique_lock<std::mutex> lk(mtx);
+        auto idle = [this] { return completed + dropped == pushed; };
+        if (timeout_ms < 0) {
+            idle_cond.wait(lk, idle);
+            return true;
+        }
+        return idle_cond.wait_for(lk, std::chrono::milliseconds(timeout_ms), idle);
+    }
+
+    size_t getQueuedCount()
+    {
+        std::lock_guard<std::mutex> lk(mtx);
+        return pending.size();
+    }
+    uint64_t getPushedCount()
+    {
+        std::lock_guard<std::mutex> lk(mtx);
+        return pushed;
+    }
+    uint64_t getCompletedCount()
+    {
+        std::lock_guard<std::mutex> lk(mtx);
+        return completed;
+    }
+    uint64_t getDroppedCount()
+    {
+        std::lock_guard<std::mutex> lk(mtx);
+        return dropped;
+    }
+
+private:
+    struct Item {
+        uint64_t id;
+        T value;
+    };
+
+    bool takeSlot(size_t slot, Item& item)
+    {
+        std::lock_guard<std::mutex> lk(mtx);
+        if (slot >= busy.size() || !busy[slot])
+            return false;
+        item = std::move(slots[slot]);
+        slots[slot] = Item();
+        busy[slot] = false;
+        inflight_cond.notify_all();
+        return true;
+    }
+
+    void finish(Item& item, bool consumed)
+    {
+        finish_cb(item.id, item.value, consumed);
+        std::lock_guard<std::mutex> lk(mtx);
+        if (consumed)
+            completed++;
+        else
+            dropped++;
+        idle_cond.notify_all();
+    }
+
+    size_t heldCount() const
+    {
+        size_t held = 0;
+        for (bool b : busy)
+            held += b;
+        return held;
+    }
+
+private:
+    FinishCallback finish_cb;
+    std::mutex mtx;
+    std::condition_variable produce_cond;   // items queued
+    std::condition_variable space_cond;     // room in the queue
+    std::condition_variable idle_cond;      // everything finished
+    std::condition_variable inflight_cond;  // a buffer came back
+    std::deque<Item> pending;
+    std::vector<Item> slots;  // held by the output buffer of the same index
+    std::vector<bool> busy;
+    size_t depth;
+    uint64_t pushed;
+    uint64_t completed;
+    uint64_t dropped;
+    bool closed;
+    bool eos;  // closed and the consumers did not get the eos yet
+};
+
+}  // namespace FFMedia
+
+#endif
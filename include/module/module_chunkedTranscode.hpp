@@ -0,0 +1,64 @@
+#ifndef __MODULE_CHUNKEDTRANSCODE_HPP__
+#define __MODULE_CHUNKEDTRANSCODE_HPP__
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "module/module_media.hpp"
+
+namespace FFMedia
+{
+/*
+ * Transcode one file with several pipes at once.
+ * The file is cut into chunk_count ranges of key frames from the idr index of
+ * ModuleFileReader, the sync samples of the container. The pts of the first frame of
+ * every range is probed up front and ends the range before it. Every range runs its
+ * own reader -> builder pipe -> spool file, all in free-run mode, and is stopped as
+ * soon as it reached its end. When all chunks are done the spool files are replayed in
+ * order into one ModuleFileWriter, the timestamps are those of the source file.
+ * Only the video stream is transcoded.
+ */
+class ChunkedTranscodeJob
+{
+public:
+    // Build the processing part of a chunk, e.g. dec -> rga -> enc, on top of productor.
+    // Return the last module, its output must be compressed video.
+    using PipeBuilder = std::function<shared_ptr<ModuleMedia>(shared_ptr<ModuleMedia> productor, int chunk_index)>;
+
+    ChunkedTranscodeJob(const string& input, const string& output, int chunk_count);
+    ~ChunkedTranscodeJob();
+
+    void setPipeBuilder(PipeBuilder builder) { pipe_builder = builder; }
+    // directory of the temporary spool files, default is the directory of output
+    void setSpoolDir(const string& dir) { spool_dir = dir; }
+
+    // Block until the output file is written. Return 0 on success.
+    int run();
+
+    int getChunkCount() const { return chunk_count; }
+
+private:
+    struct Chunk {
+        size_t first_idr;
+        size_t idr_count;  // 0: until the end of the file
+        int64_t end_pts;   // first pts of the next chunk, INT64_MIN: unknown, end by idr_count
+        string spool_path;
+        shared_ptr<ModuleMedia> source;
+    };
+
+    int64_t probeFirstPts(size_t idr_index);
+    int buildChunk(Chunk& chunk, int index);
+    int merge();
+
+    string input_path;
+    string output_path;
+    string spool_dir;
+    int chunk_count;
+    PipeBuilder pipe_builder;
+    vector<Chunk> chunks;
+};
+
+}  // namespace FFMedia
+
+#endif
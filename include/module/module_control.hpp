@@ -0,0 +1,53 @@
+#ifndef __MODULE_CONTROL_HPP__
+#define __MODULE_CONTROL_HPP__
+
+#include "module/module_media.hpp"
+
+namespace FFMedia
+{
+enum ControlEventType {
+    CONTROL_EVENT_KEY_FRAME,  // the consumers need a key frame as soon as possible
+    CONTROL_EVENT_BITRATE,    // the consumers ask for a new target bitrate (kbps)
+};
+
+enum KeyFrameReason {
+    KEY_FRAME_NEW_VIEWER,     // a viewer joined and has nothing to start from
+    KEY_FRAME_PICTURE_LOSS,   // rtcp pli
+    KEY_FRAME_FULL_INTRA,     // rtcp fir
+    KEY_FRAME_SEGMENT_START,  // a file segment is due
+    KEY_FRAME_CONGESTION,     // frames were dropped on a congested link
+    KEY_FRAME_USER,
+};
+
+struct ControlEvent {
+    ControlEventType type;
+    int reason;
+    int kbps;  // CONTROL_EVENT_BITRATE
+};
+
+/*
+ * Modules that act on control events, found by walking up the pipe.
+ * The data goes down from the productor to its consumers, control events go the other
+ * way: a sink sends one with sendControlEvent() and the nearest productor above it that
+ * handles the type gets it, for example a ModuleIdrEnc for CONTROL_EVENT_KEY_FRAME.
+ * onControlEvent() runs on the thread of the sender, often a network thread, so a handler
+ * should only take note of the event and apply it in its own doConsume().
+ */
+class ControlHandler
+{
+public:
+    virtual ~ControlHandler() {}
+    // Return true when the event was taken, it then goes no further up.
+    virtual bool onControlEvent(const ControlEvent& event) = 0;
+};
+
+// Pass event to the productors of module, nearest first. Return false when none took it.
+bool sendControlEvent(shared_ptr<ModuleMedia> module, const ControlEvent& event);
+bool requestKeyFrame(shared_ptr<ModuleMedia> module, KeyFrameReason reason);
+bool requestBitrate(shared_ptr<ModuleMedia> module, int kbps);
+
+const char* keyFrameReasonName(int reason);
+
+}  // namespace FFMedia
+
+#endif
@@ -0,0 +1,154 @@
+#ifndef __MODULE_PIPELINE_HPP__
+#define __MODULE_PIPELINE_HPP__
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "base/ff_clock.hpp"
+#include "module/module_media.hpp"
+
+namespace FFMedia
+{
+enum PipelineMode {
+    PIPELINE_MODE_REALTIME,  // paced by Synchronize, as the demos run by default
+    PIPELINE_MODE_FREE_RUN,  // as fast as possible, no sleeps, input pts are kept
+    PIPELINE_MODE_LOW_LATENCY  // live sources, no pacing, the source records capture times for the latency probe
+};
+
+// Queue depths of the low latency profile. Like every buffer count they have to be
+// set with setBufferCount() before init().
+enum {
+    LOW_LATENCY_SOURCE_BUFFERS = 2,
+    LOW_LATENCY_DECODER_BUFFERS = 4,
+    LOW_LATENCY_STAGE_BUFFERS = 2,
+    LOW_LATENCY_SINK_BUFFERS = 1,
+};
+
+struct StageStats {
+    string name;
+    uint64_t frames;
+    int64_t busy_us;
+    int64_t wall_us;
+
+    float utilisation() const
+    {
+        return wall_us > 0 ? (float)busy_us / wall_us : 0.0f;
+    }
+};
+
+// Time from the capture stamp until a stage was done with the frame.
+struct LatencyStats {
+    string name;
+    uint64_t samples;
+    int64_t p50_us;
+    int64_t p90_us;
+    int64_t p99_us;
+    int64_t max_us;
+};
+
+/*
+ * Counters shared by every profiled module. Use ModuleProfiled<T> to get an instance
+ * of module T that records them, dumpPipelineProfile() finds them by walking the pipe.
+ *
+ * Latency probe: a profiled source with setCaptureStamp(true) records the time each
+ * buffer it produces left it, in a table by pts beside the buffers, the pts itself is
+ * left alone. Every profiled stage below it then records now - that time for each frame
+ * it finishes. The pts travels with the frame through decoders and converters, so the
+ * leaf stage holds the end-to-end latency. Two sources with the same pts at the same
+ * time mix up their stamps, profile one pipe at a time.
+ */
+class StageProfiler
+{
+public:
+    StageProfiler();
+    virtual ~StageProfiler() {}
+
+    StageStats getStageStats(const char* name) const;
+    LatencyStats getLatencyStats(const char* name) const;
+    void resetStageStats();
+
+    void setCaptureStamp(bool enable) { capture_stamp = enable; }
+    bool getCaptureStamp() const { return capture_stamp; }
+
+protected:
+    void account(int64_t start_us, int64_t end_us, bool frame_done);
+    // Stamp buffer on a capturing source, record its latency on the other stages
+    void probe(const shared_ptr<MediaBuffer>& buffer, int64_t now_us);
+
+private:
+    // log-linear buckets, 8 per power of two, about 12% resolution
+    static const int LATENCY_BUCKETS = 256;
+    static int latencyBucket(int64_t us);
+    static int64_t bucketValue(int bucket);
+
+    std::atomic<uint64_t> frames;
+    std::atomic<int64_t> busy_us;
+    std::atomic<int64_t> first_us;
+    std::atomic<int64_t> last_us;
+    std::atomic<bool> capture_stamp;
+    std::atomic<uint64_t> latency[LATENCY_BUCKETS];
+    std::atomic<int64_t> latency_max;
+};
+
+template <class Module>
+class ModuleProfiled : public Module, public StageProfiler
+{
+public:
+    template <typename... Args>
+    ModuleProfiled(Args&&... args) : Module(std::forward<Args>(args)...) {}
+
+protected:
+    virtual typename Module::ConsumeResult doConsume(shared_ptr<MediaBuffer> input_buffer,
+                                                     shared_ptr<MediaBuffer> output_buffer) override
+    {
+        int64_t start = monotonicUs();
+        typename Module::ConsumeResult ret = Module::doConsume(input_buffer, output_buffer);
+        int64_t end = monotonicUs();
+        account(start, end, ret == Module::CONSUME_SUCCESS || ret == Module::CONSUME_BYPASS);
+        if (ret == Module::CONSUME_SUCCESS && output_buffer)
+            probe(output_buffer, end);
+        else if (ret == Module::CONSUME_SUCCESS || ret == Module::CONSUME_BYPASS)
+            probe(input_buffer, end);
+        return ret;
+    }
+
+    virtual typename Module::ProduceResult doProduce(shared_ptr<MediaBuffer> buffer) override
+    {
+        int64_t start = monotonicUs();
+        typename Module::ProduceResult ret = Module::doProduce(buffer);
+        int64_t end = monotonicUs();
+        account(start, end, ret == Module::PRODUCE_SUCCESS);
+        if (ret == Module::PRODUCE_SUCCESS)
+            probe(buffer, end);
+        return ret;
+    }
+};
+
+// Walk the pipe below source and switch every module to the given mode.
+// In PIPELINE_MODE_FREE_RUN all Synchronize objects are detached and encoders
+// reuse the input timestamps, so the output keeps the source pts.
+// In PIPELINE_MODE_REALTIME sync is attached to the source and to every leaf, it is
+// required there: a null sync is refused, rather than detach the sync of those modules.
+// PIPELINE_MODE_LOW_LATENCY detaches sync like PIPELINE_MODE_FREE_RUN and turns on the
+// capture stamp of the source when it is profiled. Stale frames are only dropped where
+// a ModuleNewestFrame sits in the pipe, queue depths are the LOW_LATENCY_*_BUFFERS above.
+// Return 0, or -1 and nothing changed.
+int setPipelineMode(shared_ptr<ModuleMedia> source, PipelineMode mode, shared_ptr<Synchronize> sync = nullptr);
+
+// Block until every leaf module of the pipe reached STATUS_EOS.
+// timeout_ms < 0 waits forever. Return false on timeout.
+bool waitPipelineEos(shared_ptr<ModuleMedia> source, int timeout_ms = -1);
+
+// Collect the stats of all ModuleProfiled stages, in pipe order.
+std::vector<StageStats> getPipelineProfile(shared_ptr<ModuleMedia> source);
+void dumpPipelineProfile(shared_ptr<ModuleMedia> source);
+
+// Latency percentiles of all ModuleProfiled stages below a capture stamping source,
+// in pipe order. The rows of the leaf stages are the end-to-end latency.
+std::vector<LatencyStats> getPipelineLatency(shared_ptr<ModuleMedia> source);
+void dumpPipelineLatency(shared_ptr<ModuleMedia> source);
+
+}  // namespace FFMedia
+
+#endif
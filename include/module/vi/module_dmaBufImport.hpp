@@ -0,0 +1,92 @@
+#ifndef __MODULE_DMABUFIMPORT_HPP__
+#define __MODULE_DMABUFIMPORT_HPP__
+
+#include "base/ff_submit_queue.hpp"
+#include "module/module_media.hpp"
+
+/*
+ * Raw frames the application already holds in dma-buf fds (another process, a gpu, a camera
+ * hal) as a source, e.g. ModuleDmaBufImport -> ModuleRga/ModuleMppEnc, without copying them.
+ * The buffers are registered once with addBuffer(), which dups the fd, so the caller may close
+ * its own, and maps it unless a mapping is given. submit() queues a registered buffer, the
+ * consumers get it as a VideoBuffer::EXTERNAL_BUFFER with the fd and the mapping, and the
+ * release callback hands it back once they all released it (consumed false for the submissions
+ * dropped by flush() or at stop). Until then the buffer must not be written, and a buffer is
+ * queued once at a time. The callback runs on the thread that released the buffer, usually the
+ * consumer's, and should not block.
+ * At stop the queued buffers are dropped, and the ones with the consumers are waited for up
+ * to a second. Those still held then are handed back anyway, consumed, while a consumer may
+ * still read them: stop the consumers first, or do not write a buffer handed back at stop
+ * until they are gone.
+ * The frames have the image para of the module, stride included. beginCpuAccess() and
+ * endCpuAccess() wrap cpu writes with DMA_BUF_IOCTL_SYNC; a memfd without a dma-buf behind it
+ * works too, for consumers that only use the mapping.
+ */
+class ModuleDmaBufImport : public ModuleMedia
+{
+public:
+    using ReleaseCallback = std::function<void(int handle, bool consumed)>;
+
+    enum {
+        SUBMIT_BUSY = -1,  // queued or with the consumers already
+        SUBMIT_CLOSED = -2,  // after endOfStream()
+        SUBMIT_INVALID = -3,
+    };
+
+private:
+    struct Registered {
+        int fd = -1;  // our dup
+        void* data = NULL;
+        size_t size = 0;
+        bool mapped = false;  // by us, unmapped on removal
+        bool busy = false;
+        int64_t pts = 0;
+    };
+
+    vector<Registered> buffers;
+    std::mutex mtx;
+    FFMedia::SubmitQueue<int> queue;  // handles
+    size_t frame_size;
+    ReleaseCallback release;
+
+    void finish(int handle, bool consumed);
+    int syncCpuAccess(int handle, uint64_t flags);
+
+protected:
+    virtual ProduceResult doProduce(shared_ptr<MediaBuffer> output_buffer) override;
+    virtual void bufferReleaseCallBack(shared_ptr<MediaBuffer> buffer) override;
+    virtual bool teardown() override;
+
+public:
+    ModuleDmaBufImport(const ImagePara& para);
+    ~ModuleDmaBufImport();
+    int init() override;
+
+    void setReleaseCallback(ReleaseCallback callback) { release = callback; }
+
+    // Return the handle of the buffer, -1 on error. size at least one frame of the image para,
+    // data an existing mapping of the fd, NULL to map it here.
+    int addBuffer(int fd, size_t size, void* data = NULL);
+    // Unmap and close a buffer that is not queued, -1 while it is.
+    int removeBuffer(int handle);
+    void* getBufferData(int handle);
+
+    // Queue a registered buffer, 0 or SUBMIT_*. pts_us < 0 takes the time of the submission.
+    int submit(int handle, int64_t pts_us = -1);
+    // The consumers get an eos buffer after the queued frames, later submissions are refused.
+    void endOfStream();
+    // Drop the frames the consumers have not taken yet.
+    void flush();
+    // Wait until every submitted buffer came back, false on timeout.
+    bool waitIdle(int timeout_ms);
+
+    // DMA_BUF_IOCTL_SYNC around cpu access to the mapping, 0 when the fd is not a dma-buf.
+    int beginCpuAccess(int handle, bool write = true);
+    int endCpuAccess(int handle, bool write = true);
+
+    uint64_t getSubmittedCount();
+    uint64_t getCompletedCount();
+    uint64_t getDroppedCount();
+};
+
+#endif
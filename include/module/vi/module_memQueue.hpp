@@ -0,0 +1,86 @@
+#ifndef __MODULE_MEMQUEUE_HPP__
+#define __MODULE_MEMQUEUE_HPP__
+
+#include "base/ff_submit_queue.hpp"
+#include "module/module_media.hpp"
+
+/*
+ * Memory source with a submission queue, the asynchronous counterpart of ModuleMemReader's
+ * setInputBuffer()/waitProcess() handshake. The caller submits access units without waiting
+ * for the decoder, up to the queue depth, and is told when each one is done:
+ * - owned: a vector moved into the queue, or copied by submitCopy();
+ * - borrowed: the caller's memory is passed to the consumers as is, no copy, and release
+ *   is called once they have all released the buffer, the memory must stay valid until then.
+ * The completion callback gets the id returned by submit() and whether the data reached the
+ * consumers (false for the submissions dropped by flush() or at stop). Both callbacks run on
+ * the thread that released the buffer, usually the decoder's, and should not block. A refused
+ * submission is not kept, release is not called and a moved vector is handed back.
+ * Up to getBufferCount() submissions are with the consumers at the same time.
+ * At stop the queued submissions are dropped, and the ones with the consumers are waited
+ * for up to a second. Those still held then are completed anyway: release is called while
+ * a consumer may still read the memory, so stop the consumers first, or keep borrowed
+ * memory valid until they are gone.
+ */
+class ModuleMemQueue : public ModuleMedia
+{
+public:
+    using ReleaseCallback = std::function<void(const void* data, size_t size)>;
+    using CompletionCallback = std::function<void(uint64_t id, bool consumed)>;
+
+    enum {
+        SUBMIT_TIMEOUT = -1,  // the queue stayed full
+        SUBMIT_CLOSED = -2,   // after endOfStream()
+        SUBMIT_INVALID = -3,
+    };
+
+private:
+    struct Entry {
+        vector<uint8_t> owned;
+        const void* data = NULL;
+        size_t size = 0;
+        int64_t pts = 0;
+        ReleaseCallback release;
+    };
+
+    FFMedia::SubmitQueue<Entry> queue;
+    CompletionCallback completion;
+    shared_ptr<MediaBuffer> extra_buffer;
+
+    int64_t enqueue(Entry& entry, int timeout_ms);
+    void finish(uint64_t id, Entry& entry, bool consumed);
+
+protected:
+    virtual ProduceResult doProduce(shared_ptr<MediaBuffer> output_buffer) override;
+    virtual void bufferReleaseCallBack(shared_ptr<MediaBuffer> buffer) override;
+    virtual bool teardown() override;
+
+public:
+    ModuleMemQueue(const ImagePara& para);
+    ~ModuleMemQueue();
+    int init() override;
+
+    // Queued submissions not yet taken by the consumers, default 16. Before init().
+    void setQueueDepth(size_t queue_depth) { queue.setDepth(queue_depth); }
+    void setCompletionCallback(CompletionCallback callback) { completion = callback; }
+    // Parameter sets passed as the extra data of the buffers, e.g. for a muxer behind the source.
+    void setExtraData(const uint8_t* extra_data, unsigned extra_size);
+
+    // Return the id of the submission, or SUBMIT_*. timeout_ms < 0 waits for room as long as it
+    // takes, 0 does not wait. pts_us < 0 takes the time of the submission.
+    int64_t submit(vector<uint8_t>&& data, int64_t pts_us = -1, int timeout_ms = -1);
+    int64_t submitCopy(const void* data, size_t size, int64_t pts_us = -1, int timeout_ms = -1);
+    int64_t submit(const void* data, size_t size, ReleaseCallback release, int64_t pts_us = -1, int timeout_ms = -1);
+    // The consumers get an eos buffer after the queued submissions, later submissions are refused.
+    void endOfStream();
+    // Drop the submissions the consumers have not taken yet.
+    void flush();
+    // Wait until every submission completed, false on timeout.
+    bool waitIdle(int timeout_ms);
+
+    size_t getQueuedCount();
+    uint64_t getSubmittedCount();
+    uint64_t getCompletedCount();
+    uint64_t getDroppedCount();
+};
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef __MODULE_PACKETREPLAY_HPP__
+#define __MODULE_PACKETREPLAY_HPP__
+
+#include "module/module_media.hpp"
+
+// Play back one or more ModulePacketSpool files in order, as one stream. init() fails unless
+// they all have the format, the size and the extra data (parameter sets) of the first one.
+class ModulePacketReplay : public ModuleMedia
+{
+private:
+    vector<string> files;
+    size_t cur_file;
+    FILE* fp;
+    vector<uint8_t> extra_data;
+    shared_ptr<MediaBuffer> extra_buffer;
+
+    int openFile(size_t index);
+
+protected:
+    virtual ProduceResult doProduce(shared_ptr<MediaBuffer> output_buffer) override;
+    virtual bool setup() override;
+    virtual bool teardown() override;
+
+public:
+    ModulePacketReplay(const vector<string>& spool_files);
+    ~ModulePacketReplay();
+    int init() override;
+    const uint8_t* videoExtraData();
+    unsigned videoExtraDataSize();
+};
+
+#endif
@@ -0,0 +1,47 @@
+#ifndef __MODULE_RTSPINGEST_HPP__
+#define __MODULE_RTSPINGEST_HPP__
+
+#include "base/ff_rtsp_engine.hpp"
+#include "module/module_media.hpp"
+
+/*
+ * Rtsp source on a shared RtspEngine. Unlike ModuleRtspClient it has no receive
+ * thread of its own, the sockets of all ingest modules of an engine are served by
+ * the engine's reactor threads, which scales to many cameras per process.
+ * The output buffers point at the frame storage taken from the ring, the payload is
+ * copied once, from the packet slab into that storage.
+ * Damaged frames carry BUFFER_FLAG_* (see ff_buffer_flags.hpp) when the engine is set
+ * to pass them, otherwise the frame after a dropped run has BUFFER_FLAG_DISCONTINUITY.
+ */
+class ModuleRtspIngest : public ModuleMedia
+{
+private:
+    string url;
+    RTSP_STREAM_TYPE stream_type;
+    shared_ptr<FFMedia::RtspEngine> engine;
+    shared_ptr<FFMedia::RtspSession> session;
+    vector<FFMedia::FrameRing::Frame> frames;  // held by the output buffer of the same index
+    vector<uint8_t> extra_data;
+    shared_ptr<MediaBuffer> extra_buffer;
+    int time_msec;
+
+    int open();
+
+protected:
+    virtual ProduceResult doProduce(shared_ptr<MediaBuffer> output_buffer) override;
+    virtual bool teardown() override;
+
+public:
+    // engine defaults to RtspEngine::getDefault()
+    ModuleRtspIngest(string rtsp_url, RTSP_STREAM_TYPE _stream_type = RTSP_STREAM_TYPE_UDP,
+                     shared_ptr<FFMedia::RtspEngine> rtsp_engine = nullptr);
+    ~ModuleRtspIngest();
+    int init() override;
+    // How long init() waits for the stream
+    void setTimeOutMs(int ms) { time_msec = ms; }
+    const uint8_t* videoExtraData();
+    unsigned videoExtraDataSize();
+    shared_ptr<FFMedia::RtspSession> getSession() { return session; }
+};
+
+#endif
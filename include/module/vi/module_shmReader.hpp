@@ -0,0 +1,49 @@
+#ifndef __MODULE_SHMREADER_HPP__
+#define __MODULE_SHMREADER_HPP__
+
+#include "base/ff_shm_transport.hpp"
+#include "module/module_media.hpp"
+
+/*
+ * Frames of a ModuleShmWriter in another process as a source. The output para is the one of
+ * the writer's stream, raw frames come as VideoBuffer::EXTERNAL_BUFFER over the shared slot,
+ * fd included, so rga and mpp take them without a copy, compressed frames point into the slot.
+ * A slot stays pinned until the consumers released the buffer, keep buffer_count below the
+ * writer's slot count or the writer runs out of slots.
+ * Frames that went by while this reader was behind are lost (getDroppedFrames()), the next
+ * frame after such a gap carries BUFFER_FLAG_DISCONTINUITY. The reader stops with an eos when
+ * the writer writes one or goes away.
+ */
+class ModuleShmReader : public ModuleMedia
+{
+private:
+    string path;
+    FFMedia::ShmTransportReader reader;
+    vector<FFMedia::ShmFrame> slots;  // pinned by the output buffer of the same index
+    vector<bool> held;
+    std::mutex mtx;
+    int timeout_ms;
+    bool raw;
+    bool have_seq;  // the writer numbers the frames from 0
+    uint64_t last_seq;
+
+    void releaseSlot(size_t i);
+
+protected:
+    virtual ProduceResult doProduce(shared_ptr<MediaBuffer> output_buffer) override;
+    virtual void bufferReleaseCallBack(shared_ptr<MediaBuffer> buffer) override;
+    virtual bool teardown() override;
+
+public:
+    ModuleShmReader(string path);
+    ~ModuleShmReader();
+    // Connect and take the stream para, waiting up to the timeout for the writer.
+    int init() override;
+
+    void setTimeOutMs(int ms) { timeout_ms = ms; }
+    // Skip to the newest frame when behind, for consumers that only want the latest picture.
+    void setLatestOnly(bool enable) { reader.setLatestOnly(enable); }
+    uint64_t getDroppedFrames() const { return reader.getDroppedCount(); }
+};
+
+#endif
@@ -0,0 +1,87 @@
+#ifndef __MODULE_V4L2CAPTURE_HPP__
+#define __MODULE_V4L2CAPTURE_HPP__
+
+#include "module/module_media.hpp"
+
+/*
+ * V4L2 capture without copies, for the MIPI sensors behind rkisp/rkcif as well as uvc and the
+ * vivid test driver, both the single and the multi-planar api (with a one plane format, NV12
+ * rather than NV12M, so a frame is one buffer).
+ * The frames stay in the driver's buffers: mmap buffers exported with VIDIOC_EXPBUF
+ * (IO_MMAP_EXPORT), or dma-bufs from /dev/dma_heap/system queued as V4L2_MEMORY_DMABUF
+ * (IO_DMABUF_IMPORT). The consumers get them as VideoBuffer::EXTERNAL_BUFFER with the dma-buf
+ * fd, ready for rga and mpp, and the buffer goes back to the driver once they all released it.
+ * setQueueDepth() is the number of driver buffers, setBufferCount() the frames the pipe may
+ * hold; with a depth above the buffer count the driver always keeps buffers to fill.
+ * The pts is the driver's timestamp of the frame, the sequence number of the driver is kept
+ * with setBufferSequence(), and a gap in it, frames the driver dropped, is counted and flags
+ * the next frame with BUFFER_FLAG_DISCONTINUITY.
+ */
+class ModuleV4l2Capture : public ModuleMedia
+{
+public:
+    enum IoMode {
+        IO_MMAP_EXPORT,
+        IO_DMABUF_IMPORT,
+    };
+
+private:
+    struct CaptureBuffer {
+        int fd = -1;  // dma-buf, exported or imported
+        void* data = NULL;
+        size_t length = 0;
+        bool queued = false;
+    };
+
+    string dev;
+    int fd;
+    bool mplane;
+    IoMode io_mode;
+    uint32_t queue_depth;
+    uint32_t fps;
+    size_t frame_size;
+    size_t image_size;  // sizeimage of the driver, at least a frame
+    vector<CaptureBuffer> buffers;
+    vector<int> slots;  // capture buffer held by the output buffer of the same index
+    std::mutex mtx;
+    bool streaming;
+    int64_t last_sequence;
+    uint64_t captured;
+    uint64_t dropped;
+    uint64_t errors;
+
+    uint32_t bufType() const;
+    uint32_t memoryType() const;
+    int setFormat();
+    int allocBuffers();
+    void freeBuffers();
+    int queueBuffer(int index);
+    void releaseSlot(size_t i);
+
+protected:
+    virtual ProduceResult doProduce(shared_ptr<MediaBuffer> output_buffer) override;
+    virtual void bufferReleaseCallBack(shared_ptr<MediaBuffer> buffer) override;
+    virtual bool setup() override;
+    virtual bool teardown() override;
+
+public:
+    // para: the size and format to ask for, 0 keeps the one the device has
+    ModuleV4l2Capture(string dev, const ImagePara& para = ImagePara());
+    ~ModuleV4l2Capture();
+    int init() override;
+
+    // Before init().
+    void setQueueDepth(uint32_t depth) { queue_depth = depth; }
+    void setIoMode(IoMode mode) { io_mode = mode; }
+    void setFrameRate(uint32_t rate) { fps = rate; }
+
+    bool isMultiPlanar() const { return mplane; }
+    IoMode getIoMode() const { return io_mode; }
+    uint64_t getCapturedFrames();
+    // Frames the driver dropped, by the gaps in its sequence numbers.
+    uint64_t getDroppedFrames();
+    // Buffers the driver returned with V4L2_BUF_FLAG_ERROR, requeued without a frame.
+    uint64_t getErrorFrames();
+};
+
+#endif
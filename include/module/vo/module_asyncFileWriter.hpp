@@ -0,0 +1,149 @@
+#ifndef __MODULE_ASYNCFILEWRITER_HPP__
+#define __MODULE_ASYNCFILEWRITER_HPP__
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <thread>
+
+#include "base/ff_async_writer.hpp"
+#include "base/ff_fmp4_muxer.hpp"
+#include "module/module_media.hpp"
+
+/*
+ * Save encoded video without blocking the pipe.
+ * doConsume() only copies the packet into the AsyncWriter queue, the file io runs
+ * on the writer thread, so a slow disk does not stall the encoder.
+ * A .mp4/.m4s path is written as fragmented mp4: every fragment is committed to the
+ * file as soon as it is cut, so the recording is playable while it grows and nothing
+ * has to be rewritten at close. Other paths get the raw h264/h265 stream.
+ *
+ * Segments: with a segment duration or size the recording is split at key frames into
+ * <name>_00000.<suffix>, <name>_00001.<suffix>, ... A segment thread opens the next file
+ * ahead of time and closes the finished one, so a switch costs the encode thread a swap.
+ * When a segment is due, or the first key frame is awaited, a key frame is requested from
+ * the encoder above once (see ModuleIdrEnc), so the segments can be cut on time with long gops.
+ *
+ * Temporal layers: with setMaxTemporalLayer() only the frames up to that layer of a
+ * temporally scalable stream are written, e.g. a 7.5 fps archive of a 30 fps stream
+ * without a second encoder. A new limit takes effect at the next segment (or file) start,
+ * so every segment has one frame rate.
+ *
+ * Event recording: with setPreRecord() nothing is written until triggerEvent(). The last
+ * pre_record_ms of packets, starting at a key frame, are kept in memory and written
+ * to the event segment first, without re-encoding.
+ */
+class ModuleAsyncFileWriter : public ModuleMedia
+{
+public:
+    // Called once a segment is closed and complete on disk, from the segment thread
+    // for rotated segments and event ends, from the caller for the last one.
+    typedef std::function<void(const string& path)> SegmentCallback;
+
+private:
+    struct Packet {
+        vector<uint8_t> data;
+        int64_t pts_us;
+        bool key;
+    };
+
+    string filepath;
+    FFMedia::AsyncWriter::Config config;
+    shared_ptr<FFMedia::AsyncWriter> writer;
+    shared_ptr<FFMedia::Fmp4Muxer> muxer;
+    string writer_path;
+    bool fmp4;
+    media_codec_t codec;
+    int64_t fragment_duration_ms;
+    vector<uint8_t> extra_data;
+    bool video_extra_flag;
+
+    int64_t segment_duration_ms;
+    uint64_t segment_size;
+    uint32_t segment_index;
+    int64_t segment_start_pts;
+    bool key_requested;
+    std::atomic<int> max_layer;
+    int segment_max_layer;
+
+    int64_t pre_record_ms;
+    size_t pre_record_max_bytes;
+    deque<Packet> pre_roll;
+    deque<int64_t> pre_roll_keys;
+    size_t pre_roll_bytes;
+    vector<vector<uint8_t>> packet_pool;
+    bool recording;
+    int64_t event_end_pts;
+    mutex event_mtx;
+    int64_t event_request_ms;  // -1 none, 0 until stopEvent()
+    bool event_stop_request;
+
+    // segment thread
+    std::thread* segment_thread;
+    mutex segment_mtx;
+    condition_variable segment_cv;
+    bool segment_running;
+    deque<pair<shared_ptr<FFMedia::AsyncWriter>, string>> retired;
+    shared_ptr<FFMedia::AsyncWriter> spare;
+    string spare_path;
+    string spare_wanted;
+    string spare_opening;
+    SegmentCallback segment_cb;
+    mutex writer_mtx;
+
+    bool segmented() const { return segment_duration_ms > 0 || segment_size > 0 || pre_record_ms > 0; }
+    string segmentPath(uint32_t index) const;
+    int openSegment(int64_t pts_us);
+    void closeSegment(bool wait);
+    int writePacket(const uint8_t* data, size_t size, int64_t pts_us);
+    void pushPreRoll(const uint8_t* data, size_t size, int64_t pts_us, bool key);
+    int flushPreRoll();
+    void dropPreRoll();
+    void handleEventRequest(int64_t pts_us);
+    void startSegmentThread();
+    void stopSegmentThread();
+    void segmentLoop();
+
+protected:
+    virtual ConsumeResult doConsume(shared_ptr<MediaBuffer> input_buffer, shared_ptr<MediaBuffer> output_buffer) override;
+    virtual bool setup() override;
+    virtual bool teardown() override;
+
+public:
+    ModuleAsyncFileWriter(string path);
+    ModuleAsyncFileWriter(const ImagePara& para, string path);
+    ~ModuleAsyncFileWriter();
+    int init() override;
+
+    // Take effect on the next init()
+    void setWriterConfig(const FFMedia::AsyncWriter::Config& writer_config) { config = writer_config; }
+    FFMedia::AsyncWriter::Config getWriterConfig() const { return config; }
+    // fMP4 only, cut at the first key frame after duration_ms, 0 cuts at every key frame.
+    // Take effect on the next init()
+    void setFragmentDuration(int64_t duration_ms) { fragment_duration_ms = duration_ms; }
+    // For sources that do not attach the parameter sets to their buffers
+    void setVideoExtraData(const uint8_t* extra_data, unsigned extra_size);
+
+    // Start a new segment at the first key frame after duration_ms of packet time
+    // or once the segment reaches size bytes, 0 disables. Take effect on the next init()
+    void setSegmentDuration(int64_t duration_ms) { segment_duration_ms = duration_ms; }
+    void setSegmentSize(uint64_t size) { segment_size = size; }
+    void setSegmentCallback(SegmentCallback callback) { segment_cb = callback; }
+    // Write only the temporal layers up to layer, -1 for all, from the next segment on
+    void setMaxTemporalLayer(int layer) { max_layer = layer; }
+
+    // Keep pre_record_ms of packets in memory, capped at max_bytes, and only write on events.
+    // Take effect on the next init()
+    void setPreRecord(int64_t pre_record_ms, size_t max_bytes = 64 << 20);
+    // Write the pre-roll and keep recording for duration_ms after the next packet, 0 until stopEvent().
+    // A trigger during an event extends it.
+    void triggerEvent(int64_t duration_ms);
+    void stopEvent();
+    bool isRecording() const { return recording; }
+
+    FFMedia::AsyncWriter::Stats getWriterStats();
+    void dumpWriterStats();
+};
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef __MODULE_CMAFSEGMENTER_HPP__
+#define __MODULE_CMAFSEGMENTER_HPP__
+
+#include "base/ff_cmaf_segmenter.hpp"
+#include "base/ff_cmaf_server.hpp"
+#include "module/module_media.hpp"
+
+/*
+ * LL-HLS and DASH output of an encoded h264/h265 stream, packaged as CMAF by a
+ * FFMedia::CmafSegmenter: index.m3u8, manifest.mpd, init.mp4 and seg<n>.m4s.
+ * The segments go to a directory (CmafSegmenter::Config::dir) for a static web server
+ * or a CDN origin, and/or are served by a FFMedia::CmafHttpServer on the port under
+ * http://<ip>:<port><path>/. Modules on the same port share one server unless a server
+ * is given, port 0 disables http.
+ * doConsume() muxes the frame once, viewers only read the finished parts on the server
+ * thread, so their number does not change the work of the encode thread.
+ * Segments are cut at key frames, when one is due a key frame is requested from the
+ * encoder above (see ModuleIdrEnc) so the segment durations hold with long gops.
+ */
+class ModuleCmafSegmenter : public ModuleMedia
+{
+private:
+    string stream_path;
+    int http_port;
+    FFMedia::CmafSegmenter::Config config;
+    shared_ptr<FFMedia::CmafSegmenter> segmenter;
+    shared_ptr<FFMedia::CmafHttpServer> server;
+    bool added;
+    bool extra_set;
+    media_codec_t codec;
+    int64_t last_key_pts;
+    bool key_requested;
+
+    void closeStream();
+
+protected:
+    virtual ConsumeResult doConsume(shared_ptr<MediaBuffer> input_buffer, shared_ptr<MediaBuffer> output_buffer) override;
+    virtual bool teardown() override;
+
+public:
+    ModuleCmafSegmenter(const char* path, int port, shared_ptr<FFMedia::CmafHttpServer> http_server = nullptr);
+    ModuleCmafSegmenter(const ImagePara& para, const char* path, int port,
+                        shared_ptr<FFMedia::CmafHttpServer> http_server = nullptr);
+    ~ModuleCmafSegmenter();
+    int init() override;
+
+    // Take effect on the next init()
+    void setSegmenterConfig(const FFMedia::CmafSegmenter::Config& segmenter_config) { config = segmenter_config; }
+    FFMedia::CmafSegmenter::Config getSegmenterConfig() const { return config; }
+    shared_ptr<FFMedia::CmafSegmenter> getSegmenter() { return segmenter; }
+    shared_ptr<FFMedia::CmafHttpServer> getServer() { return server; }
+};
+
+#endif
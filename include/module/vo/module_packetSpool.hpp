@@ -0,0 +1,53 @@
+#ifndef __MODULE_PACKETSPOOL_HPP__
+#define __MODULE_PACKETSPOOL_HPP__
+
+#include "module/module_media.hpp"
+
+/*
+ * Spool file layout, host endian, only meant to be read back on the same machine:
+ *   PacketSpoolHeader, extra data (extra_size bytes),
+ *   then per packet a PacketSpoolRecord followed by size bytes of data.
+ */
+struct PacketSpoolHeader {
+    char magic[4];
+    uint32_t v4l2Fmt;
+    uint32_t width;
+    uint32_t height;
+    uint32_t extra_size;
+    uint32_t max_packet_size;
+    uint64_t packet_count;
+};
+
+struct PacketSpoolRecord {
+    int64_t pts;
+    int64_t dts;
+    uint32_t size;
+    uint32_t reserved;
+};
+
+#define PACKET_SPOOL_MAGIC "FFPS"
+
+// Store the encoded packets of a stream with their timestamps in a spool file.
+class ModulePacketSpool : public ModuleMedia
+{
+private:
+    string filepath;
+    FILE* fp;
+    PacketSpoolHeader header;
+    bool header_written;
+
+    int writeHeader(shared_ptr<MediaBuffer> buffer);
+    void close();
+
+protected:
+    virtual ConsumeResult doConsume(shared_ptr<MediaBuffer> input_buffer, shared_ptr<MediaBuffer> output_buffer) override;
+    virtual bool teardown() override;
+
+public:
+    ModulePacketSpool(string path);
+    ~ModulePacketSpool();
+    int init() override;
+    uint64_t getPacketCount() const { return header.packet_count; }
+};
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef __MODULE_RTMPPUBLISHER_HPP__
+#define __MODULE_RTMPPUBLISHER_HPP__
+
+#include "base/ff_rtmp_publisher.hpp"
+#include "module/module_media.hpp"
+
+/*
+ * Publishes an encoded h264/h265 stream to a rtmp server (h265 as enhanced rtmp) with
+ * a FFMedia::RtmpPublisher, which follows the capacity of the link.
+ * The target bitrate of the publisher goes up the pipe with FFMedia::requestBitrate()
+ * and its key frame needs (a new session, frames dropped on congestion) with
+ * FFMedia::requestKeyFrame(), so the encoder above should be a ModuleIdrEnc.
+ * doConsume() only packs and queues the frame, the socket is written by the publisher
+ * thread and a slow link never blocks the encoder.
+ * The temporal layer of each buffer goes along, so a congested link sheds the upper
+ * layers of a temporally scalable stream.
+ */
+class ModuleRtmpPublisher : public ModuleMedia
+{
+private:
+    FFMedia::RtmpPublisher::Config config;
+    shared_ptr<FFMedia::RtmpPublisher> publisher;
+    media_codec_t codec;
+    bool extra_set;
+
+protected:
+    virtual ConsumeResult doConsume(shared_ptr<MediaBuffer> input_buffer, shared_ptr<MediaBuffer> output_buffer) override;
+
+public:
+    ModuleRtmpPublisher(const char* url);
+    ModuleRtmpPublisher(const ImagePara& para, const char* url);
+    ~ModuleRtmpPublisher();
+    int init() override;
+
+    // Take effect on the next init()
+    void setPublisherConfig(const FFMedia::RtmpPublisher::Config& publisher_config) { config = publisher_config; }
+    FFMedia::RtmpPublisher::Config getPublisherConfig() const { return config; }
+    shared_ptr<FFMedia::RtmpPublisher> getPublisher() { return publisher; }
+};
+
+#endif
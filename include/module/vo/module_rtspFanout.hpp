@@ -0,0 +1,50 @@
+#ifndef __MODULE_RTSPFANOUT_HPP__
+#define __MODULE_RTSPFANOUT_HPP__
+
+#include "base/ff_rtsp_server.hpp"
+#include "module/module_media.hpp"
+
+/*
+ * Rtsp output on a FFMedia::RtspServer, a drop-in for ModuleRtspServer when a stream
+ * has many viewers. The packets of a frame are built once and sent to all viewers of
+ * the path, and the modules of different paths only share the server's control thread,
+ * not a lock, so every stream can push from its own encoder thread.
+ * Modules on the same port share one server unless a server is given.
+ * With setMulticast() viewers may also ask for multicast, the stream then goes to the
+ * group once for all of them.
+ * New viewers start from the frames since the last key frame, see RtspServer::Config::gop_cache,
+ * the extra data of the encoder is put in front of key frames that come without parameter sets.
+ * Viewers without a cache to start from and rtcp PLI/FIR request a key frame from the
+ * encoder above, see ModuleIdrEnc.
+ * The temporal layer of each buffer goes to the server, a slow TCP viewer of a temporally
+ * scalable stream loses the upper layers before it has to skip to a key frame.
+ */
+class ModuleRtspFanout : public ModuleMedia
+{
+private:
+    string push_path;
+    int push_port;
+    shared_ptr<FFMedia::RtspServer> server;
+    bool mounted;
+    bool extra_sent;
+    string multicast_group;
+    uint16_t multicast_port;
+    int multicast_ttl;
+
+protected:
+    virtual ConsumeResult doConsume(shared_ptr<MediaBuffer> input_buffer, shared_ptr<MediaBuffer> output_buffer) override;
+
+public:
+    ModuleRtspFanout(const char* path, int port, shared_ptr<FFMedia::RtspServer> rtsp_server = nullptr);
+    ModuleRtspFanout(const ImagePara& para, const char* path, int port, shared_ptr<FFMedia::RtspServer> rtsp_server = nullptr);
+    ~ModuleRtspFanout();
+    int init() override;
+    // Take effect on the next init()
+    void setMulticast(const string& group, uint16_t port, int ttl = 16);
+    // Send only the temporal layers up to layer to all viewers, -1 for all. After init()
+    void setMaxTemporalLayer(int layer);
+    shared_ptr<FFMedia::RtspServer> getServer() { return server; }
+    uint32_t getViewerCount();
+};
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef __MODULE_SHMWRITER_HPP__
+#define __MODULE_SHMWRITER_HPP__
+
+#include "base/ff_shm_transport.hpp"
+#include "module/module_media.hpp"
+
+/*
+ * Share the frames of a pipe with other processes, each reading them with ModuleShmReader,
+ * e.g. one ModuleRtspClient -> ModuleMppDec -> ModuleShmWriter in the capture process and a
+ * ModuleShmReader -> ModuleRga -> ... in every analytics process, instead of an rtsp session
+ * and a decoder per process. Raw frames and h264/h265/mjpeg streams both work.
+ * Every frame is copied once into a shared slot (see ShmTransportWriter), the readers use it
+ * in place. The pipe never waits for the readers: a reader that lags loses frames, and when
+ * the readers pin every slot the frame is dropped here (getDroppedFrames()).
+ * Compressed streams should carry their parameter sets in the key frames (see
+ * ModulePassthrough), a reader joins at any frame and waits for the next key frame.
+ */
+class ModuleShmWriter : public ModuleMedia
+{
+private:
+    string path;
+    FFMedia::ShmTransportWriter::Config config;
+    FFMedia::ShmTransportWriter writer;
+    media_codec_t codec;
+    bool raw;
+    size_t frame_size;
+
+protected:
+    virtual ConsumeResult doConsume(shared_ptr<MediaBuffer> input_buffer, shared_ptr<MediaBuffer> output_buffer) override;
+    virtual bool teardown() override;
+
+public:
+    // path of the unix socket, or '@name' for the abstract namespace
+    ModuleShmWriter(string path, uint32_t slot_count = 8);
+    ~ModuleShmWriter();
+    int init() override;
+
+    // Largest frame of a compressed stream, default a quarter of a nv12 frame. Before init().
+    void setSlotSize(size_t size) { config.slot_size = size; }
+    // Slots from /dev/dma_heap/system, so the readers can hand them to rga or mpp, default on.
+    void setDmaHeap(bool enable) { config.dma_heap = enable; }
+
+    int getReaderCount() { return writer.getReaderCount(); }
+    uint64_t getWrittenFrames() const { return writer.getWrittenCount(); }
+    uint64_t getDroppedFrames() const { return writer.getDroppedCount(); }
+};
+
+#endif
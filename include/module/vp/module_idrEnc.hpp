@@ -0,0 +1,140 @@
+#ifndef __MODULE_IDRENC_HPP__
+#define __MODULE_IDRENC_HPP__
+
+#include <atomic>
+#include <functional>
+
+#include "module/module_control.hpp"
+#include "module/vp/module_mppenc.hpp"
+
+/*
+ * ModuleMppEnc that starts a gop on demand, so the fixed gop can be long.
+ * Sinks below it ask with FFMedia::requestKeyFrame(), for a new viewer, a rtcp pli/fir
+ * or a file segment. Requests are rate limited: one key frame per min_interval_ms at
+ * most, requests within the interval are merged and served when it ends, and a key
+ * frame the encoder makes by itself serves the pending ones.
+ * The encoder has no key frame request of its own, a forced key frame restarts it with
+ * changeEncodeParameter() and the current parameters before the next frame.
+ * A congestion controlled sink (see ModuleRtmpPublisher) sets the bitrate the same way
+ * with FFMedia::requestBitrate(). As each change restarts the encoder and so costs a key
+ * frame, which a congested link can afford least, increases and decreases alike are
+ * coalesced with the runtime changes below, the latest wins.
+ *
+ * Runtime control: setBitrate(), setFps(), setGop(), setQpRange() and requestIdr() may
+ * be called from any thread, they only store the value and mark it (no lock, the encode
+ * thread never waits). The encode thread takes all marked values at once at a frame
+ * boundary, the latest of each wins, and applies them with changeEncodeParameter() in the
+ * same codec type: the module and the pipe stay as they are, no buffer is flushed, but the
+ * encoder itself restarts and the next frame is a key frame. The closed encoder has no
+ * other way to change a parameter, so the changes are coalesced: they wait for a key frame
+ * that is forced anyway (requestIdr() or a sink's request), or for min_restart_interval_ms
+ * (default 2 s) since the last restart, and every change of that window costs one key
+ * frame together.
+ * Each call returns a change id; the ChangeCallback reports the highest id that took
+ * effect with the pts of the first output frame encoded with it, a change the encoder
+ * refused is never reported.
+ * The encoder takes no qp range, setQpRange() selects the nearest EncodeQuality by max_qp.
+ * Each output buffer gets the temporal layer of its slices (setBufferTemporalLayer()), the
+ * sinks drop the upper layers of a temporally scalable stream for slow viewers. The mpp
+ * encoder makes a single layer stream, all its frames are on layer 0.
+ */
+class ModuleIdrEnc : public ModuleMppEnc, public FFMedia::ControlHandler
+{
+public:
+    enum ChangeField {
+        CHANGE_BITRATE = 1 << 0,
+        CHANGE_FPS = 1 << 1,
+        CHANGE_GOP = 1 << 2,
+        CHANGE_QP_RANGE = 1 << 3,
+        CHANGE_IDR = 1 << 4,
+    };
+
+    struct ChangeReport {
+        uint32_t id;      // the highest change id in effect
+        uint32_t fields;  // ChangeField of the changes applied together
+        int bps;
+        int fps;
+        int gop;
+        EncodeQuality quality;
+        int64_t pts;         // of the first frame encoded with the change
+        int64_t latency_us;  // from the oldest call to that frame
+    };
+    using ChangeCallback = std::function<void(const ChangeReport& report)>;
+
+private:
+    EncodeType encode_type;
+    int fps;
+    int gop;
+    int bps;
+    EncodeRcMode mode;
+    EncodeQuality quality;
+    EncodeProfile profile;
+    int min_interval_ms;
+    std::atomic<bool> pending;
+    std::atomic<int> pending_reason;
+    std::atomic<int64_t> last_key_us;
+    std::atomic<uint64_t> requests;
+    std::atomic<uint64_t> forced;
+    std::atomic<int> pending_kbps;
+    std::atomic<uint64_t> bitrate_changes;
+
+    // runtime control, written by any thread
+    std::atomic<uint64_t> change_state;  // the last change id << 32 | ChangeField not applied yet
+    std::atomic<int64_t> change_first_us;
+    std::atomic<int> next_bps;
+    std::atomic<int> next_fps;
+    std::atomic<int> next_gop;
+    std::atomic<int> next_quality;
+    std::atomic<uint32_t> applied_id;
+    ChangeCallback change_cb;
+    int min_restart_interval_ms;
+    int64_t last_restart_us;
+    // encode thread, waiting for the first frame after the change
+    ChangeReport report;
+    bool report_pending;
+
+    uint32_t queueChange(ChangeField field);
+    void applyChanges(int64_t now);
+    void checkOutput(const shared_ptr<MediaBuffer>& buffer);
+
+protected:
+    virtual ConsumeResult doConsume(shared_ptr<MediaBuffer> input_buffer, shared_ptr<MediaBuffer> output_buffer) override;
+    virtual ProduceResult doProduce(shared_ptr<MediaBuffer> buffer) override;
+
+public:
+    ModuleIdrEnc(EncodeType type, int fps = 30, int gop = 60, int bps = 2048, EncodeRcMode mode = ENCODE_RC_MODE_CBR,
+                 EncodeQuality quality = ENCODE_QUALITY_BEST, EncodeProfile profile = ENCODE_PROFILE_HIGH);
+    ModuleIdrEnc(EncodeType type, const ImagePara& input_para, int fps = 30, int gop = 60, int bps = 2048,
+                 EncodeRcMode mode = ENCODE_RC_MODE_CBR, EncodeQuality quality = ENCODE_QUALITY_BEST,
+                 EncodeProfile profile = ENCODE_PROFILE_HIGH);
+    ~ModuleIdrEnc();
+
+    // Hides ModuleMppEnc::changeEncodeParameter(), a forced key frame keeps these parameters.
+    // Not thread safe, for the encode type or before the pipe runs, use the setters below.
+    int changeEncodeParameter(EncodeType type, int fps = 30, int gop = 60, int bps = 2048,
+                              EncodeRcMode mode = ENCODE_RC_MODE_CBR, EncodeQuality quality = ENCODE_QUALITY_BEST,
+                              EncodeProfile profile = ENCODE_PROFILE_HIGH);
+    void setMinKeyFrameInterval(int interval_ms) { min_interval_ms = interval_ms; }
+    // Parameter changes, of the sinks and of the setters below, are applied once per interval
+    // at most.
+    void setMinRestartInterval(int interval_ms) { min_restart_interval_ms = interval_ms; }
+    bool onControlEvent(const FFMedia::ControlEvent& event) override;
+
+    // Thread safe, applied at a frame boundary, see above. Return the change id, 0 when invalid.
+    uint32_t setBitrate(int kbps);
+    uint32_t setFps(int frame_rate);
+    uint32_t setGop(int frames);
+    uint32_t setQpRange(int min_qp, int max_qp);
+    // Not rate limited like the key frame requests of the sinks.
+    uint32_t requestIdr();
+    // Called on the encode thread, keep it short.
+    void setChangeCallback(ChangeCallback callback) { change_cb = callback; }
+    uint32_t getAppliedChange() const { return applied_id; }
+
+    uint64_t getKeyFrameRequests() const { return requests; }
+    uint64_t getForcedKeyFrames() const { return forced; }
+    int getBitrate() const { return bps; }
+    uint64_t getBitrateChanges() const { return bitrate_changes; }
+};
+
+#endif
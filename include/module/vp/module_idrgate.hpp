@@ -0,0 +1,44 @@
+#ifndef __MODULE_IDRGATE_HPP__
+#define __MODULE_IDRGATE_HPP__
+
+#include "module/module_media.hpp"
+
+/*
+ * Pass compressed video through until the frame of end_pts, or else until idr_limit
+ * key frames went by, then send one eos buffer and hold the rest. Placed after a
+ * ModuleFileReader that was seeked with setFileReaderSeekIdrIndex(), it cuts the file
+ * into one chunk. The key frames of the reader's index are the sync samples of the
+ * container, which need not be the ones the bitstream calls key frames (an hevc CRA),
+ * so the end is best given as the pts of the first frame of the next chunk.
+ * Once closed every further packet is held for a while before it is dropped, the reader
+ * runs ahead by its buffer count only and reads little more until the pipe is stopped.
+ * Audio buffers are dropped.
+ */
+class ModuleIdrGate : public ModuleMedia
+{
+private:
+    size_t idr_limit;
+    size_t idr_seen;
+    int64_t end_pts;
+    std::atomic<int64_t> first_pts;
+    std::atomic<bool> closed;
+    media_codec_t codec;
+
+protected:
+    virtual ConsumeResult doConsume(shared_ptr<MediaBuffer> input_buffer, shared_ptr<MediaBuffer> output_buffer) override;
+    void reset() override;
+
+public:
+    // idr_limit 0 passes everything until the source eos
+    ModuleIdrGate(size_t idr_limit = 0);
+    // Close at the frame of this pts rather than by idr_limit. Before init().
+    void setEndPts(int64_t pts) { end_pts = pts; }
+    bool isClosed() const { return closed; }
+    // pts of the first video frame that went by, INT64_MIN before
+    int64_t getFirstPts() const { return first_pts; }
+    ~ModuleIdrGate();
+    int init() override;
+    size_t getIdrSeen() const { return idr_seen; }
+};
+
+#endif
@@ -0,0 +1,39 @@
+#ifndef __MODULE_NEWESTFRAME_HPP__
+#define __MODULE_NEWESTFRAME_HPP__
+
+#include "module/module_media.hpp"
+
+/*
+ * Keep a live display on the newest frame. Placed in front of the sink, it bypasses
+ * a frame when it is on time and drops it when it is stale, so a backlog that built
+ * up while the sink was slow is skipped instead of being shown late.
+ * A frame is stale when its pts lags the wall clock by more than max_lag_ms compared
+ * to the best frame of the last two seconds, which works for stream pts as well as
+ * for the capture stamps of the latency probe. One frame is always let through after
+ * max_hold_ms without output, so a slow sink still shows a picture.
+ */
+class ModuleNewestFrame : public ModuleMedia
+{
+private:
+    int64_t max_lag_us;
+    int64_t max_hold_us;
+    int64_t window_start_us;
+    int64_t window_min;
+    int64_t last_window_min;
+    int64_t last_pass_us;
+    uint64_t passed;
+    uint64_t dropped;
+
+protected:
+    virtual ConsumeResult doConsume(shared_ptr<MediaBuffer> input_buffer, shared_ptr<MediaBuffer> output_buffer) override;
+    void reset() override;
+
+public:
+    ModuleNewestFrame(int max_lag_ms = 50, int max_hold_ms = 200);
+    ~ModuleNewestFrame();
+    int init() override;
+    uint64_t getPassedFrames() const { return passed; }
+    uint64_t getDroppedFrames() const { return dropped; }
+};
+
+#endif
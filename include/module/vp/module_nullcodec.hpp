@@ -0,0 +1,57 @@
+#ifndef __MODULE_NULLCODEC_HPP__
+#define __MODULE_NULLCODEC_HPP__
+
+#include <atomic>
+
+#include "module/module_media.hpp"
+
+/*
+ * Codec stand-ins without the vpu. They keep the buffer flow, frame count and
+ * timestamps of ModuleMppDec/ModuleMppEnc but do not touch the pixels, so pipes
+ * and benchmarks can be run on machines without mpp.
+ */
+
+// Output one NV12 frame of the stream size per compressed input buffer.
+class ModuleNullDec : public ModuleMedia
+{
+protected:
+    virtual ConsumeResult doConsume(shared_ptr<MediaBuffer> input_buffer, shared_ptr<MediaBuffer> output_buffer) override;
+    virtual int initBuffer() override;
+
+public:
+    ModuleNullDec();
+    ModuleNullDec(const ImagePara& input_para);
+    ~ModuleNullDec();
+    int init() override;
+};
+
+// Output one access unit delimiter per raw input frame, in the given encode type.
+// With a gop set each frame also gets an empty slice nal, an idr every gop frames or
+// after requestKeyFrame(), so the key frame logic downstream can be tested.
+// With temporal layers the p frames follow a hierarchical-p pattern, the layer is in the
+// slice (h265 temporal id, h264 svc prefix nal) and in the buffer, see setBufferTemporalLayer().
+class ModuleNullEnc : public ModuleMedia
+{
+private:
+    EncodeType encode_type;
+    int gop;
+    int temporal_layers;
+    int frame_count;
+    std::atomic<bool> key_frame;
+
+protected:
+    virtual ConsumeResult doConsume(shared_ptr<MediaBuffer> input_buffer, shared_ptr<MediaBuffer> output_buffer) override;
+
+public:
+    ModuleNullEnc(EncodeType type);
+    ModuleNullEnc(EncodeType type, const ImagePara& input_para);
+    ~ModuleNullEnc();
+    int init() override;
+    void setGop(int frames) { gop = frames; }
+    // 1 to 3, needs a gop
+    void setTemporalLayers(int layers) { temporal_layers = std::max(1, std::min(3, layers)); }
+    // The next frame is an idr, needs a gop
+    void requestKeyFrame() { key_frame = true; }
+};
+
+#endif
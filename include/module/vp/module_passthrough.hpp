@@ -0,0 +1,83 @@
+#ifndef __MODULE_PASSTHROUGH_HPP__
+#define __MODULE_PASSTHROUGH_HPP__
+
+#include "module/module_media.hpp"
+
+/*
+ * Record or restream a compressed source without decoding it, e.g. ModuleRtspClient ->
+ * ModulePassthrough -> ModuleFileWriter/ModuleRtspServer. The access units go out as
+ * annex-b with 4 byte start codes or as 4 byte length prefixed samples, whatever the
+ * source delivered (length prefixed input of a mp4 reader is converted on the way).
+ * Parameter sets come from setExtraData(), from videoExtraData() of a source module that
+ * has it, as avcC/hvcC or annex-b, from the extra data of the buffers, and from the key
+ * frames themselves; the newest ones go in front of key frames that do not carry them, so
+ * a file or a viewer can start at any key frame, and out as the extra data of the copied
+ * buffers (annex-b, or the avcC/hvcC record for length prefixed output).
+ * With rebasing the time stamps start at base_us, and a jump of more than max_gap_ms, a
+ * reconnected camera or a looped file, continues one frame interval after the last one.
+ * Frames before the first key frame are dropped. A frame nothing has to be changed in is
+ * bypassed, the others are copied once. Audio buffers are dropped, MJPEG only gets its
+ * time stamps rebased.
+ */
+class ModulePassthrough : public ModuleMedia
+{
+public:
+    enum OutputFormat {
+        OUTPUT_ANNEXB,           // for the rtsp/rtmp servers and raw files
+        OUTPUT_LENGTH_PREFIXED,  // for mp4/flv muxers
+    };
+
+private:
+    OutputFormat format;
+    media_codec_t codec;
+    bool inject;
+    bool wait_key;
+    bool rebase;
+    int64_t base_us;
+    int64_t max_gap_us;
+    int length_size;               // of length prefixed input, from the avcC/hvcC record
+    vector<uint8_t> sets;          // annex-b
+    shared_ptr<MediaBuffer> extra_buffer;
+    vector<vector<uint8_t>> frames;  // held by the output buffer of the same index
+    vector<uint8_t> annexb;        // length prefixed input converted
+    vector<uint8_t> found;
+    bool started;
+    bool rebased;
+    int64_t offset_us;
+    int64_t last_in_us;
+    int64_t last_out_us;
+    int64_t interval_us;
+    uint64_t bypassed;
+    uint64_t copied;
+    uint64_t injected;
+    uint64_t dropped;
+    uint64_t discontinuities;
+
+    void updateParameterSets(const uint8_t* data, size_t size);
+    int64_t rebaseTimestamp(int64_t pts);
+
+protected:
+    virtual ConsumeResult doConsume(shared_ptr<MediaBuffer> input_buffer, shared_ptr<MediaBuffer> output_buffer) override;
+    void reset() override;
+
+public:
+    ModulePassthrough(OutputFormat format = OUTPUT_ANNEXB);
+    ~ModulePassthrough();
+    int init() override;
+
+    // avcC/hvcC record or annex-b parameter sets, e.g. videoExtraData() of the source. Before init().
+    void setExtraData(const uint8_t* extra_data, unsigned extra_size);
+    // Put the parameter sets in front of key frames without them, default on.
+    void setInjectParameterSets(bool enable) { inject = enable; }
+    // Drop the frames before the first key frame, default on.
+    void setWaitKeyFrame(bool enable) { wait_key = enable; }
+    void setTimestampRebase(bool enable, int64_t base_us = 0, int max_gap_ms = 1000);
+
+    uint64_t getBypassedFrames() const { return bypassed; }
+    uint64_t getCopiedFrames() const { return copied; }
+    uint64_t getInjectedFrames() const { return injected; }
+    uint64_t getDroppedFrames() const { return dropped; }
+    uint64_t getDiscontinuities() const { return discontinuities; }
+};
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef __MODULE_ROIFILTER_HPP__
+#define __MODULE_ROIFILTER_HPP__
+
+#include <mutex>
+
+#include "base/ff_roi.hpp"
+#include "module/module_media.hpp"
+
+/*
+ * Spends the bits of the encoder below on the regions of interest.
+ * The regions come from setRegions(), for example the detections of ModuleInference or
+ * motion boxes, or as a FFMedia::QpMap attached to the input frame, which wins. Blocks
+ * outside the regions take background_delta.
+ * ModuleMppEnc takes no qp map, so the map is applied in the pixel domain: NV12 frames
+ * are copied with the positive delta blocks low passed (FFMedia::filterNv12Roi), the
+ * background noise and texture the rate control would spend bits on are gone while the
+ * regions are untouched. The map is attached to the output frame as well, for an encoder
+ * that takes it.
+ * Regions not refreshed for hold_ms are dropped, the whole picture is then background.
+ * Before the first regions the frames are copied unfiltered.
+ */
+class ModuleRoiFilter : public ModuleMedia
+{
+private:
+    std::mutex mtx;
+    vector<FFMedia::RoiRegion> regions;
+    int64_t regions_us;
+    bool regions_set;
+    int background_delta;
+    int margin;
+    int hold_ms;
+    shared_ptr<const FFMedia::QpMap> map;
+    uint64_t filtered;
+    bool buffers_ready;
+
+protected:
+    virtual ConsumeResult doConsume(shared_ptr<MediaBuffer> input_buffer, shared_ptr<MediaBuffer> output_buffer) override;
+    virtual int initBuffer() override;
+
+public:
+    ModuleRoiFilter(int background_delta = 6);
+    ModuleRoiFilter(const ImagePara& input_para, int background_delta = 6);
+    ~ModuleRoiFilter();
+    int init() override;
+
+    // Regions in pixels of the input frame, safe to call from any thread.
+    void setRegions(const vector<FFMedia::RoiRegion>& roi_regions);
+    void setBackgroundDelta(int delta);
+    // Grow the regions by margin pixels, for the motion between two detections.
+    void setMargin(int pixels);
+    void setHoldTime(int ms) { hold_ms = ms; }
+    uint64_t getFilteredFrames() const { return filtered; }
+};
+
+#endif
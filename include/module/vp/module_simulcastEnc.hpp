@@ -0,0 +1,103 @@
+#ifndef __MODULE_SIMULCASTENC_HPP__
+#define __MODULE_SIMULCASTENC_HPP__
+
+#include <atomic>
+
+#include "module/module_control.hpp"
+#include "module/module_media.hpp"
+
+struct SimulcastRendition {
+    uint32_t width;
+    uint32_t height;
+    int bps;  // kbps
+};
+
+class SimulcastStage;
+
+/*
+ * Encode one decoded stream into several renditions, e.g. the main and the sub stream
+ * of a camera, in one module instead of a rga and an encoder module per rendition.
+ * For each input frame the scalers and the encoders of all renditions run one after the
+ * other on the thread of this module; they are ModuleRga/ModuleIdrEnc instances that are
+ * initialised but never started, or ModuleSwScale/ModuleNullEnc with software set, which
+ * needs neither rga nor mpp.
+ * The packets of a frame go out together in one output buffer, a ModuleSimulcastOutput
+ * per rendition below it takes its own packet out as a normal compressed stream. The
+ * output buffer itself carries the packet of the first rendition.
+ * Key frames are aligned: all encoders start together with the same gop, a key frame
+ * request from below any output forces an idr in every rendition on the same frame, and
+ * when a rendition made a key frame alone the others are forced on the next frame.
+ * Requests are rate limited like in ModuleIdrEnc.
+ */
+class ModuleSimulcastEnc : public ModuleMedia, public FFMedia::ControlHandler
+{
+private:
+    struct Frame {
+        vector<vector<uint8_t>> packets;
+        vector<shared_ptr<MediaBuffer>> extra_data;
+        vector<bool> key_frames;
+    };
+
+    EncodeType encode_type;
+    vector<SimulcastRendition> renditions;
+    int fps;
+    int gop;
+    bool software;
+    vector<shared_ptr<SimulcastStage>> scalers;
+    vector<shared_ptr<SimulcastStage>> encoders;
+    vector<Frame> frames;  // held by the output buffer of the same index
+    uint64_t frame_count;
+    int min_interval_ms;
+    std::atomic<bool> pending;
+    int64_t last_key_us;
+    bool realign;
+    std::atomic<uint64_t> requests;
+    std::atomic<uint64_t> aligned_key_frames;
+    std::atomic<uint64_t> misaligned_key_frames;
+
+protected:
+    virtual ConsumeResult doConsume(shared_ptr<MediaBuffer> input_buffer, shared_ptr<MediaBuffer> output_buffer) override;
+    void reset() override;
+
+public:
+    ModuleSimulcastEnc(EncodeType type, const vector<SimulcastRendition>& renditions, int fps = 30, int gop = 60,
+                       bool software = false);
+    ModuleSimulcastEnc(EncodeType type, const ImagePara& input_para, const vector<SimulcastRendition>& renditions,
+                       int fps = 30, int gop = 60, bool software = false);
+    ~ModuleSimulcastEnc();
+    int init() override;
+    bool onControlEvent(const FFMedia::ControlEvent& event) override;
+    void setMinKeyFrameInterval(int interval_ms) { min_interval_ms = interval_ms; }
+
+    int getRenditionCount() const { return renditions.size(); }
+    // The compressed output of a rendition, valid after init()
+    ImagePara getRenditionPara(int rendition) const;
+    // Packet of a rendition in an output buffer of this module, for ModuleSimulcastOutput
+    const vector<uint8_t>& getPacket(const shared_ptr<MediaBuffer>& buffer, int rendition) const;
+    shared_ptr<MediaBuffer> getPacketExtraData(const shared_ptr<MediaBuffer>& buffer, int rendition) const;
+
+    uint64_t getKeyFrameRequests() const { return requests; }
+    // frames where every rendition was a key frame, and where only some were
+    uint64_t getAlignedKeyFrames() const { return aligned_key_frames; }
+    uint64_t getMisalignedKeyFrames() const { return misaligned_key_frames; }
+};
+
+// One rendition of the ModuleSimulcastEnc above it, a compressed video stream like the
+// output of ModuleMppEnc. Key frame requests from below go on to the simulcast module.
+class ModuleSimulcastOutput : public ModuleMedia
+{
+private:
+    int rendition;
+    vector<vector<uint8_t>> packets;  // held by the output buffer of the same index
+
+protected:
+    virtual ConsumeResult doConsume(shared_ptr<MediaBuffer> input_buffer, shared_ptr<MediaBuffer> output_buffer) override;
+
+public:
+    ModuleSimulcastOutput(int rendition);
+    ~ModuleSimulcastOutput();
+    int init() override;
+    int getRendition() const { return rendition; }
+};
+
+#endif
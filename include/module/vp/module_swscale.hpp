@@ -0,0 +1,31 @@
+#ifndef __MODULE_SWSCALE_HPP__
+#define __MODULE_SWSCALE_HPP__
+
+#include "module/module_media.hpp"
+
+/*
+ * Software stand-in of ModuleRga for NV12 scaling and cropping.
+ * It needs neither the rga device nor drm, so a pipe built with it runs on any linux machine.
+ */
+class ModuleSwScale : public ModuleMedia
+{
+private:
+    vector<uint32_t> x_map;
+    vector<uint32_t> y_map;
+
+protected:
+    virtual ConsumeResult doConsume(shared_ptr<MediaBuffer> input_buffer, shared_ptr<MediaBuffer> output_buffer) override;
+    virtual int initBuffer() override;
+
+public:
+    ModuleSwScale(const ImagePara& output_para);
+    ModuleSwScale(const ImagePara& input_para, const ImagePara& output_para);
+    ~ModuleSwScale();
+    int init() override;
+
+    // Scale one NV12 image, the maps are filled on the first call.
+    static void scaleNv12(const uint8_t* src, const ImagePara& src_para, uint8_t* dst, const ImagePara& dst_para,
+                          vector<uint32_t>& x_map, vector<uint32_t>& y_map);
+};
+
+#endif
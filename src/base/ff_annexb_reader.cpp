@@ -0,0 +1,146 @@
+#include <errno.h>
+#include <string.h>
+
+#include "base/ff_annexb_reader.hpp"
+#include "base/ff_log.h"
+
+namespace FFMedia
+{
+AnnexBReader::AnnexBReader(media_codec_t codec_, size_t block_size_)
+    : codec(codec_), block_size(block_size_ < 4096 ? 4096 : block_size_), fp(NULL), pos(0), buf_offset(0), eof(true),
+      has_sps(false)
+{
+}
+
+AnnexBReader::~AnnexBReader()
+{
+    close();
+}
+
+int AnnexBReader::open(const std::string& path)
+{
+    close();
+    fp = fopen(path.c_str(), "rb");
+    if (fp == NULL) {
+        ff_error("AnnexBReader: open %s failed: %s\n", path.c_str(), strerror(errno));
+        return -1;
+    }
+    buf.clear();
+    pos = 0;
+    buf_offset = 0;
+    eof = false;
+    return 0;
+}
+
+void AnnexBReader::close()
+{
+    if (fp)
+        fclose(fp);
+    fp = NULL;
+    buf.clear();
+    pos = 0;
+    eof = true;
+}
+
+bool AnnexBReader::fill()
+{
+    if (eof || fp == NULL)
+        return false;
+
+    // drop what was read, the unread tail moves to the front
+    if (pos > 0) {
+        buf.erase(buf.begin(), buf.begin() + pos);
+        buf_offset += pos;
+        pos = 0;
+    }
+    size_t old_size = buf.size();
+    buf.resize(old_size + block_size);
+    size_t n = fread(buf.data() + old_size, 1, block_size, fp);
+    buf.resize(old_size + n);
+    if (n < block_size)
+        eof = true;
+    return n > 0;
+}
+
+bool AnnexBReader::read(std::vector<uint8_t>& au, Entry* entry)
+{
+    size_t size = 0;
+    // an access unit is complete once the next one starts, or at the end of the file
+    while (true) {
+        size = findAccessUnitEnd(buf.data() + pos, buf.size() - pos, codec);
+        if (size > 0)
+            break;
+        if (!fill()) {
+            size = buf.size() - pos;
+            break;
+        }
+    }
+    if (size == 0)
+        return false;
+
+    const uint8_t* data = buf.data() + pos;
+    au.assign(data, data + size);
+    if (entry) {
+        entry->offset = buf_offset + pos;
+        entry->size = size;
+        entry->key = isKeyFrame(data, size, codec);
+    }
+    pos += size;
+
+    if (!has_sps) {
+        std::vector<NalUnit> nals;
+        splitNalUnits(au.data(), au.size(), nals);
+        for (auto& nal : nals) {
+            if (nalUnitType(nal.data, codec) == (codec == MEDIA_CODEC_VIDEO_H265 ? 33 : 7)) {
+                has_sps = parseSps(nal.data, nal.size, codec, &sps_info);
+                break;
+            }
+        }
+    }
+    return true;
+}
+
+bool AnnexBReader::seek(uint64_t offset)
+{
+    if (fp == NULL)
+        return false;
+    if (offset >= buf_offset && offset <= buf_offset + buf.size()) {
+        pos = offset - buf_offset;
+        return true;
+    }
+    if (fseeko(fp, offset, SEEK_SET) != 0)
+        return false;
+    buf.clear();
+    pos = 0;
+    buf_offset = offset;
+    eof = false;
+    return true;
+}
+
+int AnnexBReader::buildIndex(std::vector<Entry>& index)
+{
+    if (fp == NULL)
+        return -1;
+
+    uint64_t resume = buf_offset + pos;
+    std::vector<uint8_t> au;
+    Entry entry;
+
+    index.clear();
+    if (!seek(0))
+        return -1;
+    while (read(au, &entry))
+        index.push_back(entry);
+    if (!seek(resume))
+        return -1;
+    return index.size();
+}
+
+bool AnnexBReader::getSpsInfo(SpsInfo* info) const
+{
+    if (has_sps)
+        *info = sps_info;
+    return has_sps;
+}
+
+}  // namespace FFMedia
@@ -0,0 +1,555 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "base/ff_async_writer.hpp"
+#include "base/ff_clock.hpp"
+#include "base/ff_log.h"
+
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>) && defined(__NR_io_uring_setup)
+#include <linux/io_uring.h>
+#define HAVE_IO_URING 1
+#endif
+#endif
+
+namespace FFMedia
+{
+#define DIRECT_IO_ALIGN 4096
+
+static size_t alignUp(size_t size)
+{
+    return (size + DIRECT_IO_ALIGN - 1) & ~(size_t)(DIRECT_IO_ALIGN - 1);
+}
+
+/*
+ * Just enough of io_uring for batched writes, without liburing.
+ */
+struct AsyncWriter::Uring {
+#ifdef HAVE_IO_URING
+    int ring_fd = -1;
+    unsigned entries = 0;
+    void* sq_ptr = MAP_FAILED;
+    void* cq_ptr = MAP_FAILED;
+    size_t sq_size = 0;
+    size_t cq_size = 0;
+    io_uring_sqe* sqes = (io_uring_sqe*)MAP_FAILED;
+    size_t sqes_size = 0;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    io_uring_cqe* cqes;
+
+    int init(unsigned depth)
+    {
+        io_uring_params p;
+        memset(&p, 0, sizeof(p));
+        ring_fd = syscall(__NR_io_uring_setup, depth, &p);
+        if (ring_fd < 0)
+            return -1;
+
+        entries = p.sq_entries;
+        sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        cq_size = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+        if (p.features & IORING_FEAT_SINGLE_MMAP)
+            sq_size = cq_size = std::max(sq_size, cq_size);
+
+        sq_ptr = mmap(NULL, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+        if (sq_ptr == MAP_FAILED)
+            return -1;
+        if (p.features & IORING_FEAT_SINGLE_MMAP) {
+            cq_ptr = sq_ptr;
+        } else {
+            cq_ptr = mmap(NULL, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+            if (cq_ptr == MAP_FAILED)
+                return -1;
+        }
+        sqes_size = p.sq_entries * sizeof(io_uring_sqe);
+        sqes = (io_uring_sqe*)mmap(NULL, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+        if (sqes == MAP_FAILED)
+            return -1;
+
+        sq_head = (unsigned*)((char*)sq_ptr + p.sq_off.head);
+        sq_tail = (unsigned*)((char*)sq_ptr + p.sq_off.tail);
+        sq_mask = (unsigned*)((char*)sq_ptr + p.sq_off.ring_mask);
+        sq_array = (unsigned*)((char*)sq_ptr + p.sq_off.array);
+        cq_head = (unsigned*)((char*)cq_ptr + p.cq_off.head);
+        cq_tail = (unsigned*)((char*)cq_ptr + p.cq_off.tail);
+        cq_mask = (unsigned*)((char*)cq_ptr + p.cq_off.ring_mask);
+        cqes = (io_uring_cqe*)((char*)cq_ptr + p.cq_off.cqes);
+        return 0;
+    }
+
+    ~Uring()
+    {
+        if (sqes != MAP_FAILED)
+            munmap(sqes, sqes_size);
+        if (cq_ptr != MAP_FAILED && cq_ptr != sq_ptr)
+            munmap(cq_ptr, cq_size);
+        if (sq_ptr != MAP_FAILED)
+            munmap(sq_ptr, sq_size);
+        if (ring_fd >= 0)
+            ::close(ring_fd);
+    }
+
+    void prepWrite(int fd, const void* buf, unsigned len, off_t offset, uint64_t user_data)
+    {
+        unsigned tail = *sq_tail;
+        unsigned index = tail & *sq_mask;
+        io_uring_sqe* sqe = &sqes[index];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = IORING_OP_WRITE;
+        sqe->fd = fd;
+        sqe->addr = (uint64_t)(uintptr_t)buf;
+        sqe->len = len;
+        sqe->off = offset;
+        sqe->user_data = user_data;
+        sq_array[index] = index;
+        __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+    }
+
+    int submitAndWait(unsigned to_submit, unsigned wait_nr)
+    {
+        int ret;
+        do {
+            ret = syscall(__NR_io_uring_enter, ring_fd, to_submit, wait_nr, IORING_ENTER_GETEVENTS, NULL, 0);
+        } while (ret < 0 && errno == EINTR);
+        return ret;
+    }
+
+    bool popCqe(io_uring_cqe* out)
+    {
+        unsigned head = *cq_head;
+        if (head == __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE))
+            return false;
+        *out = cqes[head & *cq_mask];
+        __atomic_store_n(cq_head, head + 1, __ATOMIC_RELEASE);
+        return true;
+    }
+#endif
+};
+
+AsyncWriter::AsyncWriter(const Config& config_)
+    : config(config_), fd(-1), direct(false), uring(NULL), inflight(0), cur(NULL), allocated(0), total_bytes(0),
+      io_error(0), io_thread(NULL), running(false), latency_count(0), latency_total_us(0), last_sync_us(0)
+{
+    config.block_size = std::max<size_t>(alignUp(config.block_size), DIRECT_IO_ALIGN);
+    memset(&stats, 0, sizeof(stats));
+}
+
+AsyncWriter::AsyncWriter()
+    : AsyncWriter(Config())
+{
+}
+
+AsyncWriter::~AsyncWriter()
+{
+    close();
+}
+
+int AsyncWriter::open(const std::string& path_)
+{
+    int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+
+    if (fd >= 0)
+        close();
+
+    path = path_;
+    direct = false;
+    if (config.direct_io) {
+        fd = ::open(path.c_str(), flags | O_DIRECT, 0644);
+        if (fd >= 0)
+            direct = true;
+        else
+            ff_warn("%s: O_DIRECT is not supported (%s), use buffered io\n", path.c_str(), strerror(errno));
+    }
+    if (fd < 0)
+        fd = ::open(path.c_str(), flags, 0644);
+    if (fd < 0) {
+        ff_error("open file %s failed, reason = %s\n", path.c_str(), strerror(errno));
+        return -1;
+    }
+
+    size_t count = std::max<size_t>(config.queue_size / config.block_size, 2);
+    if (blocks.size() != count) {
+        releaseBlocks();
+        blocks.resize(count);
+        for (auto& block : blocks) {
+            if (posix_memalign((void**)&block.data, DIRECT_IO_ALIGN, config.block_size) != 0) {
+                block.data = NULL;
+                ff_error("alloc %zu bytes failed\n", config.block_size);
+                releaseBlocks();
+                ::close(fd);
+                fd = -1;
+                return -1;
+            }
+        }
+    }
+    free_blocks.clear();
+    pending.clear();
+    for (auto& block : blocks)
+        free_blocks.push_back(&block);
+
+#ifdef HAVE_IO_URING
+    if (config.backend == BACKEND_IO_URING) {
+        uring = new Uring();
+        if (uring->init(count) < 0) {
+            ff_warn("io_uring is not available (%s), use pwrite\n", strerror(errno));
+            delete uring;
+            uring = NULL;
+        }
+    }
+#else
+    if (config.backend == BACKEND_IO_URING)
+        ff_warn("io_uring is not supported by this build, use pwrite\n");
+#endif
+
+    cur = free_blocks.front();
+    free_blocks.pop_front();
+    cur->used = 0;
+    cur->offset = 0;
+    total_bytes = 0;
+    allocated = 0;
+    io_error = 0;
+    inflight = 0;
+    memset(&stats, 0, sizeof(stats));
+    latency_count = 0;
+    latency_total_us = 0;
+    last_sync_us = monotonicUs();
+    preallocate(1);
+    stats.preallocated_bytes = allocated;
+
+    running = true;
+    io_thread = new std::thread(&AsyncWriter::ioLoop, this);
+    return 0;
+}
+
+void AsyncWriter::preallocate(off_t end)
+{
+    if (config.preallocate_size == 0 || end <= allocated)
+        return;
+
+    // reserve whole steps, the file size is kept so the tail stays invisible
+    off_t len = (end - allocated + config.preallocate_size - 1) / config.preallocate_size * config.preallocate_size;
+    if (fallocate(fd, FALLOC_FL_KEEP_SIZE, allocated, len) < 0) {
+        ff_warn("%s: fallocate is not supported (%s), disable preallocation\n", path.c_str(), strerror(errno));
+        config.preallocate_size = 0;
+        return;
+    }
+    allocated += len;
+}
+
+void AsyncWriter::releaseBlocks()
+{
+    for (auto& block : blocks)
+        free(block.data);
+    blocks.clear();
+}
+
+AsyncWriter::Block* AsyncWriter::acquireBlock(std::unique_lock<std::mutex>& lock, bool wait)
+{
+    if (free_blocks.empty()) {
+        if (!wait)
+            return NULL;
+        int64_t start = monotonicUs();
+        free_cv.wait(lock, [this] { return !free_blocks.empty() || io_error; });
+        stats.blocked_us += monotonicUs() - start;
+        if (free_blocks.empty())
+            return NULL;
+    }
+    Block* block = free_blocks.front();
+    free_blocks.pop_front();
+    block->used = 0;
+    block->offset = total_bytes;
+    return block;
+}
+
+void AsyncWriter::queueBlock(Block* block)
+{
+    block->queued_us = monotonicUs();
+    pending.push_back(block);
+    stats.queue_depth = pending.size() + inflight;
+    stats.max_queue_depth = std::max(stats.max_queue_depth, stats.queue_depth);
+    pending_cv.notify_one();
+}
+
+int AsyncWriter::write(const void* data, size_t size)
+{
+    const uint8_t* p = (const uint8_t*)data;
+    std::unique_lock<std::mutex> lock(mtx);
+
+    if (fd < 0 || io_error)
+        return -1;
+
+    if (config.drop_when_full) {
+        size_t need = (cur->used + size) / config.block_size;
+        if (need > free_blocks.size()) {
+            stats.dropped_packets++;
+            stats.dropped_bytes += size;
+            return 1;
+        }
+    }
+
+    while (size > 0) {
+        size_t n = std::min(size, config.block_size - cur->used);
+        memcpy(cur->data + cur->used, p, n);
+        cur->used += n;
+        total_bytes += n;
+        p += n;
+        size -= n;
+
+        if (cur->used == config.block_size) {
+            queueBlock(cur);
+            cur = acquireBlock(lock, true);
+            if (cur == NULL)
+                return -1;
+        }
+    }
+    return 0;
+}
+
+int AsyncWriter::commit()
+{
+    std::unique_lock<std::mutex> lock(mtx);
+
+    if (fd < 0 || io_error)
+        return -1;
+    if (direct || cur->used == 0 || free_blocks.empty())
+        return 0;
+
+    // the next block continues right after the partial one
+    queueBlock(cur);
+    cur = acquireBlock(lock, false);
+    return 0;
+}
+
+void AsyncWriter::completeBlock(Block* block, int64_t now_us)
+{
+    int64_t latency = now_us - block->queued_us;
+    stats.bytes_written += block->used;
+    stats.blocks_written++;
+    latency_count++;
+    latency_total_us += latency;
+    stats.max_write_us = std::max(stats.max_write_us, latency);
+    free_blocks.push_back(block);
+}
+
+int AsyncWriter::writeBlockSync(Block* block)
+{
+    size_t len = block->used;
+    size_t done = 0;
+
+    if (direct)
+        len = alignUp(len);
+
+    while (done < len) {
+        ssize_t n = pwrite(fd, block->data + done, len - done, block->offset + done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        done += n;
+    }
+    return 0;
+}
+
+void AsyncWriter::writeBatch(std::vector<Block*>& batch)
+{
+    int err = 0;
+    std::vector<bool> written(batch.size(), false);
+
+#ifdef HAVE_IO_URING
+    if (uring) {
+        for (size_t i = 0; i < batch.size(); i++)
+            uring->prepWrite(fd, batch[i]->data, batch[i]->used, batch[i]->offset, i);
+        int ret = uring->submitAndWait(batch.size(), batch.size());
+        size_t submitted = ret > 0 ? ret : 0;
+        bool unsupported = submitted < batch.size();
+
+        // every write the kernel took must complete before its block is recycled, so all the
+        // completions are reaped even after an error. Short writes are completed with pwrite.
+        size_t completed = 0;
+        io_uring_cqe cqe;
+        while (completed < submitted) {
+            if (!uring->popCqe(&cqe)) {
+                uring->submitAndWait(0, 1);
+                continue;
+            }
+            completed++;
+            Block* block = batch[cqe.user_data];
+            if (cqe.res == -EINVAL) {
+                // no IORING_OP_WRITE before linux 5.6, the block is written with pwrite below
+                unsupported = true;
+                continue;
+            }
+            written[cqe.user_data] = true;
+            if (cqe.res < 0) {
+                if (!err)
+                    err = -cqe.res;
+            } else if ((size_t)cqe.res < block->used) {
+                Block rest = *block;
+                rest.data += cqe.res;
+                rest.used -= cqe.res;
+                rest.offset += cqe.res;
+                if (writeBlockSync(&rest) < 0 && !err)
+                    err = errno ? errno : EIO;
+            }
+        }
+        if (unsupported) {
+            ff_warn("io_uring can not write %s (%s), use pwrite\n", path.c_str(),
+                    ret < 0 ? strerror(errno) : strerror(EINVAL));
+            delete uring;
+            uring = NULL;
+        }
+    }
+#endif
+
+    for (size_t i = 0; i < batch.size() && !err; i++) {
+        if (!written[i] && writeBlockSync(batch[i]) < 0)
+            err = errno ? errno : EIO;
+    }
+
+    int64_t now = monotonicUs();
+    std::lock_guard<std::mutex> lock(mtx);
+    if (err) {
+        io_error = err;
+        ff_error("write %s failed, reason = %s\n", path.c_str(), strerror(io_error));
+    }
+    for (Block* block : batch)
+        completeBlock(block, now);
+    inflight = 0;
+    stats.queue_depth = pending.size();
+    stats.preallocated_bytes = allocated;
+    free_cv.notify_all();
+}
+
+void AsyncWriter::ioLoop()
+{
+    std::vector<Block*> batch;
+
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            if (config.sync_policy == SYNC_INTERVAL) {
+                pending_cv.wait_for(lock, std::chrono::milliseconds(config.sync_interval_ms),
+                                    [this] { return !pending.empty() || !running; });
+            } else {
+                pending_cv.wait(lock, [this] { return !pending.empty() || !running; });
+            }
+            if (pending.empty() && !running)
+                break;
+
+            batch.clear();
+            size_t max_batch = pending.size();
+#ifdef HAVE_IO_URING
+            if (uring)
+                max_batch = uring->entries;
+#endif
+            while (!pending.empty() && batch.size() < max_batch) {
+                batch.push_back(pending.front());
+                pending.pop_front();
+            }
+            inflight = batch.size();
+        }
+
+        if (!batch.empty()) {
+            off_t end = 0;
+            for (Block* block : batch)
+                end = std::max<off_t>(end, block->offset + block->used);
+            preallocate(end);
+            writeBatch(batch);
+        }
+
+        if (config.sync_policy == SYNC_INTERVAL && monotonicUs() - last_sync_us >= config.sync_interval_ms * 1000ll) {
+            fdatasync(fd);
+            last_sync_us = monotonicUs();
+            std::lock_guard<std::mutex> lock(mtx);
+            stats.syncs++;
+        }
+    }
+}
+
+int AsyncWriter::writePartial()
+{
+    if (cur == NULL || cur->used == 0)
+        return 0;
+
+    // O_DIRECT needs the tail padded, close() truncates the file to the real size
+    if (direct)
+        memset(cur->data + cur->used, 0, alignUp(cur->used) - cur->used);
+    if (writeBlockSync(cur) < 0) {
+        io_error = errno ? errno : EIO;
+        ff_error("write %s failed, reason = %s\n", path.c_str(), strerror(io_error));
+        return -1;
+    }
+    stats.bytes_written = total_bytes;
+    return 0;
+}
+
+int AsyncWriter::flush()
+{
+    std::unique_lock<std::mutex> lock(mtx);
+    if (fd < 0)
+        return -1;
+
+    free_cv.wait(lock, [this] { return (pending.empty() && inflight == 0) || io_error; });
+    if (io_error)
+        return -1;
+
+    // the partial block stays current, the next write completes it in place
+    return writePartial();
+}
+
+int AsyncWriter::close()
+{
+    int ret = 0;
+
+    if (fd < 0)
+        return 0;
+
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        free_cv.wait(lock, [this] { return (pending.empty() && inflight == 0) || io_error; });
+        running = false;
+        pending.clear();
+        pending_cv.notify_all();
+    }
+    if (io_thread) {
+        io_thread->join();
+        delete io_thread;
+        io_thread = NULL;
+    }
+
+    if (io_error || writePartial() < 0)
+        ret = -1;
+    // also gives back the preallocated space past the end
+    if ((direct || allocated > (off_t)total_bytes) && ftruncate(fd, total_bytes) < 0)
+        ret = -1;
+    if (config.sync_policy != SYNC_NONE) {
+        fdatasync(fd);
+        stats.syncs++;
+    }
+
+    ::close(fd);
+    fd = -1;
+    cur = NULL;
+    delete uring;
+    uring = NULL;
+    return ret;
+}
+
+AsyncWriter::Stats AsyncWriter::getStats()
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    Stats s = stats;
+    s.avg_write_us = latency_count ? latency_total_us / latency_count : 0;
+    return s;
+}
+
+}  // namespace FFMedia
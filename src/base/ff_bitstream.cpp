@@ -0,0 +1,784 @@
+#include <string.h>
+
+#include <algorithm>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "base/ff_bitstream.hpp"
+
+namespace FFMedia
+{
+namespace
+{
+// Exp-golomb reader over the rbsp, emulation prevention bytes are skipped on the fly.
+class BitReader
+{
+public:
+    BitReader(const uint8_t* data, size_t size)
+        : data(data), size(size), pos(0), bit(0), zeros(0) {}
+
+    uint32_t u(int n)
+    {
+        uint32_t v = 0;
+        while (n-- > 0)
+            v = (v << 1) | u1();
+        return v;
+    }
+    uint32_t ue()
+    {
+        int leading = 0;
+        while (u1() == 0 && !eof()) {
+            // no 32 bit code has more than 31 leading zeros, the rbsp is broken: end it
+            if (++leading > 31) {
+                pos = size;
+                return UINT32_MAX;
+            }
+        }
+        return ((1u << leading) - 1) + u(leading);
+    }
+    int32_t se()
+    {
+        uint32_t v = ue();
+        return (v & 1) ? (int32_t)((v + 1) / 2) : -(int32_t)(v / 2);
+    }
+    void skip(int n) { u(n); }
+    bool eof() const { return pos >= size; }
+
+private:
+    uint32_t u1()
+    {
+        if (pos >= size)
+            return 0;
+        if (bit == 0) {
+            if (zeros >= 2 && data[pos] == 3) {
+                pos++;
+                zeros = 0;
+                if (pos >= size)
+                    return 0;
+            }
+            zeros = data[pos] == 0 ? zeros + 1 : 0;
+        }
+        uint32_t v = (data[pos] >> (7 - bit)) & 1;
+        if (++bit == 8) {
+            bit = 0;
+            pos++;
+        }
+        return v;
+    }
+
+    const uint8_t* data;
+    size_t size;
+    size_t pos;
+    int bit;
+    int zeros;
+};
+
+void skipScalingList(BitReader& br, int count)
+{
+    int last = 8, next = 8;
+    for (int i = 0; i < count; i++) {
+        if (next != 0)
+            next = (last + br.se() + 256) % 256;
+        last = next == 0 ? last : next;
+    }
+}
+
+// aspect ratio, overscan, video signal and chroma location of the vui, shared by both codecs
+void skipVuiHead(BitReader& br)
+{
+    if (br.u(1) && br.u(8) == 255)  // aspect_ratio_idc, Extended_SAR
+        br.skip(32);
+    if (br.u(1))  // overscan_info_present_flag
+        br.skip(1);
+    if (br.u(1)) {  // video_signal_type_present_flag
+        br.skip(4);
+        if (br.u(1))
+            br.skip(24);
+    }
+    if (br.u(1)) {  // chroma_loc_info_present_flag
+        br.ue();
+        br.ue();
+    }
+}
+
+bool parseH264Sps(BitReader& br, SpsInfo* info)
+{
+    uint32_t profile = br.u(8);
+    uint32_t chroma_format = 1;
+
+    br.skip(8);
+    info->profile = profile;
+    info->level = br.u(8);
+    br.ue();
+    if (profile == 100 || profile == 110 || profile == 122 || profile == 244 || profile == 44 || profile == 83
+        || profile == 86 || profile == 118 || profile == 128 || profile == 138 || profile == 139 || profile == 134
+        || profile == 135) {
+        chroma_format = br.ue();
+        if (chroma_format == 3)
+            br.skip(1);
+        br.ue();
+        br.ue();
+        br.skip(1);
+        if (br.u(1)) {
+            for (int i = 0; i < (chroma_format != 3 ? 8 : 12); i++) {
+                if (br.u(1))
+                    skipScalingList(br, i < 6 ? 16 : 64);
+            }
+        }
+    }
+    br.ue();
+    uint32_t poc_type = br.ue();
+    if (poc_type == 0) {
+        br.ue();
+    } else if (poc_type == 1) {
+        br.skip(1);
+        br.se();
+        br.se();
+        uint32_t n = br.ue();
+        for (uint32_t i = 0; i < n && !br.eof(); i++)
+            br.se();
+    }
+    br.ue();
+    br.skip(1);
+    uint32_t width_mbs = br.ue() + 1;
+    uint32_t height_map_units = br.ue() + 1;
+    uint32_t frame_mbs_only = br.u(1);
+    if (!frame_mbs_only)
+        br.skip(1);
+    br.skip(1);
+
+    uint32_t crop[4] = {0, 0, 0, 0};
+    if (br.u(1)) {
+        for (int i = 0; i < 4; i++)
+            crop[i] = br.ue();
+    }
+    if (br.eof())
+        return false;
+
+    int crop_x = (chroma_format == 1 || chroma_format == 2) ? 2 : 1;
+    int crop_y = (chroma_format == 1 ? 2 : 1) * (2 - frame_mbs_only);
+    info->width = width_mbs * 16 - crop_x * (crop[0] + crop[1]);
+    info->height = (2 - frame_mbs_only) * height_map_units * 16 - crop_y * (crop[2] + crop[3]);
+
+    if (br.u(1)) {  // vui_parameters_present_flag
+        skipVuiHead(br);
+        if (br.u(1)) {  // timing_info_present_flag, two fields per frame
+            uint32_t num_units_in_tick = br.u(32);
+            uint32_t time_scale = br.u(32);
+            if (num_units_in_tick > 0 && !br.eof())
+                info->fps = time_scale / (2.0 * num_units_in_tick);
+        }
+    }
+    return true;
+}
+
+void skipH265ScalingListData(BitReader& br)
+{
+    for (int size_id = 0; size_id < 4; size_id++) {
+        for (int matrix_id = 0; matrix_id < 6; matrix_id += size_id == 3 ? 3 : 1) {
+            if (!br.u(1)) {  // scaling_list_pred_mode_flag
+                br.ue();
+                continue;
+            }
+            int coefs = std::min(64, 1 << (4 + (size_id << 1)));
+            if (size_id > 1)
+                br.se();
+            for (int i = 0; i < coefs; i++)
+                br.se();
+        }
+    }
+}
+
+bool parseH265Sps(BitReader& br, SpsInfo* info)
+{
+    br.skip(4);
+    uint32_t max_sub_layers = br.u(3);
+    br.skip(1);
+
+    // profile_tier_level, general_profile_idc and general_level_idc
+    br.skip(3);
+    info->profile = br.u(5);
+    br.skip(80);
+    info->level = br.u(8);
+    bool profile_present[8], level_present[8];
+    for (uint32_t i = 0; i < max_sub_layers; i++) {
+        profile_present[i] = br.u(1);
+        level_present[i] = br.u(1);
+    }
+    if (max_sub_layers > 0) {
+        for (uint32_t i = max_sub_layers; i < 8; i++)
+            br.skip(2);
+    }
+    for (uint32_t i = 0; i < max_sub_layers; i++) {
+        if (profile_present[i])
+            br.skip(88);
+        if (level_present[i])
+            br.skip(8);
+    }
+
+    br.ue();
+    uint32_t chroma_format = br.ue();
+    if (chroma_format == 3)
+        br.skip(1);
+    uint32_t w = br.ue();
+    uint32_t h = br.ue();
+    uint32_t crop[4] = {0, 0, 0, 0};
+    if (br.u(1)) {
+        for (int i = 0; i < 4; i++)
+            crop[i] = br.ue();
+    }
+    if (br.eof())
+        return false;
+
+    int crop_x = (chroma_format == 1 || chroma_format == 2) ? 2 : 1;
+    int crop_y = chroma_format == 1 ? 2 : 1;
+    info->width = w - crop_x * (crop[0] + crop[1]);
+    info->height = h - crop_y * (crop[2] + crop[3]);
+
+    // on to the vui for the frame rate
+    br.ue();
+    br.ue();
+    uint32_t log2_max_poc_lsb = br.ue() + 4;
+    uint32_t first = br.u(1) ? 0 : max_sub_layers;  // sps_sub_layer_ordering_info_present_flag
+    for (uint32_t i = first; i <= max_sub_layers; i++) {
+        br.ue();
+        br.ue();
+        br.ue();
+    }
+    for (int i = 0; i < 6; i++)
+        br.ue();
+    if (br.u(1) && br.u(1))  // scaling_list_enabled_flag, sps_scaling_list_data_present_flag
+        skipH265ScalingListData(br);
+    br.skip(2);
+    if (br.u(1)) {  // pcm_enabled_flag
+        br.skip(8);
+        br.ue();
+        br.ue();
+        br.skip(1);
+    }
+
+    uint32_t sets = br.ue();
+    if (sets > 64)
+        return true;
+    uint32_t delta_pocs[64];
+    for (uint32_t i = 0; i < sets && !br.eof(); i++) {
+        if (i > 0 && br.u(1)) {  // inter_ref_pic_set_prediction_flag, from the set before
+            br.skip(1);
+            br.ue();
+            delta_pocs[i] = 0;
+            for (uint32_t j = 0; j <= delta_pocs[i - 1]; j++) {
+                // use_delta_flag is 1 when used_by_curr_pic_flag is
+                if (br.u(1) || br.u(1))
+                    delta_pocs[i]++;
+            }
+        } else {
+            uint32_t negative = br.ue();
+            uint32_t positive = br.ue();
+            if (negative > 16 || positive > 16)
+                return true;
+            for (uint32_t j = 0; j < negative + positive; j++) {
+                br.ue();
+                br.skip(1);
+            }
+            delta_pocs[i] = negative + positive;
+        }
+    }
+    if (br.u(1)) {  // long_term_ref_pics_present_flag
+        uint32_t n = br.ue();
+        for (uint32_t i = 0; i < n && !br.eof(); i++)
+            br.skip(log2_max_poc_lsb + 1);
+    }
+    br.skip(2);
+
+    if (br.u(1)) {  // vui_parameters_present_flag
+        skipVuiHead(br);
+        br.skip(3);
+        if (br.u(1)) {  // default_display_window_flag
+            for (int i = 0; i < 4; i++)
+                br.ue();
+        }
+        if (br.u(1)) {  // vui_timing_info_present_flag
+            uint32_t num_units_in_tick = br.u(32);
+            uint32_t time_scale = br.u(32);
+            if (num_units_in_tick > 0 && !br.eof())
+                info->fps = (double)time_scale / num_units_in_tick;
+        }
+    }
+    return true;
+}
+}  // namespace
+
+const uint8_t* findStartCode(const uint8_t* data, const uint8_t* end)
+{
+    const uint8_t* p = data;
+#if defined(__SSE2__)
+    // 00 00 01 at any of 16 positions: compare three overlapping loads at once
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i one = _mm_set1_epi8(1);
+    while (end - p >= 18) {
+        __m128i b0 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)p), zero);
+        __m128i b1 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(p + 1)), zero);
+        __m128i b2 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(p + 2)), one);
+        int mask = _mm_movemask_epi8(_mm_and_si128(_mm_and_si128(b0, b1), b2));
+        if (mask)
+            return p + __builtin_ctz(mask);
+        p += 16;
+    }
+#elif defined(__ARM_NEON)
+    const uint8x16_t zero = vdupq_n_u8(0);
+    const uint8x16_t one = vdupq_n_u8(1);
+    while (end - p >= 18) {
+        uint8x16_t b0 = vceqq_u8(vld1q_u8(p), zero);
+        uint8x16_t b1 = vceqq_u8(vld1q_u8(p + 1), zero);
+        uint8x16_t b2 = vceqq_u8(vld1q_u8(p + 2), one);
+        uint8x16_t hit = vandq_u8(vandq_u8(b0, b1), b2);
+        // 4 bits per byte, there is no movemask
+        uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(hit), 4)), 0);
+        if (mask)
+            return p + (__builtin_ctzll(mask) >> 2);
+        p += 16;
+    }
+#endif
+    while (p + 3 <= end) {
+        if (p[2] > 1) {
+            p += 3;
+        } else if (p[2] == 1 && p[1] == 0 && p[0] == 0) {
+            return p;
+        } else {
+            p++;
+        }
+    }
+    return end;
+}
+
+bool isAnnexB(const uint8_t* data, size_t size)
+{
+    if (size >= 3 && data[0] == 0 && data[1] == 0 && data[2] == 1)
+        return true;
+    return size >= 4 && data[0] == 0 && data[1] == 0 && data[2] == 0 && data[3] == 1;
+}
+
+size_t splitNalUnits(const uint8_t* data, size_t size, std::vector<NalUnit>& nals)
+{
+    const uint8_t* end = data + size;
+
+    nals.clear();
+    if (data == NULL || size < 4)
+        return 0;
+
+    if (isAnnexB(data, size)) {
+        const uint8_t* p = findStartCode(data, end);
+        while (p < end) {
+            const uint8_t* start = p + 3;
+            const uint8_t* next = findStartCode(start, end);
+            const uint8_t* last = next;
+            // trailing_zero_8bits, and the first byte of a 4 byte start code
+            while (last > start && last[-1] == 0)
+                last--;
+            if (last > start)
+                nals.push_back({start, (size_t)(last - start)});
+            p = next;
+        }
+        return nals.size();
+    }
+
+    const uint8_t* p = data;
+    while (p + 4 < end) {
+        uint32_t len = ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+        if (len == 0 || len > (size_t)(end - p - 4))
+            break;
+        nals.push_back({p + 4, len});
+        p += 4 + len;
+    }
+    return nals.size();
+}
+
+int nalUnitType(const uint8_t* nal, media_codec_t codec)
+{
+    if (codec == MEDIA_CODEC_VIDEO_H265)
+        return (nal[0] >> 1) & 0x3f;
+    return nal[0] & 0x1f;
+}
+
+bool isKeyFrame(const uint8_t* data, size_t size, media_codec_t codec)
+{
+    std::vector<NalUnit> nals;
+    splitNalUnits(data, size, nals);
+    for (auto& nal : nals) {
+        int type = nalUnitType(nal.data, codec);
+        if (codec == MEDIA_CODEC_VIDEO_H265 ? (type >= 16 && type <= 21) : type == 5)
+            return true;
+    }
+    return false;
+}
+
+bool isDisposable(const uint8_t* data, size_t size, media_codec_t codec)
+{
+    std::vector<NalUnit> nals;
+    bool vcl = false;
+    splitNalUnits(data, size, nals);
+    for (auto& nal : nals) {
+        int type = nalUnitType(nal.data, codec);
+        if (codec == MEDIA_CODEC_VIDEO_H265) {
+            if (type >= 32)
+                continue;
+            // TRAIL_N, TSA_N, STSA_N, RADL_N, RASL_N and the reserved sub-layer non-reference types
+            if (type >= 16 || type % 2 != 0)
+                return false;
+        } else {
+            if (type < 1 || type > 5)
+                continue;
+            if (nal.data[0] & 0x60)  // nal_ref_idc
+                return false;
+        }
+        vcl = true;
+    }
+    return vcl;
+}
+
+int temporalLayerId(const uint8_t* data, size_t size, media_codec_t codec)
+{
+    std::vector<NalUnit> nals;
+    splitNalUnits(data, size, nals);
+    for (auto& nal : nals) {
+        int type = nalUnitType(nal.data, codec);
+        if (codec == MEDIA_CODEC_VIDEO_H265) {
+            if (type < 32 && nal.size >= 2)
+                return (nal.data[1] & 0x07) > 0 ? (nal.data[1] & 0x07) - 1 : 0;
+            continue;
+        }
+        // prefix nal or slice extension, the 3 byte header extension follows the nal header
+        if ((type == 14 || type == 20) && nal.size >= 4) {
+            // svc (G.7.3.1.1): temporal_id, use_ref_base_pic, discardable, output, 2 reserved
+            if (nal.data[1] & 0x80)  // svc_extension_flag
+                return (nal.data[3] >> 5) & 0x07;
+            // mvc (H.7.3.1.1): 2 bits of view_id, temporal_id, anchor_pic, inter_view, reserved
+            return (nal.data[3] >> 3) & 0x07;
+        }
+        if (type >= 1 && type <= 5)
+            return 0;
+    }
+    return 0;
+}
+
+size_t getParameterSets(const uint8_t* data, size_t size, media_codec_t codec, std::vector<uint8_t>& sets)
+{
+    static const uint8_t start_code[4] = {0, 0, 0, 1};
+    std::vector<NalUnit> nals;
+
+    if (isDecoderConfig(data, size))
+        return parseDecoderConfig(data, size, codec, sets);
+
+    sets.clear();
+    splitNalUnits(data, size, nals);
+    for (auto& nal : nals) {
+        int type = nalUnitType(nal.data, codec);
+        if (codec == MEDIA_CODEC_VIDEO_H265 ? (type >= 32 && type <= 34) : (type == 7 || type == 8)) {
+            sets.insert(sets.end(), start_code, start_code + 4);
+            sets.insert(sets.end(), nal.data, nal.data + nal.size);
+        }
+    }
+    return sets.size();
+}
+
+bool isDecoderConfig(const uint8_t* data, size_t size)
+{
+    // configurationVersion 1, a start code or a 4 byte length starts with 0
+    return data != NULL && size >= 7 && data[0] == 1;
+}
+
+size_t parseDecoderConfig(const uint8_t* data, size_t size, media_codec_t codec, std::vector<uint8_t>& sets,
+                          int* length_size)
+{
+    static const uint8_t start_code[4] = {0, 0, 0, 1};
+    const uint8_t* p = data;
+    const uint8_t* end = data + size;
+
+    sets.clear();
+    if (!isDecoderConfig(data, size))
+        return 0;
+
+    // (nal type, count) arrays: hvcC has numOfArrays of them, avcC one of sps and one of pps
+    int arrays, nal_length;
+    if (codec == MEDIA_CODEC_VIDEO_H265) {
+        if (size < 23)
+            return 0;
+        nal_length = (p[21] & 0x03) + 1;
+        arrays = p[22];
+        p += 23;
+    } else {
+        nal_length = (p[4] & 0x03) + 1;
+        arrays = 2;
+        p += 5;
+    }
+    if (nal_length == 3)
+        return 0;
+
+    for (int i = 0; i < arrays; i++) {
+        int count;
+        if (codec == MEDIA_CODEC_VIDEO_H265) {
+            if (end - p < 3)
+                break;
+            count = (p[1] << 8) | p[2];
+            p += 3;
+        } else {
+            if (end - p < 1)
+                break;
+            count = i == 0 ? (p[0] & 0x1f) : p[0];
+            p++;
+        }
+        for (int j = 0; j < count; j++) {
+            if (end - p < 2)
+                break;
+            size_t len = (p[0] << 8) | p[1];
+            p += 2;
+            if (len == 0 || len > (size_t)(end - p))
+                break;
+            sets.insert(sets.end(), start_code, start_code + 4);
+            sets.insert(sets.end(), p, p + len);
+            p += len;
+        }
+    }
+    if (length_size)
+        *length_size = nal_length;
+    return sets.size();
+}
+
+size_t annexBToLengthPrefixed(const uint8_t* data, size_t size, std::vector<uint8_t>& out)
+{
+    std::vector<NalUnit> nals;
+    size_t old_size = out.size();
+    size_t total = 0;
+
+    splitNalUnits(data, size, nals);
+    for (auto& nal : nals)
+        total += 4 + nal.size;
+    out.resize(old_size + total);
+    uint8_t* dst = out.data() + old_size;
+    for (auto& nal : nals) {
+        dst[0] = nal.size >> 24;
+        dst[1] = nal.size >> 16;
+        dst[2] = nal.size >> 8;
+        dst[3] = nal.size;
+        memcpy(dst + 4, nal.data, nal.size);
+        dst += 4 + nal.size;
+    }
+    return total;
+}
+
+size_t lengthPrefixedToAnnexB(const uint8_t* data, size_t size, int length_size, std::vector<uint8_t>& out)
+{
+    const uint8_t* p = data;
+    const uint8_t* end = data + size;
+    size_t old_size = out.size();
+
+    if (data == NULL || (length_size != 1 && length_size != 2 && length_size != 4))
+        return 0;
+
+    // a 4 byte length becomes a 4 byte start code, shorter ones grow the output
+    out.reserve(old_size + size + (4 - length_size) * (size / (length_size + 1) + 1));
+    while (end - p > length_size) {
+        size_t len = 0;
+        for (int i = 0; i < length_size; i++)
+            len = (len << 8) | p[i];
+        p += length_size;
+        if (len == 0)
+            continue;
+        if (len > (size_t)(end - p))
+            break;
+        size_t pos = out.size();
+        out.resize(pos + 4 + len);
+        uint8_t* dst = out.data() + pos;
+        dst[0] = 0;
+        dst[1] = 0;
+        dst[2] = 0;
+        dst[3] = 1;
+        memcpy(dst + 4, p, len);
+        p += len;
+    }
+    return out.size() - old_size;
+}
+
+bool parseSps(const uint8_t* sps, size_t size, media_codec_t codec, SpsInfo* info)
+{
+    size_t header_size = codec == MEDIA_CODEC_VIDEO_H265 ? 2 : 1;
+    if (sps == NULL || size <= header_size || info == NULL)
+        return false;
+
+    *info = SpsInfo();
+    BitReader br(sps + header_size, size - header_size);
+    if (codec == MEDIA_CODEC_VIDEO_H265)
+        return parseH265Sps(br, info);
+    return parseH264Sps(br, info);
+}
+
+bool parseSpsSize(const uint8_t* sps, size_t size, media_codec_t codec, int* width, int* height)
+{
+    SpsInfo info;
+    if (!parseSps(sps, size, codec, &info))
+        return false;
+    *width = info.width;
+    *height = info.height;
+    return true;
+}
+
+int sliceType(const uint8_t* nal, size_t size, media_codec_t codec)
+{
+    if (codec == MEDIA_CODEC_VIDEO_H265) {
+        int type = nalUnitType(nal, codec);
+        if (size < 3 || type >= 32)
+            return SLICE_TYPE_UNKNOWN;
+        BitReader br(nal + 2, size - 2);
+        // the address of a later segment needs the sps, only the first one is read
+        if (!br.u(1))
+            return SLICE_TYPE_UNKNOWN;
+        if (type >= 16 && type <= 23)
+            br.skip(1);
+        br.ue();
+        // assumes num_extra_slice_header_bits 0 in the pps, as the common encoders write it
+        static const int h265_types[3] = {SLICE_TYPE_B, SLICE_TYPE_P, SLICE_TYPE_I};
+        uint32_t slice_type = br.ue();
+        return slice_type < 3 && !br.eof() ? h265_types[slice_type] : SLICE_TYPE_UNKNOWN;
+    }
+
+    int type = nalUnitType(nal, codec);
+    if (size < 2 || type < 1 || type > 5)
+        return SLICE_TYPE_UNKNOWN;
+    BitReader br(nal + 1, size - 1);
+    br.ue();
+    // P, B, I, SP, SI
+    static const int h264_types[5] = {SLICE_TYPE_P, SLICE_TYPE_B, SLICE_TYPE_I, SLICE_TYPE_P, SLICE_TYPE_I};
+    uint32_t slice_type = br.ue();
+    return !br.eof() ? h264_types[slice_type % 5] : SLICE_TYPE_UNKNOWN;
+}
+
+bool parseAccessUnit(const uint8_t* data, size_t size, media_codec_t codec, AccessUnitInfo* info)
+{
+    std::vector<NalUnit> nals;
+
+    *info = AccessUnitInfo();
+    info->nal_count = splitNalUnits(data, size, nals);
+    for (auto& nal : nals) {
+        int type = nalUnitType(nal.data, codec);
+        bool vcl;
+        if (codec == MEDIA_CODEC_VIDEO_H265) {
+            vcl = type < 32;
+            info->idr = info->idr || type == 19 || type == 20;
+            info->cra = info->cra || type == 21;
+            info->key = info->key || (type >= 16 && type <= 21);
+            info->has_vps = info->has_vps || type == 32;
+            info->has_sps = info->has_sps || type == 33;
+            info->has_pps = info->has_pps || type == 34;
+        } else {
+            vcl = type >= 1 && type <= 5;
+            info->idr = info->idr || type == 5;
+            info->key = info->idr;
+            info->has_sps = info->has_sps || type == 7;
+            info->has_pps = info->has_pps || type == 8;
+        }
+        if (vcl && info->slice_type == SLICE_TYPE_UNKNOWN)
+            info->slice_type = sliceType(nal.data, nal.size, codec);
+        if (vcl)
+            info->slices++;
+    }
+    return info->slices > 0;
+}
+
+namespace
+{
+// The nal unit can not belong to the access unit of a slice before it (h264 7.4.1.2.3,
+// h265 7.4.2.4.4): delimiters, parameter sets, prefix sei, and the first slice of a picture.
+bool startsAccessUnit(const uint8_t* nal, media_codec_t codec)
+{
+    int type = nalUnitType(nal, codec);
+    if (codec == MEDIA_CODEC_VIDEO_H265) {
+        if (type < 32)
+            return nal[2] & 0x80;  // first_slice_segment_in_pic_flag
+        return (type >= 32 && type <= 35) || type == 39 || (type >= 41 && type <= 44) || (type >= 48 && type <= 55);
+    }
+    if (type >= 1 && type <= 5)
+        return nal[1] & 0x80;  // first_mb_in_slice 0
+    return (type >= 6 && type <= 9) || (type >= 14 && type <= 18);
+}
+}  // namespace
+
+size_t findAccessUnitEnd(const uint8_t* data, size_t size, media_codec_t codec)
+{
+    const uint8_t* end = data + size;
+    const uint8_t* p = findStartCode(data, end);
+    size_t header_size = codec == MEDIA_CODEC_VIDEO_H265 ? 3 : 2;
+    bool vcl = false;
+
+    while (p < end) {
+        const uint8_t* nal = p + 3;
+        if ((size_t)(end - nal) < header_size)
+            return 0;
+        if (vcl && startsAccessUnit(nal, codec))
+            return (p > data && p[-1] == 0 ? p - 1 : p) - data;
+        int type = nalUnitType(nal, codec);
+        vcl = vcl || (codec == MEDIA_CODEC_VIDEO_H265 ? type < 32 : (type >= 1 && type <= 5));
+        p = findStartCode(nal, end);
+    }
+    return 0;
+}
+
+bool buildDecoderConfig(media_codec_t codec, const std::vector<uint8_t>& vps, const std::vector<uint8_t>& sps,
+                        const std::vector<uint8_t>& pps, std::vector<uint8_t>& record)
+{
+    record.clear();
+    if (codec != MEDIA_CODEC_VIDEO_H265) {
+        if (sps.size() < 4 || pps.empty())
+            return false;
+        const uint8_t head[6] = {1, sps[1], sps[2], sps[3], 0xff, 0xe1};
+        record.insert(record.end(), head, head + 6);
+        record.push_back(sps.size() >> 8);
+        record.push_back(sps.size());
+        record.insert(record.end(), sps.begin(), sps.end());
+        record.push_back(1);
+        record.push_back(pps.size() >> 8);
+        record.push_back(pps.size());
+        record.insert(record.end(), pps.begin(), pps.end());
+        return true;
+    }
+
+    // general profile_tier_level follows the first byte of the sps rbsp
+    uint8_t rbsp[13];
+    size_t n = 0;
+    int zeros = 0;
+    for (size_t i = 2; i < sps.size() && n < sizeof(rbsp); i++) {
+        if (zeros >= 2 && sps[i] == 3) {
+            zeros = 0;
+            continue;
+        }
+        zeros = sps[i] == 0 ? zeros + 1 : 0;
+        rbsp[n++] = sps[i];
+    }
+    if (n < sizeof(rbsp) || vps.empty() || pps.empty())
+        return false;
+
+    uint8_t sub_layers = ((rbsp[0] >> 1) & 0x07) + 1;
+    uint8_t nested = rbsp[0] & 0x01;
+    record.push_back(1);
+    record.insert(record.end(), rbsp + 1, rbsp + 13);
+    // no min_spatial_segmentation, parallelism, 4:2:0 8 bit as the hardware encoder produces
+    const uint8_t tail[8] = {0xf0, 0x00, 0xfc, 0xfd, 0xf8, 0xf8, 0x00, 0x00};
+    record.insert(record.end(), tail, tail + 8);
+    record.push_back((sub_layers << 3) | (nested << 2) | 3);
+    record.push_back(3);
+    const std::vector<uint8_t>* arrays[3] = {&vps, &sps, &pps};
+    for (int i = 0; i < 3; i++) {
+        record.push_back(0x80 | (32 + i));
+        record.push_back(0);
+        record.push_back(1);
+        record.push_back(arrays[i]->size() >> 8);
+        record.push_back(arrays[i]->size());
+        record.insert(record.end(), arrays[i]->begin(), arrays[i]->end());
+    }
+    return true;
+}
+
+}  // namespace FFMedia
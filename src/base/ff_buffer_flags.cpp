@@ -0,0 +1,89 @@
+#include <mutex>
+#include <unordered_map>
+
+#include "base/ff_buffer_flags.hpp"
+
+namespace FFMedia
+{
+// The maps are keyed by the buffer, which the producer fills again and the library may free
+// and allocate at the same address, so each entry holds the pts of the frame it was set for.
+// An entry of another pts belongs to an earlier frame, a buffer the producer filled again
+// without setting it, and is dropped on lookup.
+template <class T>
+struct BufferTag {
+    T value;
+    int64_t pts;
+};
+
+template <class T>
+static void setTag(std::unordered_map<const MediaBuffer*, BufferTag<T>>& tags, const MediaBuffer* buffer, T value,
+                   bool keep)
+{
+    if (keep)
+        tags[buffer] = {value, buffer->getPUstimestamp()};
+    else
+        tags.erase(buffer);
+}
+
+template <class T>
+static T getTag(std::unordered_map<const MediaBuffer*, BufferTag<T>>& tags, const MediaBuffer* buffer, T none)
+{
+    auto it = tags.find(buffer);
+    if (it == tags.end())
+        return none;
+    if (it->second.pts != buffer->getPUstimestamp()) {
+        tags.erase(it);
+        return none;
+    }
+    return it->second.value;
+}
+
+static std::mutex flags_mtx;
+// only flagged buffers have an entry, so the map stays as small as the damaged frames in flight
+static std::unordered_map<const MediaBuffer*, BufferTag<uint32_t>> buffer_flags;
+
+void setBufferFlags(const MediaBuffer* buffer, uint32_t flags)
+{
+    std::lock_guard<std::mutex> lock(flags_mtx);
+    setTag(buffer_flags, buffer, flags, flags != 0);
+}
+
+uint32_t getBufferFlags(const MediaBuffer* buffer)
+{
+    std::lock_guard<std::mutex> lock(flags_mtx);
+    return getTag<uint32_t>(buffer_flags, buffer, 0);
+}
+
+static std::mutex layers_mtx;
+// only the frames above the base layer have an entry
+static std::unordered_map<const MediaBuffer*, BufferTag<int>> buffer_layers;
+
+void setBufferTemporalLayer(const MediaBuffer* buffer, int layer)
+{
+    std::lock_guard<std::mutex> lock(layers_mtx);
+    setTag(buffer_layers, buffer, layer, layer > 0);
+}
+
+int getBufferTemporalLayer(const MediaBuffer* buffer)
+{
+    std::lock_guard<std::mutex> lock(layers_mtx);
+    return getTag<int>(buffer_layers, buffer, 0);
+}
+
+static std::mutex sequences_mtx;
+// the captured buffers are reused, so the map stays as large as the capture pools
+static std::unordered_map<const MediaBuffer*, BufferTag<int64_t>> buffer_sequences;
+
+void setBufferSequence(const MediaBuffer* buffer, int64_t sequence)
+{
+    std::lock_guard<std::mutex> lock(sequences_mtx);
+    setTag(buffer_sequences, buffer, sequence, sequence >= 0);
+}
+
+int64_t getBufferSequence(const MediaBuffer* buffer)
+{
+    std::lock_guard<std::mutex> lock(sequences_mtx);
+    return getTag<int64_t>(buffer_sequences, buffer, -1);
+}
+
+}  // namespace FFMedia
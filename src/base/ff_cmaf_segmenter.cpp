@@ -0,0 +1,563 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "base/ff_bitstream.hpp"
+#include "base/ff_cmaf_segmenter.hpp"
+#include "base/ff_log.h"
+
+namespace FFMedia
+{
+#define DEFAULT_BANDWIDTH 2000000
+#define SEGMENTER_MAX_IOV 64
+
+const char* CmafSegmenter::HLS_PLAYLIST = "index.m3u8";
+const char* CmafSegmenter::DASH_MANIFEST = "manifest.mpd";
+const char* CmafSegmenter::INIT_SEGMENT = "init.mp4";
+
+static int64_t wallMs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// 2024-01-01T00:00:00.000Z
+static std::string isoTime(int64_t ms)
+{
+    time_t sec = ms / 1000;
+    struct tm tm;
+    char buf[64];
+    gmtime_r(&sec, &tm);
+    size_t n = strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%S", &tm);
+    snprintf(buf + n, sizeof(buf) - n, ".%03dZ", (int)(ms % 1000));
+    return buf;
+}
+
+static CmafSegmenter::Blob makeBlob(const std::string& text)
+{
+    return std::make_shared<const std::vector<uint8_t>>(text.begin(), text.end());
+}
+
+CmafSegmenter::CmafSegmenter(const Config& config_)
+    : config(config_), codec(MEDIA_CODEC_VIDEO_H264), width(0), height(0), base_pts_us(-1), availability_start_ms(0),
+      next_number(1), ended(false), io_thread(NULL), io_running(false)
+{
+    memset(&stats, 0, sizeof(stats));
+    config.window_segments = std::max(config.window_segments, 1);
+    config.keep_segments = std::max(config.keep_segments, config.window_segments);
+    if (config.part_duration_ms >= config.segment_duration_ms)
+        config.part_duration_ms = 0;
+}
+
+CmafSegmenter::~CmafSegmenter()
+{
+    if (io_thread) {
+        {
+            std::lock_guard<std::mutex> lock(io_mtx);
+            io_running = false;
+            io_cv.notify_all();
+        }
+        io_thread->join();
+        delete io_thread;
+    }
+}
+
+std::string CmafSegmenter::segmentName(uint32_t number)
+{
+    return "seg" + std::to_string(number) + ".m4s";
+}
+
+int CmafSegmenter::open(media_codec_t codec_, int width_, int height_)
+{
+    codec = codec_;
+    width = width_;
+    height = height_;
+    muxer.reset(new Fmp4Muxer(codec, width, height));
+    muxer->setPartDuration(config.part_duration_ms * 1000);
+    muxer->setWriteCallback([this](const uint8_t* data, size_t size) {
+        init_data.insert(init_data.end(), data, data + size);
+        return 0;
+    });
+    muxer->setFragmentCallback([this](std::vector<uint8_t>& moof, std::vector<uint8_t>& mdat, int64_t start_us,
+                                      int64_t duration_us, bool key) {
+        return onFragment(moof, mdat, start_us, duration_us, key);
+    });
+    if (!extra_data.empty())
+        muxer->setExtraData(extra_data.data(), extra_data.size());
+
+    if (!config.dir.empty() && io_thread == NULL) {
+        if (mkdir(config.dir.c_str(), 0755) < 0 && errno != EEXIST) {
+            ff_error("CmafSegmenter: can not create %s: %s\n", config.dir.c_str(), strerror(errno));
+            return -1;
+        }
+        io_running = true;
+        io_thread = new std::thread(&CmafSegmenter::ioLoop, this);
+    }
+    return 0;
+}
+
+void CmafSegmenter::setExtraData(const uint8_t* data, size_t size)
+{
+    extra_data.assign(data, data + size);
+    if (muxer)
+        muxer->setExtraData(data, size);
+}
+
+void CmafSegmenter::setUpdateCallback(UpdateCallback callback)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    update_cb = callback;
+}
+
+int CmafSegmenter::writeFrame(const uint8_t* data, size_t size, int64_t pts_us)
+{
+    if (muxer == nullptr)
+        return -1;
+    // the manifest needs the sps for the codec string
+    if (extra_data.empty() && isKeyFrame(data, size, codec))
+        getParameterSets(data, size, codec, extra_data);
+    return muxer->writeFrame(data, size, pts_us) < 0 ? -1 : 0;
+}
+
+void CmafSegmenter::close()
+{
+    if (muxer)
+        muxer->flush();
+
+    UpdateCallback callback;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (!segments.empty())
+            segments.back().complete = true;
+        ended = true;
+        publish();
+        callback = update_cb;
+    }
+    if (callback)
+        callback();
+}
+
+int CmafSegmenter::onFragment(std::vector<uint8_t>& moof, std::vector<uint8_t>& mdat, int64_t start_us,
+                              int64_t duration_us, bool key)
+{
+    // the buffers of the muxer become the part, it goes on with empty ones
+    std::shared_ptr<std::vector<uint8_t>> moof_blob = std::make_shared<std::vector<uint8_t>>();
+    std::shared_ptr<std::vector<uint8_t>> mdat_blob = std::make_shared<std::vector<uint8_t>>();
+    moof_blob->swap(moof);
+    mdat_blob->swap(mdat);
+
+    Part part;
+    part.data.push_back(moof_blob);
+    part.data.push_back(mdat_blob);
+    part.size = moof_blob->size() + mdat_blob->size();
+    part.start_us = start_us;
+    part.duration_us = duration_us;
+    part.independent = key;
+
+    UpdateCallback callback;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (init == nullptr) {
+            init = std::make_shared<const std::vector<uint8_t>>(init_data);
+            base_pts_us = start_us;
+            // the first part is out at its end
+            availability_start_ms = wallMs() - duration_us / 1000;
+            queueIo(IoJob::IO_REPLACE, INIT_SEGMENT, std::vector<Blob>(1, init));
+        }
+
+        // time stamps of 1/fps do not add up to the duration exactly, a key frame just before it is on time
+        bool completed = false;
+        bool created = false;
+        if (segments.empty()
+            || (key && start_us - segments.back().start_us >= config.segment_duration_ms * 1000 * 9 / 10)) {
+            if (!segments.empty()) {
+                segments.back().complete = true;
+                completed = true;
+            }
+            Segment segment;
+            segment.number = next_number++;
+            segment.start_us = start_us;
+            segment.duration_us = 0;
+            segment.size = 0;
+            segment.complete = false;
+            segments.push_back(segment);
+            stats.segments++;
+            created = true;
+        }
+        Segment& segment = segments.back();
+        segment.parts.push_back(part);
+        segment.size += part.size;
+        segment.duration_us = start_us + duration_us - segment.start_us;
+        queueIo(IoJob::IO_APPEND, segmentName(segment.number), part.data, created);
+        stats.parts++;
+        stats.bytes += part.size;
+
+        while ((int)segments.size() > config.keep_segments) {
+            queueIo(IoJob::IO_UNLINK, segmentName(segments.front().number), std::vector<Blob>());
+            segments.pop_front();
+        }
+        // without parts the playlists only change with a finished segment
+        if (config.part_duration_ms > 0 || completed)
+            publish();
+        callback = update_cb;
+    }
+    if (callback)
+        callback();
+    return 0;
+}
+
+// With mtx held
+void CmafSegmenter::publish()
+{
+    // nothing to list yet, the file on disk stays as it is rather than go empty
+    if (config.hls) {
+        hls_playlist = buildHlsPlaylist();
+        if (hls_playlist)
+            queueIo(IoJob::IO_REPLACE, HLS_PLAYLIST, std::vector<Blob>(1, hls_playlist));
+    }
+    if (config.dash) {
+        dash_manifest = buildDashManifest();
+        if (dash_manifest)
+            queueIo(IoJob::IO_REPLACE, DASH_MANIFEST, std::vector<Blob>(1, dash_manifest));
+    }
+}
+
+CmafSegmenter::Blob CmafSegmenter::buildHlsPlaylist()
+{
+    bool low_latency = config.part_duration_ms > 0;
+    std::vector<const Segment*> list;
+    char line[256];
+
+    for (auto& segment : segments) {
+        if (segment.complete || low_latency)
+            list.push_back(&segment);
+    }
+    if ((int)list.size() > config.window_segments)
+        list.erase(list.begin(), list.end() - config.window_segments);
+    if (list.empty())
+        return nullptr;
+
+    int64_t target_us = config.segment_duration_ms * 1000;
+    for (const Segment* segment : list)
+        target_us = std::max(target_us, segment->duration_us);
+
+    std::string m3u8 = "#EXTM3U\n";
+    m3u8 += low_latency ? "#EXT-X-VERSION:9\n" : "#EXT-X-VERSION:7\n";
+    m3u8 += "#EXT-X-TARGETDURATION:" + std::to_string((target_us + 999999) / 1000000) + "\n";
+    if (low_latency) {
+        double part_target = config.part_duration_ms / 1000.0;
+        snprintf(line, sizeof(line), "#EXT-X-PART-INF:PART-TARGET=%.3f\n", part_target);
+        m3u8 += line;
+        snprintf(line, sizeof(line), "#EXT-X-SERVER-CONTROL:%sPART-HOLD-BACK=%.3f\n",
+                 config.block_reload ? "CAN-BLOCK-RELOAD=YES," : "", part_target * 3);
+        m3u8 += line;
+    }
+    m3u8 += "#EXT-X-MEDIA-SEQUENCE:" + std::to_string(list.front()->number) + "\n";
+    m3u8 += "#EXT-X-INDEPENDENT-SEGMENTS\n";
+    m3u8 += std::string("#EXT-X-MAP:URI=\"") + INIT_SEGMENT + "\"\n";
+
+    for (size_t i = 0; i < list.size(); i++) {
+        const Segment& segment = *list[i];
+        std::string name = segmentName(segment.number);
+        // parts are only listed for the last segments, where the players start
+        if (low_latency && i + 3 >= list.size()) {
+            size_t offset = 0;
+            for (auto& part : segment.parts) {
+                snprintf(line, sizeof(line), "#EXT-X-PART:DURATION=%.5f,URI=\"%s\",BYTERANGE=\"%zu@%zu\"%s\n",
+                         part.duration_us / 1000000.0, name.c_str(), part.size, offset,
+                         part.independent ? ",INDEPENDENT=YES" : "");
+                m3u8 += line;
+                offset += part.size;
+            }
+        }
+        if (segment.complete) {
+            snprintf(line, sizeof(line), "#EXTINF:%.5f,\n%s\n", segment.duration_us / 1000000.0, name.c_str());
+            m3u8 += line;
+        }
+    }
+
+    if (ended) {
+        m3u8 += "#EXT-X-ENDLIST\n";
+    } else if (low_latency) {
+        // the next part, usually of the same segment
+        const Segment& live = *list.back();
+        snprintf(line, sizeof(line), "#EXT-X-PRELOAD-HINT:TYPE=PART,URI=\"%s\",BYTERANGE-START=%zu\n",
+                 segmentName(live.number).c_str(), live.size);
+        m3u8 += line;
+    }
+    return makeBlob(m3u8);
+}
+
+std::string CmafSegmenter::codecString()
+{
+    std::vector<NalUnit> nals;
+    char str[64];
+
+    splitNalUnits(extra_data.data(), extra_data.size(), nals);
+    for (auto& nal : nals) {
+        int type = nalUnitType(nal.data, codec);
+        if (codec == MEDIA_CODEC_VIDEO_H264 && type == 7 && nal.size >= 4) {
+            snprintf(str, sizeof(str), "avc1.%02X%02X%02X", nal.data[1], nal.data[2], nal.data[3]);
+            return str;
+        }
+        if (codec == MEDIA_CODEC_VIDEO_H265 && type == 33) {
+            // profile_tier_level right after the first byte of the sps rbsp
+            uint8_t ptl[13];
+            size_t n = 0;
+            int zeros = 0;
+            for (size_t i = 2; i < nal.size && n < sizeof(ptl); i++) {
+                if (zeros >= 2 && nal.data[i] == 3) {
+                    zeros = 0;
+                    continue;
+                }
+                zeros = nal.data[i] == 0 ? zeros + 1 : 0;
+                ptl[n++] = nal.data[i];
+            }
+            if (n < sizeof(ptl))
+                break;
+            uint32_t compat = ((uint32_t)ptl[2] << 24) | (ptl[3] << 16) | (ptl[4] << 8) | ptl[5];
+            uint32_t reversed = 0;
+            for (int i = 0; i < 32; i++)
+                reversed |= ((compat >> i) & 1) << (31 - i);
+            snprintf(str, sizeof(str), "hvc1.%d.%X.%c%d.%02X", ptl[1] & 0x1f, reversed, (ptl[1] & 0x20) ? 'H' : 'L',
+                     ptl[12], ptl[6]);
+            return str;
+        }
+    }
+    return codec == MEDIA_CODEC_VIDEO_H265 ? "hvc1.1.6.L120.90" : "avc1.640028";
+}
+
+CmafSegmenter::Blob CmafSegmenter::buildDashManifest()
+{
+    bool low_latency = config.part_duration_ms > 0;
+    std::vector<const Segment*> list;
+    char line[512];
+
+    for (auto& segment : segments) {
+        if (segment.complete)
+            list.push_back(&segment);
+    }
+    if ((int)list.size() > config.window_segments)
+        list.erase(list.begin(), list.end() - config.window_segments);
+    if (list.empty())
+        return nullptr;
+
+    uint64_t bytes = 0;
+    int64_t duration_us = 0;
+    for (const Segment* segment : list) {
+        bytes += segment->size;
+        duration_us += segment->duration_us;
+    }
+    uint64_t bandwidth = duration_us > 0 ? bytes * 8 * 1000000 / duration_us : DEFAULT_BANDWIDTH;
+    double segment_s = config.segment_duration_ms / 1000.0;
+    int64_t now_ms = wallMs();
+
+    std::string mpd = "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n";
+    if (ended) {
+        int64_t end_us = list.back()->start_us + list.back()->duration_us - base_pts_us;
+        snprintf(line, sizeof(line),
+                 "<MPD xmlns=\"urn:mpeg:dash:schema:mpd:2011\" profiles=\"urn:mpeg:dash:profile:isoff-live:2011\" "
+                 "type=\"static\" mediaPresentationDuration=\"PT%.3fS\" minBufferTime=\"PT%.3fS\">\n",
+                 end_us / 1000000.0, segment_s);
+    } else {
+        snprintf(line, sizeof(line),
+                 "<MPD xmlns=\"urn:mpeg:dash:schema:mpd:2011\" profiles=\"urn:mpeg:dash:profile:isoff-live:2011\" "
+                 "type=\"dynamic\" availabilityStartTime=\"%s\" publishTime=\"%s\" minimumUpdatePeriod=\"PT%.3fS\" "
+                 "minBufferTime=\"PT%.3fS\" timeShiftBufferDepth=\"PT%.3fS\">\n",
+                 isoTime(availability_start_ms).c_str(), isoTime(now_ms).c_str(), segment_s, segment_s,
+                 segment_s * config.window_segments);
+    }
+    mpd += line;
+    if (low_latency && !ended) {
+        snprintf(line, sizeof(line),
+                 "  <ServiceDescription id=\"0\"><Latency target=\"%" PRId64 "\" max=\"%" PRId64
+                 "\"/></ServiceDescription>\n",
+                 config.part_duration_ms * 3, config.segment_duration_ms * 2);
+        mpd += line;
+    }
+    mpd += "  <Period id=\"0\" start=\"PT0S\">\n";
+    mpd += "    <AdaptationSet id=\"0\" contentType=\"video\" mimeType=\"video/mp4\" segmentAlignment=\"true\" "
+           "startWithSAP=\"1\">\n";
+    snprintf(line, sizeof(line),
+             "      <Representation id=\"0\" codecs=\"%s\" width=\"%d\" height=\"%d\" bandwidth=\"%" PRIu64 "\">\n",
+             codecString().c_str(), width, height, bandwidth);
+    mpd += line;
+    // a low latency player fetches the live segment (chunked) once its first part is out
+    std::string availability;
+    if (low_latency && !ended) {
+        snprintf(line, sizeof(line), " availabilityTimeOffset=\"%.3f\" availabilityTimeComplete=\"false\"",
+                 (config.segment_duration_ms - config.part_duration_ms) / 1000.0);
+        availability = line;
+    }
+    snprintf(line, sizeof(line),
+             "        <SegmentTemplate timescale=\"%u\" initialization=\"%s\" media=\"seg$Number$.m4s\" "
+             "startNumber=\"%u\"%s>\n",
+             Fmp4Muxer::TIMESCALE, INIT_SEGMENT, list.front()->number, availability.c_str());
+    mpd += line;
+    mpd += "          <SegmentTimeline>\n";
+    for (const Segment* segment : list) {
+        int64_t t = (segment->start_us - base_pts_us) * Fmp4Muxer::TIMESCALE / 1000000;
+        int64_t end = (segment->start_us + segment->duration_us - base_pts_us) * Fmp4Muxer::TIMESCALE / 1000000;
+        snprintf(line, sizeof(line), "            <S t=\"%" PRId64 "\" d=\"%" PRId64 "\"/>\n", t, end - t);
+        mpd += line;
+    }
+    mpd += "          </SegmentTimeline>\n";
+    mpd += "        </SegmentTemplate>\n";
+    mpd += "      </Representation>\n";
+    mpd += "    </AdaptationSet>\n";
+    mpd += "  </Period>\n";
+    if (!ended) {
+        snprintf(line, sizeof(line), "  <UTCTiming schemeIdUri=\"urn:mpeg:dash:utc:direct:2014\" value=\"%s\"/>\n",
+                 isoTime(now_ms).c_str());
+        mpd += line;
+    }
+    mpd += "</MPD>\n";
+    return makeBlob(mpd);
+}
+
+CmafSegmenter::Blob CmafSegmenter::getInit()
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    return init;
+}
+
+CmafSegmenter::Blob CmafSegmenter::getHlsPlaylist()
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    return hls_playlist;
+}
+
+CmafSegmenter::Blob CmafSegmenter::getDashManifest()
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    return dash_manifest;
+}
+
+bool CmafSegmenter::getSegment(uint32_t number, Segment& segment)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    if (segments.empty() || number < segments.front().number || number > segments.back().number)
+        return false;
+    segment = segments[number - segments.front().number];
+    return true;
+}
+
+bool CmafSegmenter::hasPart(uint32_t number, int part)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    if (ended)
+        return true;
+    if (segments.empty() || number > segments.back().number)
+        return false;
+    // gone already, there is nothing to wait for
+    if (number < segments.front().number)
+        return true;
+    const Segment& segment = segments[number - segments.front().number];
+    return segment.complete || (part >= 0 && (int)segment.parts.size() > part);
+}
+
+uint32_t CmafSegmenter::getLiveSegment()
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    return segments.empty() ? 0 : segments.back().number;
+}
+
+bool CmafSegmenter::isEnded()
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    return ended;
+}
+
+CmafSegmenter::Stats CmafSegmenter::getStats()
+{
+    Stats s;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        s = stats;
+    }
+    std::lock_guard<std::mutex> lock(io_mtx);
+    s.io_queue = io_jobs.size();
+    return s;
+}
+
+void CmafSegmenter::queueIo(IoJob::Type type, const std::string& name, const std::vector<Blob>& data, bool first)
+{
+    if (io_thread == NULL)
+        return;
+    IoJob job;
+    job.type = type;
+    job.path = config.dir + "/" + name;
+    job.data = data;
+    job.first = first;
+    std::lock_guard<std::mutex> lock(io_mtx);
+    io_jobs.push_back(std::move(job));
+    io_cv.notify_one();
+}
+
+static int writeBlobs(int fd, const std::vector<CmafSegmenter::Blob>& data)
+{
+    for (auto& blob : data) {
+        size_t done = 0;
+        while (blob && done < blob->size()) {
+            ssize_t n = write(fd, blob->data() + done, blob->size() - done);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                return -1;
+            done += n;
+        }
+    }
+    return 0;
+}
+
+void CmafSegmenter::ioLoop()
+{
+    while (true) {
+        IoJob job;
+        {
+            std::unique_lock<std::mutex> lock(io_mtx);
+            io_cv.wait(lock, [this] { return !io_jobs.empty() || !io_running; });
+            // the queue is drained before the thread exits
+            if (io_jobs.empty())
+                return;
+            job = std::move(io_jobs.front());
+            io_jobs.pop_front();
+        }
+
+        int ret = 0;
+        if (job.type == IoJob::IO_UNLINK) {
+            if (unlink(job.path.c_str()) < 0 && errno != ENOENT)
+                ret = -1;
+        } else if (job.type == IoJob::IO_APPEND) {
+            // the segment numbers start at 1 in every run
+            int flags = O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC | (job.first ? O_TRUNC : 0);
+            int fd = ::open(job.path.c_str(), flags, 0644);
+            ret = fd < 0 ? -1 : writeBlobs(fd, job.data);
+            if (fd >= 0)
+                ::close(fd);
+        } else {
+            // readers see the old or the new file, never a partial one
+            std::string tmp = job.path + ".tmp";
+            int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            ret = fd < 0 ? -1 : writeBlobs(fd, job.data);
+            if (fd >= 0)
+                ::close(fd);
+            if (ret == 0 && rename(tmp.c_str(), job.path.c_str()) < 0)
+                ret = -1;
+        }
+        if (ret < 0) {
+            ff_warn("CmafSegmenter: %s failed: %s\n", job.path.c_str(), strerror(errno));
+            std::lock_guard<std::mutex> lock(mtx);
+            stats.io_errors++;
+        }
+    }
+}
+
+}  // namespace FFMedia
@@ -0,0 +1,662 @@
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "base/ff_clock.hpp"
+#include "base/ff_cmaf_server.hpp"
+#include "base/ff_log.h"
+
+namespace FFMedia
+{
+#define SERVER_MAX_EVENTS 128
+#define SERVER_TICK_MS 200
+#define CLIENT_BUFFER_SIZE (16 << 10)
+#define SERVER_MAX_IOV 64
+#define HOLD_SEGMENTS 3
+
+static int64_t queryValue(const std::string& query, const char* key)
+{
+    size_t len = strlen(key);
+    size_t pos = 0;
+    while (pos < query.size()) {
+        size_t next = query.find('&', pos);
+        if (next == std::string::npos)
+            next = query.size();
+        if (next - pos > len && query.compare(pos, len, key) == 0 && query[pos + len] == '=')
+            return strtoll(query.c_str() + pos + len + 1, NULL, 10);
+        pos = next + 1;
+    }
+    return -1;
+}
+
+// "bytes=<start>-[<end>]", one range only
+static bool parseRange(const std::string& value, size_t* start, size_t* end)
+{
+    if (value.compare(0, 6, "bytes=") != 0 || value.find(',') != std::string::npos)
+        return false;
+    const char* p = value.c_str() + 6;
+    char* next = NULL;
+    if (*p < '0' || *p > '9')
+        return false;
+    *start = strtoull(p, &next, 10);
+    if (*next != '-')
+        return false;
+    next++;
+    *end = (*next >= '0' && *next <= '9') ? strtoull(next, NULL, 10) : SIZE_MAX;
+    return *end >= *start;
+}
+
+CmafHttpServer::CmafHttpServer(const Config& config_)
+    : config(config_), listen_fd(-1), epfd(-1), evfd(-1), thread(NULL), running(false)
+{
+    memset(&stats, 0, sizeof(stats));
+}
+
+CmafHttpServer::CmafHttpServer()
+    : CmafHttpServer(Config())
+{
+}
+
+CmafHttpServer::~CmafHttpServer()
+{
+    stop();
+    std::lock_guard<std::mutex> lock(streams_mtx);
+    for (auto& it : streams)
+        it.second->setUpdateCallback(nullptr);
+}
+
+int CmafHttpServer::start()
+{
+    if (running)
+        return 0;
+
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(config.port);
+    listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    int one = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (listen_fd < 0 || bind(listen_fd, (sockaddr*)&addr, sizeof(addr)) < 0 || listen(listen_fd, 128) < 0) {
+        ff_error("http server listen on port %u failed, reason = %s\n", config.port, strerror(errno));
+        stop();
+        return -1;
+    }
+
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    evfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    int fds[2] = {listen_fd, evfd};
+    for (int fd : fds) {
+        epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.fd = fd;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+    }
+
+    running = true;
+    thread = new std::thread(&CmafHttpServer::loop, this);
+    ff_info("http server listen on port %u\n", config.port);
+    return 0;
+}
+
+void CmafHttpServer::stop()
+{
+    if (thread) {
+        running = false;
+        wake();
+        thread->join();
+        delete thread;
+        thread = NULL;
+    }
+
+    while (!clients.empty())
+        closeClient(clients.begin()->second.get());
+    int* fds[3] = {&listen_fd, &epfd, &evfd};
+    for (int* fd : fds) {
+        if (*fd >= 0)
+            close(*fd);
+        *fd = -1;
+    }
+}
+
+void CmafHttpServer::wake()
+{
+    uint64_t one = 1;
+    if (evfd >= 0 && write(evfd, &one, sizeof(one)) < 0) {
+    }
+}
+
+int CmafHttpServer::addStream(const std::string& prefix, std::shared_ptr<CmafSegmenter> segmenter)
+{
+    std::string path = prefix;
+    if (path.empty() || path[0] != '/')
+        path = "/" + path;
+    while (path.size() > 1 && path.back() == '/')
+        path.pop_back();
+
+    std::lock_guard<std::mutex> lock(streams_mtx);
+    if (segmenter == nullptr || streams.count(path)) {
+        ff_error("http stream %s already exists\n", path.c_str());
+        return -1;
+    }
+    streams[path] = segmenter;
+    segmenter->setUpdateCallback([this] { wake(); });
+    return 0;
+}
+
+void CmafHttpServer::removeStream(const std::string& prefix)
+{
+    std::string path = prefix;
+    if (path.empty() || path[0] != '/')
+        path = "/" + path;
+    while (path.size() > 1 && path.back() == '/')
+        path.pop_back();
+
+    std::lock_guard<std::mutex> lock(streams_mtx);
+    auto it = streams.find(path);
+    if (it == streams.end())
+        return;
+    // requests in flight keep their segmenter
+    it->second->setUpdateCallback(nullptr);
+    streams.erase(it);
+}
+
+CmafHttpServer::Stats CmafHttpServer::getStats()
+{
+    std::lock_guard<std::mutex> lock(stats_mtx);
+    return stats;
+}
+
+void CmafHttpServer::queue(Client* client, const CmafSegmenter::Blob& blob, size_t pos, size_t end)
+{
+    if (blob && end > pos)
+        client->tx.push_back({blob, pos, end});
+}
+
+void CmafHttpServer::queue(Client* client, const std::string& text)
+{
+    CmafSegmenter::Blob blob = std::make_shared<const std::vector<uint8_t>>(text.begin(), text.end());
+    queue(client, blob, 0, blob->size());
+}
+
+void CmafHttpServer::reply(Client* client, int status, const char* reason, const std::string& headers)
+{
+    std::string msg = "HTTP/1.1 " + std::to_string(status) + " " + reason
+                      + "\r\nServer: ff_media\r\nAccess-Control-Allow-Origin: *\r\n" + headers;
+    if (!client->request.keep_alive)
+        msg += "Connection: close\r\n";
+    msg += "\r\n";
+    queue(client, msg);
+    if (status == 404) {
+        std::lock_guard<std::mutex> lock(stats_mtx);
+        stats.not_found++;
+    }
+}
+
+void CmafHttpServer::replyEmpty(Client* client, int status, const char* reason)
+{
+    reply(client, status, reason, "Content-Length: 0\r\n");
+}
+
+void CmafHttpServer::replyBlob(Client* client, const char* type, const char* cache, const CmafSegmenter::Blob& blob)
+{
+    if (blob == nullptr) {
+        replyEmpty(client, 404, "Not Found");
+        return;
+    }
+    reply(client, 200, "OK",
+          std::string("Content-Type: ") + type + "\r\nCache-Control: " + cache
+              + "\r\nContent-Length: " + std::to_string(blob->size()) + "\r\n");
+    if (!client->request.head)
+        queue(client, blob, 0, blob->size());
+}
+
+void CmafHttpServer::queueRange(Client* client, const CmafSegmenter::Segment& segment, size_t start, size_t end)
+{
+    size_t offset = 0;
+    for (auto& part : segment.parts) {
+        for (auto& blob : part.data) {
+            size_t blob_end = offset + blob->size();
+            if (blob_end > start && offset < end)
+                queue(client, blob, std::max(start, offset) - offset, std::min(end, blob_end) - offset);
+            offset = blob_end;
+        }
+    }
+}
+
+bool CmafHttpServer::sendChunkedParts(Client* client)
+{
+    CmafSegmenter::Segment segment;
+    if (!client->request.stream->getSegment(client->segment, segment)) {
+        // fell out of the window, end the body early
+        queue(client, "0\r\n\r\n");
+        return true;
+    }
+    char size[32];
+    for (size_t i = client->parts_sent; i < segment.parts.size(); i++) {
+        const CmafSegmenter::Part& part = segment.parts[i];
+        snprintf(size, sizeof(size), "%zx\r\n", part.size);
+        queue(client, size);
+        for (auto& blob : part.data)
+            queue(client, blob, 0, blob->size());
+        queue(client, "\r\n");
+    }
+    client->parts_sent = segment.parts.size();
+    if (segment.complete)
+        queue(client, "0\r\n\r\n");
+    return segment.complete;
+}
+
+bool CmafHttpServer::serveSegment(Client* client, uint32_t number)
+{
+    Request& req = client->request;
+    CmafSegmenter::Segment segment;
+    if (!req.stream->getSegment(number, segment)) {
+        // a player with availabilityTimeOffset may ask for the next one a little early
+        uint32_t live = req.stream->getLiveSegment();
+        if (number == live + 1 && !req.stream->isEnded())
+            return false;
+        replyEmpty(client, 404, "Not Found");
+        return true;
+    }
+
+    if (req.range) {
+        if (req.range_start >= segment.size || (!segment.complete && req.range_end != SIZE_MAX
+                                                && req.range_end >= segment.size)) {
+            if (!segment.complete)
+                return false;
+            reply(client, 416, "Range Not Satisfiable",
+                  "Content-Range: bytes */" + std::to_string(segment.size) + "\r\nContent-Length: 0\r\n");
+            return true;
+        }
+        // an open range of the live segment gets what is there, the part of a preload hint
+        size_t end = std::min(req.range_end, segment.size - 1) + 1;
+        std::string total = segment.complete ? std::to_string(segment.size) : "*";
+        reply(client, 206, "Partial Content",
+              "Content-Type: video/mp4\r\nCache-Control: max-age=60\r\nContent-Range: bytes "
+                  + std::to_string(req.range_start) + "-" + std::to_string(end - 1) + "/" + total
+                  + "\r\nContent-Length: " + std::to_string(end - req.range_start) + "\r\n");
+        if (!req.head)
+            queueRange(client, segment, req.range_start, end);
+        return true;
+    }
+
+    if (segment.complete) {
+        reply(client, 200, "OK",
+              "Content-Type: video/mp4\r\nCache-Control: max-age=60\r\nContent-Length: " + std::to_string(segment.size)
+                  + "\r\n");
+        if (!req.head)
+            queueRange(client, segment, 0, segment.size);
+        return true;
+    }
+
+    // the live segment, as its parts come
+    reply(client, 200, "OK", "Content-Type: video/mp4\r\nCache-Control: no-cache\r\nTransfer-Encoding: chunked\r\n");
+    if (req.head)
+        return true;
+    client->segment = number;
+    client->waiting = false;
+    client->streaming = true;
+    client->parts_sent = 0;
+    if (sendChunkedParts(client))
+        client->streaming = false;
+    return true;
+}
+
+bool CmafHttpServer::serve(Client* client, int64_t now_us)
+{
+    Request& req = client->request;
+    CmafSegmenter& stream = *req.stream;
+    uint32_t number = 0;
+    bool done = true;
+
+    if (req.name == CmafSegmenter::HLS_PLAYLIST) {
+        if (req.msn >= 0) {
+            uint32_t live = stream.getLiveSegment();
+            if (req.msn > live + 2) {
+                replyEmpty(client, 400, "Bad Request");
+            } else if (!stream.hasPart(req.msn, req.part)) {
+                done = false;
+            } else {
+                replyBlob(client, "application/vnd.apple.mpegurl", "no-cache", stream.getHlsPlaylist());
+            }
+        } else {
+            replyBlob(client, "application/vnd.apple.mpegurl", "no-cache", stream.getHlsPlaylist());
+        }
+    } else if (req.name == CmafSegmenter::DASH_MANIFEST) {
+        replyBlob(client, "application/dash+xml", "no-cache", stream.getDashManifest());
+    } else if (req.name == CmafSegmenter::INIT_SEGMENT) {
+        replyBlob(client, "video/mp4", "max-age=60", stream.getInit());
+    } else if (sscanf(req.name.c_str(), "seg%u.m4s", &number) == 1
+               && req.name == CmafSegmenter::segmentName(number)) {
+        done = serveSegment(client, number);
+    } else {
+        replyEmpty(client, 404, "Not Found");
+    }
+
+    if (!done) {
+        if (now_us < client->deadline_us)
+            return false;
+        replyEmpty(client, 503, "Service Unavailable");
+    }
+    if (!client->streaming)
+        finishRequest(client);
+    return true;
+}
+
+void CmafHttpServer::finishRequest(Client* client)
+{
+    client->waiting = false;
+    client->streaming = false;
+    client->request.stream.reset();
+    if (!client->request.keep_alive)
+        client->close_after = true;
+}
+
+void CmafHttpServer::onRequest(Client* client, const RtspMessage& msg, int64_t now_us)
+{
+    Request& req = client->request;
+    const std::string* connection = msg.header("Connection");
+    req.keep_alive = connection == NULL || strcasecmp(connection->c_str(), "close") != 0;
+    req.head = msg.method == "HEAD";
+    req.stream.reset();
+    req.msn = -1;
+    req.part = -1;
+    req.range = false;
+    {
+        std::lock_guard<std::mutex> lock(stats_mtx);
+        stats.requests++;
+    }
+
+    if (msg.method == "OPTIONS") {
+        reply(client, 204, "No Content", "Access-Control-Allow-Methods: GET, HEAD, OPTIONS\r\n"
+                                         "Access-Control-Allow-Headers: Range\r\nContent-Length: 0\r\n");
+        finishRequest(client);
+        return;
+    }
+    if (msg.method != "GET" && !req.head) {
+        replyEmpty(client, 405, "Method Not Allowed");
+        finishRequest(client);
+        return;
+    }
+
+    std::string uri = msg.uri;
+    size_t scheme = uri.find("://");
+    if (scheme != std::string::npos)
+        uri = uri.substr(std::min(uri.find('/', scheme + 3), uri.size()));
+    size_t mark = uri.find('?');
+    std::string query = mark == std::string::npos ? "" : uri.substr(mark + 1);
+    std::string path = uri.substr(0, mark);
+    size_t slash = path.rfind('/');
+    std::string prefix = slash == std::string::npos || slash == 0 ? "/" : path.substr(0, slash);
+    req.name = slash == std::string::npos ? path : path.substr(slash + 1);
+    {
+        std::lock_guard<std::mutex> lock(streams_mtx);
+        auto it = streams.find(prefix);
+        if (it != streams.end())
+            req.stream = it->second;
+    }
+    if (req.stream == nullptr) {
+        replyEmpty(client, 404, "Not Found");
+        finishRequest(client);
+        return;
+    }
+
+    req.msn = queryValue(query, "_HLS_msn");
+    req.part = req.msn >= 0 ? queryValue(query, "_HLS_part") : -1;
+    const std::string* range = msg.header("Range");
+    if (range)
+        req.range = parseRange(*range, &req.range_start, &req.range_end);
+
+    client->waiting = true;
+    client->deadline_us = now_us + req.stream->getSegmentDurationMs() * 1000 * HOLD_SEGMENTS;
+    if (!serve(client, now_us)) {
+        std::lock_guard<std::mutex> lock(stats_mtx);
+        stats.held++;
+    }
+}
+
+void CmafHttpServer::progress(Client* client, int64_t now_us)
+{
+    if (client->waiting) {
+        if (!serve(client, now_us))
+            return;
+    } else if (client->streaming) {
+        size_t sent = client->parts_sent;
+        if (sendChunkedParts(client))
+            finishRequest(client);
+        else if (client->parts_sent > sent)
+            client->deadline_us = now_us + client->request.stream->getSegmentDurationMs() * 1000 * HOLD_SEGMENTS;
+        else if (now_us >= client->deadline_us)
+            client->close_after = true;  // the stream stalled, the body can not be ended properly
+    } else {
+        return;
+    }
+    int fd = client->fd;
+    if (flushClient(client) < 0) {
+        closeClient(client);
+        return;
+    }
+    if (!client->waiting && !client->streaming) {
+        processRequests(client, now_us);
+        if (clients.count(fd) == 0)
+            return;
+    }
+}
+
+int CmafHttpServer::flushClient(Client* client)
+{
+    iovec iov[SERVER_MAX_IOV];
+
+    while (!client->tx.empty()) {
+        int count = 0;
+        for (auto it = client->tx.begin(); it != client->tx.end() && count < SERVER_MAX_IOV; ++it, ++count) {
+            iov[count].iov_base = (void*)(it->blob->data() + it->pos);
+            iov[count].iov_len = it->end - it->pos;
+        }
+        msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = count;
+        ssize_t n = sendmsg(client->fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            return -1;
+        }
+        {
+            std::lock_guard<std::mutex> lock(stats_mtx);
+            stats.bytes_sent += n;
+        }
+        while (n > 0) {
+            Chunk& chunk = client->tx.front();
+            size_t left = chunk.end - chunk.pos;
+            if ((size_t)n < left) {
+                chunk.pos += n;
+                break;
+            }
+            n -= left;
+            client->tx.pop_front();
+        }
+    }
+    if (client->tx.empty() && client->close_after)
+        return -1;
+    bool need_write = !client->tx.empty();
+    if (need_write != client->want_write) {
+        epoll_event ev;
+        ev.events = EPOLLIN | (need_write ? (uint32_t)EPOLLOUT : 0u);
+        ev.data.fd = client->fd;
+        epoll_ctl(epfd, EPOLL_CTL_MOD, client->fd, &ev);
+        client->want_write = need_write;
+    }
+    return 0;
+}
+
+void CmafHttpServer::closeClient(Client* client)
+{
+    int fd = client->fd;
+    if (epfd >= 0)
+        epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);
+    close(fd);
+    clients.erase(fd);
+    std::lock_guard<std::mutex> lock(stats_mtx);
+    stats.clients = clients.size();
+}
+
+void CmafHttpServer::acceptClients(int64_t now_us)
+{
+    while (true) {
+        int fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0)
+            return;
+        if ((int)clients.size() >= config.max_clients) {
+            ff_warn("http server is full, reject a client\n");
+            close(fd);
+            continue;
+        }
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        std::shared_ptr<Client> client = std::make_shared<Client>();
+        client->fd = fd;
+        client->rx.resize(CLIENT_BUFFER_SIZE);
+        client->rx_len = 0;
+        client->want_write = false;
+        client->last_active_us = now_us;
+        client->close_after = false;
+        client->waiting = false;
+        client->streaming = false;
+        client->request.keep_alive = true;
+        client->segment = 0;
+        client->parts_sent = 0;
+        client->deadline_us = 0;
+        clients[fd] = client;
+
+        epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.fd = fd;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+        std::lock_guard<std::mutex> lock(stats_mtx);
+        stats.clients = clients.size();
+    }
+}
+
+void CmafHttpServer::processRequests(Client* client, int64_t now_us)
+{
+    int fd = client->fd;
+    size_t pos = 0;
+    // pipelined requests wait for the answer of the one before
+    while (pos < client->rx_len && !client->waiting && !client->streaming && !client->close_after) {
+        RtspMessage msg;
+        int used = parseRtspMessage((const char*)client->rx.data() + pos, client->rx_len - pos, &msg);
+        if (used < 0 || (used > 0 && !msg.is_request)) {
+            closeClient(client);
+            return;
+        }
+        if (used == 0)
+            break;
+        pos += used;
+        client->last_active_us = now_us;
+        onRequest(client, msg, now_us);
+    }
+    memmove(client->rx.data(), client->rx.data() + pos, client->rx_len - pos);
+    client->rx_len -= pos;
+    if (flushClient(client) < 0) {
+        closeClient(client);
+        return;
+    }
+    if (clients.count(fd) && client->rx_len == client->rx.size())
+        closeClient(client);
+}
+
+void CmafHttpServer::onClientReadable(Client* client, int64_t now_us)
+{
+    int fd = client->fd;
+    while (clients.count(fd) && client->rx_len < client->rx.size()) {
+        ssize_t n = recv(client->fd, client->rx.data() + client->rx_len, client->rx.size() - client->rx_len, 0);
+        if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+            closeClient(client);
+            return;
+        }
+        if (n < 0)
+            return;
+        client->rx_len += n;
+        processRequests(client, now_us);
+    }
+}
+
+void CmafHttpServer::loop()
+{
+    epoll_event events[SERVER_MAX_EVENTS];
+    int64_t last_check = monotonicUs();
+
+    while (running) {
+        int n = epoll_wait(epfd, events, SERVER_MAX_EVENTS, SERVER_TICK_MS);
+        int64_t now_us = monotonicUs();
+        bool update = false;
+        for (int i = 0; i < n; i++) {
+            int fd = events[i].data.fd;
+            if (fd == evfd) {
+                uint64_t v;
+                if (read(evfd, &v, sizeof(v)) < 0) {
+                }
+                update = true;
+            } else if (fd == listen_fd) {
+                acceptClients(now_us);
+            } else {
+                auto it = clients.find(fd);
+                if (it == clients.end())
+                    continue;
+                Client* client = it->second.get();
+                if ((events[i].events & EPOLLOUT) && flushClient(client) < 0) {
+                    closeClient(client);
+                    continue;
+                }
+                if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+                    onClientReadable(client, now_us);
+            }
+        }
+
+        // new parts, or a held request may have run out of time
+        bool check = now_us - last_check >= SERVER_TICK_MS * 1000;
+        if (update || check) {
+            std::vector<int> busy;
+            for (auto& it : clients) {
+                if (it.second->waiting || it.second->streaming)
+                    busy.push_back(it.first);
+            }
+            for (int fd : busy) {
+                auto it = clients.find(fd);
+                if (it != clients.end())
+                    progress(it->second.get(), now_us);
+            }
+        }
+        if (check) {
+            last_check = now_us;
+            std::vector<Client*> expired;
+            for (auto& it : clients) {
+                Client* client = it.second.get();
+                if (!client->waiting && !client->streaming && client->tx.empty()
+                    && now_us - client->last_active_us > config.idle_timeout_s * 1000000ll)
+                    expired.push_back(client);
+            }
+            for (Client* client : expired)
+                closeClient(client);
+        }
+    }
+}
+
+}  // namespace FFMedia
@@ -0,0 +1,457 @@
+#include <string.h>
+
+#include "base/ff_bitstream.hpp"
+#include "base/ff_fmp4_muxer.hpp"
+#include "base/ff_log.h"
+
+namespace FFMedia
+{
+#define DEFAULT_FRAME_DURATION_US 40000
+#define DEFAULT_MAX_FRAGMENT_SIZE (16 << 20)
+
+// Sample flags of the trun box, sample_depends_on and sample_is_non_sync_sample.
+#define SAMPLE_FLAGS_SYNC 0x02000000
+#define SAMPLE_FLAGS_NON_SYNC 0x01010000
+
+namespace
+{
+class BoxWriter
+{
+public:
+    BoxWriter(std::vector<uint8_t>& buf)
+        : buf(buf) {}
+
+    void u8(uint32_t v) { buf.push_back(v); }
+    void u16(uint32_t v)
+    {
+        u8(v >> 8);
+        u8(v);
+    }
+    void u24(uint32_t v)
+    {
+        u8(v >> 16);
+        u16(v);
+    }
+    void u32(uint32_t v)
+    {
+        u16(v >> 16);
+        u16(v);
+    }
+    void u64(uint64_t v)
+    {
+        u32(v >> 32);
+        u32(v);
+    }
+    void zero(size_t n) { buf.insert(buf.end(), n, 0); }
+    void bytes(const void* data, size_t size) { buf.insert(buf.end(), (const uint8_t*)data, (const uint8_t*)data + size); }
+    void fourcc(const char* tag) { bytes(tag, 4); }
+
+    size_t begin(const char* type)
+    {
+        size_t pos = buf.size();
+        u32(0);
+        fourcc(type);
+        return pos;
+    }
+    size_t beginFull(const char* type, uint8_t version, uint32_t flags)
+    {
+        size_t pos = begin(type);
+        u8(version);
+        u24(flags);
+        return pos;
+    }
+    void end(size_t pos) { patch32(pos, buf.size() - pos); }
+    void patch32(size_t pos, uint32_t v)
+    {
+        buf[pos] = v >> 24;
+        buf[pos + 1] = v >> 16;
+        buf[pos + 2] = v >> 8;
+        buf[pos + 3] = v;
+    }
+    size_t size() const { return buf.size(); }
+
+    void matrix()
+    {
+        static const uint32_t unity[9] = {0x00010000, 0, 0, 0, 0x00010000, 0, 0, 0, 0x40000000};
+        for (uint32_t v : unity)
+            u32(v);
+    }
+
+private:
+    std::vector<uint8_t>& buf;
+};
+}  // namespace
+
+Fmp4Muxer::Fmp4Muxer(media_codec_t codec_, int width_, int height_)
+    : codec(codec_), width(width_), height(height_), fragment_duration_us(0), part_duration_us(0),
+      max_fragment_size(DEFAULT_MAX_FRAGMENT_SIZE), init_written(false), base_pts_us(0),
+      last_duration_us(DEFAULT_FRAME_DURATION_US), sequence(0), bytes_written(0)
+{
+}
+
+int64_t Fmp4Muxer::toTicks(int64_t pts_us) const
+{
+    return (pts_us - base_pts_us) * TIMESCALE / 1000000;
+}
+
+int Fmp4Muxer::output(const uint8_t* data, size_t size)
+{
+    if (write_cb && write_cb(data, size) < 0)
+        return -1;
+    bytes_written += size;
+    return 0;
+}
+
+std::vector<uint8_t>* Fmp4Muxer::parameterSetSlot(const uint8_t* nal)
+{
+    int type = nalUnitType(nal, codec);
+
+    if (codec == MEDIA_CODEC_VIDEO_H265) {
+        if (type == 32)
+            return &vps;
+        if (type == 33)
+            return &sps;
+        if (type == 34)
+            return &pps;
+    } else {
+        if (type == 7)
+            return &sps;
+        if (type == 8)
+            return &pps;
+    }
+    return NULL;
+}
+
+int Fmp4Muxer::setExtraData(const uint8_t* data, size_t size)
+{
+    std::vector<NalUnit> nals;
+    std::vector<uint8_t> sets;
+    if (isDecoderConfig(data, size)) {
+        parseDecoderConfig(data, size, codec, sets);
+        data = sets.data();
+        size = sets.size();
+    }
+    splitNalUnits(data, size, nals);
+    if (init_written) {
+        // the sample entry is out already, the next key frames carry the new sets
+        keepInBand(nals);
+        return 0;
+    }
+    for (auto& nal : nals) {
+        std::vector<uint8_t>* slot = parameterSetSlot(nal.data);
+        if (slot)
+            slot->assign(nal.data, nal.data + nal.size);
+    }
+    return sps.empty() || pps.empty() ? -1 : 0;
+}
+
+bool Fmp4Muxer::keepInBand(const std::vector<NalUnit>& nals)
+{
+    std::vector<uint8_t> sets;
+    bool changed = false;
+    for (auto& nal : nals) {
+        std::vector<uint8_t>* slot = parameterSetSlot(nal.data);
+        if (slot == NULL)
+            continue;
+        if (slot->size() != nal.size || memcmp(slot->data(), nal.data, nal.size) != 0)
+            changed = true;
+        BoxWriter(sets).u32(nal.size);
+        sets.insert(sets.end(), nal.data, nal.data + nal.size);
+    }
+    if (sets.empty())
+        return false;
+    if (!changed) {
+        // back to the ones of the sample entry
+        band_sets.clear();
+        return false;
+    }
+    if (band_sets != sets)
+        ff_info("parameter sets changed after the init segment, they go in band with the key frames\n");
+    band_sets.swap(sets);
+    return true;
+}
+
+int Fmp4Muxer::writeInitSegment()
+{
+    bool hevc = codec == MEDIA_CODEC_VIDEO_H265;
+    BoxWriter w(box);
+    size_t pos[8];
+
+    if (sps.size() < 4 || pps.empty() || (hevc && vps.empty())) {
+        ff_error("Fmp4Muxer: missing parameter sets\n");
+        return -1;
+    }
+
+    box.clear();
+    pos[0] = w.begin("ftyp");
+    w.fourcc("iso6");
+    w.u32(0);
+    w.fourcc("iso6");
+    w.fourcc("cmfc");
+    w.fourcc("isom");
+    w.fourcc("mp41");
+    w.end(pos[0]);
+
+    pos[0] = w.begin("moov");
+    pos[1] = w.beginFull("mvhd", 0, 0);
+    w.u32(0);
+    w.u32(0);
+    w.u32(1000);
+    w.u32(0);
+    w.u32(0x00010000);
+    w.u16(0x0100);
+    w.zero(10);
+    w.matrix();
+    w.zero(24);
+    w.u32(2);
+    w.end(pos[1]);
+
+    pos[1] = w.begin("trak");
+    pos[2] = w.beginFull("tkhd", 0, 3);
+    w.u32(0);
+    w.u32(0);
+    w.u32(1);
+    w.u32(0);
+    w.u32(0);
+    w.zero(8);
+    w.u16(0);
+    w.u16(0);
+    w.u16(0);
+    w.u16(0);
+    w.matrix();
+    w.u32(width << 16);
+    w.u32(height << 16);
+    w.end(pos[2]);
+
+    pos[2] = w.begin("mdia");
+    pos[3] = w.beginFull("mdhd", 0, 0);
+    w.u32(0);
+    w.u32(0);
+    w.u32(TIMESCALE);
+    w.u32(0);
+    w.u16(0x55c4);  // "und"
+    w.u16(0);
+    w.end(pos[3]);
+
+    pos[3] = w.beginFull("hdlr", 0, 0);
+    w.u32(0);
+    w.fourcc("vide");
+    w.zero(12);
+    w.bytes("VideoHandler", 13);
+    w.end(pos[3]);
+
+    pos[3] = w.begin("minf");
+    pos[4] = w.beginFull("vmhd", 0, 1);
+    w.zero(8);
+    w.end(pos[4]);
+    pos[4] = w.begin("dinf");
+    pos[5] = w.beginFull("dref", 0, 0);
+    w.u32(1);
+    pos[6] = w.beginFull("url ", 0, 1);
+    w.end(pos[6]);
+    w.end(pos[5]);
+    w.end(pos[4]);
+
+    pos[4] = w.begin("stbl");
+    pos[5] = w.beginFull("stsd", 0, 0);
+    w.u32(1);
+    pos[6] = w.begin(hevc ? "hvc1" : "avc1");
+    w.zero(6);
+    w.u16(1);
+    w.zero(16);
+    w.u16(width);
+    w.u16(height);
+    w.u32(0x00480000);
+    w.u32(0x00480000);
+    w.u32(0);
+    w.u16(1);
+    w.zero(32);
+    w.u16(0x0018);
+    w.u16(0xffff);
+
+    std::vector<uint8_t> record;
+    if (!buildDecoderConfig(codec, vps, sps, pps, record)) {
+        ff_error("Fmp4Muxer: invalid parameter sets\n");
+        return -1;
+    }
+    pos[7] = w.begin(hevc ? "hvcC" : "avcC");
+    w.bytes(record.data(), record.size());
+    w.end(pos[7]);
+    w.end(pos[6]);
+    w.end(pos[5]);
+
+    // the sample tables are empty, every sample lives in a fragment
+    const char* empty_tables[4] = {"stts", "stsc", "stsz", "stco"};
+    for (const char* type : empty_tables) {
+        pos[5] = w.beginFull(type, 0, 0);
+        if (strcmp(type, "stsz") == 0)
+            w.u32(0);
+        w.u32(0);
+        w.end(pos[5]);
+    }
+    w.end(pos[4]);
+    w.end(pos[3]);
+    w.end(pos[2]);
+    w.end(pos[1]);
+
+    pos[1] = w.begin("mvex");
+    pos[2] = w.beginFull("trex", 0, 0);
+    w.u32(1);
+    w.u32(1);
+    w.u32(0);
+    w.u32(0);
+    w.u32(0);
+    w.end(pos[2]);
+    w.end(pos[1]);
+    w.end(pos[0]);
+
+    if (output(box.data(), box.size()) < 0)
+        return -1;
+    init_written = true;
+    return 0;
+}
+
+int Fmp4Muxer::writeFragment(int64_t end_pts_us)
+{
+    BoxWriter w(box);
+    size_t moof, traf, trun, data_offset;
+
+    if (samples.empty())
+        return 0;
+    if (!init_written && writeInitSegment() < 0)
+        return -1;
+
+    box.clear();
+    sequence++;
+    moof = w.begin("moof");
+    size_t mfhd = w.beginFull("mfhd", 0, 0);
+    w.u32(sequence);
+    w.end(mfhd);
+
+    traf = w.begin("traf");
+    size_t tfhd = w.beginFull("tfhd", 0, 0x020000);  // default-base-is-moof
+    w.u32(1);
+    w.end(tfhd);
+    size_t tfdt = w.beginFull("tfdt", 1, 0);
+    w.u64(toTicks(samples[0].pts_us));
+    w.end(tfdt);
+
+    // data offset, duration, size and flags per sample
+    trun = w.beginFull("trun", 0, 0x000701);
+    w.u32(samples.size());
+    data_offset = w.size();
+    w.u32(0);
+    for (size_t i = 0; i < samples.size(); i++) {
+        int64_t next = i + 1 < samples.size() ? samples[i + 1].pts_us : end_pts_us;
+        // durations come from tick differences so rounding never accumulates
+        int64_t duration = toTicks(next) - toTicks(samples[i].pts_us);
+        if (duration <= 0)
+            duration = last_duration_us * TIMESCALE / 1000000;
+        w.u32(duration);
+        w.u32(samples[i].size);
+        w.u32(samples[i].key ? SAMPLE_FLAGS_SYNC : SAMPLE_FLAGS_NON_SYNC);
+    }
+    w.end(trun);
+    w.end(traf);
+    w.end(moof);
+    w.patch32(data_offset, w.size() - moof + 8);
+
+    w.u32(mdat.size() + 8);
+    w.fourcc("mdat");
+    if (fragment_cb) {
+        size_t capacity = mdat.capacity();
+        int64_t start_us = samples[0].pts_us;
+        bool key = samples[0].key;
+        bytes_written += box.size() + mdat.size();
+        if (fragment_cb(box, mdat, start_us, end_pts_us - start_us, key) < 0)
+            return -1;
+        box.clear();
+        mdat.clear();
+        mdat.reserve(capacity);
+    } else if (output(box.data(), box.size()) < 0 || output(mdat.data(), mdat.size()) < 0) {
+        return -1;
+    }
+
+    // clear() keeps the capacity, the next fragment reuses the buffers
+    samples.clear();
+    mdat.clear();
+    return 1;
+}
+
+int Fmp4Muxer::writeFrame(const uint8_t* data, size_t size, int64_t pts_us)
+{
+    std::vector<NalUnit> nals;
+    bool key = false;
+    int ret = 0;
+
+    if (splitNalUnits(data, size, nals) == 0)
+        return 0;
+
+    for (auto& nal : nals) {
+        int type = nalUnitType(nal.data, codec);
+        if (codec == MEDIA_CODEC_VIDEO_H265 ? (type >= 16 && type <= 21) : type == 5)
+            key = true;
+    }
+
+    bool first = !init_written && samples.empty();
+    if (first) {
+        // a fragment must start with a key frame
+        if (!key)
+            return 0;
+        base_pts_us = pts_us;
+        // the sample entry describes the sets of the first frame
+        for (auto& nal : nals) {
+            std::vector<uint8_t>* slot = parameterSetSlot(nal.data);
+            if (slot)
+                slot->assign(nal.data, nal.data + nal.size);
+        }
+    }
+
+    if (!samples.empty()) {
+        int64_t duration = pts_us - samples.back().pts_us;
+        if (duration > 0)
+            last_duration_us = duration;
+        bool cut = key && (fragment_duration_us == 0 || pts_us - samples[0].pts_us >= fragment_duration_us);
+        // a part ends before the frame that would make it longer than the part duration
+        if (part_duration_us > 0 && pts_us + last_duration_us - samples[0].pts_us > part_duration_us)
+            cut = true;
+        if (cut || mdat.size() >= max_fragment_size) {
+            ret = writeFragment(pts_us);
+            if (ret < 0)
+                return ret;
+        }
+    }
+
+    // length prefixed sample, parameter sets live in the sample entry and aud is dropped.
+    // Sets that differ from the sample entry's stay in band, and are repeated in every key
+    // frame until they change back, so a player may start at any fragment.
+    Sample sample = {pts_us, 0, key};
+    if (!first)
+        keepInBand(nals);
+    if (key && !band_sets.empty()) {
+        mdat.insert(mdat.end(), band_sets.begin(), band_sets.end());
+        sample.size += band_sets.size();
+    }
+    for (auto& nal : nals) {
+        int type = nalUnitType(nal.data, codec);
+        if (parameterSetSlot(nal.data))
+            continue;
+        if (codec == MEDIA_CODEC_VIDEO_H265 ? type == 35 : type == 9)
+            continue;
+        BoxWriter(mdat).u32(nal.size);
+        mdat.insert(mdat.end(), nal.data, nal.data + nal.size);
+        sample.size += 4 + nal.size;
+    }
+    if (sample.size > 0)
+        samples.push_back(sample);
+    return ret;
+}
+
+int Fmp4Muxer::flush()
+{
+    if (samples.empty())
+        return 0;
+    return writeFragment(samples.back().pts_us + last_duration_us);
+}
+
+}  // namespace FFMedia
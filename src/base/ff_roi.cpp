@@ -0,0 +1,269 @@
+#include <math.h>
+#include <string.h>
+
+#include <algorithm>
+#include <mutex>
+#include <unordered_map>
+
+#include "base/ff_roi.hpp"
+
+namespace FFMedia
+{
+QpMap::QpMap(int width_, int height_, int background_delta, int block_size_)
+    : width(width_), height(height_), block_size(block_size_), columns((width_ + block_size_ - 1) / block_size_),
+      rows((height_ + block_size_ - 1) / block_size_), background(background_delta)
+{
+    fill(background_delta);
+}
+
+void QpMap::fill(int qp_delta)
+{
+    background = std::max(-QP_DELTA_MAX, std::min(QP_DELTA_MAX, qp_delta));
+    deltas.assign(columns * rows, background);
+    in_region.assign(columns * rows, false);
+}
+
+void QpMap::addRegion(const RoiRegion& region, int margin)
+{
+    int x0 = std::max(0, region.x - margin) / block_size;
+    int y0 = std::max(0, region.y - margin) / block_size;
+    int x1 = std::min(width, region.x + region.width + margin);
+    int y1 = std::min(height, region.y + region.height + margin);
+    if (x1 <= 0 || y1 <= 0)
+        return;
+    x1 = (x1 - 1) / block_size;
+    y1 = (y1 - 1) / block_size;
+    int8_t delta = std::max(-QP_DELTA_MAX, std::min(QP_DELTA_MAX, region.qp_delta));
+
+    for (int row = y0; row <= y1; row++) {
+        for (int column = x0; column <= x1; column++) {
+            int i = row * columns + column;
+            if (!in_region[i] || delta < deltas[i])
+                deltas[i] = delta;
+            in_region[i] = true;
+        }
+    }
+}
+
+struct BufferMap {
+    std::shared_ptr<const QpMap> map;
+    int64_t pts;  // of the frame the map was set for
+};
+
+static std::mutex maps_mtx;
+// only the frames that carry a map have an entry
+static std::unordered_map<const MediaBuffer*, BufferMap> buffer_maps;
+
+void setBufferQpMap(const MediaBuffer* buffer, std::shared_ptr<const QpMap> map)
+{
+    std::lock_guard<std::mutex> lock(maps_mtx);
+    if (map)
+        buffer_maps[buffer] = {map, buffer->getPUstimestamp()};
+    else
+        buffer_maps.erase(buffer);
+}
+
+std::shared_ptr<const QpMap> getBufferQpMap(const MediaBuffer* buffer)
+{
+    std::lock_guard<std::mutex> lock(maps_mtx);
+    auto it = buffer_maps.find(buffer);
+    if (it == buffer_maps.end())
+        return nullptr;
+    // the producer filled the buffer again without a map
+    if (it->second.pts != buffer->getPUstimestamp()) {
+        buffer_maps.erase(it);
+        return nullptr;
+    }
+    return it->second.map;
+}
+
+// One plane of 8 bit samples step bytes apart (2 for the interleaved uv plane). A row of
+// the plane covers row_scale rows of the map.
+static void filterPlane(const uint8_t* src, uint8_t* dst, int stride, int width, int height, int step, int row_scale,
+                        const QpMap& map)
+{
+    std::vector<int> lines(3 * width);
+    int* h[3] = {&lines[0], &lines[width], &lines[2 * width]};
+    int bs = map.getBlockSize();
+
+    // horizontal [1 2 1] of row y into line
+    auto hpass = [&](int y, int* line) {
+        const uint8_t* s = src + y * stride;
+        for (int x = 0; x < width; x++) {
+            int l = x >= step ? s[x - step] : s[x];
+            int r = x + step < width ? s[x + step] : s[x];
+            line[x] = l + 2 * s[x] + r;
+        }
+    };
+
+    hpass(0, h[1]);
+    memcpy(h[0], h[1], width * sizeof(int));
+    for (int y = 0; y < height; y++) {
+        if (y + 1 < height)
+            hpass(y + 1, h[2]);
+        else
+            memcpy(h[2], h[1], width * sizeof(int));
+
+        const uint8_t* s = src + y * stride;
+        uint8_t* d = dst + y * stride;
+        int row = std::min(y * row_scale / bs, map.getRows() - 1);
+        for (int column = 0; column < map.getColumns(); column++) {
+            int x0 = column * bs;
+            int x1 = std::min(width, x0 + bs);
+            int strength = std::min(map.at(column, row), QP_DELTA_MAX);
+            if (strength <= 0) {
+                memcpy(d + x0, s + x0, x1 - x0);
+                continue;
+            }
+            for (int x = x0; x < x1; x++) {
+                int blur = (h[0][x] + 2 * h[1][x] + h[2][x] + 8) >> 4;
+                d[x] = s[x] + (blur - s[x]) * strength / QP_DELTA_MAX;
+            }
+        }
+        std::swap(h[0], h[1]);
+        std::swap(h[1], h[2]);
+    }
+}
+
+void filterNv12Roi(const uint8_t* src, uint8_t* dst, const ImagePara& para, const QpMap& map)
+{
+    size_t luma_size = para.hstride * para.vstride;
+    filterPlane(src, dst, para.hstride, para.width, para.height, 1, 1, map);
+    filterPlane(src + luma_size, dst + luma_size, para.hstride, para.width, para.height / 2, 2, 2, map);
+}
+
+static int blockSad(const uint8_t* a, const uint8_t* b, int stride, int size)
+{
+    int sad = 0;
+    for (int y = 0; y < size; y++, a += stride, b += stride) {
+        for (int x = 0; x < size; x++)
+            sad += abs(a[x] - b[x]);
+    }
+    return sad;
+}
+
+// Full pel small diamond search of the 16x16 block at (bx, by), started from the best of
+// the zero vector and the vectors of the left and upper blocks, *mvx/*mvy hold those.
+static void searchMotion(const uint8_t* cur, const uint8_t* ref, const ImagePara& para, int bx, int by, int* mvx,
+                         int* mvy)
+{
+    static const int dirs[4][2] = {{1, 0}, {-1, 0}, {0, 1}, {0, -1}};
+    const int range = 16;
+    int stride = para.hstride;
+    const uint8_t* block = cur + by * stride + bx;
+    // a vector has to pay for its bits, noise alone does not move a static block
+    auto cost = [&](int cx, int cy) {
+        if (abs(cx) > range || abs(cy) > range || bx + cx < 0 || by + cy < 0 || bx + cx + 16 > (int)para.width
+            || by + cy + 16 > (int)para.height)
+            return INT32_MAX;
+        return blockSad(block, ref + (by + cy) * stride + bx + cx, stride, 16) + 4 * (abs(cx) + abs(cy));
+    };
+
+    int x = 0, y = 0;
+    int best = cost(0, 0);
+    for (int i = 0; i < 2; i++) {
+        int c = cost(mvx[i], mvy[i]);
+        if (c < best) {
+            best = c;
+            x = mvx[i];
+            y = mvy[i];
+        }
+    }
+    for (int step = 0; step < range * 2 && best > 0; step++) {
+        int next_x = x, next_y = y;
+        for (auto& d : dirs) {
+            int c = cost(x + d[0], y + d[1]);
+            if (c < best) {
+                best = c;
+                next_x = x + d[0];
+                next_y = y + d[1];
+            }
+        }
+        if (next_x == x && next_y == y)
+            break;
+        x = next_x;
+        y = next_y;
+    }
+    *mvx = x;
+    *mvy = y;
+}
+
+size_t estimateFrameBits(const uint8_t* cur, const uint8_t* ref, const ImagePara& para, int qp, const QpMap* map)
+{
+    // 4 * qstep, the unnormalized hadamard has a gain of 4
+    static float scale[52];
+    static std::once_flag once;
+    std::call_once(once, [] {
+        for (int q = 0; q < 52; q++)
+            scale[q] = 1.0f / (4 * 0.625f * powf(2.0f, q / 6.0f));
+    });
+    // dead zone rounding, wider for inter blocks
+    const float rounding = ref ? 1.0f / 6 : 1.0f / 3;
+
+    size_t bits = 0;
+    int stride = para.hstride;
+    // the vectors of the row above, [column] = {x, y}
+    std::vector<int> above((para.width / 16 + 1) * 2, 0);
+    for (uint32_t my = 0; my + 16 <= para.height; my += 16) {
+        int left_x = 0, left_y = 0;
+        for (uint32_t mx = 0; mx + 16 <= para.width; mx += 16) {
+            int q = qp;
+            if (map)
+                q += map->at(mx / map->getBlockSize(), my / map->getBlockSize());
+            q = std::max(0, std::min(51, q));
+
+            int mvx = 0, mvy = 0;
+            size_t block_bits = 0;
+            bool coded = false;
+            if (ref) {
+                int* up = &above[mx / 16 * 2];
+                int cand_x[2] = {left_x, up[0]}, cand_y[2] = {left_y, up[1]};
+                searchMotion(cur, ref, para, mx, my, cand_x, cand_y);
+                mvx = left_x = up[0] = cand_x[0];
+                mvy = left_y = up[1] = cand_y[0];
+            }
+
+            for (uint32_t by = my; by < my + 16; by += 4) {
+                for (uint32_t bx = mx; bx < mx + 16; bx += 4) {
+                    int r[16];
+                    for (int y = 0; y < 4; y++) {
+                        const uint8_t* c = cur + (by + y) * stride + bx;
+                        const uint8_t* p = ref ? ref + (by + y + mvy) * stride + bx + mvx : NULL;
+                        for (int x = 0; x < 4; x++)
+                            r[y * 4 + x] = c[x] - (p ? p[x] : 128);
+                    }
+                    for (int i = 0; i < 4; i++) {
+                        int* v = r + i * 4;
+                        int a = v[0] + v[3], b = v[1] + v[2], c = v[0] - v[3], d = v[1] - v[2];
+                        v[0] = a + b;
+                        v[1] = c + d;
+                        v[2] = a - b;
+                        v[3] = c - d;
+                    }
+                    block_bits++;  // coded block flag
+                    for (int i = 0; i < 4; i++) {
+                        int a = r[i] + r[12 + i], b = r[4 + i] + r[8 + i];
+                        int c = r[i] - r[12 + i], d = r[4 + i] - r[8 + i];
+                        int coef[4] = {a + b, c + d, a - b, c - d};
+                        for (int k = 0; k < 4; k++) {
+                            int level = (int)(abs(coef[k]) * scale[q] + rounding);
+                            if (level > 0) {
+                                block_bits += 2 * (31 - __builtin_clz(level + 1)) + 2;
+                                coded = true;
+                            }
+                        }
+                    }
+                }
+            }
+            // a block without coefficients is a skip, or just its vector
+            if (!coded)
+                block_bits = ref ? 1 : 16;
+            if (mvx || mvy)
+                block_bits += 2 * (31 - __builtin_clz(abs(mvx) + abs(mvy) + 1)) + 4;
+            bits += block_bits;
+        }
+    }
+    return bits;
+}
+
+}  // namespace FFMedia
@@ -0,0 +1,443 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "base/ff_bitstream.hpp"
+#include "base/ff_rtmp.hpp"
+
+namespace FFMedia
+{
+#define AMF0_NUMBER 0x00
+#define AMF0_BOOLEAN 0x01
+#define AMF0_STRING 0x02
+#define AMF0_OBJECT 0x03
+#define AMF0_NULL 0x05
+#define AMF0_UNDEFINED 0x06
+#define AMF0_ECMA_ARRAY 0x08
+#define AMF0_OBJECT_END 0x09
+#define AMF0_STRICT_ARRAY 0x0a
+#define AMF0_DATE 0x0b
+#define AMF0_LONG_STRING 0x0c
+#define AMF0_MAX_DEPTH 16
+
+// Flv video tags
+#define FLV_FRAME_KEY 1
+#define FLV_FRAME_INTER 2
+#define FLV_CODEC_AVC 7
+#define FLV_AVC_SEQUENCE_HEADER 0
+#define FLV_AVC_NALU 1
+// Enhanced rtmp
+#define FLV_EX_HEADER 0x80
+#define FLV_EX_SEQUENCE_START 0
+#define FLV_EX_CODED_FRAMES 1
+#define FLV_EX_CODED_FRAMES_X 3
+
+bool parseRtmpUrl(const std::string& url, RtmpUrl* out)
+{
+    const std::string scheme = "rtmp://";
+    if (url.compare(0, scheme.size(), scheme) != 0)
+        return false;
+
+    std::string rest = url.substr(scheme.size());
+    size_t slash = rest.find('/');
+    if (slash == std::string::npos)
+        return false;
+    std::string authority = rest.substr(0, slash);
+    std::string path = rest.substr(slash + 1);
+
+    size_t colon = authority.rfind(':');
+    out->port = 1935;
+    if (colon != std::string::npos && authority.find(']', colon) == std::string::npos) {
+        out->port = atoi(authority.substr(colon + 1).c_str());
+        authority = authority.substr(0, colon);
+    }
+    if (authority.size() > 2 && authority.front() == '[' && authority.back() == ']')
+        authority = authority.substr(1, authority.size() - 2);
+    out->host = authority;
+
+    // the query belongs to the stream, "app/stream?key=..."
+    size_t query = path.find('?');
+    size_t last = path.rfind('/', query == std::string::npos ? std::string::npos : query);
+    if (last == std::string::npos)
+        return false;
+    out->app = path.substr(0, last);
+    out->stream = path.substr(last + 1);
+    out->tc_url = scheme + rest.substr(0, slash) + "/" + out->app;
+    return !out->host.empty() && out->port != 0 && !out->app.empty() && !out->stream.empty();
+}
+
+const Amf0Value* Amf0Value::get(const char* name) const
+{
+    for (auto& p : properties) {
+        if (p.first == name)
+            return &p.second;
+    }
+    return NULL;
+}
+
+namespace
+{
+class Amf0Reader
+{
+public:
+    Amf0Reader(const uint8_t* data, size_t size)
+        : p(data), end(data + size) {}
+
+    bool done() const { return p >= end; }
+
+    bool value(Amf0Value& v, int depth)
+    {
+        if (p >= end || depth > AMF0_MAX_DEPTH)
+            return false;
+        uint8_t marker = *p++;
+        switch (marker) {
+            case AMF0_NUMBER: {
+                if (end - p < 8)
+                    return false;
+                uint64_t bits = 0;
+                for (int i = 0; i < 8; i++)
+                    bits = (bits << 8) | *p++;
+                memcpy(&v.number, &bits, 8);
+                v.type = Amf0Value::NUMBER;
+                return true;
+            }
+            case AMF0_BOOLEAN:
+                if (p >= end)
+                    return false;
+                v.boolean = *p++ != 0;
+                v.type = Amf0Value::BOOLEAN;
+                return true;
+            case AMF0_STRING:
+                v.type = Amf0Value::STRING;
+                return string(v.string, 2);
+            case AMF0_LONG_STRING:
+                v.type = Amf0Value::STRING;
+                return string(v.string, 4);
+            case AMF0_NULL:
+                v.type = Amf0Value::NUL;
+                return true;
+            case AMF0_UNDEFINED:
+                v.type = Amf0Value::UNDEFINED;
+                return true;
+            case AMF0_ECMA_ARRAY:
+                if (end - p < 4)
+                    return false;
+                p += 4;
+            // fall through
+            case AMF0_OBJECT:
+                v.type = Amf0Value::OBJECT;
+                while (true) {
+                    std::string name;
+                    if (!string(name, 2))
+                        return false;
+                    if (name.empty() && p < end && *p == AMF0_OBJECT_END) {
+                        p++;
+                        return true;
+                    }
+                    v.properties.push_back(std::make_pair(name, Amf0Value()));
+                    if (!value(v.properties.back().second, depth + 1))
+                        return false;
+                }
+            case AMF0_STRICT_ARRAY: {
+                if (end - p < 4)
+                    return false;
+                uint32_t count = (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+                p += 4;
+                v.type = Amf0Value::OBJECT;
+                for (uint32_t i = 0; i < count; i++) {
+                    v.properties.push_back(std::make_pair(std::to_string(i), Amf0Value()));
+                    if (!value(v.properties.back().second, depth + 1))
+                        return false;
+                }
+                return true;
+            }
+            case AMF0_DATE:
+                if (end - p < 10)
+                    return false;
+                p += 10;
+                v.type = Amf0Value::UNDEFINED;
+                return true;
+            default:
+                return false;
+        }
+    }
+
+private:
+    bool string(std::string& s, int length_size)
+    {
+        if (end - p < length_size)
+            return false;
+        size_t len = 0;
+        for (int i = 0; i < length_size; i++)
+            len = (len << 8) | *p++;
+        if ((size_t)(end - p) < len)
+            return false;
+        s.assign((const char*)p, len);
+        p += len;
+        return true;
+    }
+
+    const uint8_t* p;
+    const uint8_t* end;
+};
+
+void put16(std::vector<uint8_t>& buf, uint32_t v)
+{
+    buf.push_back(v >> 8);
+    buf.push_back(v);
+}
+
+void put24(std::vector<uint8_t>& buf, uint32_t v)
+{
+    buf.push_back(v >> 16);
+    put16(buf, v);
+}
+
+void put32(std::vector<uint8_t>& buf, uint32_t v)
+{
+    put16(buf, v >> 16);
+    put16(buf, v);
+}
+}  // namespace
+
+bool parseAmf0(const uint8_t* data, size_t size, std::vector<Amf0Value>& values)
+{
+    Amf0Reader reader(data, size);
+    values.clear();
+    while (!reader.done()) {
+        values.push_back(Amf0Value());
+        if (!reader.value(values.back(), 0))
+            return false;
+    }
+    return true;
+}
+
+void Amf0Writer::number(double v)
+{
+    uint64_t bits;
+    memcpy(&bits, &v, 8);
+    buf.push_back(AMF0_NUMBER);
+    put32(buf, bits >> 32);
+    put32(buf, bits);
+}
+
+void Amf0Writer::boolean(bool v)
+{
+    buf.push_back(AMF0_BOOLEAN);
+    buf.push_back(v ? 1 : 0);
+}
+
+void Amf0Writer::string(const std::string& v)
+{
+    buf.push_back(AMF0_STRING);
+    put16(buf, v.size());
+    buf.insert(buf.end(), v.begin(), v.end());
+}
+
+void Amf0Writer::null()
+{
+    buf.push_back(AMF0_NULL);
+}
+
+void Amf0Writer::objectBegin()
+{
+    buf.push_back(AMF0_OBJECT);
+}
+
+void Amf0Writer::key(const std::string& name)
+{
+    put16(buf, name.size());
+    buf.insert(buf.end(), name.begin(), name.end());
+}
+
+void Amf0Writer::objectEnd()
+{
+    put16(buf, 0);
+    buf.push_back(AMF0_OBJECT_END);
+}
+
+void writeRtmpChunks(std::vector<uint8_t>& out, uint32_t csid, uint8_t type, uint32_t stream_id, uint32_t timestamp,
+                     const uint8_t* payload, size_t size, size_t chunk_size)
+{
+    bool extended = timestamp >= 0xffffff;
+    out.reserve(out.size() + size + 16 + size / chunk_size * 5);
+
+    out.push_back(csid & 0x3f);
+    put24(out, extended ? 0xffffff : timestamp);
+    put24(out, size);
+    out.push_back(type);
+    // the message stream id is little endian
+    for (int i = 0; i < 4; i++)
+        out.push_back(stream_id >> (8 * i));
+    if (extended)
+        put32(out, timestamp);
+
+    for (size_t pos = 0;;) {
+        size_t n = std::min(chunk_size, size - pos);
+        out.insert(out.end(), payload + pos, payload + pos + n);
+        pos += n;
+        if (pos >= size)
+            break;
+        out.push_back(0xc0 | (csid & 0x3f));
+        if (extended)
+            put32(out, timestamp);
+    }
+}
+
+int RtmpChunkReader::feed(const uint8_t* data, size_t size, std::vector<RtmpMessage>& messages)
+{
+    static const size_t header_sizes[4] = {11, 7, 3, 0};
+    size_t used = 0;
+
+    while (used < size) {
+        const uint8_t* p = data + used;
+        size_t left = size - used;
+        uint8_t fmt = p[0] >> 6;
+        uint32_t csid = p[0] & 0x3f;
+        size_t pos = 1;
+        if (csid == 0) {
+            if (left < 2)
+                break;
+            csid = 64 + p[1];
+            pos = 2;
+        } else if (csid == 1) {
+            if (left < 3)
+                break;
+            csid = 64 + p[1] + p[2] * 256;
+            pos = 3;
+        }
+        if (left < pos + header_sizes[fmt])
+            break;
+
+        Stream& s = streams[csid];
+        const uint8_t* h = p + pos;
+        uint32_t ts_field = 0;
+        uint32_t length = s.length;
+        uint8_t type = s.type;
+        uint32_t stream_id = s.stream_id;
+        if (fmt <= 2)
+            ts_field = (h[0] << 16) | (h[1] << 8) | h[2];
+        if (fmt <= 1) {
+            length = (h[3] << 16) | (h[4] << 8) | h[5];
+            type = h[6];
+        }
+        if (fmt == 0)
+            stream_id = h[7] | (h[8] << 8) | (h[9] << 16) | ((uint32_t)h[10] << 24);
+        pos += header_sizes[fmt];
+
+        bool extended = fmt <= 2 ? ts_field == 0xffffff : s.extended;
+        if (extended) {
+            if (left < pos + 4)
+                break;
+            ts_field = ((uint32_t)p[pos] << 24) | (p[pos + 1] << 16) | (p[pos + 2] << 8) | p[pos + 3];
+            pos += 4;
+        }
+
+        bool first = s.payload.empty();
+        if (!first && fmt != 3)
+            return -1;
+        size_t n = std::min(chunk_size, (size_t)length - s.payload.size());
+        if (left < pos + n)
+            break;
+
+        // the whole chunk is here, commit it
+        if (first) {
+            if (fmt == 0) {
+                s.timestamp = ts_field;
+                s.delta = 0;
+            } else {
+                if (fmt != 3)
+                    s.delta = ts_field;
+                s.timestamp += s.delta;
+            }
+            s.length = length;
+            s.type = type;
+            s.stream_id = stream_id;
+            s.extended = extended;
+            s.payload.reserve(length);
+        }
+        s.payload.insert(s.payload.end(), p + pos, p + pos + n);
+        used += pos + n;
+
+        if (s.payload.size() >= s.length) {
+            RtmpMessage msg;
+            msg.type = s.type;
+            msg.stream_id = s.stream_id;
+            msg.timestamp = s.timestamp;
+            msg.payload.swap(s.payload);
+            if (msg.type == RTMP_MSG_SET_CHUNK_SIZE && msg.payload.size() >= 4) {
+                const uint8_t* v = msg.payload.data();
+                size_t next = (((uint32_t)v[0] << 24) | (v[1] << 16) | (v[2] << 8) | v[3]) & 0x7fffffff;
+                if (next == 0)
+                    return -1;
+                chunk_size = next;
+            }
+            messages.push_back(std::move(msg));
+        }
+    }
+    return used;
+}
+
+std::vector<uint8_t> rtmpControlPayload(uint32_t value)
+{
+    std::vector<uint8_t> payload;
+    put32(payload, value);
+    return payload;
+}
+
+std::vector<uint8_t> rtmpUserControlPayload(uint16_t event, uint32_t value)
+{
+    std::vector<uint8_t> payload;
+    put16(payload, event);
+    put32(payload, value);
+    return payload;
+}
+
+void buildFlvSequenceHeader(media_codec_t codec, const std::vector<uint8_t>& record, std::vector<uint8_t>& tag)
+{
+    tag.clear();
+    if (codec == MEDIA_CODEC_VIDEO_H265) {
+        tag.push_back(FLV_EX_HEADER | (FLV_FRAME_KEY << 4) | FLV_EX_SEQUENCE_START);
+        tag.insert(tag.end(), {'h', 'v', 'c', '1'});
+    } else {
+        tag.push_back((FLV_FRAME_KEY << 4) | FLV_CODEC_AVC);
+        tag.push_back(FLV_AVC_SEQUENCE_HEADER);
+        put24(tag, 0);
+    }
+    tag.insert(tag.end(), record.begin(), record.end());
+}
+
+bool buildFlvVideoTag(media_codec_t codec, const uint8_t* data, size_t size, bool key, int32_t cts_ms,
+                      std::vector<uint8_t>& tag)
+{
+    std::vector<NalUnit> nals;
+    bool hevc = codec == MEDIA_CODEC_VIDEO_H265;
+    uint8_t frame = key ? FLV_FRAME_KEY : FLV_FRAME_INTER;
+
+    tag.clear();
+    tag.reserve(size + 16);
+    if (hevc) {
+        // CodedFramesX is CodedFrames with a composition time of 0
+        tag.push_back(FLV_EX_HEADER | (frame << 4) | (cts_ms ? FLV_EX_CODED_FRAMES : FLV_EX_CODED_FRAMES_X));
+        tag.insert(tag.end(), {'h', 'v', 'c', '1'});
+        if (cts_ms)
+            put24(tag, (uint32_t)cts_ms & 0xffffff);
+    } else {
+        tag.push_back((frame << 4) | FLV_CODEC_AVC);
+        tag.push_back(FLV_AVC_NALU);
+        put24(tag, (uint32_t)cts_ms & 0xffffff);
+    }
+    size_t header_size = tag.size();
+
+    splitNalUnits(data, size, nals);
+    for (auto& nal : nals) {
+        int type = nalUnitType(nal.data, codec);
+        // the parameter sets go in the sequence header
+        if (hevc ? (type >= 32 && type <= 35) : (type == 7 || type == 8 || type == 9))
+            continue;
+        put32(tag, nal.size);
+        tag.insert(tag.end(), nal.data, nal.data + nal.size);
+    }
+    return tag.size() > header_size;
+}
+
+}  // namespace FFMedia
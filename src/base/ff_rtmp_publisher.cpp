@@ -0,0 +1,783 @@
+#include <errno.h>
+#include <linux/sockios.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "base/ff_bitstream.hpp"
+#include "base/ff_clock.hpp"
+#include "base/ff_log.h"
+#include "base/ff_rtmp_publisher.hpp"
+
+namespace FFMedia
+{
+#define RTMP_CHUNK_SIZE 4096
+#define RTMP_CSID_CONTROL 2
+#define RTMP_CSID_COMMAND 3
+#define RTMP_CSID_DATA 5
+#define RTMP_CSID_VIDEO 6
+#define PUBLISHER_MAX_IOV 64
+#define PUBLISHER_READ_SIZE (16 << 10)
+#define PUBLISHER_TICK_MS 200
+#define MAX_COMPOSITION_US 1000000
+#define FLV_CODEC_ID_AVC 7
+#define FLV_FOURCC_HVC1 0x68766331
+
+static int remainingMs(int64_t deadline_us)
+{
+    int64_t left = deadline_us - monotonicUs();
+    return left > 0 ? (int)((left + 999) / 1000) : 0;
+}
+
+static uint32_t be32(const uint8_t* p)
+{
+    return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static bool isCommand(const std::vector<Amf0Value>& values, const char* name)
+{
+    return !values.empty() && values[0].type == Amf0Value::STRING && values[0].string == name;
+}
+
+static bool isResult(const std::vector<Amf0Value>& values, double transaction)
+{
+    return (isCommand(values, "_result") || isCommand(values, "_error")) && values.size() >= 2
+           && values[1].type == Amf0Value::NUMBER && values[1].number == transaction;
+}
+
+// The code of an onStatus info object, empty when values is something else.
+static std::string statusCode(const std::vector<Amf0Value>& values, std::string* level)
+{
+    if (!isCommand(values, "onStatus") || values.size() < 4)
+        return std::string();
+    const Amf0Value* code = values[3].get("code");
+    const Amf0Value* lvl = values[3].get("level");
+    if (level)
+        *level = lvl ? lvl->string : std::string();
+    return code ? code->string : std::string();
+}
+
+RtmpPublisher::RtmpPublisher(const Config& config_)
+    : config(config_), fd(-1), evfd(-1), thread(NULL), running(false), publishing(false), congested(false),
+      target_kbps(config_.start_kbps), top_layer(0), max_layer(INT32_MAX), rx_bytes(0), rx_acked(0), ack_window(0), sending_pos(0), written(0),
+      written_mark(0), outq_mark(0), interval_start_us(0), last_decrease_us(0), clear_intervals(0), min_rtt_us(0),
+      queue_bytes(0), stream_id(0), chunk_size(RTMP_DEFAULT_CHUNK_SIZE), need_key(true), need_header(true),
+      base_dts_us(INT64_MIN)
+{
+    memset(&stats, 0, sizeof(stats));
+}
+
+RtmpPublisher::~RtmpPublisher()
+{
+    stop();
+}
+
+int RtmpPublisher::start()
+{
+    if (running)
+        return 0;
+    if (!parseRtmpUrl(config.url, &url)) {
+        ff_error("Invalid rtmp url %s\n", config.url.c_str());
+        return -1;
+    }
+    evfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (evfd < 0) {
+        ff_error("Failed to create the eventfd, reason = %s\n", strerror(errno));
+        return -1;
+    }
+    running = true;
+    thread = new std::thread(&RtmpPublisher::loop, this);
+    return 0;
+}
+
+void RtmpPublisher::stop()
+{
+    if (thread) {
+        running = false;
+        uint64_t one = 1;
+        if (write(evfd, &one, sizeof(one)) < 0) {
+        }
+        thread->join();
+        delete thread;
+        thread = NULL;
+    }
+    closeSession();
+    if (evfd >= 0) {
+        close(evfd);
+        evfd = -1;
+    }
+}
+
+void RtmpPublisher::loop()
+{
+    int64_t next_connect_us = 0;
+
+    while (running) {
+        int64_t now = monotonicUs();
+        if (fd < 0) {
+            if (now >= next_connect_us) {
+                if (connectSession())
+                    continue;
+                closeSession();
+                if (config.reconnect_ms <= 0)
+                    break;
+                next_connect_us = monotonicUs() + config.reconnect_ms * 1000ll;
+            }
+            pollfd pfd = {evfd, POLLIN, 0};
+            poll(&pfd, 1, std::min(remainingMs(next_connect_us), PUBLISHER_TICK_MS));
+            uint64_t v;
+            if (read(evfd, &v, sizeof(v)) < 0) {
+            }
+            continue;
+        }
+
+        bool pending;
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            pending = !sending.empty() || !queue.empty();
+        }
+        pollfd pfds[2];
+        pfds[0].fd = fd;
+        pfds[0].events = POLLIN | (pending ? POLLOUT : 0);
+        pfds[1].fd = evfd;
+        pfds[1].events = POLLIN;
+        int timeout = remainingMs(interval_start_us + config.interval_ms * 1000ll);
+        poll(pfds, 2, std::min(timeout, PUBLISHER_TICK_MS));
+
+        bool ok = true;
+        if (pfds[1].revents & POLLIN) {
+            uint64_t v;
+            if (read(evfd, &v, sizeof(v)) < 0) {
+            }
+        }
+        if (pfds[0].revents & (POLLIN | POLLERR | POLLHUP)) {
+            ok = readMessages() >= 0;
+            while (ok && !inbox.empty()) {
+                ok = handleMessage(inbox.front());
+                inbox.pop_front();
+            }
+        }
+        if (ok && ((pfds[0].revents & POLLOUT) || (pfds[1].revents & POLLIN)))
+            ok = writeQueue() >= 0;
+
+        now = monotonicUs();
+        if (ok && now - interval_start_us >= config.interval_ms * 1000ll)
+            control(now);
+
+        if (!ok) {
+            ff_warn("rtmp publish to %s lost\n", config.url.c_str());
+            closeSession();
+            if (config.reconnect_ms <= 0)
+                break;
+            next_connect_us = now + config.reconnect_ms * 1000ll;
+        }
+    }
+}
+
+bool RtmpPublisher::connectSession()
+{
+    int64_t deadline = monotonicUs() + config.connect_timeout_ms * 1000ll;
+
+    addrinfo hints;
+    addrinfo* res = NULL;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    std::string port = std::to_string(url.port);
+    int ret = getaddrinfo(url.host.c_str(), port.c_str(), &hints, &res);
+    if (ret != 0 || res == NULL) {
+        ff_error("Failed to resolve %s, reason = %s\n", url.host.c_str(), gai_strerror(ret));
+        return false;
+    }
+    fd = socket(res->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd >= 0 && connect(fd, res->ai_addr, res->ai_addrlen) < 0 && errno == EINPROGRESS) {
+        pollfd pfd = {fd, POLLOUT, 0};
+        int err = ETIMEDOUT;
+        socklen_t len = sizeof(err);
+        if (poll(&pfd, 1, remainingMs(deadline)) > 0)
+            getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len);
+        errno = err;
+    } else if (fd >= 0) {
+        errno = 0;
+    }
+    freeaddrinfo(res);
+    if (fd < 0 || errno != 0) {
+        ff_error("Failed to connect to %s:%u, reason = %s\n", url.host.c_str(), url.port, strerror(errno));
+        return false;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (config.notsent_lowat > 0)
+        setsockopt(fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &config.notsent_lowat, sizeof(config.notsent_lowat));
+
+    // simple handshake: C0 C1, S0 S1 S2, C2 = S1
+    std::vector<uint8_t> out(1 + RTMP_HANDSHAKE_SIZE, 0);
+    out[0] = 3;
+    for (size_t i = 9; i < out.size(); i++)
+        out[i] = rand();
+    std::vector<uint8_t> in(1 + 2 * RTMP_HANDSHAKE_SIZE);
+    if (!sendAll(out, deadline) || !recvAll(in.data(), in.size(), deadline) || in[0] != 3) {
+        ff_error("rtmp handshake with %s:%u failed\n", url.host.c_str(), url.port);
+        return false;
+    }
+    out.assign(in.begin() + 1, in.begin() + 1 + RTMP_HANDSHAKE_SIZE);
+    if (!sendAll(out, deadline))
+        return false;
+
+    std::vector<Amf0Value> values;
+    std::vector<uint8_t> amf;
+    Amf0Writer w(amf);
+    out.clear();
+    std::vector<uint8_t> payload = rtmpControlPayload(RTMP_CHUNK_SIZE);
+    writeRtmpChunks(out, RTMP_CSID_CONTROL, RTMP_MSG_SET_CHUNK_SIZE, 0, 0, payload.data(), payload.size(),
+                    RTMP_DEFAULT_CHUNK_SIZE);
+    w.string("connect");
+    w.number(1);
+    w.objectBegin();
+    w.key("app");
+    w.string(url.app);
+    w.key("type");
+    w.string("nonprivate");
+    w.key("flashVer");
+    w.string("FMLE/3.0 (compatible; FFMedia)");
+    w.key("tcUrl");
+    w.string(url.tc_url);
+    w.objectEnd();
+    writeRtmpChunks(out, RTMP_CSID_COMMAND, RTMP_MSG_AMF0_COMMAND, 0, 0, amf.data(), amf.size(), RTMP_CHUNK_SIZE);
+    if (!sendAll(out, deadline)
+        || !waitCommand([](const std::vector<Amf0Value>& v) { return isResult(v, 1); }, values, deadline))
+        return false;
+    if (isCommand(values, "_error")) {
+        ff_error("rtmp connect to app %s refused\n", url.app.c_str());
+        return false;
+    }
+
+    out.clear();
+    const char* names[2] = {"releaseStream", "FCPublish"};
+    for (int i = 0; i < 2; i++) {
+        amf.clear();
+        w.string(names[i]);
+        w.number(2 + i);
+        w.null();
+        w.string(url.stream);
+        writeRtmpChunks(out, RTMP_CSID_COMMAND, RTMP_MSG_AMF0_COMMAND, 0, 0, amf.data(), amf.size(), RTMP_CHUNK_SIZE);
+    }
+    amf.clear();
+    w.string("createStream");
+    w.number(4);
+    w.null();
+    writeRtmpChunks(out, RTMP_CSID_COMMAND, RTMP_MSG_AMF0_COMMAND, 0, 0, amf.data(), amf.size(), RTMP_CHUNK_SIZE);
+    if (!sendAll(out, deadline)
+        || !waitCommand([](const std::vector<Amf0Value>& v) { return isResult(v, 4); }, values, deadline))
+        return false;
+    if (!isCommand(values, "_result") || values.size() < 4 || values[3].type != Amf0Value::NUMBER) {
+        ff_error("rtmp createStream failed\n");
+        return false;
+    }
+    uint32_t id = values[3].number;
+
+    out.clear();
+    amf.clear();
+    w.string("publish");
+    w.number(5);
+    w.null();
+    w.string(url.stream);
+    w.string("live");
+    writeRtmpChunks(out, RTMP_CSID_COMMAND, RTMP_MSG_AMF0_COMMAND, id, 0, amf.data(), amf.size(), RTMP_CHUNK_SIZE);
+    auto status = [](const std::vector<Amf0Value>& v) {
+        std::string level;
+        std::string code = statusCode(v, &level);
+        return code == "NetStream.Publish.Start" || level == "error";
+    };
+    if (!sendAll(out, deadline) || !waitCommand(status, values, deadline))
+        return false;
+    std::string code = statusCode(values, NULL);
+    if (code != "NetStream.Publish.Start") {
+        ff_error("rtmp publish of %s refused, %s\n", url.stream.c_str(), code.c_str());
+        return false;
+    }
+
+    int64_t now = monotonicUs();
+    written = written_mark = 0;
+    outq_mark = 0;
+    interval_start_us = now;
+    last_decrease_us = 0;
+    clear_intervals = 0;
+    min_rtt_us = 0;
+    max_layer = INT32_MAX;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        stream_id = id;
+        chunk_size = RTMP_CHUNK_SIZE;
+        need_key = true;
+        need_header = true;
+        base_dts_us = INT64_MIN;
+        stats.connects++;
+    }
+    publishing = true;
+    ff_info("rtmp publishing %s, %d kbps\n", config.url.c_str(), (int)target_kbps);
+    if (key_frame_cb)
+        key_frame_cb(false);
+    return true;
+}
+
+void RtmpPublisher::closeSession()
+{
+    publishing = false;
+    congested = false;
+    if (fd >= 0) {
+        close(fd);
+        fd = -1;
+    }
+    reader = RtmpChunkReader();
+    rx.clear();
+    inbox.clear();
+    rx_bytes = rx_acked = 0;
+    ack_window = 0;
+
+    std::lock_guard<std::mutex> lock(mtx);
+    sending.clear();
+    sending_pos = 0;
+    queue.clear();
+    queue_bytes = 0;
+}
+
+bool RtmpPublisher::sendAll(const std::vector<uint8_t>& data, int64_t deadline_us)
+{
+    size_t pos = 0;
+    while (pos < data.size()) {
+        ssize_t n = send(fd, data.data() + pos, data.size() - pos, MSG_NOSIGNAL);
+        if (n > 0) {
+            pos += n;
+            continue;
+        }
+        if (n < 0 && errno != EAGAIN && errno != EINTR)
+            return false;
+        pollfd pfd = {fd, POLLOUT, 0};
+        if (poll(&pfd, 1, remainingMs(deadline_us)) <= 0)
+            return false;
+    }
+    return true;
+}
+
+bool RtmpPublisher::recvAll(uint8_t* data, size_t size, int64_t deadline_us)
+{
+    size_t pos = 0;
+    while (pos < size) {
+        ssize_t n = recv(fd, data + pos, size - pos, 0);
+        if (n > 0) {
+            pos += n;
+            continue;
+        }
+        if (n == 0 || (errno != EAGAIN && errno != EINTR))
+            return false;
+        pollfd pfd = {fd, POLLIN, 0};
+        if (poll(&pfd, 1, remainingMs(deadline_us)) <= 0)
+            return false;
+    }
+    return true;
+}
+
+bool RtmpPublisher::waitCommand(const std::function<bool(const std::vector<Amf0Value>&)>& match,
+                                std::vector<Amf0Value>& values, int64_t deadline_us)
+{
+    while (true) {
+        while (!inbox.empty()) {
+            RtmpMessage msg = std::move(inbox.front());
+            inbox.pop_front();
+            if (msg.type == RTMP_MSG_AMF0_COMMAND && parseAmf0(msg.payload.data(), msg.payload.size(), values)
+                && match(values))
+                return true;
+            if (!handleMessage(msg))
+                return false;
+        }
+        if (writeQueue() < 0)
+            return false;
+        pollfd pfd = {fd, POLLIN, 0};
+        if (poll(&pfd, 1, remainingMs(deadline_us)) <= 0) {
+            ff_error("rtmp server %s:%u does not answer\n", url.host.c_str(), url.port);
+            return false;
+        }
+        if (readMessages() < 0)
+            return false;
+    }
+}
+
+int RtmpPublisher::readMessages()
+{
+    size_t old = rx.size();
+    rx.resize(old + PUBLISHER_READ_SIZE);
+    ssize_t n = recv(fd, rx.data() + old, PUBLISHER_READ_SIZE, 0);
+    if (n <= 0) {
+        rx.resize(old);
+        return n < 0 && (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+    }
+    rx.resize(old + n);
+    rx_bytes += n;
+
+    std::vector<RtmpMessage> messages;
+    int used = reader.feed(rx.data(), rx.size(), messages);
+    if (used < 0) {
+        ff_error("Bad rtmp chunk stream from %s:%u\n", url.host.c_str(), url.port);
+        return -1;
+    }
+    rx.erase(rx.begin(), rx.begin() + used);
+    for (auto& msg : messages)
+        inbox.push_back(std::move(msg));
+
+    if (ack_window && rx_bytes - rx_acked >= ack_window) {
+        std::vector<uint8_t> out;
+        std::vector<uint8_t> payload = rtmpControlPayload(rx_bytes);
+        writeRtmpChunks(out, RTMP_CSID_CONTROL, RTMP_MSG_ACK, 0, 0, payload.data(), payload.size(), RTMP_CHUNK_SIZE);
+        queueControl(std::move(out));
+        rx_acked = rx_bytes;
+    }
+    return messages.size();
+}
+
+bool RtmpPublisher::handleMessage(const RtmpMessage& msg)
+{
+    const std::vector<uint8_t>& p = msg.payload;
+    switch (msg.type) {
+        case RTMP_MSG_WINDOW_ACK_SIZE:
+            if (p.size() >= 4)
+                ack_window = be32(p.data());
+            break;
+        case RTMP_MSG_USER_CONTROL:
+            if (p.size() >= 6 && ((p[0] << 8) | p[1]) == RTMP_USER_PING_REQUEST) {
+                std::vector<uint8_t> out;
+                std::vector<uint8_t> payload = rtmpUserControlPayload(RTMP_USER_PING_RESPONSE, be32(p.data() + 2));
+                writeRtmpChunks(out, RTMP_CSID_CONTROL, RTMP_MSG_USER_CONTROL, 0, 0, payload.data(), payload.size(),
+                                RTMP_CHUNK_SIZE);
+                queueControl(std::move(out));
+            }
+            break;
+        case RTMP_MSG_AMF0_COMMAND: {
+            std::vector<Amf0Value> values;
+            std::string level;
+            if (!parseAmf0(p.data(), p.size(), values))
+                break;
+            std::string code = statusCode(values, &level);
+            if (level == "error") {
+                ff_error("rtmp server %s:%u: %s\n", url.host.c_str(), url.port, code.c_str());
+                return false;
+            }
+            break;
+        }
+        default:
+            break;
+    }
+    return true;
+}
+
+void RtmpPublisher::queueControl(std::vector<uint8_t>&& data)
+{
+    Slab slab;
+    slab.data = std::make_shared<std::vector<uint8_t>>(std::move(data));
+    slab.frame = false;
+    slab.queued_us = monotonicUs();
+
+    std::lock_guard<std::mutex> lock(mtx);
+    sending.insert(sending.begin() + (sending_pos > 0 ? 1 : 0), slab);
+}
+
+int RtmpPublisher::writeQueue()
+{
+    iovec iov[PUBLISHER_MAX_IOV];
+    int count = 0;
+    std::lock_guard<std::mutex> lock(mtx);
+
+    while (!queue.empty() && sending.size() < PUBLISHER_MAX_IOV) {
+        queue_bytes -= queue.front().data->size();
+        sending.push_back(std::move(queue.front()));
+        queue.pop_front();
+    }
+    for (auto& slab : sending) {
+        size_t pos = count == 0 ? sending_pos : 0;
+        iov[count].iov_base = slab.data->data() + pos;
+        iov[count].iov_len = slab.data->size() - pos;
+        if (++count >= PUBLISHER_MAX_IOV)
+            break;
+    }
+    if (count == 0)
+        return 0;
+
+    ssize_t n = writev(fd, iov, count);
+    if (n < 0)
+        return errno == EAGAIN || errno == EINTR ? 0 : -1;
+    written += n;
+    stats.bytes_sent += n;
+    size_t left = n;
+    while (left > 0) {
+        size_t rest = sending.front().data->size() - sending_pos;
+        if (left < rest) {
+            sending_pos += left;
+            break;
+        }
+        left -= rest;
+        if (sending.front().frame)
+            stats.frames_sent++;
+        sending.pop_front();
+        sending_pos = 0;
+    }
+    return n;
+}
+
+void RtmpPublisher::control(int64_t now_us)
+{
+    int outq = 0;
+    ioctl(fd, SIOCOUTQ, &outq);
+    tcp_info info;
+    socklen_t len = sizeof(info);
+    memset(&info, 0, sizeof(info));
+    getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &len);
+    if (info.tcpi_rtt > 0 && (min_rtt_us == 0 || info.tcpi_rtt < min_rtt_us))
+        min_rtt_us = info.tcpi_rtt;
+
+    int64_t elapsed = std::max<int64_t>(now_us - interval_start_us, 1);
+    int64_t acked = (int64_t)(written - written_mark) + (int64_t)outq_mark - outq;
+    int throughput = std::max<int64_t>(acked, 0) * 8 * 1000 / elapsed;
+
+    int64_t oldest_us = now_us;
+    size_t queued;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (!sending.empty())
+            oldest_us = sending.front().queued_us;
+        else if (!queue.empty())
+            oldest_us = queue.front().queued_us;
+        queued = queue_bytes + outq;
+        for (auto& slab : sending)
+            queued += slab.data->size();
+    }
+    int outq_ms = outq == 0 ? 0 : throughput > 0 ? (int64_t)outq * 8 / throughput : elapsed / 1000;
+    int queue_ms = (now_us - oldest_us) / 1000 + outq_ms;
+    int rtt_rise_ms = (int)(info.tcpi_rtt - min_rtt_us) / 1000;
+
+    int target = target_kbps;
+    int next = target;
+    if (queue_ms > config.queue_high_ms || rtt_rise_ms > config.rtt_rise_ms) {
+        if (!congested) {
+            std::lock_guard<std::mutex> lock(mtx);
+            stats.congestion_events++;
+        }
+        congested = true;
+        clear_intervals = 0;
+        if (now_us - last_decrease_us >= config.decrease_hold_ms * 1000ll) {
+            int base = throughput > 0 ? std::min(target, throughput) : target;
+            next = std::max(config.min_kbps, base * 85 / 100);
+            last_decrease_us = now_us;
+            if (top_layer > 0 && max_layer > 0) {
+                max_layer = std::min<int>(max_layer, top_layer) - 1;
+                ff_info("rtmp temporal layers up to %d\n", (int)max_layer);
+            }
+        }
+    } else {
+        congested = false;
+        if (++clear_intervals >= config.increase_intervals) {
+            clear_intervals = 0;
+            // the frame rate comes back first
+            if (max_layer < top_layer) {
+                max_layer = max_layer + 1;
+                ff_info("rtmp temporal layers up to %d\n", (int)max_layer);
+            } else {
+                next = std::min(config.max_kbps, target * 110 / 100 + 1);
+            }
+        }
+    }
+    if (next != target) {
+        target_kbps = next;
+        ff_info("rtmp target %d -> %d kbps, throughput %d kbps, queue %d ms, rtt %u/%d ms\n", target, next, throughput,
+                queue_ms, info.tcpi_rtt / 1000, (int)(min_rtt_us / 1000));
+        if (bitrate_cb)
+            bitrate_cb(next);
+    }
+    if (queue_ms > config.drop_ms && dropQueue()) {
+        ff_warn("rtmp queue %d ms, drop to the next key frame\n", queue_ms);
+        if (key_frame_cb)
+            key_frame_cb(true);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        stats.throughput_kbps = throughput;
+        stats.queue_ms = queue_ms;
+        stats.rtt_ms = info.tcpi_rtt / 1000;
+        stats.min_rtt_ms = min_rtt_us / 1000;
+        stats.queued_bytes = queued;
+    }
+    written_mark = written;
+    outq_mark = outq;
+    interval_start_us = now_us;
+}
+
+bool RtmpPublisher::dropQueue()
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    // the queue is already going, the rest is what was written before
+    if (need_key)
+        return false;
+    auto keep = [this](std::deque<Slab>& slabs, size_t first) {
+        std::deque<Slab> kept;
+        for (size_t i = 0; i < slabs.size(); i++) {
+            if (i < first || !slabs[i].frame)
+                kept.push_back(std::move(slabs[i]));
+            else
+                stats.frames_dropped++;
+        }
+        slabs.swap(kept);
+    };
+    // the slab being written has to go out whole
+    keep(sending, sending_pos > 0 ? 1 : 0);
+    keep(queue, 0);
+    queue_bytes = 0;
+    for (auto& slab : queue)
+        queue_bytes += slab.data->size();
+    need_key = true;
+    return true;
+}
+
+void RtmpPublisher::setExtraData(media_codec_t codec, const uint8_t* data, size_t size)
+{
+    std::vector<uint8_t> found;
+    getParameterSets(data, size, codec, found);
+    std::lock_guard<std::mutex> lock(mtx);
+    extra_sets.swap(found);
+}
+
+bool RtmpPublisher::pushFrame(media_codec_t codec, const uint8_t* data, size_t size, int64_t pts_us, int64_t dts_us,
+                              int temporal_layer)
+{
+    if (!publishing)
+        return false;
+
+    if (temporal_layer > top_layer)
+        top_layer = temporal_layer;
+    if (temporal_layer > max_layer) {
+        std::lock_guard<std::mutex> lock(mtx);
+        stats.frames_dropped++;
+        stats.layer_dropped++;
+        return false;
+    }
+
+    bool key = isKeyFrame(data, size, codec);
+    if (!key && congested && isDisposable(data, size, codec)) {
+        std::lock_guard<std::mutex> lock(mtx);
+        stats.frames_dropped++;
+        return false;
+    }
+    // a dts after the pts, or too far before it, is not one the producer set
+    if (dts_us < 0 || dts_us > pts_us || pts_us - dts_us > MAX_COMPOSITION_US)
+        dts_us = pts_us;
+    std::vector<uint8_t> tag;
+    std::vector<uint8_t> new_sets;
+    if (!buildFlvVideoTag(codec, data, size, key, (pts_us - dts_us) / 1000, tag))
+        return false;
+    if (key)
+        getParameterSets(data, size, codec, new_sets);
+
+    int64_t now = monotonicUs();
+    std::lock_guard<std::mutex> lock(mtx);
+    if (key && new_sets.empty())
+        new_sets = extra_sets;
+    if (need_key && !key) {
+        stats.frames_dropped++;
+        return false;
+    }
+    need_key = false;
+    if (base_dts_us == INT64_MIN)
+        base_dts_us = dts_us;
+    uint32_t timestamp = dts_us > base_dts_us ? (dts_us - base_dts_us) / 1000 : 0;
+
+    if (!new_sets.empty() && (need_header || new_sets != sets)) {
+        std::vector<uint8_t> ps[3];  // vps, sps, pps
+        std::vector<NalUnit> nals;
+        splitNalUnits(new_sets.data(), new_sets.size(), nals);
+        for (auto& nal : nals) {
+            int type = nalUnitType(nal.data, codec);
+            int index = codec == MEDIA_CODEC_VIDEO_H265 ? type - 32 : type - 6;
+            if (index >= 0 && index < 3)
+                ps[index].assign(nal.data, nal.data + nal.size);
+        }
+        std::vector<uint8_t> record;
+        if (buildDecoderConfig(codec, ps[0], ps[1], ps[2], record)) {
+            Slab slab;
+            slab.data = std::make_shared<std::vector<uint8_t>>();
+            slab.frame = false;
+            slab.queued_us = now;
+
+            int width = 0, height = 0;
+            parseSpsSize(ps[1].data(), ps[1].size(), codec, &width, &height);
+            std::vector<uint8_t> amf;
+            Amf0Writer w(amf);
+            w.string("@setDataFrame");
+            w.string("onMetaData");
+            w.objectBegin();
+            w.key("width");
+            w.number(width);
+            w.key("height");
+            w.number(height);
+            w.key("videocodecid");
+            w.number(codec == MEDIA_CODEC_VIDEO_H265 ? FLV_FOURCC_HVC1 : FLV_CODEC_ID_AVC);
+            w.key("videodatarate");
+            w.number(target_kbps);
+            w.key("encoder");
+            w.string("FFMedia");
+            w.objectEnd();
+            writeRtmpChunks(*slab.data, RTMP_CSID_DATA, RTMP_MSG_AMF0_DATA, stream_id, timestamp, amf.data(),
+                            amf.size(), chunk_size);
+
+            std::vector<uint8_t> header;
+            buildFlvSequenceHeader(codec, record, header);
+            writeRtmpChunks(*slab.data, RTMP_CSID_VIDEO, RTMP_MSG_VIDEO, stream_id, timestamp, header.data(),
+                            header.size(), chunk_size);
+            queue_bytes += slab.data->size();
+            queue.push_back(std::move(slab));
+            sets.swap(new_sets);
+            need_header = false;
+        }
+    }
+    if (need_header) {
+        // no parameter sets yet, a decoder could not start with this frame
+        need_key = true;
+        stats.frames_dropped++;
+        return false;
+    }
+
+    Slab slab;
+    slab.data = std::make_shared<std::vector<uint8_t>>();
+    slab.frame = true;
+    slab.queued_us = now;
+    writeRtmpChunks(*slab.data, RTMP_CSID_VIDEO, RTMP_MSG_VIDEO, stream_id, timestamp, tag.data(), tag.size(),
+                    chunk_size);
+    queue_bytes += slab.data->size();
+    queue.push_back(std::move(slab));
+
+    uint64_t one = 1;
+    if (write(evfd, &one, sizeof(one)) < 0) {
+    }
+    return true;
+}
+
+RtmpPublisher::Stats RtmpPublisher::getStats()
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    Stats s = stats;
+    s.publishing = publishing;
+    s.target_kbps = target_kbps;
+    s.max_layer = max_layer < top_layer ? (int)max_layer : -1;
+    return s;
+}
+
+}  // namespace FFMedia
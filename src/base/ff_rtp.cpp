@@ -0,0 +1,605 @@
+#include <string.h>
+
+#include <algorithm>
+
+#include "base/ff_bitstream.hpp"
+#include "base/ff_rtp.hpp"
+
+namespace FFMedia
+{
+#define DEFAULT_MAX_FRAME_SIZE (8 << 20)
+
+static const uint8_t start_code[4] = {0, 0, 0, 1};
+
+int parseRtpHeader(const uint8_t* data, size_t size, RtpHeader* header)
+{
+    if (size < RTP_HEADER_SIZE || (data[0] >> 6) != 2)
+        return -1;
+
+    size_t offset = RTP_HEADER_SIZE + (data[0] & 0x0f) * 4;
+    if (data[0] & 0x10) {
+        if (offset + 4 > size)
+            return -1;
+        offset += 4 + ((data[offset + 2] << 8) | data[offset + 3]) * 4;
+    }
+    size_t padding = (data[0] & 0x20) ? data[size - 1] : 0;
+    if (offset + padding > size)
+        return -1;
+
+    header->payload_type = data[1] & 0x7f;
+    header->marker = data[1] >> 7;
+    header->seq = (data[2] << 8) | data[3];
+    header->timestamp = ((uint32_t)data[4] << 24) | (data[5] << 16) | (data[6] << 8) | data[7];
+    header->ssrc = ((uint32_t)data[8] << 24) | (data[9] << 16) | (data[10] << 8) | data[11];
+    header->payload = data + offset;
+    header->payload_size = size - offset - padding;
+    return 0;
+}
+
+static const char base64_table[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+std::string base64Encode(const uint8_t* data, size_t size)
+{
+    std::string out;
+    out.reserve((size + 2) / 3 * 4);
+    for (size_t i = 0; i < size; i += 3) {
+        uint32_t v = data[i] << 16;
+        if (i + 1 < size)
+            v |= data[i + 1] << 8;
+        if (i + 2 < size)
+            v |= data[i + 2];
+        out += base64_table[(v >> 18) & 0x3f];
+        out += base64_table[(v >> 12) & 0x3f];
+        out += i + 1 < size ? base64_table[(v >> 6) & 0x3f] : '=';
+        out += i + 2 < size ? base64_table[v & 0x3f] : '=';
+    }
+    return out;
+}
+
+std::vector<uint8_t> base64Decode(const std::string& text)
+{
+    std::vector<uint8_t> out;
+    uint32_t v = 0;
+    int bits = 0;
+    for (char c : text) {
+        const char* p = strchr(base64_table, c);
+        if (c == '=' || c == 0 || p == NULL)
+            continue;
+        v = (v << 6) | (p - base64_table);
+        bits += 6;
+        if (bits >= 8) {
+            bits -= 8;
+            out.push_back(v >> bits);
+        }
+    }
+    return out;
+}
+
+RtpDepacketizer::RtpDepacketizer(media_codec_t codec_)
+    : codec(codec_), max_frame_size(DEFAULT_MAX_FRAME_SIZE)
+{
+    memset(&stats, 0, sizeof(stats));
+    reset();
+}
+
+void RtpDepacketizer::reset()
+{
+    frame.clear();
+    timestamp = 0;
+    expected_seq = 0;
+    seen_mask = 0;
+    started = false;
+    key = false;
+    corrupt = false;
+    fu_active = false;
+}
+
+void RtpDepacketizer::appendNal(const uint8_t* header, size_t header_size, const uint8_t* data, size_t size, bool with_start_code)
+{
+    if (frame.size() + 4 + header_size + size > max_frame_size) {
+        corrupt = true;
+        return;
+    }
+    if (with_start_code) {
+        frame.insert(frame.end(), start_code, start_code + 4);
+        const uint8_t* nal = header_size ? header : data;
+        int type = nalUnitType(nal, codec);
+        if (codec == MEDIA_CODEC_VIDEO_H265 ? (type >= 16 && type <= 21) : type == 5)
+            key = true;
+    }
+    frame.insert(frame.end(), header, header + header_size);
+    frame.insert(frame.end(), data, data + size);
+}
+
+void RtpDepacketizer::emitFrame()
+{
+    if (!frame.empty()) {
+        stats.frames++;
+        if (corrupt)
+            stats.corrupt_frames++;
+        if (frame_cb)
+            frame_cb(frame, timestamp, key, corrupt);
+    }
+    frame.clear();
+    key = false;
+    corrupt = false;
+    fu_active = false;
+}
+
+void RtpDepacketizer::input(const RtpHeader& rtp)
+{
+    const uint8_t* p = rtp.payload;
+    size_t size = rtp.payload_size;
+
+    stats.packets++;
+    if (started) {
+        int16_t diff = (int16_t)(rtp.seq - expected_seq);
+        if (diff < 0) {
+            uint16_t back = expected_seq - 1 - rtp.seq;
+            if (back < 64 && (seen_mask >> back) & 1) {
+                stats.duplicates++;
+            } else {
+                // counted as lost when the gap was seen
+                if (back < 64)
+                    seen_mask |= 1ull << back;
+                stats.reordered++;
+                if (stats.lost > 0)
+                    stats.lost--;
+            }
+            return;
+        }
+        seen_mask = diff + 1 >= 64 ? 0 : seen_mask << (diff + 1);
+        if (diff > 0) {
+            // the missing packets may be the tail of this frame or the head of the next one
+            stats.lost += diff;
+            if (!frame.empty() && rtp.timestamp != timestamp) {
+                corrupt = true;
+                emitFrame();
+            }
+            corrupt = true;
+        }
+    }
+    started = true;
+    seen_mask |= 1;
+    expected_seq = rtp.seq + 1;
+
+    // the marker of the last frame was lost or not set
+    if (!frame.empty() && rtp.timestamp != timestamp)
+        emitFrame();
+    timestamp = rtp.timestamp;
+
+    if (codec == MEDIA_CODEC_VIDEO_H265) {
+        if (size < 3)
+            return;
+        int type = (p[0] >> 1) & 0x3f;
+        if (type == 48) {
+            // aggregation packet
+            p += 2;
+            size -= 2;
+            while (size > 2) {
+                size_t len = (p[0] << 8) | p[1];
+                if (len == 0 || len + 2 > size)
+                    break;
+                appendNal(NULL, 0, p + 2, len, true);
+                p += len + 2;
+                size -= len + 2;
+            }
+        } else if (type == 49) {
+            uint8_t fu = p[2];
+            if (fu & 0x80) {
+                uint8_t header[2] = {(uint8_t)((p[0] & 0x81) | ((fu & 0x3f) << 1)), p[1]};
+                appendNal(header, 2, p + 3, size - 3, true);
+                fu_active = true;
+            } else if (fu_active) {
+                appendNal(NULL, 0, p + 3, size - 3, false);
+            } else {
+                corrupt = true;
+            }
+            if (fu & 0x40)
+                fu_active = false;
+        } else {
+            appendNal(NULL, 0, p, size, true);
+        }
+    } else {
+        if (size < 2)
+            return;
+        int type = p[0] & 0x1f;
+        if (type == 24) {
+            // STAP-A
+            p += 1;
+            size -= 1;
+            while (size > 2) {
+                size_t len = (p[0] << 8) | p[1];
+                if (len == 0 || len + 2 > size)
+                    break;
+                appendNal(NULL, 0, p + 2, len, true);
+                p += len + 2;
+                size -= len + 2;
+            }
+        } else if (type == 28) {
+            uint8_t fu = p[1];
+            if (fu & 0x80) {
+                uint8_t header = (p[0] & 0xe0) | (fu & 0x1f);
+                appendNal(&header, 1, p + 2, size - 2, true);
+                fu_active = true;
+            } else if (fu_active) {
+                appendNal(NULL, 0, p + 2, size - 2, false);
+            } else {
+                corrupt = true;
+            }
+            if (fu & 0x40)
+                fu_active = false;
+        } else if (type >= 1 && type <= 23) {
+            appendNal(NULL, 0, p, size, true);
+        }
+    }
+
+    if (rtp.marker)
+        emitFrame();
+}
+
+#define JITTER_MIN_SLOTS 64
+#define JITTER_MAX_SLOTS 32768
+
+static size_t jitterSlotCount(size_t capacity)
+{
+    size_t count = JITTER_MIN_SLOTS;
+    while (count < capacity && count < JITTER_MAX_SLOTS)
+        count <<= 1;
+    return count;
+}
+
+RtpJitterBuffer::RtpJitterBuffer(int depth_ms, size_t capacity)
+    : depth_us(depth_ms * 1000ll), nack_delay_us(depth_ms * 250ll), slots(jitterSlotCount(capacity))
+{
+    memset(&stats, 0, sizeof(stats));
+    reset();
+}
+
+void RtpJitterBuffer::reset()
+{
+    for (auto& s : slots) {
+        s.used = false;
+        s.nacked = false;
+    }
+    pending_nacks.clear();
+    started = false;
+    next_seq = 0;
+    highest_seq = 0;
+    held = 0;
+}
+
+void RtpJitterBuffer::release()
+{
+    while (held > 0) {
+        Slot& s = slot(next_seq);
+        if (!s.used || s.seq != next_seq)
+            break;
+        s.used = false;
+        s.nacked = false;
+        held--;
+        next_seq++;
+        if (packet_cb)
+            packet_cb(s.header);
+    }
+}
+
+void RtpJitterBuffer::skipGap()
+{
+    while (held > 0) {
+        Slot& s = slot(next_seq);
+        if (s.used && s.seq == next_seq)
+            break;
+        s.nacked = false;
+        stats.lost++;
+        next_seq++;
+    }
+    release();
+}
+
+void RtpJitterBuffer::flush()
+{
+    while (held > 0)
+        skipGap();
+}
+
+void RtpJitterBuffer::poll(int64_t now_us)
+{
+    while (!pending_nacks.empty() && pending_nacks.front().second <= now_us) {
+        uint16_t seq = pending_nacks.front().first;
+        Slot& s = slot(seq);
+        pending_nacks.pop_front();
+        // arrived meanwhile, or given up
+        if ((int16_t)(seq - next_seq) < 0 || (s.used && s.seq == seq))
+            continue;
+        s.seq = seq;
+        s.nacked = true;
+        nacks.push_back(seq);
+    }
+    if (!nacks.empty()) {
+        if (nack_cb) {
+            stats.nack_sent += nacks.size();
+            nack_cb(nacks);
+        }
+        nacks.clear();
+    }
+
+    while (held > 0) {
+        // the first held packet arrived when the gap in front of it was found
+        uint16_t seq = next_seq;
+        size_t n = 0;
+        while (n < slots.size() && (!slot(seq).used || slot(seq).seq != seq)) {
+            seq++;
+            n++;
+        }
+        if (n == slots.size()) {
+            // held out of step with the slots, start over rather than spin
+            reset();
+            break;
+        }
+        if (now_us - slot(seq).arrival_us < depth_us)
+            break;
+        skipGap();
+    }
+}
+
+void RtpJitterBuffer::input(const RtpHeader& rtp, int64_t now_us)
+{
+    stats.packets++;
+    if (!started) {
+        started = true;
+        next_seq = rtp.seq;
+        highest_seq = rtp.seq - 1;
+    }
+
+    int diff = (int16_t)(rtp.seq - next_seq);
+    if (diff < 0 && -diff < (int)slots.size()) {
+        stats.late++;
+        return;
+    }
+    if (diff < 0 || diff >= (int)slots.size()) {
+        // a sender restart (far backward) or a gap longer than the buffer, only the gap is lost
+        flush();
+        diff = (int16_t)(rtp.seq - next_seq);
+        if (diff > 0)
+            stats.lost += diff;
+        next_seq = rtp.seq;
+        highest_seq = rtp.seq - 1;
+        diff = 0;
+    }
+
+    Slot& s = slot(rtp.seq);
+    if (s.used && s.seq == rtp.seq) {
+        stats.duplicates++;
+        return;
+    }
+    bool behind = (int16_t)(rtp.seq - highest_seq) <= 0;
+    if (behind && s.nacked && s.seq == rtp.seq)
+        stats.recovered++;
+    else if (behind)
+        stats.reordered++;
+    s.nacked = false;
+
+    if (diff == 0) {
+        // in order, no copy
+        next_seq++;
+        if (!behind)
+            highest_seq = rtp.seq;
+        if (packet_cb)
+            packet_cb(rtp);
+        release();
+        return;
+    }
+
+    if (!behind) {
+        for (uint16_t seq = highest_seq + 1; seq != rtp.seq; seq++) {
+            Slot& gap = slot(seq);
+            gap.seq = seq;
+            gap.nacked = false;
+            if (nack_cb)
+                pending_nacks.emplace_back(seq, now_us + nack_delay_us);
+        }
+        highest_seq = rtp.seq;
+    }
+    s.used = true;
+    s.seq = rtp.seq;
+    s.arrival_us = now_us;
+    s.header = rtp;
+    s.payload.assign(rtp.payload, rtp.payload + rtp.payload_size);
+    s.header.payload = s.payload.data();
+    held++;
+}
+
+void buildRtcpNack(uint32_t sender_ssrc, uint32_t media_ssrc, const std::vector<uint16_t>& seqs, std::vector<uint8_t>& out)
+{
+    std::vector<uint32_t> fci;
+    for (size_t i = 0; i < seqs.size();) {
+        uint16_t pid = seqs[i++];
+        uint16_t blp = 0;
+        while (i < seqs.size() && (uint16_t)(seqs[i] - pid) >= 1 && (uint16_t)(seqs[i] - pid) <= 16) {
+            blp |= 1 << ((uint16_t)(seqs[i] - pid) - 1);
+            i++;
+        }
+        fci.push_back(((uint32_t)pid << 16) | blp);
+    }
+    if (fci.empty())
+        return;
+
+    uint32_t words[2] = {sender_ssrc, media_ssrc};
+    uint16_t length = 2 + fci.size();
+    uint8_t header[4] = {0x81, 205, (uint8_t)(length >> 8), (uint8_t)length};
+    out.insert(out.end(), header, header + 4);
+    for (uint32_t w : words) {
+        uint8_t b[4] = {(uint8_t)(w >> 24), (uint8_t)(w >> 16), (uint8_t)(w >> 8), (uint8_t)w};
+        out.insert(out.end(), b, b + 4);
+    }
+    for (uint32_t w : fci) {
+        uint8_t b[4] = {(uint8_t)(w >> 24), (uint8_t)(w >> 16), (uint8_t)(w >> 8), (uint8_t)w};
+        out.insert(out.end(), b, b + 4);
+    }
+}
+
+bool parseRtcpNack(const uint8_t* data, size_t size, std::vector<uint16_t>& seqs)
+{
+    seqs.clear();
+    while (size >= 4 && (data[0] >> 6) == 2) {
+        size_t len = (((data[2] << 8) | data[3]) + 1) * 4;
+        if (len > size)
+            break;
+        if (data[1] == 205 && (data[0] & 0x1f) == 1) {
+            for (size_t off = 12; off + 4 <= len; off += 4) {
+                uint16_t pid = (data[off] << 8) | data[off + 1];
+                uint16_t blp = (data[off + 2] << 8) | data[off + 3];
+                seqs.push_back(pid);
+                for (int bit = 0; bit < 16; bit++) {
+                    if (blp & (1 << bit))
+                        seqs.push_back(pid + bit + 1);
+                }
+            }
+        }
+        data += len;
+        size -= len;
+    }
+    return !seqs.empty();
+}
+
+void buildRtcpPli(uint32_t sender_ssrc, uint32_t media_ssrc, std::vector<uint8_t>& out)
+{
+    uint8_t pli[12] = {0x81, 206, 0, 2};
+    uint32_t words[2] = {sender_ssrc, media_ssrc};
+    for (int i = 0; i < 2; i++) {
+        pli[4 + i * 4] = words[i] >> 24;
+        pli[5 + i * 4] = words[i] >> 16;
+        pli[6 + i * 4] = words[i] >> 8;
+        pli[7 + i * 4] = words[i];
+    }
+    out.insert(out.end(), pli, pli + sizeof(pli));
+}
+
+RtcpKeyRequest parseRtcpKeyRequest(const uint8_t* data, size_t size)
+{
+    RtcpKeyRequest request = RTCP_KEY_REQUEST_NONE;
+    while (size >= 4 && (data[0] >> 6) == 2) {
+        size_t len = (((data[2] << 8) | data[3]) + 1) * 4;
+        if (len > size)
+            break;
+        // payload specific feedback
+        if (data[1] == 206 && (data[0] & 0x1f) == 4)
+            return RTCP_KEY_REQUEST_FIR;
+        if (data[1] == 206 && (data[0] & 0x1f) == 1)
+            request = RTCP_KEY_REQUEST_PLI;
+        data += len;
+        size -= len;
+    }
+    return request;
+}
+
+void buildRtcpSkip(uint32_t sender_ssrc, uint32_t frames, std::vector<uint8_t>& out)
+{
+    uint8_t app[16] = {0x80, 204, 0, 3};
+    uint32_t words[2] = {sender_ssrc, frames};
+    memcpy(app + 8, "FFSK", 4);
+    for (int i = 0; i < 2; i++) {
+        int off = i ? 12 : 4;
+        app[off] = words[i] >> 24;
+        app[off + 1] = words[i] >> 16;
+        app[off + 2] = words[i] >> 8;
+        app[off + 3] = words[i];
+    }
+    out.insert(out.end(), app, app + sizeof(app));
+}
+
+bool parseRtcpSkip(const uint8_t* data, size_t size, uint32_t* frames)
+{
+    while (size >= 4 && (data[0] >> 6) == 2) {
+        size_t len = (((data[2] << 8) | data[3]) + 1) * 4;
+        if (len > size)
+            break;
+        if (data[1] == 204 && len >= 16 && memcmp(data + 8, "FFSK", 4) == 0) {
+            *frames = ((uint32_t)data[12] << 24) | (data[13] << 16) | (data[14] << 8) | data[15];
+            return true;
+        }
+        data += len;
+        size -= len;
+    }
+    return false;
+}
+
+RtpPacketizer::RtpPacketizer(media_codec_t codec_, uint8_t payload_type_, uint32_t ssrc_, size_t mtu_)
+    : codec(codec_), payload_type(payload_type_), ssrc(ssrc_), mtu(mtu_), seq(ssrc_ & 0xffff)
+{
+}
+
+void RtpPacketizer::writeHeader(RtpPacket& packet, uint32_t timestamp, bool marker)
+{
+    uint8_t* h = packet.header;
+    h[0] = 0x80;
+    h[1] = (marker ? 0x80 : 0) | payload_type;
+    h[2] = seq >> 8;
+    h[3] = seq;
+    h[4] = timestamp >> 24;
+    h[5] = timestamp >> 16;
+    h[6] = timestamp >> 8;
+    h[7] = timestamp;
+    h[8] = ssrc >> 24;
+    h[9] = ssrc >> 16;
+    h[10] = ssrc >> 8;
+    h[11] = ssrc;
+    packet.header_size = RTP_HEADER_SIZE;
+    seq++;
+}
+
+size_t RtpPacketizer::packetize(const uint8_t* data, size_t size, uint32_t timestamp, std::vector<RtpPacket>& packets)
+{
+    std::vector<NalUnit> nals;
+    bool hevc = codec == MEDIA_CODEC_VIDEO_H265;
+    size_t nal_header_size = hevc ? 2 : 1;
+    size_t max_payload = mtu - RTP_HEADER_SIZE;
+
+    packets.clear();
+    splitNalUnits(data, size, nals);
+    for (size_t i = 0; i < nals.size(); i++) {
+        const NalUnit& nal = nals[i];
+        bool last_nal = i + 1 == nals.size();
+        RtpPacket packet;
+
+        if (nal.size <= max_payload) {
+            writeHeader(packet, timestamp, last_nal);
+            packet.payload = nal.data;
+            packet.payload_size = nal.size;
+            packets.push_back(packet);
+            continue;
+        }
+
+        // FU-A: indicator + header, FU: payload header + header
+        const uint8_t* p = nal.data + nal_header_size;
+        size_t left = nal.size - nal_header_size;
+        size_t chunk = max_payload - nal_header_size - 1;
+        bool first = true;
+        while (left > 0) {
+            size_t n = std::min(left, chunk);
+            bool end = n == left;
+            writeHeader(packet, timestamp, end && last_nal);
+            uint8_t* fu = packet.header + RTP_HEADER_SIZE;
+            if (hevc) {
+                fu[0] = (nal.data[0] & 0x81) | (49 << 1);
+                fu[1] = nal.data[1];
+                fu[2] = (first ? 0x80 : 0) | (end ? 0x40 : 0) | ((nal.data[0] >> 1) & 0x3f);
+                packet.header_size += 3;
+            } else {
+                fu[0] = (nal.data[0] & 0xe0) | 28;
+                fu[1] = (first ? 0x80 : 0) | (end ? 0x40 : 0) | (nal.data[0] & 0x1f);
+                packet.header_size += 2;
+            }
+            packet.payload = p;
+            packet.payload_size = n;
+            packets.push_back(packet);
+            p += n;
+            left -= n;
+            first = false;
+        }
+    }
+    return packets.size();
+}
+
+}  // namespace FFMedia
@@ -0,0 +1,346 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "base/ff_rtp.hpp"
+#include "base/ff_rtsp.hpp"
+
+namespace FFMedia
+{
+bool parseRtspUrl(const std::string& url, RtspUrl* out)
+{
+    const std::string scheme = "rtsp://";
+    if (url.compare(0, scheme.size(), scheme) != 0)
+        return false;
+
+    std::string rest = url.substr(scheme.size());
+    size_t slash = rest.find('/');
+    std::string authority = rest.substr(0, slash);
+    out->path = slash == std::string::npos ? "/" : rest.substr(slash);
+
+    size_t at = authority.rfind('@');
+    out->user.clear();
+    out->password.clear();
+    if (at != std::string::npos) {
+        std::string credentials = authority.substr(0, at);
+        size_t colon = credentials.find(':');
+        out->user = credentials.substr(0, colon);
+        if (colon != std::string::npos)
+            out->password = credentials.substr(colon + 1);
+        authority = authority.substr(at + 1);
+    }
+
+    size_t colon = authority.rfind(':');
+    out->port = 554;
+    if (colon != std::string::npos && authority.find(']', colon) == std::string::npos) {
+        out->port = atoi(authority.substr(colon + 1).c_str());
+        authority = authority.substr(0, colon);
+    }
+    if (authority.size() > 2 && authority.front() == '[' && authority.back() == ']')
+        authority = authority.substr(1, authority.size() - 2);
+    out->host = authority;
+    out->url = scheme + (at == std::string::npos ? rest : rest.substr(at + 1));
+    return !out->host.empty() && out->port != 0;
+}
+
+const std::string* RtspMessage::header(const char* name) const
+{
+    for (auto& h : headers) {
+        if (strcasecmp(h.first.c_str(), name) == 0)
+            return &h.second;
+    }
+    return NULL;
+}
+
+int RtspMessage::cseq() const
+{
+    const std::string* v = header("CSeq");
+    return v ? atoi(v->c_str()) : -1;
+}
+
+int parseRtspMessage(const char* data, size_t size, RtspMessage* msg)
+{
+    const char* end = NULL;
+    for (size_t i = 0; i + 3 < size; i++) {
+        if (data[i] == '\r' && data[i + 1] == '\n' && data[i + 2] == '\r' && data[i + 3] == '\n') {
+            end = data + i;
+            break;
+        }
+    }
+    if (end == NULL)
+        return size > 16384 ? -1 : 0;
+
+    std::string head(data, end - data);
+    size_t line_end = head.find("\r\n");
+    std::string first = head.substr(0, line_end);
+
+    msg->headers.clear();
+    msg->body.clear();
+    msg->status = 0;
+    if (first.compare(0, 5, "RTSP/") == 0) {
+        size_t sp = first.find(' ');
+        if (sp == std::string::npos)
+            return -1;
+        msg->is_request = false;
+        msg->status = atoi(first.c_str() + sp + 1);
+    } else {
+        size_t sp1 = first.find(' ');
+        size_t sp2 = first.rfind(' ');
+        if (sp1 == std::string::npos || sp2 == sp1
+            || (first.compare(sp2 + 1, 5, "RTSP/") != 0 && first.compare(sp2 + 1, 5, "HTTP/") != 0))
+            return -1;
+        msg->is_request = true;
+        msg->method = first.substr(0, sp1);
+        msg->uri = first.substr(sp1 + 1, sp2 - sp1 - 1);
+    }
+
+    size_t pos = line_end == std::string::npos ? head.size() : line_end + 2;
+    while (pos < head.size()) {
+        size_t next = head.find("\r\n", pos);
+        if (next == std::string::npos)
+            next = head.size();
+        size_t colon = head.find(':', pos);
+        if (colon != std::string::npos && colon < next) {
+            size_t value = head.find_first_not_of(' ', colon + 1);
+            if (value == std::string::npos || value > next)
+                value = next;
+            msg->headers.push_back(std::make_pair(head.substr(pos, colon - pos), head.substr(value, next - value)));
+        }
+        pos = next + 2;
+    }
+
+    size_t used = end - data + 4;
+    const std::string* length = msg->header("Content-Length");
+    if (length) {
+        size_t body_size = strtoul(length->c_str(), NULL, 10);
+        if (body_size > 65536)
+            return -1;
+        if (used + body_size > size)
+            return 0;
+        msg->body.assign(data + used, body_size);
+        used += body_size;
+    }
+    return used;
+}
+
+/*
+ * md5, RFC 1321
+ */
+namespace
+{
+const uint32_t md5_k[64] = {
+    0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+    0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+    0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+    0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+    0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+    0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+    0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+    0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391};
+const uint8_t md5_r[64] = {7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 5, 9,  14, 20, 5, 9,
+                           14, 20, 5, 9,  14, 20, 5, 9,  14, 20, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+                           4, 11, 16, 23, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21};
+
+void md5Block(uint32_t h[4], const uint8_t* block)
+{
+    uint32_t w[16];
+    for (int i = 0; i < 16; i++)
+        w[i] = block[i * 4] | (block[i * 4 + 1] << 8) | (block[i * 4 + 2] << 16) | ((uint32_t)block[i * 4 + 3] << 24);
+
+    uint32_t a = h[0], b = h[1], c = h[2], d = h[3];
+    for (int i = 0; i < 64; i++) {
+        uint32_t f;
+        int g;
+        if (i < 16) {
+            f = (b & c) | (~b & d);
+            g = i;
+        } else if (i < 32) {
+            f = (d & b) | (~d & c);
+            g = (5 * i + 1) % 16;
+        } else if (i < 48) {
+            f = b ^ c ^ d;
+            g = (3 * i + 5) % 16;
+        } else {
+            f = c ^ (b | ~d);
+            g = (7 * i) % 16;
+        }
+        uint32_t t = d;
+        d = c;
+        c = b;
+        uint32_t x = a + f + md5_k[i] + w[g];
+        b = b + ((x << md5_r[i]) | (x >> (32 - md5_r[i])));
+        a = t;
+    }
+    h[0] += a;
+    h[1] += b;
+    h[2] += c;
+    h[3] += d;
+}
+
+// value of key="value" or key=value in an auth header
+std::string authParam(const std::string& header, const char* key)
+{
+    std::string k = std::string(key) + "=";
+    size_t pos = 0;
+    while ((pos = header.find(k, pos)) != std::string::npos) {
+        if (pos == 0 || header[pos - 1] == ' ' || header[pos - 1] == ',')
+            break;
+        pos += k.size();
+    }
+    if (pos == std::string::npos)
+        return "";
+    pos += k.size();
+    if (pos < header.size() && header[pos] == '"') {
+        size_t end = header.find('"', pos + 1);
+        return header.substr(pos + 1, end == std::string::npos ? std::string::npos : end - pos - 1);
+    }
+    size_t end = header.find(',', pos);
+    return header.substr(pos, end == std::string::npos ? std::string::npos : end - pos);
+}
+}  // namespace
+
+std::string md5Hex(const std::string& text)
+{
+    uint32_t h[4] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476};
+    std::vector<uint8_t> msg(text.begin(), text.end());
+    uint64_t bits = (uint64_t)text.size() * 8;
+
+    msg.push_back(0x80);
+    while (msg.size() % 64 != 56)
+        msg.push_back(0);
+    for (int i = 0; i < 8; i++)
+        msg.push_back(bits >> (i * 8));
+    for (size_t i = 0; i < msg.size(); i += 64)
+        md5Block(h, &msg[i]);
+
+    char hex[33];
+    for (int i = 0; i < 16; i++)
+        snprintf(hex + i * 2, 3, "%02x", (h[i / 4] >> ((i % 4) * 8)) & 0xff);
+    return hex;
+}
+
+void RtspAuth::setCredentials(const std::string& user_, const std::string& password_)
+{
+    user = user_;
+    password = password_;
+    scheme = SCHEME_NONE;
+}
+
+bool RtspAuth::setChallenge(const std::string& www_authenticate)
+{
+    if (strncasecmp(www_authenticate.c_str(), "Digest", 6) == 0) {
+        scheme = SCHEME_DIGEST;
+        realm = authParam(www_authenticate, "realm");
+        nonce = authParam(www_authenticate, "nonce");
+        return true;
+    }
+    if (strncasecmp(www_authenticate.c_str(), "Basic", 5) == 0) {
+        scheme = SCHEME_BASIC;
+        realm = authParam(www_authenticate, "realm");
+        return true;
+    }
+    return false;
+}
+
+std::string RtspAuth::header(const std::string& method, const std::string& uri) const
+{
+    if (scheme == SCHEME_BASIC) {
+        std::string credentials = user + ":" + password;
+        return "Basic " + base64Encode((const uint8_t*)credentials.data(), credentials.size());
+    }
+    if (scheme == SCHEME_DIGEST) {
+        std::string ha1 = md5Hex(user + ":" + realm + ":" + password);
+        std::string ha2 = md5Hex(method + ":" + uri);
+        std::string response = md5Hex(ha1 + ":" + nonce + ":" + ha2);
+        return "Digest username=\"" + user + "\", realm=\"" + realm + "\", nonce=\"" + nonce + "\", uri=\"" + uri
+               + "\", response=\"" + response + "\"";
+    }
+    return "";
+}
+
+bool parseSdpVideo(const std::string& sdp, SdpVideo* out)
+{
+    bool in_video = false, found = false;
+    size_t pos = 0;
+
+    out->codec = MEDIA_CODEC_UNKNOWN;
+    out->payload_type = -1;
+    out->control.clear();
+    out->extra_data.clear();
+    out->nack = false;
+
+    while (pos < sdp.size()) {
+        size_t end = sdp.find('\n', pos);
+        if (end == std::string::npos)
+            end = sdp.size();
+        std::string line = sdp.substr(pos, end - pos);
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+        pos = end + 1;
+
+        if (line.compare(0, 2, "m=") == 0) {
+            if (found)
+                break;
+            in_video = line.compare(0, 8, "m=video ") == 0;
+            if (in_video) {
+                size_t last = line.rfind(' ');
+                out->payload_type = atoi(line.c_str() + last + 1);
+            }
+            continue;
+        }
+        if (!in_video)
+            continue;
+
+        if (line.compare(0, 9, "a=rtpmap:") == 0) {
+            if (strcasestr(line.c_str(), "H264/"))
+                out->codec = MEDIA_CODEC_VIDEO_H264;
+            else if (strcasestr(line.c_str(), "H265/") || strcasestr(line.c_str(), "HEVC/"))
+                out->codec = MEDIA_CODEC_VIDEO_H265;
+            found = out->codec != MEDIA_CODEC_UNKNOWN;
+        } else if (line.compare(0, 10, "a=rtcp-fb:") == 0) {
+            size_t space = line.find(' ');
+            if (space != std::string::npos && line.compare(space + 1, std::string::npos, "nack") == 0)
+                out->nack = true;
+        } else if (line.compare(0, 10, "a=control:") == 0) {
+            out->control = line.substr(10);
+        } else if (line.compare(0, 7, "a=fmtp:") == 0) {
+            // sprop-parameter-sets=a,b or sprop-vps=..;sprop-sps=..;sprop-pps=..
+            const char* keys[4] = {"sprop-parameter-sets=", "sprop-vps=", "sprop-sps=", "sprop-pps="};
+            for (const char* key : keys) {
+                size_t k = line.find(key);
+                if (k == std::string::npos)
+                    continue;
+                k += strlen(key);
+                std::string value = line.substr(k, line.find(';', k) - k);
+                size_t start = 0;
+                while (start <= value.size()) {
+                    size_t comma = value.find(',', start);
+                    if (comma == std::string::npos)
+                        comma = value.size();
+                    std::vector<uint8_t> nal = base64Decode(value.substr(start, comma - start));
+                    if (!nal.empty()) {
+                        const uint8_t start_code[4] = {0, 0, 0, 1};
+                        out->extra_data.insert(out->extra_data.end(), start_code, start_code + 4);
+                        out->extra_data.insert(out->extra_data.end(), nal.begin(), nal.end());
+                    }
+                    start = comma + 1;
+                }
+            }
+        }
+    }
+    return found;
+}
+
+std::string resolveControlUrl(const std::string& base, const std::string& control)
+{
+    if (control.empty() || control == "*")
+        return base;
+    if (control.compare(0, 7, "rtsp://") == 0)
+        return control;
+    if (!base.empty() && base.back() == '/')
+        return base + control;
+    return base + "/" + control;
+}
+
+}  // namespace FFMedia
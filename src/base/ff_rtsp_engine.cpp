@@ -0,0 +1,1233 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <functional>
+
+#include "base/ff_bitstream.hpp"
+#include "base/ff_clock.hpp"
+#include "base/ff_log.h"
+#include "base/ff_rtsp_engine.hpp"
+
+namespace FFMedia
+{
+#define REACTOR_TICK_MS 50
+#define REACTOR_MAX_EVENTS 256
+#define UDP_BATCHES_PER_EVENT 8
+#define CONTROL_BUFFER_SIZE (256 << 10)
+#define RTCP_REPORT_INTERVAL_US 5000000
+#define SESSION_PLI_INTERVAL_US 500000
+#define DEFAULT_SESSION_TIMEOUT_S 60
+#define UDP_PORT_MIN 40000
+#define UDP_PORT_MAX 60000
+
+FrameRing::FrameRing(size_t slot_count)
+    : slots(std::max<size_t>(slot_count, 2)), head(0), count(0), closed(false), wait_key(false), dropped(0)
+{
+}
+
+FrameRing::Frame* FrameRing::reserve(bool key)
+{
+    if (closed)
+        return NULL;
+    // after a drop the following frames reference a missing picture
+    if (wait_key && !key) {
+        dropped++;
+        return NULL;
+    }
+    if (count == slots.size()) {
+        wait_key = true;
+        dropped++;
+        return NULL;
+    }
+    wait_key = false;
+    return &slots[(head + count) % slots.size()];
+}
+
+bool FrameRing::push(const uint8_t* data, size_t size, int64_t pts_us, bool key, uint32_t flags)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    Frame* frame = reserve(key);
+    if (frame == NULL)
+        return false;
+
+    frame->data.assign(data, data + size);
+    frame->pts_us = pts_us;
+    frame->key = key;
+    frame->flags = flags;
+    count++;
+    cv.notify_one();
+    return true;
+}
+
+bool FrameRing::push(std::vector<uint8_t>& data, int64_t pts_us, bool key, uint32_t flags)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    Frame* frame = reserve(key);
+    if (frame == NULL)
+        return false;
+
+    frame->data.swap(data);
+    frame->pts_us = pts_us;
+    frame->key = key;
+    frame->flags = flags;
+    count++;
+    cv.notify_one();
+    return true;
+}
+
+bool FrameRing::pop(Frame& frame, int timeout_ms)
+{
+    std::unique_lock<std::mutex> lock(mtx);
+    if (!cv.wait_for(lock, std::chrono::milliseconds(timeout_ms), [this] { return count > 0 || closed; }) || count == 0)
+        return false;
+
+    Frame& slot = slots[head];
+    frame.data.swap(slot.data);
+    frame.pts_us = slot.pts_us;
+    frame.key = slot.key;
+    frame.flags = slot.flags;
+    head = (head + 1) % slots.size();
+    count--;
+    return true;
+}
+
+void FrameRing::close()
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    closed = true;
+    cv.notify_all();
+}
+
+void FrameRing::reopen()
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    closed = false;
+    head = 0;
+    count = 0;
+    wait_key = false;
+}
+
+bool FrameRing::isClosed()
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    return closed && count == 0;
+}
+
+size_t FrameRing::size()
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    return count;
+}
+
+/*
+ * One epoll loop. Sessions are only touched from their reactor thread,
+ * other threads post commands through the eventfd.
+ */
+struct RtspSession::Reactor {
+    int epfd = -1;
+    int evfd = -1;
+    std::thread* thread = NULL;
+    bool running = false;
+    std::atomic<int> load{0};
+    std::mutex mtx;
+    std::deque<std::function<void()>> commands;
+    std::vector<std::shared_ptr<RtspSession>> sessions;
+
+    // packet slab shared by the udp sockets of this reactor
+    std::vector<uint8_t> slab;
+    std::vector<mmsghdr> msgs;
+    std::vector<iovec> iovs;
+    size_t packet_size = 0;
+
+    int start(int batch, size_t packet_size_)
+    {
+        batch = std::max(batch, 1);
+        packet_size = packet_size_;
+        slab.resize(batch * packet_size);
+        msgs.resize(batch);
+        iovs.resize(batch);
+        for (int i = 0; i < batch; i++) {
+            iovs[i].iov_base = slab.data() + i * packet_size;
+            iovs[i].iov_len = packet_size;
+        }
+
+        epfd = epoll_create1(EPOLL_CLOEXEC);
+        evfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (epfd < 0 || evfd < 0)
+            return -1;
+        epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.ptr = NULL;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, evfd, &ev);
+        running = true;
+        thread = new std::thread(&Reactor::loop, this);
+        return 0;
+    }
+
+    void stop()
+    {
+        if (thread) {
+            post([this] { running = false; });
+            thread->join();
+            delete thread;
+            thread = NULL;
+        }
+        if (evfd >= 0)
+            ::close(evfd);
+        if (epfd >= 0)
+            ::close(epfd);
+        evfd = epfd = -1;
+    }
+
+    void post(std::function<void()> command)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            commands.push_back(std::move(command));
+        }
+        uint64_t one = 1;
+        if (write(evfd, &one, sizeof(one)) < 0) {
+        }
+    }
+
+    void loop()
+    {
+        epoll_event events[REACTOR_MAX_EVENTS];
+        std::deque<std::function<void()>> pending;
+        int64_t last_tick = 0;
+
+        while (running) {
+            int n = epoll_wait(epfd, events, REACTOR_MAX_EVENTS, REACTOR_TICK_MS);
+            int64_t now = monotonicUs();
+            for (int i = 0; i < n; i++) {
+                FdTag* tag = (FdTag*)events[i].data.ptr;
+                if (tag == NULL) {
+                    uint64_t v;
+                    if (read(evfd, &v, sizeof(v)) < 0) {
+                    }
+                    continue;
+                }
+                tag->session->onEvent(tag->kind, events[i].events, now);
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                pending.swap(commands);
+            }
+            for (auto& command : pending)
+                command();
+            pending.clear();
+
+            if (now - last_tick >= REACTOR_TICK_MS * 1000) {
+                for (auto& session : sessions)
+                    session->tick(now);
+                last_tick = now;
+            }
+        }
+
+        for (auto& session : sessions)
+            session->teardown();
+        sessions.clear();
+    }
+};
+
+RtspSession::RtspSession(const RtspUrl& url_, RTSP_STREAM_TYPE transport_, RtspEngine* engine_)
+    : engine(engine_), reactor(NULL), epfd(-1), url(url_), transport(transport_), status(STATUS_CONNECTING), step(STEP_IDLE),
+      step_start_us(0), retry_at_us(0), timeout_count(0), server_addr_len(0), ctrl_fd(-1), rtp_fd(-1), rtcp_fd(-1),
+      client_port(0), server_rtcp_port(0), want_write(false), rx(CONTROL_BUFFER_SIZE), rx_len(0), cseq(0),
+      auth_retried(false), session_timeout_s(DEFAULT_SESSION_TIMEOUT_S), media_ssrc(0), broken(false),
+      discontinuity(false), server_skip(false), last_data_us(0), last_keepalive_us(0), last_report_us(0), last_pli_us(0), local_ssrc((uint32_t)random()),
+      rx_packets(0), rx_bytes(0), rx_truncated(0), rx_calls(0), ts_started(false), last_ts(0), ts_base_us(0), ts_unwrapped(0), ring(engine_->getConfig().ring_slots),
+      codec(MEDIA_CODEC_UNKNOWN), width(0), height(0)
+{
+    ctrl_tag = {this, FD_CONTROL};
+    rtp_tag = {this, FD_RTP};
+    rtcp_tag = {this, FD_RTCP};
+    auth.setCredentials(url.user, url.password);
+    memset(&server_addr, 0, sizeof(server_addr));
+    memset(&stats, 0, sizeof(stats));
+    memset(&base_rtp_stats, 0, sizeof(base_rtp_stats));
+    memset(&base_jitter_stats, 0, sizeof(base_jitter_stats));
+}
+
+RtspSession::~RtspSession()
+{
+    closeSockets();
+}
+
+void RtspSession::setStatus(Status status_)
+{
+    std::lock_guard<std::mutex> lock(info_mtx);
+    status = status_;
+    info_cv.notify_all();
+}
+
+bool RtspSession::waitPlaying(int timeout_ms)
+{
+    std::unique_lock<std::mutex> lock(info_mtx);
+    info_cv.wait_for(lock, std::chrono::milliseconds(timeout_ms), [this] { return status != STATUS_CONNECTING; });
+    return status == STATUS_PLAYING;
+}
+
+media_codec_t RtspSession::getCodec()
+{
+    std::lock_guard<std::mutex> lock(info_mtx);
+    return codec;
+}
+
+void RtspSession::getVideoSize(int* width_, int* height_)
+{
+    std::lock_guard<std::mutex> lock(info_mtx);
+    *width_ = width;
+    *height_ = height;
+}
+
+std::vector<uint8_t> RtspSession::getExtraData()
+{
+    std::lock_guard<std::mutex> lock(info_mtx);
+    return extra_data;
+}
+
+RtspSession::Stats RtspSession::getStats()
+{
+    std::lock_guard<std::mutex> lock(info_mtx);
+    Stats s = stats;
+    s.dropped_frames = ring.getDropped();
+    return s;
+}
+
+void RtspSession::syncStats()
+{
+    std::lock_guard<std::mutex> lock(info_mtx);
+    stats.packets = rx_packets;
+    stats.bytes = rx_bytes;
+    stats.truncated = rx_truncated;
+    stats.receive_calls = rx_calls;
+    stats.lost = base_rtp_stats.lost;
+    stats.reordered = base_rtp_stats.reordered + base_jitter_stats.reordered + base_jitter_stats.late;
+    stats.recovered = base_jitter_stats.recovered;
+    stats.duplicates = base_rtp_stats.duplicates + base_jitter_stats.duplicates;
+    stats.nack_sent = base_jitter_stats.nack_sent;
+    if (depacketizer) {
+        const RtpDepacketizer::Stats& s = depacketizer->getStats();
+        stats.lost += s.lost;
+        stats.reordered += s.reordered;
+        stats.duplicates += s.duplicates;
+    }
+    if (jitter) {
+        const RtpJitterBuffer::Stats& s = jitter->getStats();
+        stats.reordered += s.reordered + s.late;
+        stats.recovered += s.recovered;
+        stats.duplicates += s.duplicates;
+        stats.nack_sent += s.nack_sent;
+    }
+}
+
+void RtspSession::updateEpoll(int fd, FdTag* tag, uint32_t events, bool add)
+{
+    epoll_event ev;
+    ev.events = events;
+    ev.data.ptr = tag;
+    epoll_ctl(epfd, add ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, fd, &ev);
+}
+
+void RtspSession::closeSockets()
+{
+    int* fds[3] = {&ctrl_fd, &rtp_fd, &rtcp_fd};
+    for (int* fd : fds) {
+        if (*fd >= 0) {
+            ::close(*fd);
+            *fd = -1;
+        }
+    }
+    want_write = false;
+}
+
+void RtspSession::connect(int64_t now_us)
+{
+    step = STEP_CONNECTING;
+    step_start_us = now_us;
+    rx_len = 0;
+    tx.clear();
+    cseq = 0;
+    session_id.clear();
+    auth_retried = false;
+    ts_started = false;
+    broken = false;
+    discontinuity = stats.frames > 0;
+    server_skip = false;
+    sim_queue.clear();
+
+    // resolved once, reconnects go to the same address
+    if (server_addr_len == 0) {
+        step = STEP_RESOLVING;
+        engine->resolve(shared_from_this());
+        return;
+    }
+    connectControl(now_us);
+}
+
+void RtspSession::onResolved(const sockaddr_storage& addr, socklen_t addr_len, int64_t now_us)
+{
+    // a late answer for an attempt that timed out, or a session closed meanwhile
+    if (step != STEP_RESOLVING || status == STATUS_CLOSED)
+        return;
+    if (addr_len == 0) {
+        errno = EHOSTUNREACH;
+        fail("resolve host failed", now_us);
+        return;
+    }
+    memcpy(&server_addr, &addr, addr_len);
+    server_addr_len = addr_len;
+    step = STEP_CONNECTING;
+    connectControl(now_us);
+}
+
+void RtspSession::connectControl(int64_t now_us)
+{
+    ctrl_fd = socket(server_addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (ctrl_fd < 0) {
+        fail("create socket failed", now_us);
+        return;
+    }
+    int one = 1;
+    setsockopt(ctrl_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (::connect(ctrl_fd, (sockaddr*)&server_addr, server_addr_len) < 0 && errno != EINPROGRESS) {
+        fail("connect failed", now_us);
+        return;
+    }
+    updateEpoll(ctrl_fd, &ctrl_tag, EPOLLIN | EPOLLOUT, true);
+    want_write = true;
+}
+
+void RtspSession::fail(const char* reason, int64_t now_us)
+{
+    const RtspEngine::Config& config = engine->getConfig();
+
+    ff_warn("%s: %s, %s\n", url.url.c_str(), reason, strerror(errno));
+    closeSockets();
+    step = STEP_IDLE;
+    timeout_count++;
+    if (config.max_timeout_count > 0 && timeout_count >= config.max_timeout_count) {
+        ring.close();
+        setStatus(STATUS_CLOSED);
+        return;
+    }
+    retry_at_us = now_us + config.reconnect_ms * 1000ll;
+    {
+        std::lock_guard<std::mutex> lock(info_mtx);
+        stats.reconnects++;
+    }
+    setStatus(STATUS_CONNECTING);
+}
+
+void RtspSession::teardown()
+{
+    if (step == STEP_PLAYING && ctrl_fd >= 0) {
+        // best effort, the socket is closed right after
+        tx.clear();
+        sendRequest("TEARDOWN", content_base.empty() ? url.url : content_base, "", monotonicUs());
+    }
+    closeSockets();
+    step = STEP_IDLE;
+    ring.close();
+    setStatus(STATUS_CLOSED);
+}
+
+int RtspSession::flushControl()
+{
+    while (!tx.empty()) {
+        ssize_t n = send(ctrl_fd, tx.data(), tx.size(), MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            return -1;
+        }
+        tx.erase(0, n);
+    }
+    bool need_write = !tx.empty();
+    if (need_write != want_write) {
+        updateEpoll(ctrl_fd, &ctrl_tag, EPOLLIN | (need_write ? (uint32_t)EPOLLOUT : 0u), false);
+        want_write = need_write;
+    }
+    return 0;
+}
+
+void RtspSession::sendRequest(const std::string& method, const std::string& uri, const std::string& headers, int64_t now_us)
+{
+    std::string request = method + " " + uri + " RTSP/1.0\r\nCSeq: " + std::to_string(++cseq) + "\r\nUser-Agent: ff_media\r\n";
+    if (auth.ready())
+        request += "Authorization: " + auth.header(method, uri) + "\r\n";
+    if (!session_id.empty())
+        request += "Session: " + session_id + "\r\n";
+    request += headers + "\r\n";
+
+    last_method = method;
+    last_uri = uri;
+    last_headers = headers;
+    if (step != STEP_PLAYING)
+        step_start_us = now_us;
+    tx += request;
+    if (flushControl() < 0)
+        fail("send request failed", now_us);
+}
+
+void RtspSession::sendReceiverReport(int64_t now_us)
+{
+    // empty receiver report, keeps the server side rtcp timeout alive
+    uint8_t rr[8] = {0x80, 201, 0, 1, (uint8_t)(local_ssrc >> 24), (uint8_t)(local_ssrc >> 16), (uint8_t)(local_ssrc >> 8),
+                     (uint8_t)local_ssrc};
+
+    last_report_us = now_us;
+    if (transport == RTSP_STREAM_TYPE_TCP) {
+        uint8_t header[4] = {'$', 1, 0, sizeof(rr)};
+        tx.append((const char*)header, sizeof(header));
+        tx.append((const char*)rr, sizeof(rr));
+        if (flushControl() < 0)
+            fail("send rtcp failed", now_us);
+    } else if (rtcp_fd >= 0 && server_rtcp_port) {
+        sockaddr_storage addr = server_addr;
+        if (addr.ss_family == AF_INET6)
+            ((sockaddr_in6*)&addr)->sin6_port = htons(server_rtcp_port);
+        else
+            ((sockaddr_in*)&addr)->sin_port = htons(server_rtcp_port);
+        sendto(rtcp_fd, rr, sizeof(rr), 0, (sockaddr*)&addr, server_addr_len);
+    }
+}
+
+int RtspSession::openUdpPorts()
+{
+    static std::atomic<uint32_t> next_port(UDP_PORT_MIN);
+    int family = server_addr.ss_family;
+
+    for (int attempt = 0; attempt < 1000; attempt++) {
+        uint16_t port = UDP_PORT_MIN + (next_port.fetch_add(2) - UDP_PORT_MIN) % (UDP_PORT_MAX - UDP_PORT_MIN);
+        int fds[2] = {-1, -1};
+        bool ok = true;
+        for (int i = 0; i < 2 && ok; i++) {
+            sockaddr_storage addr;
+            memset(&addr, 0, sizeof(addr));
+            addr.ss_family = family;
+            if (family == AF_INET6)
+                ((sockaddr_in6*)&addr)->sin6_port = htons(port + i);
+            else
+                ((sockaddr_in*)&addr)->sin_port = htons(port + i);
+            fds[i] = socket(family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+            ok = fds[i] >= 0 && bind(fds[i], (sockaddr*)&addr, family == AF_INET6 ? sizeof(sockaddr_in6) : sizeof(sockaddr_in)) == 0;
+        }
+        if (!ok) {
+            for (int fd : fds) {
+                if (fd >= 0)
+                    ::close(fd);
+            }
+            continue;
+        }
+
+        int rcvbuf = engine->getConfig().udp_recv_buffer;
+        setsockopt(fds[0], SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+        rtp_fd = fds[0];
+        rtcp_fd = fds[1];
+        client_port = port;
+        updateEpoll(rtp_fd, &rtp_tag, EPOLLIN, true);
+        updateEpoll(rtcp_fd, &rtcp_tag, EPOLLIN, true);
+        return 0;
+    }
+    return -1;
+}
+
+int RtspSession::openMulticastPorts(const std::string& group, uint16_t port)
+{
+    ip_mreq mreq;
+    memset(&mreq, 0, sizeof(mreq));
+    if (inet_pton(AF_INET, group.c_str(), &mreq.imr_multiaddr) != 1) {
+        errno = EINVAL;
+        return -1;
+    }
+    const std::string& interface = engine->getConfig().multicast_interface;
+    mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+    if (!interface.empty())
+        inet_pton(AF_INET, interface.c_str(), &mreq.imr_interface);
+
+    // bound to the group, so other groups on the same port are not received
+    int fds[2] = {-1, -1};
+    for (int i = 0; i < 2; i++) {
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port + i);
+        addr.sin_addr = mreq.imr_multiaddr;
+        int one = 1;
+        fds[i] = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fds[i] < 0 || setsockopt(fds[i], SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) < 0
+            || bind(fds[i], (sockaddr*)&addr, sizeof(addr)) < 0
+            || setsockopt(fds[i], IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0) {
+            for (int fd : fds) {
+                if (fd >= 0)
+                    ::close(fd);
+            }
+            return -1;
+        }
+    }
+
+    int rcvbuf = engine->getConfig().udp_recv_buffer;
+    setsockopt(fds[0], SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    rtp_fd = fds[0];
+    rtcp_fd = fds[1];
+    client_port = port;
+    updateEpoll(rtp_fd, &rtp_tag, EPOLLIN, true);
+    updateEpoll(rtcp_fd, &rtcp_tag, EPOLLIN, true);
+    return 0;
+}
+
+void RtspSession::updateVideoInfo(const uint8_t* data, size_t size)
+{
+    std::vector<NalUnit> nals;
+    std::vector<uint8_t> sets;
+    int w = 0, h = 0;
+
+    getParameterSets(data, size, sdp.codec, sets);
+    splitNalUnits(sets.data(), sets.size(), nals);
+    for (auto& nal : nals) {
+        int type = nalUnitType(nal.data, sdp.codec);
+        if ((sdp.codec == MEDIA_CODEC_VIDEO_H265 ? type == 33 : type == 7)
+            && parseSpsSize(nal.data, nal.size, sdp.codec, &w, &h))
+            break;
+    }
+
+    std::lock_guard<std::mutex> lock(info_mtx);
+    if (w > 0 && width == 0) {
+        width = w;
+        height = h;
+    }
+    if (extra_data.empty() && !sets.empty())
+        extra_data = sets;
+}
+
+void RtspSession::onFrame(std::vector<uint8_t>& frame, uint32_t timestamp, bool key, bool corrupt)
+{
+    if (!ts_started) {
+        ts_started = true;
+        last_ts = timestamp;
+        ts_unwrapped = 0;
+        ts_base_us = monotonicUs();
+    }
+    ts_unwrapped += (int32_t)(timestamp - last_ts);
+    last_ts = timestamp;
+    int64_t pts_us = ts_base_us + ts_unwrapped * 1000000 / RTP_VIDEO_CLOCK;
+
+    // the sdp may not carry the parameter sets
+    if (key && width == 0)
+        updateVideoInfo(frame.data(), frame.size());
+
+    // a lost packet damages the frame and everything predicted from it up to an intact key frame
+    uint32_t flags = 0;
+    if (corrupt) {
+        flags = BUFFER_FLAG_CORRUPT;
+        broken = true;
+    } else if (key) {
+        broken = false;
+    } else if (broken) {
+        flags = BUFFER_FLAG_REF_LOST;
+    }
+    // asked again while no intact key frame came, the server may have been rate limited
+    if (flags)
+        sendPli(monotonicUs());
+
+    std::lock_guard<std::mutex> lock(info_mtx);
+    stats.frames++;
+    if (corrupt)
+        stats.corrupt_frames++;
+    if (flags && engine->getConfig().drop_until_idr) {
+        stats.skipped_frames++;
+        discontinuity = true;
+        return;
+    }
+    // frames the server left out on purpose, the key frame is intact and nothing was lost
+    if (key && server_skip) {
+        server_skip = false;
+        discontinuity = true;
+    }
+    if (discontinuity)
+        flags |= BUFFER_FLAG_DISCONTINUITY;
+
+    // the depacketizer continues in the storage of the slot that was freed last
+    discontinuity = !ring.push(frame, pts_us, key, flags);
+}
+
+void RtspSession::onRtp(const uint8_t* data, size_t size, int64_t now_us)
+{
+    RtpHeader rtp;
+
+    if (depacketizer == nullptr || parseRtpHeader(data, size, &rtp) < 0 || rtp.payload_type != sdp.payload_type)
+        return;
+    last_data_us = now_us;
+    rx_packets++;
+    rx_bytes += size;
+    media_ssrc = rtp.ssrc;
+    if (jitter) {
+        jitter->input(rtp, now_us);
+        jitter->poll(now_us);
+    } else {
+        depacketizer->input(rtp);
+    }
+}
+
+bool RtspSession::simulateNetwork(const uint8_t* data, size_t size, int64_t now_us)
+{
+    const RtspEngine::Config& config = engine->getConfig();
+
+    if (config.sim_loss_percent <= 0 && config.sim_jitter_ms <= 0)
+        return false;
+    if (random() % 10000 < config.sim_loss_percent * 100)
+        return true;
+    if (config.sim_jitter_ms > 0) {
+        int64_t release_us = now_us + random() % (config.sim_jitter_ms * 1000);
+        sim_queue.emplace(release_us, std::vector<uint8_t>(data, data + size));
+        return true;
+    }
+    return false;
+}
+
+void RtspSession::releaseSimulated(int64_t now_us)
+{
+    while (!sim_queue.empty() && sim_queue.begin()->first <= now_us) {
+        onRtp(sim_queue.begin()->second.data(), sim_queue.begin()->second.size(), now_us);
+        sim_queue.erase(sim_queue.begin());
+    }
+}
+
+void RtspSession::sendNack(const std::vector<uint16_t>& seqs)
+{
+    uint8_t rr[8] = {0x80, 201, 0, 1, (uint8_t)(local_ssrc >> 24), (uint8_t)(local_ssrc >> 16), (uint8_t)(local_ssrc >> 8),
+                     (uint8_t)local_ssrc};
+
+    if (rtcp_fd < 0 || server_rtcp_port == 0)
+        return;
+    // a compound rtcp packet starts with a report
+    rtcp_out.assign(rr, rr + sizeof(rr));
+    buildRtcpNack(local_ssrc, media_ssrc, seqs, rtcp_out);
+    sendRtcp();
+}
+
+void RtspSession::sendPli(int64_t now_us)
+{
+    uint8_t rr[8] = {0x80, 201, 0, 1, (uint8_t)(local_ssrc >> 24), (uint8_t)(local_ssrc >> 16), (uint8_t)(local_ssrc >> 8),
+                     (uint8_t)local_ssrc};
+
+    if (rtcp_fd < 0 || server_rtcp_port == 0 || !engine->getConfig().pli)
+        return;
+    // the server rate limits key frames too, this only keeps a burst of losses from flooding it
+    if (last_pli_us && now_us - last_pli_us < SESSION_PLI_INTERVAL_US)
+        return;
+    last_pli_us = now_us;
+    rtcp_out.assign(rr, rr + sizeof(rr));
+    buildRtcpPli(local_ssrc, media_ssrc, rtcp_out);
+    sendRtcp();
+}
+
+void RtspSession::sendRtcp()
+{
+    sockaddr_storage addr = server_addr;
+    if (addr.ss_family == AF_INET6)
+        ((sockaddr_in6*)&addr)->sin6_port = htons(server_rtcp_port);
+    else
+        ((sockaddr_in*)&addr)->sin_port = htons(server_rtcp_port);
+    sendto(rtcp_fd, rtcp_out.data(), rtcp_out.size(), 0, (sockaddr*)&addr, server_addr_len);
+}
+
+void RtspSession::onEvent(FdKind kind, uint32_t events, int64_t now_us)
+{
+    if (kind == FD_CONTROL) {
+        if (ctrl_fd < 0)
+            return;
+        if (step == STEP_CONNECTING) {
+            int err = 0;
+            socklen_t len = sizeof(err);
+            getsockopt(ctrl_fd, SOL_SOCKET, SO_ERROR, &err, &len);
+            if (err) {
+                errno = err;
+                fail("connect failed", now_us);
+                return;
+            }
+            if (!(events & EPOLLOUT))
+                return;
+            step = STEP_OPTIONS;
+            sendRequest("OPTIONS", url.url, "", now_us);
+            return;
+        }
+        if ((events & EPOLLOUT) && flushControl() < 0) {
+            fail("send failed", now_us);
+            return;
+        }
+        if (events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+            onControlReadable(now_us);
+        return;
+    }
+
+    receiveUdp(kind == FD_RTP ? rtp_fd : rtcp_fd, kind == FD_RTP, now_us);
+    releaseSimulated(now_us);
+}
+
+void RtspSession::receiveUdp(int fd, bool rtp, int64_t now_us)
+{
+    std::vector<mmsghdr>& msgs = reactor->msgs;
+    int batch = msgs.size();
+
+    // bounded, so one busy camera can not starve the others on this reactor
+    for (int round = 0; round < UDP_BATCHES_PER_EVENT; round++) {
+        for (int i = 0; i < batch; i++) {
+            memset(&msgs[i].msg_hdr, 0, sizeof(msgs[i].msg_hdr));
+            msgs[i].msg_hdr.msg_iov = &reactor->iovs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+        int n = recvmmsg(fd, msgs.data(), batch, MSG_DONTWAIT, NULL);
+        if (n <= 0)
+            return;
+        rx_calls++;
+        for (int i = 0; i < n; i++) {
+            if (msgs[i].msg_hdr.msg_flags & MSG_TRUNC) {
+                rx_truncated++;
+                continue;
+            }
+            const uint8_t* packet = (const uint8_t*)reactor->iovs[i].iov_base;
+            if (rtp && !simulateNetwork(packet, msgs[i].msg_len, now_us))
+                onRtp(packet, msgs[i].msg_len, now_us);
+        }
+        if (n < batch)
+            return;
+    }
+}
+
+void RtspSession::onControlReadable(int64_t now_us)
+{
+    while (ctrl_fd >= 0) {
+        ssize_t n = recv(ctrl_fd, rx.data() + rx_len, rx.size() - rx_len, 0);
+        if (n == 0) {
+            errno = ECONNRESET;
+            fail("connection closed", now_us);
+            return;
+        }
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                fail("receive failed", now_us);
+            return;
+        }
+        rx_len += n;
+
+        size_t pos = 0;
+        while (pos < rx_len && ctrl_fd >= 0) {
+            const uint8_t* p = rx.data() + pos;
+            size_t left = rx_len - pos;
+            if (p[0] == '$') {
+                // interleaved binary data, channel 0 is rtp and 1 is rtcp
+                if (left < 4)
+                    break;
+                size_t len = (p[2] << 8) | p[3];
+                if (left < 4 + len)
+                    break;
+                uint32_t skipped;
+                if (p[1] == 0)
+                    onRtp(p + 4, len, now_us);
+                else if (parseRtcpSkip(p + 4, len, &skipped))
+                    server_skip = true;
+                pos += 4 + len;
+                continue;
+            }
+            RtspMessage msg;
+            int used = parseRtspMessage((const char*)p, left, &msg);
+            if (used < 0) {
+                errno = EPROTO;
+                fail("invalid rtsp message", now_us);
+                return;
+            }
+            if (used == 0)
+                break;
+            pos += used;
+            if (!msg.is_request)
+                onResponse(msg, now_us);
+        }
+        if (ctrl_fd < 0)
+            return;
+        memmove(rx.data(), rx.data() + pos, rx_len - pos);
+        rx_len -= pos;
+        if (rx_len == rx.size()) {
+            errno = EMSGSIZE;
+            fail("control buffer overflow", now_us);
+            return;
+        }
+    }
+}
+
+void RtspSession::onResponse(const RtspMessage& msg, int64_t now_us)
+{
+    if (msg.status == 401 && !auth_retried && auth.hasCredentials()) {
+        // prefer digest when the server offers both
+        const std::string* challenge = NULL;
+        for (auto& h : msg.headers) {
+            if (strcasecmp(h.first.c_str(), "WWW-Authenticate") != 0)
+                continue;
+            if (challenge == NULL || strncasecmp(h.second.c_str(), "Digest", 6) == 0)
+                challenge = &h.second;
+        }
+        if (challenge && auth.setChallenge(*challenge)) {
+            auth_retried = true;
+            sendRequest(last_method, last_uri, last_headers, now_us);
+            return;
+        }
+    }
+    if (msg.status != 200) {
+        // keep alive requests may be refused, the stream goes on
+        if (step == STEP_PLAYING)
+            return;
+        errno = EPROTO;
+        std::string reason = last_method + " returned " + std::to_string(msg.status);
+        fail(reason.c_str(), now_us);
+        return;
+    }
+    auth_retried = false;
+
+    switch (step) {
+        case STEP_OPTIONS:
+            step = STEP_DESCRIBE;
+            sendRequest("DESCRIBE", url.url, "Accept: application/sdp\r\n", now_us);
+            break;
+
+        case STEP_DESCRIBE: {
+            if (!parseSdpVideo(msg.body, &sdp)) {
+                errno = EPROTO;
+                fail("no h264/h265 video in the sdp", now_us);
+                return;
+            }
+            const std::string* base = msg.header("Content-Base");
+            if (base == NULL)
+                base = msg.header("Content-Location");
+            content_base = base ? *base : url.url;
+            track_url = resolveControlUrl(content_base, sdp.control);
+
+            if (depacketizer) {
+                const RtpDepacketizer::Stats& s = depacketizer->getStats();
+                base_rtp_stats.lost += s.lost;
+                base_rtp_stats.reordered += s.reordered;
+                base_rtp_stats.duplicates += s.duplicates;
+            }
+            depacketizer.reset(new RtpDepacketizer(sdp.codec));
+            depacketizer->setMaxFrameSize(engine->getConfig().max_frame_size);
+            depacketizer->setFrameCallback([this](std::vector<uint8_t>& frame, uint32_t ts, bool key, bool corrupt) {
+                onFrame(frame, ts, key, corrupt);
+            });
+
+            if (jitter) {
+                const RtpJitterBuffer::Stats& s = jitter->getStats();
+                base_jitter_stats.reordered += s.reordered;
+                base_jitter_stats.recovered += s.recovered;
+                base_jitter_stats.late += s.late;
+                base_jitter_stats.duplicates += s.duplicates;
+                base_jitter_stats.nack_sent += s.nack_sent;
+            }
+            jitter.reset();
+            // interleaved tcp is neither lossy nor reordered
+            if (transport != RTSP_STREAM_TYPE_TCP && engine->getConfig().jitter_ms > 0) {
+                jitter.reset(new RtpJitterBuffer(engine->getConfig().jitter_ms));
+                jitter->setPacketCallback([this](const RtpHeader& rtp) { depacketizer->input(rtp); });
+                if (sdp.nack && engine->getConfig().nack)
+                    jitter->setNackCallback([this](const std::vector<uint16_t>& seqs) { sendNack(seqs); });
+            }
+            {
+                std::lock_guard<std::mutex> lock(info_mtx);
+                codec = sdp.codec;
+            }
+            if (!sdp.extra_data.empty())
+                updateVideoInfo(sdp.extra_data.data(), sdp.extra_data.size());
+
+            std::string transport_header;
+            if (transport == RTSP_STREAM_TYPE_TCP) {
+                transport_header = "Transport: RTP/AVP/TCP;unicast;interleaved=0-1\r\n";
+            } else if (transport == RTSP_STREAM_TYPE_MULTICAST) {
+                // the server picks the group, the sockets are opened with its reply
+                transport_header = "Transport: RTP/AVP;multicast\r\n";
+            } else {
+                if (rtp_fd < 0 && openUdpPorts() < 0) {
+                    fail("no free udp port", now_us);
+                    return;
+                }
+                transport_header = "Transport: RTP/AVP;unicast;client_port=" + std::to_string(client_port) + "-"
+                                   + std::to_string(client_port + 1) + "\r\n";
+            }
+            step = STEP_SETUP;
+            sendRequest("SETUP", track_url, transport_header, now_us);
+            break;
+        }
+
+        case STEP_SETUP: {
+            const std::string* session = msg.header("Session");
+            if (session == NULL) {
+                errno = EPROTO;
+                fail("SETUP returned no session", now_us);
+                return;
+            }
+            session_id = session->substr(0, session->find(';'));
+            size_t timeout = session->find("timeout=");
+            if (timeout != std::string::npos)
+                session_timeout_s = std::max(atoi(session->c_str() + timeout + 8), 2);
+
+            const std::string* transport_reply = msg.header("Transport");
+            size_t server_port = transport_reply ? transport_reply->find("server_port=") : std::string::npos;
+            if (server_port != std::string::npos) {
+                size_t dash = transport_reply->find('-', server_port);
+                if (dash != std::string::npos)
+                    server_rtcp_port = atoi(transport_reply->c_str() + dash + 1);
+            }
+            if (transport == RTSP_STREAM_TYPE_MULTICAST) {
+                size_t destination = transport_reply ? transport_reply->find("destination=") : std::string::npos;
+                size_t port = transport_reply ? transport_reply->find("port=") : std::string::npos;
+                // port= is also the tail of client_port= and server_port=
+                while (port != std::string::npos && port > 0 && (*transport_reply)[port - 1] == '_')
+                    port = transport_reply->find("port=", port + 5);
+                if (transport_reply == NULL || transport_reply->find("multicast") == std::string::npos
+                    || destination == std::string::npos || port == std::string::npos) {
+                    errno = EPROTO;
+                    fail("SETUP returned no multicast group", now_us);
+                    return;
+                }
+                std::string group = transport_reply->substr(destination + 12);
+                group = group.substr(0, group.find(';'));
+                if (openMulticastPorts(group, atoi(transport_reply->c_str() + port + 5)) < 0) {
+                    fail("join multicast group failed", now_us);
+                    return;
+                }
+            }
+            step = STEP_PLAY;
+            sendRequest("PLAY", content_base, "Range: npt=0.000-\r\n", now_us);
+            break;
+        }
+
+        case STEP_PLAY:
+            step = STEP_PLAYING;
+            timeout_count = 0;
+            last_data_us = last_keepalive_us = now_us;
+            sendReceiverReport(now_us);
+            setStatus(STATUS_PLAYING);
+            break;
+
+        default:
+            break;
+    }
+}
+
+void RtspSession::tick(int64_t now_us)
+{
+    const RtspEngine::Config& config = engine->getConfig();
+
+    syncStats();
+    switch (step) {
+        case STEP_IDLE:
+            if (status != STATUS_CLOSED && now_us >= retry_at_us)
+                connect(now_us);
+            break;
+
+        case STEP_PLAYING:
+            if (now_us - last_data_us > config.timeout_ms * 1000ll) {
+                errno = ETIMEDOUT;
+                fail("no data", now_us);
+                break;
+            }
+            if (now_us - last_keepalive_us >= session_timeout_s * 1000000ll / 2) {
+                last_keepalive_us = now_us;
+                sendRequest("OPTIONS", url.url, "", now_us);
+            }
+            if (step == STEP_PLAYING && now_us - last_report_us >= RTCP_REPORT_INTERVAL_US)
+                sendReceiverReport(now_us);
+            releaseSimulated(now_us);
+            if (jitter)
+                jitter->poll(now_us);
+            break;
+
+        default:
+            if (now_us - step_start_us > config.timeout_ms * 1000ll) {
+                errno = ETIMEDOUT;
+                fail("handshake timeout", now_us);
+            }
+            break;
+    }
+}
+
+RtspEngine::RtspEngine(const Config& config_)
+    : config(config_), resolver(NULL), resolver_running(true)
+{
+    int threads = std::max(config.threads, 1);
+    for (int i = 0; i < threads; i++) {
+        Reactor* reactor = new Reactor();
+        if (reactor->start(config.udp_batch, config.udp_packet_size) < 0) {
+            ff_error("start rtsp reactor failed, reason = %s\n", strerror(errno));
+            reactor->stop();
+            delete reactor;
+            break;
+        }
+        reactors.push_back(reactor);
+    }
+    resolver = new std::thread(&RtspEngine::resolveLoop, this);
+}
+
+RtspEngine::RtspEngine()
+    : RtspEngine(Config())
+{
+}
+
+RtspEngine::~RtspEngine()
+{
+    // it posts to the reactors, so it goes first
+    {
+        std::lock_guard<std::mutex> lock(resolve_mtx);
+        resolver_running = false;
+    }
+    resolve_cv.notify_all();
+    resolver->join();
+    delete resolver;
+    for (Reactor* reactor : reactors) {
+        reactor->stop();
+        delete reactor;
+    }
+}
+
+std::shared_ptr<RtspEngine> RtspEngine::getDefault()
+{
+    static std::mutex mtx;
+    static std::shared_ptr<RtspEngine> engine;
+    std::lock_guard<std::mutex> lock(mtx);
+    if (engine == nullptr) {
+        Config config;
+        config.threads = 2;
+        engine = std::make_shared<RtspEngine>(config);
+    }
+    return engine;
+}
+
+std::shared_ptr<RtspSession> RtspEngine::open(const std::string& url, RTSP_STREAM_TYPE transport)
+{
+    RtspUrl parsed;
+    if (!parseRtspUrl(url, &parsed)) {
+        ff_error("invalid rtsp url %s\n", url.c_str());
+        return nullptr;
+    }
+    if (reactors.empty())
+        return nullptr;
+
+    std::shared_ptr<RtspSession> session(new RtspSession(parsed, transport, this));
+    Reactor* reactor = reactors[0];
+    for (Reactor* r : reactors) {
+        if (r->load < reactor->load)
+            reactor = r;
+    }
+    reactor->load++;
+    session->reactor = reactor;
+    session->epfd = reactor->epfd;
+    {
+        std::lock_guard<std::mutex> lock(sessions_mtx);
+        sessions.push_back(session);
+    }
+    reactor->post([reactor, session] {
+        reactor->sessions.push_back(session);
+        session->connect(monotonicUs());
+    });
+    return session;
+}
+
+void RtspEngine::resolve(const std::shared_ptr<RtspSession>& session)
+{
+    {
+        std::lock_guard<std::mutex> lock(resolve_mtx);
+        resolve_queue.push_back(session);
+    }
+    resolve_cv.notify_one();
+}
+
+void RtspEngine::resolveLoop()
+{
+    while (true) {
+        std::shared_ptr<RtspSession> session;
+        {
+            std::unique_lock<std::mutex> lock(resolve_mtx);
+            resolve_cv.wait(lock, [this] { return !resolve_queue.empty() || !resolver_running; });
+            if (!resolver_running)
+                break;
+            session = resolve_queue.front().lock();
+            resolve_queue.pop_front();
+        }
+        if (session == nullptr)
+            continue;
+
+        // the url never changes, no lock needed to read it here
+        sockaddr_storage addr;
+        socklen_t addr_len = 0;
+        memset(&addr, 0, sizeof(addr));
+        addrinfo hints, *result = NULL;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_socktype = SOCK_STREAM;
+        std::string port = std::to_string(session->url.port);
+        if (getaddrinfo(session->url.host.c_str(), port.c_str(), &hints, &result) == 0 && result != NULL) {
+            memcpy(&addr, result->ai_addr, result->ai_addrlen);
+            addr_len = result->ai_addrlen;
+        }
+        if (result)
+            freeaddrinfo(result);
+        session->reactor->post([session, addr, addr_len] { session->onResolved(addr, addr_len, monotonicUs()); });
+    }
+}
+
+void RtspEngine::close(std::shared_ptr<RtspSession> session)
+{
+    if (session == nullptr || session->reactor == NULL)
+        return;
+    {
+        std::lock_guard<std::mutex> lock(sessions_mtx);
+        sessions.erase(std::remove(sessions.begin(), sessions.end(), session), sessions.end());
+    }
+    session->ring.close();
+    Reactor* reactor = session->reactor;
+    reactor->post([reactor, session] {
+        session->teardown();
+        auto& list = reactor->sessions;
+        list.erase(std::remove(list.begin(), list.end(), session), list.end());
+        reactor->load--;
+    });
+}
+
+RtspEngine::Stats RtspEngine::getStats()
+{
+    Stats s;
+    memset(&s, 0, sizeof(s));
+    std::lock_guard<std::mutex> lock(sessions_mtx);
+    for (auto& session : sessions) {
+        RtspSession::Stats ss = session->getStats();
+        s.sessions++;
+        s.playing += session->getStatus() == RtspSession::STATUS_PLAYING;
+        s.frames += ss.frames;
+        s.bytes += ss.bytes;
+        s.packets += ss.packets;
+        s.lost += ss.lost;
+        s.reordered += ss.reordered;
+        s.recovered += ss.recovered;
+        s.receive_calls += ss.receive_calls;
+        s.corrupt_frames += ss.corrupt_frames;
+        s.skipped_frames += ss.skipped_frames;
+        s.dropped_frames += ss.dropped_frames;
+    }
+    return s;
+}
+
+}  // namespace FFMedia
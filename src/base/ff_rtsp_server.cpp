@@ -0,0 +1,1133 @@
+#include <arpa/inet.h>
+#include <linux/sockios.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "base/ff_bitstream.hpp"
+#include "base/ff_clock.hpp"
+#include "base/ff_log.h"
+#include "base/ff_rtsp_server.hpp"
+
+namespace FFMedia
+{
+#define SERVER_MAX_EVENTS 128
+#define SERVER_TICK_MS 200
+#define CLIENT_BUFFER_SIZE (64 << 10)
+#define SERVER_UDP_PORT_MIN 50000
+#define SERVER_UDP_PORT_MAX 52000
+#define SERVER_PAYLOAD_TYPE 96
+#define SERVER_MAX_IOV 64
+#define SERVER_MAX_MMSG 1024
+
+static int bindUdp(uint16_t port)
+{
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    int fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd >= 0 && bind(fd, (sockaddr*)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        fd = -1;
+    }
+    return fd;
+}
+
+RtspServer::Mount::Mount()
+    : codec(MEDIA_CODEC_UNKNOWN), removed(false), gop_bytes(0), top_layer(0), max_layer(-1), multicast_fd(-1),
+      multicast_ttl(0), multicast_viewers(0)
+{
+    memset(&multicast_addr, 0, sizeof(multicast_addr));
+    memset(&stats, 0, sizeof(stats));
+}
+
+RtspServer::Mount::~Mount()
+{
+    if (multicast_fd >= 0)
+        close(multicast_fd);
+}
+
+RtspServer::RtspServer(const Config& config_)
+    : config(config_), listen_fd(-1), rtp_fd(-1), rtcp_fd(-1), server_rtp_port(0), epfd(-1), evfd(-1), thread(NULL),
+      running(false), client_count(0), next_session((uint32_t)random())
+{
+}
+
+RtspServer::RtspServer()
+    : RtspServer(Config())
+{
+}
+
+RtspServer::~RtspServer()
+{
+    stop();
+}
+
+int RtspServer::start()
+{
+    if (running)
+        return 0;
+
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(config.port);
+    listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    int one = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (listen_fd < 0 || bind(listen_fd, (sockaddr*)&addr, sizeof(addr)) < 0 || listen(listen_fd, 128) < 0) {
+        ff_error("rtsp server listen on port %u failed, reason = %s\n", config.port, strerror(errno));
+        stop();
+        return -1;
+    }
+
+    // the rtp/rtcp pair that is announced in the SETUP replies
+    for (uint16_t port = SERVER_UDP_PORT_MIN; port < SERVER_UDP_PORT_MAX && rtcp_fd < 0; port += 2) {
+        rtp_fd = bindUdp(port);
+        if (rtp_fd < 0)
+            continue;
+        rtcp_fd = bindUdp(port + 1);
+        if (rtcp_fd < 0) {
+            close(rtp_fd);
+            rtp_fd = -1;
+            continue;
+        }
+        server_rtp_port = port;
+    }
+    if (rtcp_fd < 0) {
+        ff_error("rtsp server has no free udp port\n");
+        stop();
+        return -1;
+    }
+    int sndbuf = 4 << 20;
+    setsockopt(rtp_fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    evfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    int fds[3] = {listen_fd, rtcp_fd, evfd};
+    for (int fd : fds) {
+        epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.fd = fd;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+    }
+
+    running = true;
+    thread = new std::thread(&RtspServer::loop, this);
+    ff_info("rtsp server listen on port %u\n", config.port);
+    return 0;
+}
+
+void RtspServer::stop()
+{
+    if (thread) {
+        running = false;
+        uint64_t one = 1;
+        if (write(evfd, &one, sizeof(one)) < 0) {
+        }
+        thread->join();
+        delete thread;
+        thread = NULL;
+    }
+
+    while (!clients.empty())
+        closeClient(clients.begin()->second.get());
+    int* fds[5] = {&listen_fd, &rtp_fd, &rtcp_fd, &epfd, &evfd};
+    for (int* fd : fds) {
+        if (*fd >= 0)
+            close(*fd);
+        *fd = -1;
+    }
+}
+
+int RtspServer::addMount(const std::string& path, media_codec_t codec)
+{
+    if (codec != MEDIA_CODEC_VIDEO_H264 && codec != MEDIA_CODEC_VIDEO_H265) {
+        ff_error("rtsp server only supports h264 and h265\n");
+        return -1;
+    }
+    std::shared_ptr<Mount> mount = std::make_shared<Mount>();
+    mount->codec = codec;
+    mount->packetizer.reset(new RtpPacketizer(codec, SERVER_PAYLOAD_TYPE, (uint32_t)random(), config.mtu));
+    mount->history.resize(config.nack_history);
+
+    std::lock_guard<std::shared_timed_mutex> lock(mounts_mtx);
+    if (mounts.count(path)) {
+        ff_error("mount %s already exists\n", path.c_str());
+        return -1;
+    }
+    mounts[path] = mount;
+    return 0;
+}
+
+void RtspServer::removeMount(const std::string& path)
+{
+    std::shared_ptr<Mount> mount;
+    {
+        std::lock_guard<std::shared_timed_mutex> lock(mounts_mtx);
+        auto it = mounts.find(path);
+        if (it == mounts.end())
+            return;
+        mount = it->second;
+        mounts.erase(it);
+    }
+    {
+        std::lock_guard<std::mutex> lock(mount->mtx);
+        mount->removed = true;
+        mount->viewers.clear();
+    }
+    // the control thread closes the viewers
+    uint64_t one = 1;
+    if (evfd >= 0 && write(evfd, &one, sizeof(one)) < 0) {
+    }
+}
+
+void RtspServer::setExtraData(const std::string& path, const uint8_t* data, size_t size)
+{
+    std::shared_ptr<Mount> mount = findMount(path, false);
+    if (mount) {
+        std::lock_guard<std::mutex> lock(mount->mtx);
+        // annex-b, so it can go in front of key frames as it is
+        getParameterSets(data, size, mount->codec, mount->extra_data);
+    }
+}
+
+int RtspServer::setMulticast(const std::string& path, const std::string& group, uint16_t port, int ttl)
+{
+    std::shared_ptr<Mount> mount = findMount(path, false);
+    if (mount == nullptr)
+        return -1;
+
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, group.c_str(), &addr.sin_addr) != 1 || !IN_MULTICAST(ntohl(addr.sin_addr.s_addr))) {
+        ff_error("%s is not a multicast group\n", group.c_str());
+        return -1;
+    }
+
+    int fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+    unsigned char loop = 1, mttl = (unsigned char)ttl;
+    setsockopt(fd, IPPROTO_IP, IP_MULTICAST_TTL, &mttl, sizeof(mttl));
+    setsockopt(fd, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop));
+    if (!config.multicast_interface.empty()) {
+        in_addr interface;
+        if (inet_pton(AF_INET, config.multicast_interface.c_str(), &interface) == 1)
+            setsockopt(fd, IPPROTO_IP, IP_MULTICAST_IF, &interface, sizeof(interface));
+    }
+    int sndbuf = 4 << 20;
+    setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+
+    std::lock_guard<std::mutex> lock(mount->mtx);
+    if (mount->multicast_fd >= 0)
+        close(mount->multicast_fd);
+    mount->multicast_fd = fd;
+    mount->multicast_addr = addr;
+    mount->multicast_ttl = ttl;
+    return 0;
+}
+
+void RtspServer::setKeyFrameCallback(const std::string& path, KeyFrameCallback callback)
+{
+    std::shared_ptr<Mount> mount = findMount(path, false);
+    if (mount == nullptr)
+        return;
+    std::lock_guard<std::mutex> lock(mount->mtx);
+    mount->key_cb = callback;
+}
+
+void RtspServer::setMaxTemporalLayer(const std::string& path, int layer)
+{
+    std::shared_ptr<Mount> mount = findMount(path, false);
+    if (mount == nullptr)
+        return;
+    std::lock_guard<std::mutex> lock(mount->mtx);
+    mount->max_layer = layer;
+}
+
+void RtspServer::requestKeyFrame(const std::shared_ptr<Mount>& mount, KeyRequest reason)
+{
+    KeyFrameCallback callback;
+    {
+        std::lock_guard<std::mutex> lock(mount->mtx);
+        if (!mount->key_cb)
+            return;
+        callback = mount->key_cb;
+        mount->stats.key_requests++;
+    }
+    callback(reason);
+}
+
+uint32_t RtspServer::getViewerCount(const std::string& path)
+{
+    std::shared_ptr<Mount> mount = findMount(path, false);
+    if (mount == nullptr)
+        return 0;
+    std::lock_guard<std::mutex> lock(mount->mtx);
+    return mount->viewers.size();
+}
+
+RtspServer::Stats RtspServer::getStats()
+{
+    Stats s;
+    memset(&s, 0, sizeof(s));
+    s.clients = client_count;
+
+    std::shared_lock<std::shared_timed_mutex> lock(mounts_mtx);
+    for (auto& it : mounts) {
+        Mount& mount = *it.second;
+        std::lock_guard<std::mutex> mount_lock(mount.mtx);
+        s.playing += mount.viewers.size();
+        s.frames += mount.stats.frames;
+        s.packets_sent += mount.stats.packets_sent;
+        s.bytes_sent += mount.stats.bytes_sent;
+        s.frames_dropped += mount.stats.frames_dropped;
+        s.retransmits += mount.stats.retransmits;
+        s.send_calls += mount.stats.send_calls;
+        s.evicted += mount.stats.evicted;
+        s.cache_starts += mount.stats.cache_starts;
+        s.key_requests += mount.stats.key_requests;
+        s.layer_dropped += mount.stats.layer_dropped;
+    }
+    return s;
+}
+
+std::shared_ptr<RtspServer::Mount> RtspServer::findMount(const std::string& uri, bool track)
+{
+    RtspUrl url;
+    if (uri.empty() || uri[0] == '/')
+        url.path = uri;
+    else if (!parseRtspUrl(uri, &url))
+        return nullptr;
+    std::string path = url.path;
+    if (track) {
+        size_t slash = path.rfind('/');
+        if (slash != std::string::npos && path.compare(slash + 1, 5, "track") == 0)
+            path.erase(slash);
+    }
+    while (path.size() > 1 && path.back() == '/')
+        path.pop_back();
+    std::shared_lock<std::shared_timed_mutex> lock(mounts_mtx);
+    auto it = mounts.find(path);
+    return it == mounts.end() ? nullptr : it->second;
+}
+
+std::string RtspServer::buildSdp(Mount& mount)
+{
+    std::lock_guard<std::mutex> lock(mount.mtx);
+    std::vector<NalUnit> nals;
+    std::string pt = std::to_string(SERVER_PAYLOAD_TYPE);
+    std::string sdp = "v=0\r\no=- 0 0 IN IP4 0.0.0.0\r\ns=ff_media\r\nc=IN IP4 0.0.0.0\r\nt=0 0\r\na=control:*\r\n";
+
+    sdp += "m=video 0 RTP/AVP " + pt + "\r\n";
+    splitNalUnits(mount.extra_data.data(), mount.extra_data.size(), nals);
+    if (mount.codec == MEDIA_CODEC_VIDEO_H265) {
+        std::string vps, sps, pps;
+        for (auto& nal : nals) {
+            int type = nalUnitType(nal.data, mount.codec);
+            std::string* out = type == 32 ? &vps : type == 33 ? &sps : type == 34 ? &pps : NULL;
+            if (out)
+                *out += (out->empty() ? "" : ",") + base64Encode(nal.data, nal.size);
+        }
+        sdp += "a=rtpmap:" + pt + " H265/90000\r\n";
+        if (!sps.empty())
+            sdp += "a=fmtp:" + pt + " sprop-vps=" + vps + ";sprop-sps=" + sps + ";sprop-pps=" + pps + "\r\n";
+    } else {
+        std::string sets;
+        for (auto& nal : nals)
+            sets += (sets.empty() ? "" : ",") + base64Encode(nal.data, nal.size);
+        sdp += "a=rtpmap:" + pt + " H264/90000\r\na=fmtp:" + pt + " packetization-mode=1";
+        sdp += sets.empty() ? "\r\n" : ";sprop-parameter-sets=" + sets + "\r\n";
+    }
+    if (config.nack_history > 0)
+        sdp += "a=rtcp-fb:" + pt + " nack\r\n";
+    sdp += "a=control:track0\r\n";
+    return sdp;
+}
+
+void RtspServer::reply(Client* client, int status, const char* reason, int cseq, const std::string& headers,
+                       const std::string& body)
+{
+    std::string msg = "RTSP/1.0 " + std::to_string(status) + " " + reason + "\r\nCSeq: " + std::to_string(cseq)
+                      + "\r\nServer: ff_media\r\n" + headers;
+    if (!body.empty())
+        msg += "Content-Length: " + std::to_string(body.size()) + "\r\n";
+    msg += "\r\n" + body;
+
+    std::shared_ptr<Slab> slab = std::make_shared<Slab>();
+    slab->data.assign(msg.begin(), msg.end());
+    {
+        std::lock_guard<std::mutex> lock(client->tx_mtx);
+        client->tx.push_back({slab, 0, {}});
+        client->tx_bytes += slab->data.size();
+    }
+    flushClient(client);
+}
+
+// The unsent part of a chunk as at most max iovecs. With its own sequence numbers every
+// packet is cut around them, the rest is still sent from the shared slab.
+int RtspServer::chunkIov(const Chunk& chunk, iovec* iov, int max)
+{
+    const std::vector<uint8_t>& data = chunk.slab->data;
+    if (chunk.seqs.empty()) {
+        iov[0].iov_base = (void*)(data.data() + chunk.pos);
+        iov[0].iov_len = data.size() - chunk.pos;
+        return 1;
+    }
+
+    int count = 0;
+    auto add = [&](const uint8_t* from, size_t begin, size_t end) {
+        if (end <= chunk.pos || count == max)
+            return;
+        size_t skip = chunk.pos > begin ? chunk.pos - begin : 0;
+        iov[count].iov_base = (void*)(from + skip);
+        iov[count].iov_len = end - begin - skip;
+        count++;
+    };
+    const std::vector<uint32_t>& packets = chunk.slab->packets;
+    for (size_t i = 0; i < packets.size() && count < max; i++) {
+        // behind the interleaved prefix and the first two bytes of the rtp header
+        size_t seq = packets[i] + 6;
+        size_t end = i + 1 < packets.size() ? packets[i + 1] : data.size();
+        add(data.data() + packets[i], packets[i], seq);
+        add(chunk.seqs.data() + i * 2, seq, seq + 2);
+        add(data.data() + seq + 2, seq + 2, end);
+    }
+    return count;
+}
+
+int RtspServer::flushClient(Client* client)
+{
+    std::lock_guard<std::mutex> lock(client->tx_mtx);
+    iovec iov[SERVER_MAX_IOV];
+
+    while (!client->tx.empty()) {
+        int count = 0;
+        for (auto it = client->tx.begin(); it != client->tx.end() && count < SERVER_MAX_IOV; ++it)
+            count += chunkIov(*it, iov + count, SERVER_MAX_IOV - count);
+        msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = count;
+        ssize_t n = sendmsg(client->fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            return -1;
+        }
+        client->tx_bytes -= n;
+        while (n > 0) {
+            Chunk& chunk = client->tx.front();
+            size_t left = chunk.slab->data.size() - chunk.pos;
+            if ((size_t)n < left) {
+                chunk.pos += n;
+                break;
+            }
+            n -= left;
+            client->tx.pop_front();
+        }
+    }
+    bool need_write = !client->tx.empty();
+    if (need_write != client->want_write) {
+        epoll_event ev;
+        ev.events = EPOLLIN | (need_write ? (uint32_t)EPOLLOUT : 0u);
+        ev.data.fd = client->fd;
+        epoll_ctl(epfd, EPOLL_CTL_MOD, client->fd, &ev);
+        client->want_write = need_write;
+    }
+    return 0;
+}
+
+void RtspServer::onRequest(Client* client, const RtspMessage& msg, int64_t now_us)
+{
+    int cseq = msg.cseq();
+    std::string session = client->session_id.empty() ? "" : "Session: " + client->session_id + ";timeout="
+                                                                 + std::to_string(config.session_timeout_s) + "\r\n";
+
+    client->last_active_us = now_us;
+    if (msg.method == "OPTIONS" || msg.method == "GET_PARAMETER" || msg.method == "SET_PARAMETER") {
+        reply(client, 200, "OK", cseq,
+              session + "Public: OPTIONS, DESCRIBE, SETUP, PLAY, TEARDOWN, GET_PARAMETER, SET_PARAMETER\r\n");
+        return;
+    }
+
+    if (msg.method == "DESCRIBE") {
+        std::shared_ptr<Mount> mount = findMount(msg.uri, false);
+        if (mount == nullptr) {
+            reply(client, 404, "Not Found", cseq, "");
+            return;
+        }
+        std::string base = msg.uri.back() == '/' ? msg.uri : msg.uri + "/";
+        reply(client, 200, "OK", cseq, "Content-Base: " + base + "\r\nContent-Type: application/sdp\r\n", buildSdp(*mount));
+        return;
+    }
+
+    if (msg.method == "SETUP") {
+        const std::string* transport = msg.header("Transport");
+        std::shared_ptr<Mount> mount = findMount(msg.uri, true);
+        if (mount == nullptr || transport == NULL) {
+            reply(client, mount ? 461 : 404, mount ? "Unsupported Transport" : "Not Found", cseq, "");
+            return;
+        }
+        // a viewer that plays is counted by its transport, it cannot switch mount or transport
+        if (client->playing) {
+            reply(client, 455, "Method Not Valid in This State", cseq, session);
+            return;
+        }
+        client->mount = mount;
+
+        std::string transport_reply;
+        size_t client_port = transport->find("client_port=");
+        if (transport->find("/TCP") != std::string::npos || transport->find("interleaved") != std::string::npos) {
+            client->tcp = true;
+            client->multicast = false;
+            transport_reply = "RTP/AVP/TCP;unicast;interleaved=0-1";
+        } else if (transport->find("multicast") != std::string::npos) {
+            std::lock_guard<std::mutex> lock(mount->mtx);
+            if (mount->multicast_fd < 0) {
+                reply(client, 461, "Unsupported Transport", cseq, "");
+                return;
+            }
+            char group[INET_ADDRSTRLEN];
+            uint16_t port = ntohs(mount->multicast_addr.sin_port);
+            inet_ntop(AF_INET, &mount->multicast_addr.sin_addr, group, sizeof(group));
+            client->tcp = false;
+            client->multicast = true;
+            transport_reply = std::string("RTP/AVP;multicast;destination=") + group + ";port=" + std::to_string(port)
+                              + "-" + std::to_string(port + 1) + ";ttl=" + std::to_string(mount->multicast_ttl);
+        } else if (client_port != std::string::npos) {
+            int port = atoi(transport->c_str() + client_port + 12);
+            client->tcp = false;
+            client->multicast = false;
+            client->rtp_addr_len = sizeof(client->rtp_addr);
+            getpeername(client->fd, (sockaddr*)&client->rtp_addr, &client->rtp_addr_len);
+            ((sockaddr_in*)&client->rtp_addr)->sin_port = htons(port);
+            transport_reply = "RTP/AVP;unicast;client_port=" + std::to_string(port) + "-" + std::to_string(port + 1)
+                              + ";server_port=" + std::to_string(server_rtp_port) + "-"
+                              + std::to_string(server_rtp_port + 1);
+        } else {
+            reply(client, 461, "Unsupported Transport", cseq, "");
+            return;
+        }
+        if (client->session_id.empty()) {
+            char id[16];
+            snprintf(id, sizeof(id), "%08X", next_session++);
+            client->session_id = id;
+        }
+        // every viewer of a mount gets the same packets
+        reply(client, 200, "OK", cseq,
+              "Transport: " + transport_reply + ";ssrc=" + std::to_string(mount->packetizer->getSsrc()) + "\r\nSession: "
+                  + client->session_id + ";timeout=" + std::to_string(config.session_timeout_s) + "\r\n");
+        return;
+    }
+
+    if (msg.method == "PLAY") {
+        std::shared_ptr<Mount> mount = client->mount;
+        if (mount == nullptr || mount->removed) {
+            reply(client, 455, "Method Not Valid in This State", cseq, session);
+            return;
+        }
+        // the reply goes first, a tcp viewer gets the cached frames behind it
+        reply(client, 200, "OK", cseq, session + "Range: npt=0.000-\r\n");
+        if (!client->playing) {
+            bool started = false;
+            client->playing = true;
+            client->wait_key = true;
+            client->behind_since_us = 0;
+            client->max_layer = INT32_MAX;
+            client->layer_change_us = 0;
+            client->short_since_us = 0;
+            client->seq_started = false;
+            client->seq_offset = 0;
+            client->skipped = 0;
+            {
+                std::lock_guard<std::mutex> lock(mount->mtx);
+                mount->viewers.push_back(clients[client->fd]);
+                if (client->multicast)
+                    mount->multicast_viewers++;
+                else
+                    started = startFromCache(*mount, client);
+            }
+            if (!started)
+                requestKeyFrame(mount, KEY_REQUEST_NEW_VIEWER);
+        }
+        return;
+    }
+
+    if (msg.method == "TEARDOWN") {
+        reply(client, 200, "OK", cseq, session);
+        closeClient(client);
+        return;
+    }
+
+    reply(client, 501, "Not Implemented", cseq, session);
+}
+
+void RtspServer::closeClient(Client* client)
+{
+    // once it is out of the viewers no pushing thread uses the socket
+    if (client->mount) {
+        std::lock_guard<std::mutex> lock(client->mount->mtx);
+        auto& viewers = client->mount->viewers;
+        auto it = std::find_if(viewers.begin(), viewers.end(),
+                               [client](const std::shared_ptr<Client>& c) { return c.get() == client; });
+        if (it != viewers.end()) {
+            viewers.erase(it);
+            if (client->multicast)
+                client->mount->multicast_viewers--;
+        }
+    }
+    int fd = client->fd;
+    if (epfd >= 0)
+        epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);
+    close(fd);
+    client_count--;
+    clients.erase(fd);
+}
+
+void RtspServer::acceptClients(int64_t now_us)
+{
+    while (true) {
+        int fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0)
+            return;
+        if ((int)clients.size() >= config.max_clients) {
+            ff_warn("rtsp server is full, reject a client\n");
+            close(fd);
+            continue;
+        }
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        std::shared_ptr<Client> client = std::make_shared<Client>();
+        client->fd = fd;
+        client->rx.resize(CLIENT_BUFFER_SIZE);
+        client->rx_len = 0;
+        client->tcp = false;
+        client->playing = false;
+        client->last_active_us = now_us;
+        client->rtp_addr_len = 0;
+        client->multicast = false;
+        client->evict = false;
+        client->tx_bytes = 0;
+        client->want_write = false;
+        client->wait_key = true;
+        client->behind_since_us = 0;
+        client->max_layer = INT32_MAX;
+        client->layer_change_us = 0;
+        client->short_since_us = 0;
+        client->seq_started = false;
+        client->seq_offset = 0;
+        client->skipped = 0;
+        clients[fd] = client;
+        client_count++;
+
+        epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.fd = fd;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+    }
+}
+
+void RtspServer::onClientReadable(Client* client, int64_t now_us)
+{
+    while (true) {
+        ssize_t n = recv(client->fd, client->rx.data() + client->rx_len, client->rx.size() - client->rx_len, 0);
+        if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+            closeClient(client);
+            return;
+        }
+        if (n < 0)
+            return;
+        client->rx_len += n;
+
+        size_t pos = 0;
+        while (pos < client->rx_len) {
+            const uint8_t* p = client->rx.data() + pos;
+            size_t left = client->rx_len - pos;
+            if (p[0] == '$') {
+                // interleaved rtcp from the viewer
+                if (left < 4)
+                    break;
+                size_t len = (p[2] << 8) | p[3];
+                if (left < 4 + len)
+                    break;
+                client->last_active_us = now_us;
+                if ((p[1] & 1) && client->mount) {
+                    RtcpKeyRequest key_request = parseRtcpKeyRequest(p + 4, len);
+                    if (key_request != RTCP_KEY_REQUEST_NONE)
+                        requestKeyFrame(client->mount,
+                                        key_request == RTCP_KEY_REQUEST_FIR ? KEY_REQUEST_FIR : KEY_REQUEST_PLI);
+                }
+                pos += 4 + len;
+                continue;
+            }
+            RtspMessage msg;
+            int used = parseRtspMessage((const char*)p, left, &msg);
+            if (used < 0 || (used > 0 && !msg.is_request)) {
+                closeClient(client);
+                return;
+            }
+            if (used == 0)
+                break;
+            pos += used;
+            int fd = client->fd;
+            onRequest(client, msg, now_us);
+            if (clients.count(fd) == 0)
+                return;
+        }
+        memmove(client->rx.data(), client->rx.data() + pos, client->rx_len - pos);
+        client->rx_len -= pos;
+        if (client->rx_len == client->rx.size()) {
+            closeClient(client);
+            return;
+        }
+    }
+}
+
+void RtspServer::onRtcp(int64_t now_us)
+{
+    uint8_t rtcp[2048];
+    sockaddr_storage from;
+    socklen_t from_len = sizeof(from);
+    std::vector<uint16_t> seqs;
+    ssize_t n;
+
+    while ((n = recvfrom(rtcp_fd, rtcp, sizeof(rtcp), 0, (sockaddr*)&from, &from_len)) > 0) {
+        from_len = sizeof(from);
+        // the rtcp port of a viewer is its rtp port + 1
+        Client* client = NULL;
+        for (auto& it : clients) {
+            Client* c = it.second.get();
+            if (!c->tcp && c->rtp_addr_len
+                && ((sockaddr_in*)&c->rtp_addr)->sin_addr.s_addr == ((sockaddr_in*)&from)->sin_addr.s_addr
+                && ntohs(((sockaddr_in*)&c->rtp_addr)->sin_port) + 1 == ntohs(((sockaddr_in*)&from)->sin_port)) {
+                client = c;
+                break;
+            }
+        }
+        if (client == NULL)
+            continue;
+        // receiver reports keep the udp viewers alive
+        client->last_active_us = now_us;
+        std::shared_ptr<Mount> mount = client->mount;
+        if (mount == nullptr)
+            continue;
+        RtcpKeyRequest key_request = parseRtcpKeyRequest(rtcp, n);
+        if (key_request != RTCP_KEY_REQUEST_NONE)
+            requestKeyFrame(mount, key_request == RTCP_KEY_REQUEST_FIR ? KEY_REQUEST_FIR : KEY_REQUEST_PLI);
+        if (mount->history.empty() || !parseRtcpNack(rtcp, n, seqs))
+            continue;
+
+        std::lock_guard<std::mutex> lock(mount->mtx);
+        for (uint16_t seq : seqs) {
+            auto& entry = mount->history[seq % mount->history.size()];
+            if (entry.first == nullptr)
+                continue;
+            const Slab& slab = *entry.first;
+            uint32_t start = slab.packets[entry.second] + 4;
+            uint32_t end = entry.second + 1 < slab.packets.size() ? slab.packets[entry.second + 1] : slab.data.size();
+            const uint8_t* packet = slab.data.data() + start;
+            if (((packet[2] << 8) | packet[3]) != seq)
+                continue;
+            if (sendto(rtp_fd, packet, end - start, MSG_DONTWAIT, (sockaddr*)&client->rtp_addr, client->rtp_addr_len) > 0)
+                mount->stats.retransmits++;
+        }
+    }
+}
+
+// Viewers of removed mounts and slow viewers the pushing threads gave up on
+void RtspServer::closeOrphans()
+{
+    std::vector<Client*> orphans;
+    for (auto& it : clients) {
+        Client* client = it.second.get();
+        if (client->evict || (client->mount && client->mount->removed))
+            orphans.push_back(client);
+    }
+    for (Client* client : orphans) {
+        if (client->evict)
+            ff_warn("rtsp session %s can not keep up, close it\n", client->session_id.c_str());
+        closeClient(client);
+    }
+}
+
+void RtspServer::loop()
+{
+    epoll_event events[SERVER_MAX_EVENTS];
+    int64_t last_check = monotonicUs();
+
+    while (running) {
+        int n = epoll_wait(epfd, events, SERVER_MAX_EVENTS, SERVER_TICK_MS);
+        int64_t now_us = monotonicUs();
+        for (int i = 0; i < n; i++) {
+            int fd = events[i].data.fd;
+            if (fd == evfd) {
+                uint64_t v;
+                if (read(evfd, &v, sizeof(v)) < 0) {
+                }
+                closeOrphans();
+            } else if (fd == listen_fd) {
+                acceptClients(now_us);
+            } else if (fd == rtcp_fd) {
+                onRtcp(now_us);
+            } else {
+                auto it = clients.find(fd);
+                if (it == clients.end())
+                    continue;
+                Client* client = it->second.get();
+                if ((events[i].events & EPOLLOUT) && flushClient(client) < 0) {
+                    closeClient(client);
+                    continue;
+                }
+                if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+                    onClientReadable(client, now_us);
+            }
+        }
+
+        if (now_us - last_check >= 1000000) {
+            last_check = now_us;
+            closeOrphans();
+            std::vector<Client*> expired;
+            for (auto& it : clients) {
+                if (now_us - it.second->last_active_us > config.session_timeout_s * 1000000ll)
+                    expired.push_back(it.second.get());
+            }
+            for (Client* client : expired) {
+                ff_info("rtsp session %s timeout\n", client->session_id.c_str());
+                closeClient(client);
+            }
+        }
+    }
+}
+
+std::shared_ptr<const RtspServer::Slab> RtspServer::buildSlab(Mount& mount, const uint8_t* data, size_t size,
+                                                               uint32_t timestamp)
+{
+    std::shared_ptr<Slab> slab = std::make_shared<Slab>();
+
+    mount.packets.clear();
+    mount.packetizer->packetize(data, size, timestamp, mount.packets);
+    slab->data.reserve(size + mount.packets.size() * 24);
+    slab->packets.reserve(mount.packets.size());
+    for (auto& packet : mount.packets) {
+        size_t len = packet.header_size + packet.payload_size;
+        uint8_t prefix[4] = {'$', 0, (uint8_t)(len >> 8), (uint8_t)len};
+        slab->packets.push_back(slab->data.size());
+        slab->data.insert(slab->data.end(), prefix, prefix + 4);
+        slab->data.insert(slab->data.end(), packet.header, packet.header + packet.header_size);
+        slab->data.insert(slab->data.end(), packet.payload, packet.payload + packet.payload_size);
+    }
+
+    if (!mount.history.empty()) {
+        for (uint32_t i = 0; i < mount.packets.size(); i++) {
+            uint16_t seq = (mount.packets[i].header[2] << 8) | mount.packets[i].header[3];
+            mount.history[seq % mount.history.size()] = std::make_pair(slab, i);
+        }
+    }
+    return slab;
+}
+
+void RtspServer::sendUdp(Mount& mount, const Slab& slab,
+                         const std::vector<std::pair<const sockaddr*, socklen_t>>& targets, int fd)
+{
+    size_t total = slab.packets.size() * targets.size();
+    mount.msgs.resize(std::min(total, (size_t)SERVER_MAX_MMSG));
+    mount.iovs.resize(mount.msgs.size());
+
+    // packet by packet, so every viewer gets the start of the frame at about the same time
+    size_t index = 0;
+    while (index < total) {
+        size_t count = std::min(total - index, mount.msgs.size());
+        for (size_t i = 0; i < count; i++) {
+            size_t packet = (index + i) / targets.size();
+            auto& target = targets[(index + i) % targets.size()];
+            uint32_t start = slab.packets[packet] + 4;
+            uint32_t end = packet + 1 < slab.packets.size() ? slab.packets[packet + 1] : slab.data.size();
+            mount.iovs[i].iov_base = (void*)(slab.data.data() + start);
+            mount.iovs[i].iov_len = end - start;
+            memset(&mount.msgs[i], 0, sizeof(mmsghdr));
+            mount.msgs[i].msg_hdr.msg_name = (void*)target.first;
+            mount.msgs[i].msg_hdr.msg_namelen = target.second;
+            mount.msgs[i].msg_hdr.msg_iov = &mount.iovs[i];
+            mount.msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        size_t done = 0;
+        while (done < count) {
+            int n = sendmmsg(fd, mount.msgs.data() + done, count - done, MSG_DONTWAIT);
+            mount.stats.send_calls++;
+            if (n < 0) {
+                if (errno == EINTR)
+                    continue;
+                // socket buffer full or a bad address, drop this one
+                done++;
+                continue;
+            }
+            for (int i = 0; i < n; i++) {
+                mount.stats.packets_sent++;
+                mount.stats.bytes_sent += mount.msgs[done + i].msg_len;
+            }
+            done += n;
+        }
+        index += count;
+    }
+}
+
+void RtspServer::updateGopCache(Mount& mount, const std::shared_ptr<const Slab>& slab, bool key)
+{
+    if (key) {
+        mount.gop.clear();
+        mount.gop_bytes = 0;
+    } else if (mount.gop.empty()) {
+        return;
+    }
+    if (mount.gop_bytes + slab->data.size() > config.gop_cache_max_bytes) {
+        // too long a gop, the next viewers wait for the key frame
+        mount.gop.clear();
+        mount.gop_bytes = 0;
+        return;
+    }
+    mount.gop.push_back(slab);
+    mount.gop_bytes += slab->data.size();
+}
+
+// Called with the mount locked, right after the PLAY reply
+bool RtspServer::startFromCache(Mount& mount, Client* client)
+{
+    if (config.gop_cache == GOP_CACHE_OFF || mount.gop.empty())
+        return false;
+    if (client->tcp && mount.gop_bytes > config.max_tcp_backlog)
+        return false;
+
+    std::vector<std::shared_ptr<const Slab>> slabs = mount.gop;
+    if (config.gop_cache == GOP_CACHE_LIVE) {
+        // the same packets, all with the time stamp of the newest frame
+        const Slab& newest = *slabs.back();
+        const uint8_t* ts = newest.data.data() + newest.packets[0] + 8;
+        for (size_t i = 0; i + 1 < slabs.size(); i++) {
+            std::shared_ptr<Slab> copy = std::make_shared<Slab>(*slabs[i]);
+            for (uint32_t offset : copy->packets)
+                memcpy(copy->data.data() + offset + 8, ts, 4);
+            slabs[i] = copy;
+        }
+    }
+
+    if (client->tcp) {
+        size_t packets = 0, bytes = 0;
+        {
+            std::lock_guard<std::mutex> tx_lock(client->tx_mtx);
+            for (auto& slab : slabs) {
+                queueSlab(client, slab);
+                packets += slab->packets.size();
+                bytes += slab->data.size();
+            }
+        }
+        mount.stats.send_calls++;
+        mount.stats.packets_sent += packets;
+        mount.stats.bytes_sent += bytes;
+        if (flushClient(client) < 0)
+            return false;
+    } else {
+        std::vector<std::pair<const sockaddr*, socklen_t>> target(
+            1, std::make_pair((const sockaddr*)&client->rtp_addr, client->rtp_addr_len));
+        for (auto& slab : slabs)
+            sendUdp(mount, *slab, target, rtp_fd);
+    }
+    client->wait_key = false;
+    mount.stats.cache_starts++;
+    return true;
+}
+
+// With the mount and the viewer's tx_mtx locked.
+void RtspServer::queueSlab(Client* client, const std::shared_ptr<const Slab>& slab)
+{
+    Chunk chunk = {slab, 0, {}};
+    if (client->seq_offset != 0) {
+        chunk.seqs.resize(slab->packets.size() * 2);
+        for (size_t i = 0; i < slab->packets.size(); i++) {
+            const uint8_t* seq = slab->data.data() + slab->packets[i] + 6;
+            uint16_t value = ((seq[0] << 8) | seq[1]) - client->seq_offset;
+            chunk.seqs[i * 2] = value >> 8;
+            chunk.seqs[i * 2 + 1] = value;
+        }
+    }
+    client->seq_started = true;
+    client->tx_bytes += slab->data.size();
+    client->tx.push_back(std::move(chunk));
+}
+
+// A frame a tcp viewer does not get, its later packets are numbered as if it was never sent.
+// The viewers that wait for their first key frame have no numbers to keep continuous yet.
+void RtspServer::skipSlab(Client* client, const Slab& slab, bool to_key)
+{
+    if (!client->seq_started)
+        return;
+    client->seq_offset += slab.packets.size();
+    if (to_key)
+        client->skipped++;
+}
+
+int RtspServer::pushFrame(const std::string& path, const uint8_t* data, size_t size, int64_t pts_us, int temporal_layer)
+{
+    std::shared_ptr<Mount> mount_ptr = findMount(path, false);
+    if (mount_ptr == nullptr)
+        return -1;
+    Mount& mount = *mount_ptr;
+    std::lock_guard<std::mutex> lock(mount.mtx);
+    bool key = isKeyFrame(data, size, mount.codec);
+    uint32_t timestamp = (uint32_t)(pts_us * RTP_VIDEO_CLOCK / 1000000);
+    int sent = 0;
+
+    if (key) {
+        if (getParameterSets(data, size, mount.codec, mount.sets) > 0) {
+            if (mount.extra_data.empty())
+                mount.extra_data = mount.sets;
+        } else if (!mount.extra_data.empty()) {
+            // the encoder keeps them in its extra data, every key frame has to carry them for
+            // the viewers that start at it
+            mount.key_frame.assign(mount.extra_data.begin(), mount.extra_data.end());
+            mount.key_frame.insert(mount.key_frame.end(), data, data + size);
+            data = mount.key_frame.data();
+            size = mount.key_frame.size();
+        }
+    }
+    mount.stats.frames++;
+    if (temporal_layer > mount.top_layer)
+        mount.top_layer = temporal_layer;
+    if (mount.max_layer >= 0 && temporal_layer > mount.max_layer) {
+        // not packetized at all, the sequence numbers stay continuous
+        mount.stats.layer_dropped += mount.viewers.size();
+        return 0;
+    }
+    if (mount.viewers.empty() && config.gop_cache == GOP_CACHE_OFF)
+        return 0;
+
+    std::shared_ptr<const Slab> slab = buildSlab(mount, data, size, timestamp);
+    if (config.gop_cache != GOP_CACHE_OFF)
+        updateGopCache(mount, slab, key);
+    if (mount.viewers.empty())
+        return 0;
+    int64_t now_us = monotonicUs();
+    bool evict = false;
+    mount.udp_targets.clear();
+    for (auto& viewer : mount.viewers) {
+        Client* client = viewer.get();
+        if (client->multicast || client->evict)
+            continue;
+        if (client->wait_key && !key) {
+            if (client->tcp)
+                skipSlab(client, *slab, true);
+            continue;
+        }
+        if (!client->tcp) {
+            client->wait_key = false;
+            mount.udp_targets.push_back(std::make_pair((const sockaddr*)&client->rtp_addr, client->rtp_addr_len));
+            sent++;
+            continue;
+        }
+
+        {
+            std::lock_guard<std::mutex> tx_lock(client->tx_mtx);
+            if (config.layer_shed_backlog > 0 && mount.top_layer > 0) {
+                // a slow viewer gets a lower frame rate of the same stream first. The socket
+                // buffer takes megabytes before our queue grows, so its unsent bytes count too.
+                int unsent = 0;
+                if (ioctl(client->fd, SIOCOUTQ, &unsent) < 0)
+                    unsent = 0;
+                size_t backlog = client->tx_bytes + unsent;
+                if (backlog > config.layer_shed_backlog && client->max_layer > 0
+                    && now_us - client->layer_change_us >= config.layer_hold_ms * 1000ll) {
+                    client->max_layer = std::min(client->max_layer, mount.top_layer) - 1;
+                    client->layer_change_us = now_us;
+                }
+                if (backlog >= config.layer_shed_backlog / 4) {
+                    client->short_since_us = 0;
+                } else if (client->short_since_us == 0) {
+                    client->short_since_us = now_us;
+                } else if (client->max_layer < mount.top_layer
+                           && now_us - client->short_since_us >= config.layer_restore_ms * 1000ll) {
+                    client->max_layer++;
+                    client->short_since_us = now_us;
+                }
+                if (temporal_layer > client->max_layer) {
+                    // no key frame needed, nothing refers to the upper layers
+                    skipSlab(client, *slab, false);
+                    mount.stats.layer_dropped++;
+                    continue;
+                }
+            }
+            if (client->tx_bytes > config.max_tcp_backlog) {
+                // the viewer can not keep up, skip to the next key frame
+                skipSlab(client, *slab, true);
+                client->wait_key = true;
+                mount.stats.frames_dropped++;
+                if (client->behind_since_us == 0) {
+                    client->behind_since_us = now_us;
+                } else if (config.slow_client_timeout_ms > 0
+                           && now_us - client->behind_since_us > config.slow_client_timeout_ms * 1000ll) {
+                    client->evict = true;
+                    mount.stats.evicted++;
+                    evict = true;
+                }
+                continue;
+            }
+            client->behind_since_us = 0;
+            if (client->skipped > 0) {
+                // before the key frame it resumes at, so it is not taken for a loss
+                std::shared_ptr<Slab> notice = std::make_shared<Slab>();
+                std::vector<uint8_t> app;
+                buildRtcpSkip(mount.packetizer->getSsrc(), client->skipped, app);
+                uint8_t prefix[4] = {'$', 1, (uint8_t)(app.size() >> 8), (uint8_t)app.size()};
+                notice->data.assign(prefix, prefix + 4);
+                notice->data.insert(notice->data.end(), app.begin(), app.end());
+                client->tx.push_back({notice, 0, {}});
+                client->tx_bytes += notice->data.size();
+                client->skipped = 0;
+            }
+            queueSlab(client, slab);
+        }
+        client->wait_key = false;
+        mount.stats.send_calls++;
+        mount.stats.packets_sent += slab->packets.size();
+        mount.stats.bytes_sent += slab->data.size();
+        if (flushClient(client) < 0)
+            client->wait_key = true;
+        sent++;
+    }
+    if (!mount.udp_targets.empty())
+        sendUdp(mount, *slab, mount.udp_targets, rtp_fd);
+
+    // once to the group for all multicast viewers
+    if (mount.multicast_viewers > 0) {
+        mount.udp_targets.assign(1, std::make_pair((const sockaddr*)&mount.multicast_addr, (socklen_t)sizeof(sockaddr_in)));
+        sendUdp(mount, *slab, mount.udp_targets, mount.multicast_fd);
+        sent += mount.multicast_viewers;
+    }
+
+    if (evict) {
+        // the control thread owns the sockets
+        uint64_t one = 1;
+        if (write(evfd, &one, sizeof(one)) < 0) {
+        }
+    }
+    return sent;
+}
+
+}  // namespace FFMedia
@@ -0,0 +1,619 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/dma-buf.h>
+#include <linux/dma-heap.h>
+#include <poll.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <new>
+
+#include "base/ff_clock.hpp"
+#include "base/ff_log.h"
+#include "base/ff_shm_transport.hpp"
+
+#define SHM_TRANSPORT_MAGIC 0x48534646  // "FFSH"
+#define SHM_TRANSPORT_VERSION 1
+#define SHM_TRANSPORT_MAX_SLOTS 64
+#define SHM_TRANSPORT_POLL_MS 100
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "the control block needs lock free 64 bit atomics");
+
+namespace FFMedia
+{
+// The control block, in a memfd mapped by the writer and all readers.
+struct ShmControl {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slot_count;
+    uint32_t ring_size;
+    uint64_t slot_size;
+    ShmStreamInfo info;
+    std::atomic<uint64_t> write_seq;  // frames published
+    std::atomic<uint32_t> state;      // SHM_FRAME_EOS
+};
+
+struct alignas(64) ShmSlot {
+    std::atomic<uint64_t> seq;   // sequence number + 1 of the frame in it, 0 while written
+    std::atomic<uint64_t> pins;  // one bit per reader using it
+    uint64_t size;
+    int64_t pts;
+    uint32_t flags;
+};
+
+// ring entry: sequence number << 8 | slot
+struct ShmHello {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t bit;
+    uint32_t fd_count;
+    uint64_t control_size;
+};
+
+static size_t slotsOffset()
+{
+    return (sizeof(ShmControl) + 63) & ~(size_t)63;
+}
+
+static size_t ringOffset(uint32_t slot_count)
+{
+    return slotsOffset() + slot_count * sizeof(ShmSlot);
+}
+
+static ShmControl* controlOf(uint8_t* base)
+{
+    return (ShmControl*)base;
+}
+
+static ShmSlot* slotOf(uint8_t* base, uint32_t index)
+{
+    return (ShmSlot*)(base + slotsOffset()) + index;
+}
+
+static std::atomic<uint64_t>* ringOf(uint8_t* base)
+{
+    return (std::atomic<uint64_t>*)(base + ringOffset(controlOf(base)->slot_count));
+}
+
+static socklen_t socketAddress(const std::string& path, struct sockaddr_un* addr)
+{
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    size_t len = std::min(path.size(), sizeof(addr->sun_path) - 1);
+    memcpy(addr->sun_path, path.data(), len);
+    // '@name' is in the abstract namespace, no file to clean up
+    if (path[0] == '@')
+        addr->sun_path[0] = 0;
+    return offsetof(struct sockaddr_un, sun_path) + len + (path[0] == '@' ? 0 : 1);
+}
+
+static int allocDmaHeap(size_t size)
+{
+    int heap = ::open("/dev/dma_heap/system", O_RDWR | O_CLOEXEC);
+    if (heap < 0)
+        return -1;
+    struct dma_heap_allocation_data data;
+    memset(&data, 0, sizeof(data));
+    data.len = size;
+    data.fd_flags = O_RDWR | O_CLOEXEC;
+    int ret = ioctl(heap, DMA_HEAP_IOCTL_ALLOC, &data);
+    ::close(heap);
+    return ret < 0 ? -1 : (int)data.fd;
+}
+
+static int allocMemfd(const char* name, size_t size)
+{
+    int fd = memfd_create(name, MFD_CLOEXEC);
+    if (fd >= 0 && ftruncate(fd, size) < 0) {
+        ::close(fd);
+        fd = -1;
+    }
+    return fd;
+}
+
+static void dmaBufSync(int fd, uint64_t flags)
+{
+    struct dma_buf_sync sync;
+    sync.flags = flags;
+    while (ioctl(fd, DMA_BUF_IOCTL_SYNC, &sync) < 0 && (errno == EINTR || errno == EAGAIN))
+        ;
+}
+
+ShmTransportWriter::ShmTransportWriter()
+    : listen_fd(-1), control_fd(-1), control_size(0), control(NULL), slot_size(0), next_slot(0), seq(0),
+      dma_buf(false), written(0), dropped(0), used_bits(0), running(false)
+{
+}
+
+ShmTransportWriter::~ShmTransportWriter()
+{
+    close();
+}
+
+int ShmTransportWriter::open(const std::string& path_, const ShmStreamInfo& info, const Config& config)
+{
+    close();
+    if (path_.empty() || config.slot_count == 0 || config.slot_count > SHM_TRANSPORT_MAX_SLOTS
+        || config.slot_size == 0) {
+        ff_error("ShmTransportWriter: %u slots of %zu bytes are not supported\n", config.slot_count, config.slot_size);
+        return -1;
+    }
+    path = path_;
+    slot_size = config.slot_size;
+
+    // 1. the control block, the ring holds twice the slots
+    uint32_t ring_size = config.slot_count * 2;
+    control_size = ringOffset(config.slot_count) + ring_size * sizeof(uint64_t);
+    control_fd = allocMemfd("ff_shm_control", control_size);
+    if (control_fd >= 0) {
+        void* p = mmap(NULL, control_size, PROT_READ | PROT_WRITE, MAP_SHARED, control_fd, 0);
+        control = p == MAP_FAILED ? NULL : (uint8_t*)p;
+    }
+    if (control == NULL) {
+        ff_error("ShmTransportWriter: control block: %s\n", strerror(errno));
+        close();
+        return -1;
+    }
+    ShmControl* ctl = new (control) ShmControl;
+    ctl->magic = SHM_TRANSPORT_MAGIC;
+    ctl->version = SHM_TRANSPORT_VERSION;
+    ctl->slot_count = config.slot_count;
+    ctl->ring_size = ring_size;
+    ctl->slot_size = slot_size;
+    ctl->info = info;
+    ctl->write_seq = 0;
+    ctl->state = 0;
+    for (uint32_t i = 0; i < config.slot_count; i++) {
+        ShmSlot* slot = new (slotOf(control, i)) ShmSlot;
+        slot->seq = 0;
+        slot->pins = 0;
+    }
+    for (uint32_t i = 0; i < ring_size; i++)
+        new (&ringOf(control)[i]) std::atomic<uint64_t>(UINT64_MAX);
+
+    // 2. the slots, all dma-bufs or all memfds
+    dma_buf = config.dma_heap;
+    for (uint32_t i = 0; i < config.slot_count; i++) {
+        int fd = dma_buf ? allocDmaHeap(slot_size) : -1;
+        if (fd < 0 && dma_buf && i == 0)
+            dma_buf = false;
+        if (fd < 0 && !dma_buf)
+            fd = allocMemfd("ff_shm_slot", slot_size);
+        void* p = fd < 0 ? MAP_FAILED : mmap(NULL, slot_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (p == MAP_FAILED) {
+            ff_error("ShmTransportWriter: slot %u of %zu bytes: %s\n", i, slot_size, strerror(errno));
+            if (fd >= 0)
+                ::close(fd);
+            close();
+            return -1;
+        }
+        slot_fds.push_back(fd);
+        slot_data.push_back((uint8_t*)p);
+    }
+
+    // 3. the socket the readers connect to
+    struct sockaddr_un addr;
+    socklen_t addr_len = socketAddress(path, &addr);
+    if (path[0] != '@')
+        unlink(path.c_str());
+    listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (listen_fd < 0 || bind(listen_fd, (struct sockaddr*)&addr, addr_len) < 0 || listen(listen_fd, 16) < 0) {
+        ff_error("ShmTransportWriter: listen on %s failed: %s\n", path.c_str(), strerror(errno));
+        close();
+        return -1;
+    }
+
+    running = true;
+    accept_thread = std::thread(&ShmTransportWriter::acceptLoop, this);
+    ff_info("ShmTransportWriter: %s, %u %s slots of %zu bytes\n", path.c_str(), config.slot_count,
+            dma_buf ? "dma-buf" : "memfd", slot_size);
+    return 0;
+}
+
+void ShmTransportWriter::close()
+{
+    running = false;
+    if (accept_thread.joinable())
+        accept_thread.join();
+
+    {
+        std::lock_guard<std::mutex> lk(mtx);
+        for (auto& client : clients)
+            ::close(client.fd);
+        clients.clear();
+        used_bits = 0;
+    }
+    if (listen_fd >= 0) {
+        ::close(listen_fd);
+        if (path[0] != '@')
+            unlink(path.c_str());
+    }
+    listen_fd = -1;
+
+    for (size_t i = 0; i < slot_fds.size(); i++) {
+        munmap(slot_data[i], slot_size);
+        ::close(slot_fds[i]);
+    }
+    slot_fds.clear();
+    slot_data.clear();
+    if (control)
+        munmap(control, control_size);
+    control = NULL;
+    if (control_fd >= 0)
+        ::close(control_fd);
+    control_fd = -1;
+    next_slot = 0;
+    seq = 0;
+}
+
+int ShmTransportWriter::sendHello(int fd, int bit)
+{
+    ShmHello hello;
+    hello.magic = SHM_TRANSPORT_MAGIC;
+    hello.version = SHM_TRANSPORT_VERSION;
+    hello.bit = bit;
+    hello.fd_count = 1 + slot_fds.size();
+    hello.control_size = control_size;
+
+    std::vector<int> fds;
+    fds.push_back(control_fd);
+    fds.insert(fds.end(), slot_fds.begin(), slot_fds.end());
+
+    struct iovec iov = {&hello, sizeof(hello)};
+    std::vector<uint8_t> cmsg_buf(CMSG_SPACE(sizeof(int) * fds.size()), 0);
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cmsg_buf.data();
+    msg.msg_controllen = cmsg_buf.size();
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fds.size());
+    memcpy(CMSG_DATA(cmsg), fds.data(), sizeof(int) * fds.size());
+    return sendmsg(fd, &msg, MSG_NOSIGNAL) == (ssize_t)sizeof(hello) ? 0 : -1;
+}
+
+void ShmTransportWriter::dropClient(size_t index)
+{
+    // the frames it still had pinned are free again
+    uint64_t mask = ~(1ull << clients[index].bit);
+    for (uint32_t i = 0; i < slot_fds.size(); i++)
+        slotOf(control, i)->pins.fetch_and(mask);
+    used_bits &= mask;
+    ::close(clients[index].fd);
+    clients.erase(clients.begin() + index);
+}
+
+void ShmTransportWriter::acceptLoop()
+{
+    std::vector<struct pollfd> fds;
+    char buf[64];
+
+    while (running) {
+        fds.clear();
+        fds.push_back({listen_fd, POLLIN, 0});
+        {
+            std::lock_guard<std::mutex> lk(mtx);
+            for (auto& client : clients)
+                fds.push_back({client.fd, POLLIN, 0});
+        }
+        if (poll(fds.data(), fds.size(), SHM_TRANSPORT_POLL_MS) <= 0)
+            continue;
+
+        std::lock_guard<std::mutex> lk(mtx);
+        // readers send nothing, readable means closed
+        for (size_t i = 1; i < fds.size(); i++) {
+            if (fds[i].revents == 0)
+                continue;
+            ssize_t n = recv(fds[i].fd, buf, sizeof(buf), MSG_DONTWAIT);
+            if (n > 0 || (n < 0 && (errno == EAGAIN || errno == EINTR)))
+                continue;
+            for (size_t c = 0; c < clients.size(); c++) {
+                if (clients[c].fd == fds[i].fd) {
+                    ff_info("ShmTransportWriter: reader %d left\n", clients[c].bit);
+                    dropClient(c);
+                    break;
+                }
+            }
+        }
+
+        if (!(fds[0].revents & POLLIN))
+            continue;
+        int fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
+        if (fd < 0)
+            continue;
+        int bit = 0;
+        while (bit < 64 && (used_bits & (1ull << bit)))
+            bit++;
+        if (bit == 64 || sendHello(fd, bit) < 0) {
+            ff_warn("ShmTransportWriter: reader refused, %zu connected\n", clients.size());
+            ::close(fd);
+            continue;
+        }
+        used_bits |= 1ull << bit;
+        clients.push_back({fd, bit});
+        ff_info("ShmTransportWriter: reader %d joined\n", bit);
+    }
+}
+
+bool ShmTransportWriter::write(const void* data, size_t size, int64_t pts, uint32_t flags)
+{
+    if (control == NULL)
+        return false;
+    if (size > slot_size) {
+        ff_warn("ShmTransportWriter: frame of %zu bytes, the slots have %zu\n", size, slot_size);
+        dropped++;
+        return false;
+    }
+
+    // The oldest slot no reader pins. Writer and readers each store first and then load
+    // the other side, so either the writer sees the pin or the reader sees the slot invalid.
+    ShmControl* ctl = controlOf(control);
+    ShmSlot* slot = NULL;
+    uint32_t index = 0;
+    for (uint32_t t = 0; t < ctl->slot_count; t++) {
+        index = (next_slot + t) % ctl->slot_count;
+        ShmSlot* s = slotOf(control, index);
+        if (s->pins.load() != 0)
+            continue;
+        s->seq.store(0);
+        if (s->pins.load() != 0)
+            continue;
+        slot = s;
+        break;
+    }
+    if (slot == NULL) {
+        dropped++;
+        return false;
+    }
+
+    if (dma_buf)
+        dmaBufSync(slot_fds[index], DMA_BUF_SYNC_START | DMA_BUF_SYNC_WRITE);
+    memcpy(slot_data[index], data, size);
+    if (dma_buf)
+        dmaBufSync(slot_fds[index], DMA_BUF_SYNC_END | DMA_BUF_SYNC_WRITE);
+    slot->size = size;
+    slot->pts = pts;
+    slot->flags = flags;
+    slot->seq.store(seq + 1, std::memory_order_release);
+    ringOf(control)[seq % ctl->ring_size].store(seq << 8 | index, std::memory_order_release);
+    ctl->write_seq.store(seq + 1, std::memory_order_release);
+    seq++;
+    next_slot = index + 1;
+    written++;
+
+    // a wake up per frame, a reader whose socket is full is behind anyway
+    std::lock_guard<std::mutex> lk(mtx);
+    for (auto& client : clients)
+        send(client.fd, "f", 1, MSG_DONTWAIT | MSG_NOSIGNAL);
+    return true;
+}
+
+void ShmTransportWriter::writeEos()
+{
+    if (control == NULL)
+        return;
+    controlOf(control)->state.fetch_or(SHM_FRAME_EOS);
+    std::lock_guard<std::mutex> lk(mtx);
+    for (auto& client : clients)
+        send(client.fd, "e", 1, MSG_DONTWAIT | MSG_NOSIGNAL);
+}
+
+int ShmTransportWriter::getReaderCount()
+{
+    std::lock_guard<std::mutex> lk(mtx);
+    return clients.size();
+}
+
+ShmTransportReader::ShmTransportReader()
+    : sock(-1), control_fd(-1), control_size(0), control(NULL), slot_size(0), bit(0), next(0), latest_only(false),
+      writer_gone(false), dropped(0)
+{
+}
+
+ShmTransportReader::~ShmTransportReader()
+{
+    close();
+}
+
+int ShmTransportReader::open(const std::string& path, int timeout_ms)
+{
+    close();
+    if (path.empty())
+        return -1;
+
+    struct sockaddr_un addr;
+    socklen_t addr_len = socketAddress(path, &addr);
+    int64_t deadline = monotonicMs() + timeout_ms;
+    while (true) {
+        sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (sock >= 0 && connect(sock, (struct sockaddr*)&addr, addr_len) == 0)
+            break;
+        if (sock >= 0)
+            ::close(sock);
+        sock = -1;
+        if (monotonicMs() >= deadline) {
+            ff_error("ShmTransportReader: connect to %s failed: %s\n", path.c_str(), strerror(errno));
+            return -1;
+        }
+        usleep(10 * 1000);
+    }
+
+    // the hello with the fds of the control block and the slots
+    ShmHello hello;
+    struct iovec iov = {&hello, sizeof(hello)};
+    std::vector<uint8_t> cmsg_buf(CMSG_SPACE(sizeof(int) * (SHM_TRANSPORT_MAX_SLOTS + 1)), 0);
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cmsg_buf.data();
+    msg.msg_controllen = cmsg_buf.size();
+    struct pollfd pfd = {sock, POLLIN, 0};
+    int wait_ms = std::max<int64_t>(deadline - monotonicMs(), 1000);
+    ssize_t n = poll(&pfd, 1, wait_ms) == 1 ? recvmsg(sock, &msg, MSG_CMSG_CLOEXEC) : -1;
+
+    std::vector<int> fds;
+    for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); n > 0 && cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+            size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            fds.resize(count);
+            memcpy(fds.data(), CMSG_DATA(cmsg), count * sizeof(int));
+        }
+    }
+    if (n != sizeof(hello) || hello.magic != SHM_TRANSPORT_MAGIC || hello.version != SHM_TRANSPORT_VERSION
+        || hello.fd_count != fds.size() || fds.size() < 2 || hello.bit >= 64) {
+        ff_error("ShmTransportReader: %s is not a shm transport writer, or refused this reader\n", path.c_str());
+        for (int fd : fds)
+            ::close(fd);
+        close();
+        return -1;
+    }
+
+    control_fd = fds[0];
+    control_size = hello.control_size;
+    void* p = mmap(NULL, control_size, PROT_READ | PROT_WRITE, MAP_SHARED, control_fd, 0);
+    control = p == MAP_FAILED ? NULL : (uint8_t*)p;
+    ShmControl* ctl = controlOf(control);
+    if (control == NULL || ctl->slot_count != fds.size() - 1) {
+        ff_error("ShmTransportReader: control block of %s: %s\n", path.c_str(), strerror(errno));
+        for (size_t i = 1; i < fds.size(); i++)
+            ::close(fds[i]);
+        close();
+        return -1;
+    }
+
+    slot_size = ctl->slot_size;
+    for (size_t i = 1; i < fds.size(); i++) {
+        p = mmap(NULL, slot_size, PROT_READ, MAP_SHARED, fds[i], 0);
+        slot_fds.push_back(fds[i]);
+        slot_data.push_back(p == MAP_FAILED ? NULL : (uint8_t*)p);
+        if (p == MAP_FAILED) {
+            ff_error("ShmTransportReader: slot %zu of %s: %s\n", i - 1, path.c_str(), strerror(errno));
+            for (size_t j = i + 1; j < fds.size(); j++)
+                ::close(fds[j]);
+            close();
+            return -1;
+        }
+    }
+
+    info = ctl->info;
+    bit = 1ull << hello.bit;
+    // start with the frames written from now on
+    next = ctl->write_seq.load(std::memory_order_acquire);
+    writer_gone = false;
+    dropped = 0;
+    return 0;
+}
+
+void ShmTransportReader::close()
+{
+    if (control) {
+        // nothing of this reader stays pinned
+        ShmControl* ctl = controlOf(control);
+        for (uint32_t i = 0; i < ctl->slot_count && i < slot_fds.size(); i++)
+            slotOf(control, i)->pins.fetch_and(~bit);
+        munmap(control, control_size);
+    }
+    control = NULL;
+    for (size_t i = 0; i < slot_fds.size(); i++) {
+        if (slot_data[i])
+            munmap(slot_data[i], slot_size);
+        ::close(slot_fds[i]);
+    }
+    slot_fds.clear();
+    slot_data.clear();
+    if (control_fd >= 0)
+        ::close(control_fd);
+    control_fd = -1;
+    if (sock >= 0)
+        ::close(sock);
+    sock = -1;
+    bit = 0;
+}
+
+bool ShmTransportReader::waitWriter(int timeout_ms)
+{
+    char buf[256];
+    struct pollfd pfd = {sock, POLLIN, 0};
+    if (timeout_ms > 0 && poll(&pfd, 1, timeout_ms) <= 0)
+        return false;
+    while (true) {
+        ssize_t n = recv(sock, buf, sizeof(buf), MSG_DONTWAIT);
+        if (n > 0)
+            continue;
+        if (n == 0 || (errno != EAGAIN && errno != EINTR))
+            writer_gone = true;
+        return true;
+    }
+}
+
+ShmTransportReader::ReadResult ShmTransportReader::read(ShmFrame* frame, int timeout_ms)
+{
+    if (control == NULL)
+        return READ_EOS;
+
+    ShmControl* ctl = controlOf(control);
+    std::atomic<uint64_t>* ring = ringOf(control);
+    int64_t deadline = timeout_ms < 0 ? INT64_MAX : monotonicMs() + timeout_ms;
+
+    while (true) {
+        uint64_t w = ctl->write_seq.load(std::memory_order_acquire);
+        if (next < w) {
+            // what went by is lost, the ring only holds the newest frames
+            uint64_t first = latest_only ? w - 1 : (w > ctl->ring_size ? w - ctl->ring_size : 0);
+            if (next < first) {
+                dropped += first - next;
+                next = first;
+            }
+            uint64_t k = next++;
+            uint64_t entry = ring[k % ctl->ring_size].load(std::memory_order_acquire);
+            if (entry >> 8 != k) {
+                dropped++;
+                continue;
+            }
+            uint32_t index = entry & 0xff;
+            ShmSlot* slot = slotOf(control, index);
+            slot->pins.fetch_or(bit);
+            if (slot->seq.load() != k + 1) {
+                // the writer took the slot for a newer frame
+                slot->pins.fetch_and(~bit);
+                dropped++;
+                continue;
+            }
+            frame->seq = k;
+            frame->slot = index;
+            frame->data = slot_data[index];
+            frame->fd = slot_fds[index];
+            frame->slot_size = slot_size;
+            frame->size = slot->size;
+            frame->pts = slot->pts;
+            frame->flags = slot->flags;
+            return READ_FRAME;
+        }
+
+        if ((ctl->state.load() & SHM_FRAME_EOS) || writer_gone)
+            return READ_EOS;
+        int64_t now = monotonicMs();
+        if (now >= deadline)
+            return READ_TIMEOUT;
+        waitWriter(std::min<int64_t>(deadline - now, SHM_TRANSPORT_POLL_MS));
+    }
+}
+
+void ShmTransportReader::release(const ShmFrame& frame)
+{
+    if (control && frame.slot < slot_fds.size())
+        slotOf(control, frame.slot)->pins.fetch_and(~bit);
+}
+
+}  // namespace FFMedia
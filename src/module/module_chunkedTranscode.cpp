@@ -0,0 +1,207 @@
+#include "module/module_chunkedTranscode.hpp"
+#include "module/module_pipeline.hpp"
+#include "module/vi/module_fileReader.hpp"
+#include "module/vi/module_packetReplay.hpp"
+#include "module/vo/module_fileWriter.hpp"
+#include "module/vo/module_packetSpool.hpp"
+#include "module/vp/module_idrgate.hpp"
+
+// how long the pts of a chunk boundary is waited for
+#define PROBE_TIMEOUT_MS 2000
+
+namespace FFMedia
+{
+ChunkedTranscodeJob::ChunkedTranscodeJob(const string& input, const string& output, int chunk_count_)
+    : input_path(input), output_path(output), chunk_count(std::max(chunk_count_, 1))
+{
+    size_t pos = output_path.find_last_of('/');
+    spool_dir = pos == string::npos ? "." : output_path.substr(0, pos);
+}
+
+ChunkedTranscodeJob::~ChunkedTranscodeJob()
+{
+    for (auto& chunk : chunks) {
+        if (chunk.source)
+            chunk.source->stop();
+    }
+}
+
+int64_t ChunkedTranscodeJob::probeFirstPts(size_t idr_index)
+{
+    shared_ptr<ModuleFileReader> reader = make_shared<ModuleFileReader>(input_path);
+    reader->setBufferCount(2);
+    if (reader->init() < 0 || reader->setFileReaderSeekIdrIndex(idr_index) < 0)
+        return INT64_MIN;
+
+    shared_ptr<ModuleIdrGate> gate = make_shared<ModuleIdrGate>();
+    gate->setProductor(reader);
+    if (gate->init() < 0)
+        return INT64_MIN;
+
+    reader->start();
+    int waited = 0;
+    while (gate->getFirstPts() == INT64_MIN && reader->getModuleStatus() != STATUS_EOS && waited < PROBE_TIMEOUT_MS) {
+        usleep(10000);
+        waited += 10;
+    }
+    reader->stop();
+    return gate->getFirstPts();
+}
+
+int ChunkedTranscodeJob::buildChunk(Chunk& chunk, int index)
+{
+    int ret;
+    shared_ptr<ModuleFileReader> reader = make_shared<ModuleFileReader>(input_path);
+    reader->setBufferCount(20);
+    ret = reader->init();
+    if (ret < 0) {
+        ff_error("chunk %d: file reader init failed\n", index);
+        return ret;
+    }
+    if (chunk.first_idr > 0) {
+        ret = reader->setFileReaderSeekIdrIndex(chunk.first_idr);
+        if (ret < 0) {
+            ff_error("chunk %d: seek to idr %zu failed\n", index, chunk.first_idr);
+            return ret;
+        }
+    }
+
+    shared_ptr<ModuleIdrGate> gate = make_shared<ModuleIdrGate>(chunk.idr_count);
+    gate->setEndPts(chunk.end_pts);
+    shared_ptr<ModuleMedia> last_module = gate;
+    last_module->setProductor(reader);
+    ret = last_module->init();
+    if (ret < 0) {
+        ff_error("chunk %d: idr gate init failed\n", index);
+        return ret;
+    }
+
+    if (pipe_builder) {
+        last_module = pipe_builder(last_module, index);
+        if (last_module == nullptr) {
+            ff_error("chunk %d: build pipe failed\n", index);
+            return -1;
+        }
+    }
+
+    char name[32];
+    snprintf(name, sizeof(name), ".chunk%02d.spool", index);
+    size_t pos = output_path.find_last_of('/');
+    chunk.spool_path = spool_dir + "/" + (pos == string::npos ? output_path : output_path.substr(pos + 1)) + name;
+
+    shared_ptr<ModulePacketSpool> spool = make_shared<ModulePacketSpool>(chunk.spool_path);
+    spool->setProductor(last_module);
+    ret = spool->init();
+    if (ret < 0) {
+        ff_error("chunk %d: spool init failed\n", index);
+        return ret;
+    }
+
+    setPipelineMode(reader, PIPELINE_MODE_FREE_RUN);
+    chunk.source = reader;
+    return 0;
+}
+
+int ChunkedTranscodeJob::merge()
+{
+    int ret;
+    vector<string> files;
+    for (auto& chunk : chunks)
+        files.push_back(chunk.spool_path);
+
+    shared_ptr<ModulePacketReplay> replay = make_shared<ModulePacketReplay>(files);
+    ret = replay->init();
+    if (ret < 0) {
+        ff_error("packet replay init failed\n");
+        return ret;
+    }
+
+    const ImagePara& para = replay->getOutputImagePara();
+    shared_ptr<ModuleFileWriter> writer = make_shared<ModuleFileWriter>(output_path);
+    writer->setProductor(replay);
+    writer->setVideoParameter(para.width, para.height,
+                              para.v4l2Fmt == V4L2_PIX_FMT_HEVC ? MEDIA_CODEC_VIDEO_H265 : MEDIA_CODEC_VIDEO_H264);
+    if (replay->videoExtraDataSize())
+        writer->setVideoExtraData(replay->videoExtraData(), replay->videoExtraDataSize());
+    ret = writer->init();
+    if (ret < 0) {
+        ff_error("ModuleFileWriter init failed\n");
+        return ret;
+    }
+
+    replay->start();
+    waitPipelineEos(replay);
+    replay->stop();
+    return 0;
+}
+
+int ChunkedTranscodeJob::run()
+{
+    int ret;
+    size_t idr_total;
+
+    {
+        ModuleFileReader probe(input_path);
+        ret = probe.init();
+        if (ret < 0) {
+            ff_error("open %s failed\n", input_path.c_str());
+            return ret;
+        }
+        idr_total = probe.getFileReaderIdrCount();
+    }
+
+    int count = chunk_count;
+    if (idr_total < (size_t)count)
+        count = std::max<size_t>(idr_total, 1);
+    ff_info("%s: %zu idr frames, %d chunks\n", input_path.c_str(), idr_total, count);
+
+    chunks.clear();
+    chunks.resize(count);
+    for (int i = 0; i < count; i++) {
+        Chunk& chunk = chunks[i];
+        chunk.first_idr = idr_total * i / count;
+        chunk.idr_count = (i == count - 1) ? 0 : idr_total * (i + 1) / count - chunk.first_idr;
+        chunk.end_pts = INT64_MIN;
+        if (chunk.idr_count) {
+            // the key frame the next reader starts at, whatever its nal type
+            chunk.end_pts = probeFirstPts(chunk.first_idr + chunk.idr_count);
+            if (chunk.end_pts == INT64_MIN)
+                ff_warn("chunk %d: no pts at idr %zu, end by counting key frames\n", i, chunk.first_idr + chunk.idr_count);
+        }
+        ret = buildChunk(chunk, i);
+        if (ret < 0)
+            goto EXIT;
+    }
+
+    for (auto& chunk : chunks)
+        chunk.source->start();
+    // stop every chunk once it is done, so its reader does not go on to the end of the file
+    for (int left = count; left > 0;) {
+        for (auto& chunk : chunks) {
+            if (chunk.source == nullptr || !waitPipelineEos(chunk.source, 0))
+                continue;
+            chunk.source->dumpPipeSummary();
+            dumpPipelineProfile(chunk.source);
+            chunk.source->stop();
+            chunk.source = nullptr;
+            left--;
+        }
+        if (left > 0)
+            usleep(10000);
+    }
+
+    ret = merge();
+
+EXIT:
+    for (auto& chunk : chunks) {
+        if (chunk.source) {
+            chunk.source->stop();
+            chunk.source = nullptr;
+        }
+        if (!chunk.spool_path.empty())
+            unlink(chunk.spool_path.c_str());
+    }
+    return ret;
+}
+
+}  // namespace FFMedia
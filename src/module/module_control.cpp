@@ -0,0 +1,55 @@
+#include "module/module_control.hpp"
+
+namespace FFMedia
+{
+bool sendControlEvent(shared_ptr<ModuleMedia> module, const ControlEvent& event)
+{
+    if (module == nullptr)
+        return false;
+    for (shared_ptr<ModuleMedia> up = module->getProductor(); up != nullptr; up = up->getProductor()) {
+        ControlHandler* handler = dynamic_cast<ControlHandler*>(up.get());
+        if (handler && handler->onControlEvent(event))
+            return true;
+    }
+    return false;
+}
+
+bool requestKeyFrame(shared_ptr<ModuleMedia> module, KeyFrameReason reason)
+{
+    ControlEvent event;
+    event.type = CONTROL_EVENT_KEY_FRAME;
+    event.reason = reason;
+    event.kbps = 0;
+    return sendControlEvent(module, event);
+}
+
+bool requestBitrate(shared_ptr<ModuleMedia> module, int kbps)
+{
+    ControlEvent event;
+    event.type = CONTROL_EVENT_BITRATE;
+    event.reason = 0;
+    event.kbps = kbps;
+    return sendControlEvent(module, event);
+}
+
+const char* keyFrameReasonName(int reason)
+{
+    switch (reason) {
+        case KEY_FRAME_NEW_VIEWER:
+            return "new viewer";
+        case KEY_FRAME_PICTURE_LOSS:
+            return "picture loss";
+        case KEY_FRAME_FULL_INTRA:
+            return "full intra request";
+        case KEY_FRAME_SEGMENT_START:
+            return "segment start";
+        case KEY_FRAME_CONGESTION:
+            return "congestion";
+        case KEY_FRAME_USER:
+            return "user";
+        default:
+            return "unknown";
+    }
+}
+
+}  // namespace FFMedia
@@ -0,0 +1,271 @@
+#include <deque>
+#include <mutex>
+#include <unordered_map>
+
+#include "module/module_pipeline.hpp"
+#include "module/vp/module_mppenc.hpp"
+
+namespace FFMedia
+{
+// A stage that is later than this got a frame of an earlier stamp with the same pts
+static const int64_t MAX_PROBE_LATENCY_US = 10000000;
+// Frames in flight between the source and the last stage
+static const size_t CAPTURE_STAMP_FRAMES = 512;
+
+// Capture time of the recent frames by pts, the pts travels with the frame through the
+// decoders and converters while their output buffers are others
+static std::mutex stamps_mtx;
+static std::unordered_map<int64_t, int64_t> capture_stamps;
+static std::deque<int64_t> stamp_order;
+
+static void recordCaptureTime(int64_t pts, int64_t now_us)
+{
+    std::lock_guard<std::mutex> lock(stamps_mtx);
+    if (capture_stamps.count(pts) == 0) {
+        stamp_order.push_back(pts);
+        if (stamp_order.size() > CAPTURE_STAMP_FRAMES) {
+            capture_stamps.erase(stamp_order.front());
+            stamp_order.pop_front();
+        }
+    }
+    capture_stamps[pts] = now_us;
+}
+
+static int64_t findCaptureTime(int64_t pts)
+{
+    std::lock_guard<std::mutex> lock(stamps_mtx);
+    auto it = capture_stamps.find(pts);
+    return it == capture_stamps.end() ? -1 : it->second;
+}
+
+StageProfiler::StageProfiler()
+    : frames(0), busy_us(0), first_us(0), last_us(0), capture_stamp(false), latency_max(0)
+{
+    for (int i = 0; i < LATENCY_BUCKETS; i++)
+        latency[i] = 0;
+}
+
+StageStats StageProfiler::getStageStats(const char* name) const
+{
+    StageStats stats;
+    stats.name = name ? name : "";
+    stats.frames = frames.load();
+    stats.busy_us = busy_us.load();
+    stats.wall_us = first_us.load() ? last_us.load() - first_us.load() : 0;
+    return stats;
+}
+
+void StageProfiler::resetStageStats()
+{
+    frames = 0;
+    busy_us = 0;
+    first_us = 0;
+    last_us = 0;
+    for (int i = 0; i < LATENCY_BUCKETS; i++)
+        latency[i] = 0;
+    latency_max = 0;
+}
+
+void StageProfiler::account(int64_t start_us, int64_t end_us, bool frame_done)
+{
+    int64_t zero = 0;
+    first_us.compare_exchange_strong(zero, start_us);
+    last_us = end_us;
+    busy_us += end_us - start_us;
+    if (frame_done)
+        frames++;
+}
+
+int StageProfiler::latencyBucket(int64_t us)
+{
+    if (us < 16)
+        return (int)us;
+    int msb = 63 - __builtin_clzll((uint64_t)us);
+    int bucket = 16 + (msb - 4) * 8 + (int)((us >> (msb - 3)) & 7);
+    return std::min(bucket, LATENCY_BUCKETS - 1);
+}
+
+int64_t StageProfiler::bucketValue(int bucket)
+{
+    if (bucket < 16)
+        return bucket;
+    int msb = (bucket - 16) / 8 + 4;
+    int64_t width = (int64_t)1 << (msb - 3);
+    // middle of the bucket
+    return ((int64_t)(8 + (bucket - 16) % 8) << (msb - 3)) + width / 2;
+}
+
+void StageProfiler::probe(const shared_ptr<MediaBuffer>& buffer, int64_t now_us)
+{
+    if (buffer == nullptr || buffer->getEos())
+        return;
+    if (capture_stamp) {
+        recordCaptureTime(buffer->getPUstimestamp(), now_us);
+        return;
+    }
+
+    int64_t stamp = findCaptureTime(buffer->getPUstimestamp());
+    if (stamp < 0)
+        return;
+    int64_t us = now_us - stamp;
+    if (us < 0 || us >= MAX_PROBE_LATENCY_US)
+        return;
+    latency[latencyBucket(us)]++;
+    int64_t max = latency_max.load();
+    while (us > max && !latency_max.compare_exchange_weak(max, us))
+        ;
+}
+
+LatencyStats StageProfiler::getLatencyStats(const char* name) const
+{
+    LatencyStats stats;
+    uint64_t counts[LATENCY_BUCKETS];
+
+    stats.name = name ? name : "";
+    stats.samples = 0;
+    for (int i = 0; i < LATENCY_BUCKETS; i++) {
+        counts[i] = latency[i].load();
+        stats.samples += counts[i];
+    }
+    stats.max_us = latency_max.load();
+
+    int64_t* targets[3] = {&stats.p50_us, &stats.p90_us, &stats.p99_us};
+    const double ranks[3] = {0.5, 0.9, 0.99};
+    for (int t = 0; t < 3; t++) {
+        uint64_t rank = (uint64_t)(stats.samples * ranks[t]);
+        uint64_t seen = 0;
+        *targets[t] = 0;
+        for (int i = 0; i < LATENCY_BUCKETS && stats.samples > 0; i++) {
+            seen += counts[i];
+            if (seen > rank) {
+                *targets[t] = std::min(bucketValue(i), stats.max_us);
+                break;
+            }
+        }
+    }
+    return stats;
+}
+
+static void walkPipe(shared_ptr<ModuleMedia> module, const std::function<void(shared_ptr<ModuleMedia>)>& func)
+{
+    if (module == nullptr)
+        return;
+    func(module);
+    for (uint16_t i = 0; i < module->getConsumersCount(); i++)
+        walkPipe(module->getConsumer(i), func);
+}
+
+int setPipelineMode(shared_ptr<ModuleMedia> source, PipelineMode mode, shared_ptr<Synchronize> sync)
+{
+    if (mode == PIPELINE_MODE_REALTIME && sync == nullptr) {
+        ff_error("PIPELINE_MODE_REALTIME needs a Synchronize\n");
+        return -1;
+    }
+
+    walkPipe(source, [&](shared_ptr<ModuleMedia> module) {
+        if (mode == PIPELINE_MODE_FREE_RUN || mode == PIPELINE_MODE_LOW_LATENCY) {
+            module->setSynchronize(nullptr);
+            shared_ptr<ModuleMppEnc> enc = dynamic_pointer_cast<ModuleMppEnc>(module);
+            if (enc)
+                enc->setDuration(0);  // Use the input source timestamp
+            StageProfiler* profiler = dynamic_cast<StageProfiler*>(module.get());
+            if (profiler)
+                profiler->setCaptureStamp(mode == PIPELINE_MODE_LOW_LATENCY && module == source);
+        } else if (module == source || module->getConsumersCount() == 0) {
+            module->setSynchronize(sync);
+        }
+    });
+    return 0;
+}
+
+bool waitPipelineEos(shared_ptr<ModuleMedia> source, int timeout_ms)
+{
+    int waited = 0;
+    while (true) {
+        bool eos = true;
+        walkPipe(source, [&](shared_ptr<ModuleMedia> module) {
+            if (module->getConsumersCount() == 0 && module->getModuleStatus() != STATUS_EOS)
+                eos = false;
+        });
+        if (eos)
+            return true;
+        if (timeout_ms >= 0 && waited >= timeout_ms)
+            return false;
+        usleep(10000);
+        waited += 10;
+    }
+}
+
+std::vector<StageStats> getPipelineProfile(shared_ptr<ModuleMedia> source)
+{
+    std::vector<StageStats> stages;
+    walkPipe(source, [&](shared_ptr<ModuleMedia> module) {
+        StageProfiler* profiler = dynamic_cast<StageProfiler*>(module.get());
+        if (profiler)
+            stages.push_back(profiler->getStageStats(module->getName()));
+    });
+    return stages;
+}
+
+void dumpPipelineProfile(shared_ptr<ModuleMedia> source)
+{
+    std::vector<StageStats> stages = getPipelineProfile(source);
+    int64_t wall_us = 0;
+    uint64_t frames = 0;
+
+    ff_print("\n%-24s %10s %12s %12s %8s\n", "stage", "frames", "busy(ms)", "wall(ms)", "util");
+    for (auto& s : stages) {
+        ff_print("%-24s %10" PRIu64 " %12.1f %12.1f %7.1f%%\n", s.name.c_str(), s.frames, s.busy_us / 1000.0,
+                 s.wall_us / 1000.0, s.utilisation() * 100);
+        wall_us = std::max(wall_us, s.wall_us);
+    }
+    // the frames the source gave, else those of the busiest leaf; the last stage walked can be
+    // any branch of a tee
+    StageProfiler* source_profiler = dynamic_cast<StageProfiler*>(source.get());
+    if (source_profiler) {
+        frames = source_profiler->getStageStats(source->getName()).frames;
+    } else {
+        walkPipe(source, [&](shared_ptr<ModuleMedia> module) {
+            StageProfiler* profiler = dynamic_cast<StageProfiler*>(module.get());
+            if (profiler && module->getConsumersCount() == 0)
+                frames = std::max(frames, profiler->getStageStats(module->getName()).frames);
+        });
+    }
+
+    ff_print("total: %" PRIu64 " frames in %.3f s, %.2f fps\n\n", frames, wall_us / 1000000.0,
+             wall_us > 0 ? frames * 1000000.0 / wall_us : 0.0);
+}
+
+std::vector<LatencyStats> getPipelineLatency(shared_ptr<ModuleMedia> source)
+{
+    std::vector<LatencyStats> stages;
+    walkPipe(source, [&](shared_ptr<ModuleMedia> module) {
+        StageProfiler* profiler = dynamic_cast<StageProfiler*>(module.get());
+        if (profiler && !profiler->getCaptureStamp())
+            stages.push_back(profiler->getLatencyStats(module->getName()));
+    });
+    return stages;
+}
+
+void dumpPipelineLatency(shared_ptr<ModuleMedia> source)
+{
+    std::vector<LatencyStats> stages;
+    std::vector<bool> leaves;
+    walkPipe(source, [&](shared_ptr<ModuleMedia> module) {
+        StageProfiler* profiler = dynamic_cast<StageProfiler*>(module.get());
+        if (profiler && !profiler->getCaptureStamp()) {
+            stages.push_back(profiler->getLatencyStats(module->getName()));
+            leaves.push_back(module->getConsumersCount() == 0);
+        }
+    });
+
+    ff_print("\n%-24s %10s %10s %10s %10s %10s\n", "stage", "frames", "p50(ms)", "p90(ms)", "p99(ms)", "max(ms)");
+    for (size_t i = 0; i < stages.size(); i++) {
+        const LatencyStats& s = stages[i];
+        ff_print("%-24s %10" PRIu64 " %10.1f %10.1f %10.1f %10.1f%s\n", s.name.c_str(), s.samples, s.p50_us / 1000.0,
+                 s.p90_us / 1000.0, s.p99_us / 1000.0, s.max_us / 1000.0, leaves[i] ? "  end-to-end" : "");
+    }
+    ff_print("\n");
+}
+
+}  // namespace FFMedia
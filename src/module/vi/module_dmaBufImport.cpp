@@ -0,0 +1,256 @@
+#include <linux/dma-buf.h>
+#include <sys/ioctl.h>
+
+#include "base/ff_clock.hpp"
+#include "module/vi/module_dmaBufImport.hpp"
+
+#define DMABUF_POP_TIMEOUT_MS 100
+#define DMABUF_TEARDOWN_WAIT_MS 1000
+
+ModuleDmaBufImport::ModuleDmaBufImport(const ImagePara& para)
+    : ModuleMedia("ModuleDmaBufImport"),
+      queue([this](uint64_t, int& handle, bool consumed) { finish(handle, consumed); }),
+      frame_size(0)
+{
+    media_type = BUFFER_TYPE_VIDEO;
+    buffer_count = 4;
+    output_para = para;
+    if (output_para.hstride < output_para.width)
+        output_para.hstride = output_para.width;
+    if (output_para.vstride < output_para.height)
+        output_para.vstride = output_para.height;
+    frame_size = v4l2GetFrameSize(output_para.v4l2Fmt, output_para.hstride, output_para.vstride);
+}
+
+ModuleDmaBufImport::~ModuleDmaBufImport()
+{
+    queue.dropAll(true);
+    for (auto& b : buffers) {
+        if (b.mapped)
+            munmap(b.data, b.size);
+        if (b.fd >= 0)
+            close(b.fd);
+    }
+}
+
+int ModuleDmaBufImport::init()
+{
+    if (v4l2fmtIsCompressed(output_para.v4l2Fmt) || frame_size == 0) {
+        ff_error_m("Format %s is not supported, only raw frames\n", v4l2GetFmtName(output_para.v4l2Fmt));
+        return -1;
+    }
+
+    queue.setSlotCount(buffer_count);
+    buffer_size = frame_size;
+    return ModuleMedia::initBuffer(VideoBuffer::EXTERNAL_BUFFER);
+}
+
+int ModuleDmaBufImport::addBuffer(int fd, size_t size, void* data)
+{
+    Registered b;
+
+    if (fd < 0 || size < frame_size) {
+        ff_error_m("Buffer of %zu bytes is too small, a frame has %zu\n", size, frame_size);
+        return -1;
+    }
+    b.fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+    if (b.fd < 0) {
+        ff_error_m("dup fd %d failed: %s\n", fd, strerror(errno));
+        return -1;
+    }
+    b.size = size;
+    b.data = data;
+    if (b.data == NULL) {
+        b.data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, b.fd, 0);
+        if (b.data == MAP_FAILED)
+            b.data = mmap(NULL, size, PROT_READ, MAP_SHARED, b.fd, 0);
+        if (b.data == MAP_FAILED) {
+            // hardware consumers only need the fd
+            ff_warn_m("mmap fd %d failed: %s, the buffer has no cpu mapping\n", fd, strerror(errno));
+            b.data = NULL;
+        } else {
+            b.mapped = true;
+        }
+    }
+
+    std::lock_guard<std::mutex> lk(mtx);
+    for (size_t i = 0; i < buffers.size(); i++) {
+        if (buffers[i].fd < 0) {
+            buffers[i] = b;
+            return i;
+        }
+    }
+    buffers.push_back(b);
+    return buffers.size() - 1;
+}
+
+int ModuleDmaBufImport::removeBuffer(int handle)
+{
+    Registered b;
+    {
+        std::lock_guard<std::mutex> lk(mtx);
+        if (handle < 0 || (size_t)handle >= buffers.size() || buffers[handle].fd < 0 || buffers[handle].busy)
+            return -1;
+        b = buffers[handle];
+        buffers[handle] = Registered();
+    }
+    if (b.mapped)
+        munmap(b.data, b.size);
+    close(b.fd);
+    return 0;
+}
+
+void* ModuleDmaBufImport::getBufferData(int handle)
+{
+    std::lock_guard<std::mutex> lk(mtx);
+    if (handle < 0 || (size_t)handle >= buffers.size())
+        return NULL;
+    return buffers[handle].data;
+}
+
+int ModuleDmaBufImport::submit(int handle, int64_t pts_us)
+{
+    {
+        std::lock_guard<std::mutex> lk(mtx);
+        if (handle < 0 || (size_t)handle >= buffers.size() || buffers[handle].fd < 0)
+            return SUBMIT_INVALID;
+        if (buffers[handle].busy)
+            return SUBMIT_BUSY;
+        buffers[handle].busy = true;
+        buffers[handle].pts = pts_us < 0 ? FFMedia::monotonicUs() : pts_us;
+    }
+
+    // registered buffers bound the queue, the push does not wait
+    if (queue.push(handle, -1) < 0) {
+        std::lock_guard<std::mutex> lk(mtx);
+        buffers[handle].busy = false;
+        return SUBMIT_CLOSED;
+    }
+    return 0;
+}
+
+void ModuleDmaBufImport::endOfStream()
+{
+    queue.close();
+}
+
+void ModuleDmaBufImport::finish(int handle, bool consumed)
+{
+    {
+        std::lock_guard<std::mutex> lk(mtx);
+        // not busy before the callback, it may submit the buffer again
+        buffers[handle].busy = false;
+    }
+    if (release)
+        release(handle, consumed);
+}
+
+void ModuleDmaBufImport::flush()
+{
+    queue.dropAll(false);
+}
+
+bool ModuleDmaBufImport::waitIdle(int timeout_ms)
+{
+    return queue.waitIdle(timeout_ms);
+}
+
+int ModuleDmaBufImport::syncCpuAccess(int handle, uint64_t flags)
+{
+    int fd;
+    {
+        std::lock_guard<std::mutex> lk(mtx);
+        if (handle < 0 || (size_t)handle >= buffers.size() || buffers[handle].fd < 0)
+            return -1;
+        fd = buffers[handle].fd;
+    }
+
+    struct dma_buf_sync sync;
+    sync.flags = flags;
+    int ret;
+    do {
+        ret = ioctl(fd, DMA_BUF_IOCTL_SYNC, &sync);
+    } while (ret < 0 && (errno == EINTR || errno == EAGAIN));
+    // a memfd is coherent already
+    if (ret < 0 && errno == ENOTTY)
+        return 0;
+    return ret;
+}
+
+int ModuleDmaBufImport::beginCpuAccess(int handle, bool write)
+{
+    return syncCpuAccess(handle, DMA_BUF_SYNC_START | (write ? DMA_BUF_SYNC_RW : DMA_BUF_SYNC_READ));
+}
+
+int ModuleDmaBufImport::endCpuAccess(int handle, bool write)
+{
+    return syncCpuAccess(handle, DMA_BUF_SYNC_END | (write ? DMA_BUF_SYNC_RW : DMA_BUF_SYNC_READ));
+}
+
+uint64_t ModuleDmaBufImport::getSubmittedCount()
+{
+    return queue.getPushedCount();
+}
+
+uint64_t ModuleDmaBufImport::getCompletedCount()
+{
+    return queue.getCompletedCount();
+}
+
+uint64_t ModuleDmaBufImport::getDroppedCount()
+{
+    return queue.getDroppedCount();
+}
+
+bool ModuleDmaBufImport::teardown()
+{
+    queue.dropAll(false);
+    // rga or the encoder may still be reading the last frames
+    size_t held = queue.waitInFlight(DMABUF_TEARDOWN_WAIT_MS);
+    if (held > 0)
+        ff_warn_m("%zu buffers still with the consumers, handed back anyway\n", held);
+    queue.dropAll(true);
+    return true;
+}
+
+void ModuleDmaBufImport::bufferReleaseCallBack(shared_ptr<MediaBuffer> buffer)
+{
+    // the output buffer is back in the pool before the release callback, which may submit the
+    // handle again right away
+    queue.release(buffer->getIndex(), [this, buffer] { ModuleMedia::bufferReleaseCallBack(buffer); });
+}
+
+ModuleMedia::ProduceResult ModuleDmaBufImport::doProduce(shared_ptr<MediaBuffer> output_buffer)
+{
+    shared_ptr<VideoBuffer> buffer = static_pointer_cast<VideoBuffer>(output_buffer);
+    bool eos;
+
+    if (buffer == NULL || queue.getSlotCount() == 0)
+        return PRODUCE_EMPTY;
+
+    // a handle the output buffer still carries goes back to the application here
+    int* handle = queue.pop(buffer->getIndex() % queue.getSlotCount(), DMABUF_POP_TIMEOUT_MS, &eos);
+    if (eos) {
+        buffer->setActiveSize(0);
+        buffer->setEos(true);
+        return PRODUCE_EOS;
+    }
+    if (handle == NULL)
+        return PRODUCE_EMPTY;
+
+    Registered b;
+    {
+        std::lock_guard<std::mutex> lk(mtx);
+        // copied, addBuffer() may grow the vector
+        b = buffers[*handle];
+    }
+
+    buffer->initWithExternalBuffer(b.data, b.size, b.fd);
+    buffer->setImagePara(output_para);
+    buffer->setActiveData(b.data);
+    buffer->setActiveSize(frame_size);
+    buffer->setPUstimestamp(b.pts);
+    buffer->setDUstimestamp(b.pts);
+    buffer->setEos(false);
+    return PRODUCE_SUCCESS;
+}
@@ -0,0 +1,186 @@
+#include "base/ff_clock.hpp"
+#include "module/vi/module_memQueue.hpp"
+
+#define MEMQUEUE_POP_TIMEOUT_MS 100
+#define MEMQUEUE_DEFAULT_DEPTH 16
+#define MEMQUEUE_TEARDOWN_WAIT_MS 1000
+
+ModuleMemQueue::ModuleMemQueue(const ImagePara& para)
+    : ModuleMedia("ModuleMemQueue"),
+      queue([this](uint64_t id, Entry& entry, bool consumed) { finish(id, entry, consumed); })
+{
+    media_type = BUFFER_TYPE_VIDEO;
+    buffer_count = 8;
+    output_para = para;
+    queue.setDepth(MEMQUEUE_DEFAULT_DEPTH);
+}
+
+ModuleMemQueue::~ModuleMemQueue()
+{
+    queue.dropAll(true);
+}
+
+int ModuleMemQueue::init()
+{
+    if (output_para.v4l2Fmt != V4L2_PIX_FMT_H264 && output_para.v4l2Fmt != V4L2_PIX_FMT_HEVC
+        && output_para.v4l2Fmt != V4L2_PIX_FMT_MJPEG) {
+        ff_error_m("Format %s is not supported, only compressed video\n", v4l2GetFmtName(output_para.v4l2Fmt));
+        return -1;
+    }
+
+    queue.setSlotCount(buffer_count);
+
+    // the buffers only carry pointers to the submitted data
+    buffer_size = 16;
+    return ModuleMedia::initBuffer(VideoBuffer::MALLOC_BUFFER);
+}
+
+void ModuleMemQueue::setExtraData(const uint8_t* extra_data, unsigned extra_size)
+{
+    extra_buffer = nullptr;
+    if (extra_data == NULL || extra_size == 0)
+        return;
+    extra_buffer = make_shared<MediaBuffer>(extra_size);
+    memcpy(extra_buffer->getData(), extra_data, extra_size);
+    extra_buffer->setActiveData(extra_buffer->getData());
+    extra_buffer->setActiveSize(extra_size);
+}
+
+int64_t ModuleMemQueue::enqueue(Entry& entry, int timeout_ms)
+{
+    if (entry.pts < 0)
+        entry.pts = FFMedia::monotonicUs();
+    int64_t ret = queue.push(entry, timeout_ms);
+    if (ret == FFMedia::SubmitQueue<Entry>::PUSH_TIMEOUT)
+        return SUBMIT_TIMEOUT;
+    if (ret == FFMedia::SubmitQueue<Entry>::PUSH_CLOSED)
+        return SUBMIT_CLOSED;
+    return ret;
+}
+
+int64_t ModuleMemQueue::submit(vector<uint8_t>&& data, int64_t pts_us, int timeout_ms)
+{
+    Entry entry;
+    if (data.empty())
+        return SUBMIT_INVALID;
+    entry.owned = std::move(data);
+    entry.data = entry.owned.data();
+    entry.size = entry.owned.size();
+    entry.pts = pts_us;
+    int64_t ret = enqueue(entry, timeout_ms);
+    // a refused submission goes back to the caller
+    if (ret < 0)
+        data = std::move(entry.owned);
+    return ret;
+}
+
+int64_t ModuleMemQueue::submitCopy(const void* data, size_t size, int64_t pts_us, int timeout_ms)
+{
+    if (data == NULL || size == 0)
+        return SUBMIT_INVALID;
+    const uint8_t* p = (const uint8_t*)data;
+    vector<uint8_t> copy(p, p + size);
+    return submit(std::move(copy), pts_us, timeout_ms);
+}
+
+int64_t ModuleMemQueue::submit(const void* data, size_t size, ReleaseCallback release, int64_t pts_us, int timeout_ms)
+{
+    Entry entry;
+    if (data == NULL || size == 0)
+        return SUBMIT_INVALID;
+    entry.data = data;
+    entry.size = size;
+    entry.release = release;
+    entry.pts = pts_us;
+    return enqueue(entry, timeout_ms);
+}
+
+void ModuleMemQueue::endOfStream()
+{
+    queue.close();
+}
+
+void ModuleMemQueue::finish(uint64_t id, Entry& entry, bool consumed)
+{
+    if (entry.release)
+        entry.release(entry.data, entry.size);
+    if (completion)
+        completion(id, consumed);
+}
+
+void ModuleMemQueue::flush()
+{
+    queue.dropAll(false);
+}
+
+bool ModuleMemQueue::waitIdle(int timeout_ms)
+{
+    return queue.waitIdle(timeout_ms);
+}
+
+size_t ModuleMemQueue::getQueuedCount()
+{
+    return queue.getQueuedCount();
+}
+
+uint64_t ModuleMemQueue::getSubmittedCount()
+{
+    return queue.getPushedCount();
+}
+
+uint64_t ModuleMemQueue::getCompletedCount()
+{
+    return queue.getCompletedCount();
+}
+
+uint64_t ModuleMemQueue::getDroppedCount()
+{
+    return queue.getDroppedCount();
+}
+
+bool ModuleMemQueue::teardown()
+{
+    queue.dropAll(false);
+    // the decoder may still be reading the last access units
+    size_t held = queue.waitInFlight(MEMQUEUE_TEARDOWN_WAIT_MS);
+    if (held > 0)
+        ff_warn_m("%zu submissions still with the consumers, released anyway\n", held);
+    queue.dropAll(true);
+    return true;
+}
+
+void ModuleMemQueue::bufferReleaseCallBack(shared_ptr<MediaBuffer> buffer)
+{
+    // the output buffer is back in the pool before release and completion run, a callback
+    // that submits again finds room
+    queue.release(buffer->getIndex(), [this, buffer] { ModuleMedia::bufferReleaseCallBack(buffer); });
+}
+
+ModuleMedia::ProduceResult ModuleMemQueue::doProduce(shared_ptr<MediaBuffer> output_buffer)
+{
+    shared_ptr<VideoBuffer> buffer = static_pointer_cast<VideoBuffer>(output_buffer);
+    bool eos;
+
+    if (buffer == NULL || queue.getSlotCount() == 0)
+        return PRODUCE_EMPTY;
+
+    // a submission the buffer still carries, its release did not reach us, completes here
+    Entry* entry = queue.pop(buffer->getIndex() % queue.getSlotCount(), MEMQUEUE_POP_TIMEOUT_MS, &eos);
+    if (eos) {
+        buffer->setActiveSize(0);
+        buffer->setEos(true);
+        return PRODUCE_EOS;
+    }
+    if (entry == NULL)
+        return PRODUCE_EMPTY;
+
+    // owned data stays where it was, moving the vector keeps its storage
+    buffer->setImagePara(output_para);
+    buffer->setActiveData((void*)entry->data);
+    buffer->setActiveSize(entry->size);
+    buffer->setPUstimestamp(entry->pts);
+    buffer->setDUstimestamp(entry->pts);
+    buffer->setExtraData(extra_buffer);
+    buffer->setEos(false);
+    return PRODUCE_SUCCESS;
+}
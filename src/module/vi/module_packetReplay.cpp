@@ -0,0 +1,156 @@
+#include "module/vi/module_packetReplay.hpp"
+#include "module/vo/module_packetSpool.hpp"
+
+ModulePacketReplay::ModulePacketReplay(const vector<string>& spool_files)
+    : ModuleMedia("ModulePacketReplay"), files(spool_files), cur_file(0), fp(NULL)
+{
+    media_type = BUFFER_TYPE_VIDEO;
+    buffer_count = 8;
+}
+
+ModulePacketReplay::~ModulePacketReplay()
+{
+    if (fp)
+        fclose(fp);
+}
+
+static int readSpoolHeader(FILE* fp, PacketSpoolHeader* header)
+{
+    if (fread(header, sizeof(*header), 1, fp) != 1)
+        return -1;
+    if (memcmp(header->magic, PACKET_SPOOL_MAGIC, sizeof(header->magic)) != 0)
+        return -1;
+    return 0;
+}
+
+int ModulePacketReplay::init()
+{
+    uint32_t max_packet_size = 0;
+    PacketSpoolHeader header;
+
+    if (files.empty()) {
+        ff_error_m("No spool file is set\n");
+        return -1;
+    }
+
+    for (size_t i = 0; i < files.size(); i++) {
+        FILE* f = fopen(files[i].c_str(), "rb");
+        if (f == NULL) {
+            ff_error_m("open file %s failed, reason = %s\n", files[i].c_str(), strerror(errno));
+            return -1;
+        }
+        vector<uint8_t> extra;
+        int ret = readSpoolHeader(f, &header);
+        if (ret == 0) {
+            extra.resize(header.extra_size);
+            if (header.extra_size && fread(extra.data(), header.extra_size, 1, f) != 1)
+                ret = -1;
+        }
+        fclose(f);
+        if (ret < 0) {
+            ff_error_m("%s is not a valid spool file\n", files[i].c_str());
+            return -1;
+        }
+
+        if (i == 0) {
+            output_para = ImagePara(header.width, header.height, header.width, header.height, header.v4l2Fmt);
+            extra_data = extra;
+        } else if (header.v4l2Fmt != output_para.v4l2Fmt || header.width != output_para.width
+                   || header.height != output_para.height) {
+            ff_error_m("%s is %s %ux%u, expected %s %ux%u\n", files[i].c_str(), v4l2GetFmtName(header.v4l2Fmt),
+                       header.width, header.height, v4l2GetFmtName(output_para.v4l2Fmt), output_para.width,
+                       output_para.height);
+            return -1;
+        } else if (extra != extra_data) {
+            // the writer takes one set of parameter sets for the whole file, the packets of
+            // this file would be decoded with the first file's
+            ff_error_m("%s has other parameter sets than %s, not one stream\n", files[i].c_str(),
+                       files[0].c_str());
+            return -1;
+        }
+        max_packet_size = std::max(max_packet_size, header.max_packet_size);
+    }
+
+    if (!extra_data.empty()) {
+        extra_buffer = make_shared<MediaBuffer>(extra_data.size());
+        memcpy(extra_buffer->getData(), extra_data.data(), extra_data.size());
+        extra_buffer->setActiveData(extra_buffer->getData());
+        extra_buffer->setActiveSize(extra_data.size());
+    }
+
+    buffer_size = std::max<size_t>(max_packet_size, 16);
+    return ModuleMedia::initBuffer(VideoBuffer::MALLOC_BUFFER);
+}
+
+int ModulePacketReplay::openFile(size_t index)
+{
+    PacketSpoolHeader header;
+
+    if (fp)
+        fclose(fp);
+    fp = NULL;
+    cur_file = index;
+    if (index >= files.size())
+        return -1;
+
+    fp = fopen(files[index].c_str(), "rb");
+    if (fp == NULL || readSpoolHeader(fp, &header) < 0 || fseek(fp, header.extra_size, SEEK_CUR) < 0) {
+        ff_error_m("open file %s failed\n", files[index].c_str());
+        return -1;
+    }
+    return 0;
+}
+
+bool ModulePacketReplay::setup()
+{
+    return openFile(0) == 0;
+}
+
+bool ModulePacketReplay::teardown()
+{
+    if (fp)
+        fclose(fp);
+    fp = NULL;
+    return true;
+}
+
+const uint8_t* ModulePacketReplay::videoExtraData()
+{
+    return extra_data.empty() ? NULL : extra_data.data();
+}
+
+unsigned ModulePacketReplay::videoExtraDataSize()
+{
+    return extra_data.size();
+}
+
+ModuleMedia::ProduceResult ModulePacketReplay::doProduce(shared_ptr<MediaBuffer> output_buffer)
+{
+    PacketSpoolRecord record;
+    shared_ptr<VideoBuffer> buffer = static_pointer_cast<VideoBuffer>(output_buffer);
+
+    if (buffer == NULL)
+        return PRODUCE_EMPTY;
+
+    while (fp == NULL || fread(&record, sizeof(record), 1, fp) != 1) {
+        if (openFile(cur_file + 1) < 0) {
+            buffer->setActiveSize(0);
+            buffer->setEos(true);
+            return PRODUCE_EOS;
+        }
+    }
+
+    if (record.size > buffer->getSize() || fread(buffer->getData(), record.size, 1, fp) != 1) {
+        ff_error_m("%s is truncated\n", files[cur_file].c_str());
+        return PRODUCE_FAILED;
+    }
+
+    buffer->setImagePara(output_para);
+    buffer->setActiveData(buffer->getData());
+    buffer->setActiveSize(record.size);
+    buffer->setPUstimestamp(record.pts);
+    buffer->setDUstimestamp(record.dts);
+    buffer->setExtraData(extra_buffer);
+    buffer->setEos(false);
+    return PRODUCE_SUCCESS;
+}
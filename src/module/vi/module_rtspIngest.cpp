@@ -0,0 +1,123 @@
+#include "module/vi/module_rtspIngest.hpp"
+
+#define INGEST_POP_TIMEOUT_MS 100
+
+ModuleRtspIngest::ModuleRtspIngest(string rtsp_url, RTSP_STREAM_TYPE _stream_type, shared_ptr<FFMedia::RtspEngine> rtsp_engine)
+    : ModuleMedia("ModuleRtspIngest"), url(rtsp_url), stream_type(_stream_type), engine(rtsp_engine), time_msec(5000)
+{
+    media_type = BUFFER_TYPE_VIDEO;
+    buffer_count = 8;
+    if (engine == nullptr)
+        engine = FFMedia::RtspEngine::getDefault();
+}
+
+ModuleRtspIngest::~ModuleRtspIngest()
+{
+    if (session)
+        engine->close(session);
+}
+
+int ModuleRtspIngest::open()
+{
+    int width = 0, height = 0;
+
+    if (session)
+        engine->close(session);
+    session = engine->open(url, stream_type);
+    if (session == nullptr)
+        return -1;
+    if (!session->waitPlaying(time_msec)) {
+        ff_error_m("open %s failed\n", url.c_str());
+        engine->close(session);
+        session = nullptr;
+        return -1;
+    }
+
+    // without sprop parameter sets the size is known at the first key frame
+    for (int waited = 0; waited < time_msec; waited += 10) {
+        session->getVideoSize(&width, &height);
+        if (width > 0)
+            break;
+        usleep(10 * 1000);
+    }
+    if (width <= 0) {
+        ff_error_m("%s has no sps\n", url.c_str());
+        engine->close(session);
+        session = nullptr;
+        return -1;
+    }
+    return 0;
+}
+
+int ModuleRtspIngest::init()
+{
+    int width = 0, height = 0;
+
+    if (open() < 0)
+        return -1;
+
+    session->getVideoSize(&width, &height);
+    uint32_t fmt = session->getCodec() == MEDIA_CODEC_VIDEO_H265 ? V4L2_PIX_FMT_HEVC : V4L2_PIX_FMT_H264;
+    output_para = ImagePara(width, height, width, height, fmt);
+
+    extra_data = session->getExtraData();
+    if (!extra_data.empty()) {
+        extra_buffer = make_shared<MediaBuffer>(extra_data.size());
+        memcpy(extra_buffer->getData(), extra_data.data(), extra_data.size());
+        extra_buffer->setActiveData(extra_buffer->getData());
+        extra_buffer->setActiveSize(extra_data.size());
+    }
+
+    // the buffers only carry the metadata, the data stays in the frame storage
+    frames.resize(buffer_count);
+    buffer_size = 16;
+    return ModuleMedia::initBuffer(VideoBuffer::MALLOC_BUFFER);
+}
+
+bool ModuleRtspIngest::teardown()
+{
+    if (session)
+        engine->close(session);
+    session = nullptr;
+    return true;
+}
+
+const uint8_t* ModuleRtspIngest::videoExtraData()
+{
+    return extra_data.empty() ? NULL : extra_data.data();
+}
+
+unsigned ModuleRtspIngest::videoExtraDataSize()
+{
+    return extra_data.size();
+}
+
+ModuleMedia::ProduceResult ModuleRtspIngest::doProduce(shared_ptr<MediaBuffer> output_buffer)
+{
+    shared_ptr<VideoBuffer> buffer = static_pointer_cast<VideoBuffer>(output_buffer);
+
+    if (buffer == NULL || session == nullptr)
+        return PRODUCE_EMPTY;
+
+    // the buffer is only produced again once downstream released it, so its
+    // previous frame can go back to the ring
+    FFMedia::FrameRing::Frame& frame = frames[buffer->getIndex() % frames.size()];
+    FFMedia::FrameRing& ring = session->getRing();
+    if (!ring.pop(frame, INGEST_POP_TIMEOUT_MS)) {
+        if (!ring.isClosed())
+            return PRODUCE_EMPTY;
+        buffer->setActiveSize(0);
+        buffer->setEos(true);
+        return PRODUCE_EOS;
+    }
+
+    buffer->setImagePara(output_para);
+    buffer->setActiveData(frame.data.data());
+    buffer->setActiveSize(frame.data.size());
+    buffer->setPUstimestamp(frame.pts_us);
+    buffer->setDUstimestamp(frame.pts_us);
+    buffer->setExtraData(extra_buffer);
+    buffer->setEos(false);
+    FFMedia::setBufferFlags(buffer.get(), frame.flags);
+    return PRODUCE_SUCCESS;
+}
@@ -0,0 +1,117 @@
+#include "module/vi/module_shmReader.hpp"
+#include "base/ff_buffer_flags.hpp"
+
+using namespace FFMedia;
+
+#define SHM_READ_TIMEOUT_MS 100
+
+ModuleShmReader::ModuleShmReader(string path_)
+    : ModuleMedia("ModuleShmReader"), path(path_), timeout_ms(3000), raw(true), have_seq(false), last_seq(0)
+{
+    media_type = BUFFER_TYPE_VIDEO;
+    buffer_count = 4;
+}
+
+ModuleShmReader::~ModuleShmReader()
+{
+    reader.close();
+}
+
+int ModuleShmReader::init()
+{
+    if (reader.open(path, timeout_ms) < 0) {
+        ff_error_m("Failed to connect to %s\n", path.c_str());
+        return -1;
+    }
+
+    const ShmStreamInfo& info = reader.getStreamInfo();
+    output_para.width = info.width;
+    output_para.height = info.height;
+    output_para.hstride = info.hstride;
+    output_para.vstride = info.vstride;
+    output_para.v4l2Fmt = info.v4l2Fmt;
+    raw = !v4l2fmtIsCompressed(output_para.v4l2Fmt);
+    ff_info_m("%s %ux%u from %s\n", v4l2GetFmtName(output_para.v4l2Fmt), output_para.width, output_para.height,
+              path.c_str());
+
+    slots.assign(buffer_count, ShmFrame());
+    held.assign(buffer_count, false);
+    if (raw) {
+        buffer_size = v4l2GetFrameSize(output_para.v4l2Fmt, output_para.hstride, output_para.vstride);
+        return ModuleMedia::initBuffer(VideoBuffer::EXTERNAL_BUFFER);
+    }
+    // the data stays in the slot, the buffers only carry the pointer
+    buffer_size = 16;
+    return ModuleMedia::initBuffer(VideoBuffer::MALLOC_BUFFER);
+}
+
+void ModuleShmReader::releaseSlot(size_t i)
+{
+    ShmFrame frame;
+    {
+        std::lock_guard<std::mutex> lk(mtx);
+        if (i >= held.size() || !held[i])
+            return;
+        held[i] = false;
+        frame = slots[i];
+    }
+    reader.release(frame);
+}
+
+bool ModuleShmReader::teardown()
+{
+    for (size_t i = 0; i < held.size(); i++)
+        releaseSlot(i);
+    return true;
+}
+
+void ModuleShmReader::bufferReleaseCallBack(shared_ptr<MediaBuffer> buffer)
+{
+    releaseSlot(buffer->getIndex());
+    ModuleMedia::bufferReleaseCallBack(buffer);
+}
+
+ModuleMedia::ProduceResult ModuleShmReader::doProduce(shared_ptr<MediaBuffer> output_buffer)
+{
+    shared_ptr<VideoBuffer> buffer = static_pointer_cast<VideoBuffer>(output_buffer);
+
+    if (buffer == NULL || slots.empty())
+        return PRODUCE_EMPTY;
+
+    size_t i = buffer->getIndex() % slots.size();
+    // a ring slot the writer may not reuse yet, when its buffer is produced again unreleased
+    releaseSlot(i);
+
+    ShmFrame frame;
+    ShmTransportReader::ReadResult ret = reader.read(&frame, SHM_READ_TIMEOUT_MS);
+    if (ret == ShmTransportReader::READ_TIMEOUT)
+        return PRODUCE_EMPTY;
+    if (ret == ShmTransportReader::READ_EOS) {
+        buffer->setActiveSize(0);
+        buffer->setEos(true);
+        return PRODUCE_EOS;
+    }
+    {
+        std::lock_guard<std::mutex> lk(mtx);
+        slots[i] = frame;
+        held[i] = true;
+    }
+
+    uint32_t flags = frame.flags & 0xffff;
+    if (have_seq && frame.seq != last_seq + 1)
+        flags |= BUFFER_FLAG_DISCONTINUITY;
+    have_seq = true;
+    last_seq = frame.seq;
+
+    if (raw) {
+        buffer->initWithExternalBuffer((void*)frame.data, frame.slot_size, frame.fd);
+        buffer->setImagePara(output_para);
+    }
+    buffer->setActiveData((void*)frame.data);
+    buffer->setActiveSize(frame.size);
+    buffer->setPUstimestamp(frame.pts);
+    buffer->setDUstimestamp(frame.pts);
+    buffer->setEos(false);
+    setBufferFlags(buffer.get(), flags);
+    return PRODUCE_SUCCESS;
+}
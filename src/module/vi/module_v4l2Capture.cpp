@@ -0,0 +1,503 @@
+#include <fcntl.h>
+#include <linux/dma-heap.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "base/ff_buffer_flags.hpp"
+#include "base/ff_clock.hpp"
+#include "module/vi/module_v4l2Capture.hpp"
+
+using namespace FFMedia;
+
+#define V4L2_CAPTURE_POLL_TIMEOUT_MS 100
+
+static int xioctl(int fd, unsigned long request, void* arg)
+{
+    int ret;
+    do {
+        ret = ioctl(fd, request, arg);
+    } while (ret < 0 && errno == EINTR);
+    return ret;
+}
+
+// Bytes of a pixel in the first plane, to turn bytesperline into the stride in pixels.
+static uint32_t bytesPerPixel(uint32_t fmt)
+{
+    switch (fmt) {
+        case V4L2_PIX_FMT_YUYV:
+        case V4L2_PIX_FMT_YVYU:
+        case V4L2_PIX_FMT_UYVY:
+        case V4L2_PIX_FMT_VYUY:
+        case V4L2_PIX_FMT_RGB565:
+            return 2;
+        case V4L2_PIX_FMT_RGB24:
+        case V4L2_PIX_FMT_BGR24:
+            return 3;
+        case V4L2_PIX_FMT_RGB32:
+        case V4L2_PIX_FMT_BGR32:
+        case V4L2_PIX_FMT_ARGB32:
+        case V4L2_PIX_FMT_ABGR32:
+        case V4L2_PIX_FMT_XRGB32:
+        case V4L2_PIX_FMT_XBGR32:
+            return 4;
+        default:
+            return 1;
+    }
+}
+
+static int allocDmaHeap(size_t size)
+{
+    int heap = open("/dev/dma_heap/system", O_RDWR | O_CLOEXEC);
+    if (heap < 0)
+        return -1;
+    struct dma_heap_allocation_data data;
+    memset(&data, 0, sizeof(data));
+    data.len = size;
+    data.fd_flags = O_RDWR | O_CLOEXEC;
+    int ret = xioctl(heap, DMA_HEAP_IOCTL_ALLOC, &data);
+    close(heap);
+    return ret < 0 ? -1 : (int)data.fd;
+}
+
+ModuleV4l2Capture::ModuleV4l2Capture(string dev_, const ImagePara& para)
+    : ModuleMedia("ModuleV4l2Capture"), dev(dev_), fd(-1), mplane(false), io_mode(IO_MMAP_EXPORT), queue_depth(6),
+      fps(0), frame_size(0), image_size(0), streaming(false), last_sequence(-1), captured(0), dropped(0), errors(0)
+{
+    media_type = BUFFER_TYPE_VIDEO;
+    buffer_count = 4;
+    output_para = para;
+}
+
+ModuleV4l2Capture::~ModuleV4l2Capture()
+{
+    if (fd >= 0 && streaming) {
+        uint32_t type = bufType();
+        xioctl(fd, VIDIOC_STREAMOFF, &type);
+    }
+    freeBuffers();
+    if (fd >= 0)
+        close(fd);
+}
+
+uint32_t ModuleV4l2Capture::bufType() const
+{
+    return mplane ? V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE : V4L2_BUF_TYPE_VIDEO_CAPTURE;
+}
+
+uint32_t ModuleV4l2Capture::memoryType() const
+{
+    return io_mode == IO_DMABUF_IMPORT ? V4L2_MEMORY_DMABUF : V4L2_MEMORY_MMAP;
+}
+
+int ModuleV4l2Capture::init()
+{
+    struct v4l2_capability cap;
+
+    fd = open(dev.c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0) {
+        ff_error_m("open %s failed: %s\n", dev.c_str(), strerror(errno));
+        return -1;
+    }
+    memset(&cap, 0, sizeof(cap));
+    if (xioctl(fd, VIDIOC_QUERYCAP, &cap) < 0) {
+        ff_error_m("%s is not a v4l2 device: %s\n", dev.c_str(), strerror(errno));
+        return -1;
+    }
+    uint32_t caps = (cap.capabilities & V4L2_CAP_DEVICE_CAPS) ? cap.device_caps : cap.capabilities;
+    if (!(caps & (V4L2_CAP_VIDEO_CAPTURE | V4L2_CAP_VIDEO_CAPTURE_MPLANE)) || !(caps & V4L2_CAP_STREAMING)) {
+        ff_error_m("%s (%s) is not a streaming capture device\n", dev.c_str(), cap.driver);
+        return -1;
+    }
+    mplane = !(caps & V4L2_CAP_VIDEO_CAPTURE);
+
+    if (setFormat() < 0)
+        return -1;
+
+    if (fps) {
+        struct v4l2_streamparm parm;
+        memset(&parm, 0, sizeof(parm));
+        parm.type = bufType();
+        parm.parm.capture.timeperframe.numerator = 1;
+        parm.parm.capture.timeperframe.denominator = fps;
+        if (xioctl(fd, VIDIOC_S_PARM, &parm) < 0)
+            ff_warn_m("Failed to set %u fps: %s\n", fps, strerror(errno));
+    }
+
+    if (allocBuffers() < 0)
+        return -1;
+    ff_info_m("%s (%s%s), %zu %s buffers\n", dev.c_str(), cap.driver, mplane ? ", mplane" : "", buffers.size(),
+              io_mode == IO_DMABUF_IMPORT ? "dma heap" : "exported");
+    output_para.dump();
+
+    slots.assign(buffer_count, -1);
+    buffer_size = frame_size;
+    return ModuleMedia::initBuffer(VideoBuffer::EXTERNAL_BUFFER);
+}
+
+int ModuleV4l2Capture::setFormat()
+{
+    struct v4l2_format fmt;
+    uint32_t bytesperline, sizeimage;
+    ImagePara requested = output_para;
+
+    memset(&fmt, 0, sizeof(fmt));
+    fmt.type = bufType();
+    if (xioctl(fd, VIDIOC_G_FMT, &fmt) < 0) {
+        ff_error_m("VIDIOC_G_FMT failed: %s\n", strerror(errno));
+        return -1;
+    }
+
+    if (mplane) {
+        struct v4l2_pix_format_mplane& pix = fmt.fmt.pix_mp;
+        if (output_para.width && output_para.height) {
+            pix.width = output_para.width;
+            pix.height = output_para.height;
+        }
+        if (output_para.v4l2Fmt)
+            pix.pixelformat = output_para.v4l2Fmt;
+        pix.field = V4L2_FIELD_ANY;
+        pix.num_planes = 1;
+        memset(pix.plane_fmt, 0, sizeof(pix.plane_fmt));
+        if (xioctl(fd, VIDIOC_S_FMT, &fmt) < 0) {
+            ff_error_m("VIDIOC_S_FMT failed: %s\n", strerror(errno));
+            return -1;
+        }
+        if (pix.num_planes != 1) {
+            ff_error_m("%s has %u planes, only formats with one plane are supported\n",
+                       v4l2GetFmtName(pix.pixelformat), pix.num_planes);
+            return -1;
+        }
+        output_para.width = pix.width;
+        output_para.height = pix.height;
+        output_para.v4l2Fmt = pix.pixelformat;
+        bytesperline = pix.plane_fmt[0].bytesperline;
+        sizeimage = pix.plane_fmt[0].sizeimage;
+    } else {
+        struct v4l2_pix_format& pix = fmt.fmt.pix;
+        if (output_para.width && output_para.height) {
+            pix.width = output_para.width;
+            pix.height = output_para.height;
+        }
+        if (output_para.v4l2Fmt)
+            pix.pixelformat = output_para.v4l2Fmt;
+        pix.field = V4L2_FIELD_ANY;
+        pix.bytesperline = 0;
+        if (xioctl(fd, VIDIOC_S_FMT, &fmt) < 0) {
+            ff_error_m("VIDIOC_S_FMT failed: %s\n", strerror(errno));
+            return -1;
+        }
+        output_para.width = pix.width;
+        output_para.height = pix.height;
+        output_para.v4l2Fmt = pix.pixelformat;
+        bytesperline = pix.bytesperline;
+        sizeimage = pix.sizeimage;
+    }
+
+    if (requested.v4l2Fmt && requested.v4l2Fmt != output_para.v4l2Fmt) {
+        ff_error_m("%s does not capture %s\n", dev.c_str(), v4l2GetFmtName(requested.v4l2Fmt));
+        return -1;
+    }
+    if (requested.width && (requested.width != output_para.width || requested.height != output_para.height))
+        ff_warn_m("%ux%u asked for, the driver captures %ux%u\n", requested.width, requested.height,
+                  output_para.width, output_para.height);
+
+    output_para.hstride = output_para.width;
+    output_para.vstride = output_para.height;
+    if (v4l2fmtIsCompressed(output_para.v4l2Fmt)) {
+        frame_size = sizeimage;
+    } else {
+        if (bytesperline / bytesPerPixel(output_para.v4l2Fmt) > output_para.width)
+            output_para.hstride = bytesperline / bytesPerPixel(output_para.v4l2Fmt);
+        frame_size = v4l2GetFrameSize(output_para.v4l2Fmt, output_para.hstride, output_para.vstride);
+    }
+    if (frame_size == 0) {
+        ff_error_m("Format %s is not supported\n", v4l2GetFmtName(output_para.v4l2Fmt));
+        return -1;
+    }
+    image_size = std::max<size_t>(sizeimage, frame_size);
+    return 0;
+}
+
+int ModuleV4l2Capture::allocBuffers()
+{
+    struct v4l2_requestbuffers req;
+
+    memset(&req, 0, sizeof(req));
+    req.count = queue_depth;
+    req.type = bufType();
+    req.memory = memoryType();
+    if (xioctl(fd, VIDIOC_REQBUFS, &req) < 0) {
+        ff_error_m("VIDIOC_REQBUFS %s failed: %s\n", io_mode == IO_DMABUF_IMPORT ? "dmabuf" : "mmap", strerror(errno));
+        return -1;
+    }
+    if (req.count < 2) {
+        ff_error_m("The driver gives %u buffers only\n", req.count);
+        return -1;
+    }
+    if (req.count != queue_depth)
+        ff_warn_m("Queue depth %u, the driver gives %u\n", queue_depth, req.count);
+    buffers.assign(req.count, CaptureBuffer());
+
+    bool exported = true;
+    for (uint32_t i = 0; i < req.count; i++) {
+        CaptureBuffer& b = buffers[i];
+        if (io_mode == IO_DMABUF_IMPORT) {
+            b.length = ALIGN(image_size, 4096);
+            b.fd = allocDmaHeap(b.length);
+            if (b.fd < 0) {
+                ff_error_m("Allocating from /dev/dma_heap/system failed: %s\n", strerror(errno));
+                return -1;
+            }
+            b.data = mmap(NULL, b.length, PROT_READ | PROT_WRITE, MAP_SHARED, b.fd, 0);
+        } else {
+            struct v4l2_buffer buf;
+            struct v4l2_plane planes[VIDEO_MAX_PLANES];
+            memset(&buf, 0, sizeof(buf));
+            memset(planes, 0, sizeof(planes));
+            buf.index = i;
+            buf.type = req.type;
+            buf.memory = req.memory;
+            if (mplane) {
+                buf.m.planes = planes;
+                buf.length = VIDEO_MAX_PLANES;
+            }
+            if (xioctl(fd, VIDIOC_QUERYBUF, &buf) < 0) {
+                ff_error_m("VIDIOC_QUERYBUF %u failed: %s\n", i, strerror(errno));
+                return -1;
+            }
+            b.length = mplane ? planes[0].length : buf.length;
+            b.data = mmap(NULL, b.length, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+                          mplane ? planes[0].m.mem_offset : buf.m.offset);
+
+            struct v4l2_exportbuffer exp;
+            memset(&exp, 0, sizeof(exp));
+            exp.type = req.type;
+            exp.index = i;
+            exp.plane = 0;
+            exp.flags = O_RDWR | O_CLOEXEC;
+            if (xioctl(fd, VIDIOC_EXPBUF, &exp) == 0)
+                b.fd = exp.fd;
+            else
+                exported = false;
+        }
+        if (b.data == MAP_FAILED) {
+            ff_error_m("mmap buffer %u failed: %s\n", i, strerror(errno));
+            b.data = NULL;
+            return -1;
+        }
+    }
+    // the frames then only have the cpu mapping, rga and mpp would copy them
+    if (!exported)
+        ff_warn_m("VIDIOC_EXPBUF is not supported, the buffers have no dma-buf fd\n");
+    return 0;
+}
+
+void ModuleV4l2Capture::freeBuffers()
+{
+    for (auto& b : buffers) {
+        if (b.data)
+            munmap(b.data, b.length);
+        if (b.fd >= 0)
+            close(b.fd);
+    }
+    buffers.clear();
+    if (fd >= 0) {
+        struct v4l2_requestbuffers req;
+        memset(&req, 0, sizeof(req));
+        req.type = bufType();
+        req.memory = memoryType();
+        xioctl(fd, VIDIOC_REQBUFS, &req);
+    }
+}
+
+// Called with mtx held.
+int ModuleV4l2Capture::queueBuffer(int index)
+{
+    struct v4l2_buffer buf;
+    struct v4l2_plane planes[VIDEO_MAX_PLANES];
+    CaptureBuffer& b = buffers[index];
+
+    memset(&buf, 0, sizeof(buf));
+    memset(planes, 0, sizeof(planes));
+    buf.index = index;
+    buf.type = bufType();
+    buf.memory = memoryType();
+    if (mplane) {
+        buf.m.planes = planes;
+        buf.length = 1;
+        if (io_mode == IO_DMABUF_IMPORT) {
+            planes[0].m.fd = b.fd;
+            planes[0].length = b.length;
+        }
+    } else if (io_mode == IO_DMABUF_IMPORT) {
+        buf.m.fd = b.fd;
+        buf.length = b.length;
+    }
+    if (xioctl(fd, VIDIOC_QBUF, &buf) < 0) {
+        ff_error_m("VIDIOC_QBUF %d failed: %s\n", index, strerror(errno));
+        return -1;
+    }
+    b.queued = true;
+    return 0;
+}
+
+bool ModuleV4l2Capture::setup()
+{
+    std::lock_guard<std::mutex> lk(mtx);
+    for (size_t i = 0; i < buffers.size(); i++) {
+        // the buffers the consumers still hold from the last run are queued on release
+        if (buffers[i].queued || std::find(slots.begin(), slots.end(), (int)i) != slots.end())
+            continue;
+        if (queueBuffer(i) < 0)
+            return false;
+    }
+
+    uint32_t type = bufType();
+    if (xioctl(fd, VIDIOC_STREAMON, &type) < 0) {
+        ff_error_m("VIDIOC_STREAMON failed: %s\n", strerror(errno));
+        return false;
+    }
+    streaming = true;
+    last_sequence = -1;
+    return true;
+}
+
+bool ModuleV4l2Capture::teardown()
+{
+    std::lock_guard<std::mutex> lk(mtx);
+    if (!streaming)
+        return true;
+    // gives back every queued buffer
+    uint32_t type = bufType();
+    xioctl(fd, VIDIOC_STREAMOFF, &type);
+    for (auto& b : buffers)
+        b.queued = false;
+    streaming = false;
+    return true;
+}
+
+void ModuleV4l2Capture::releaseSlot(size_t i)
+{
+    std::lock_guard<std::mutex> lk(mtx);
+    if (i >= slots.size() || slots[i] < 0)
+        return;
+    int index = slots[i];
+    slots[i] = -1;
+    if (streaming)
+        queueBuffer(index);
+}
+
+void ModuleV4l2Capture::bufferReleaseCallBack(shared_ptr<MediaBuffer> buffer)
+{
+    releaseSlot(buffer->getIndex());
+    ModuleMedia::bufferReleaseCallBack(buffer);
+}
+
+uint64_t ModuleV4l2Capture::getCapturedFrames()
+{
+    std::lock_guard<std::mutex> lk(mtx);
+    return captured;
+}
+
+uint64_t ModuleV4l2Capture::getDroppedFrames()
+{
+    std::lock_guard<std::mutex> lk(mtx);
+    return dropped;
+}
+
+uint64_t ModuleV4l2Capture::getErrorFrames()
+{
+    std::lock_guard<std::mutex> lk(mtx);
+    return errors;
+}
+
+ModuleMedia::ProduceResult ModuleV4l2Capture::doProduce(shared_ptr<MediaBuffer> output_buffer)
+{
+    shared_ptr<VideoBuffer> buffer = static_pointer_cast<VideoBuffer>(output_buffer);
+
+    if (buffer == NULL || slots.empty())
+        return PRODUCE_EMPTY;
+
+    size_t i = buffer->getIndex() % slots.size();
+    // the driver must get its buffer back even when the output buffer skipped the release
+    releaseSlot(i);
+
+    struct pollfd pfd = {fd, POLLIN, 0};
+    if (poll(&pfd, 1, V4L2_CAPTURE_POLL_TIMEOUT_MS) <= 0)
+        return PRODUCE_EMPTY;
+
+    struct v4l2_buffer buf;
+    struct v4l2_plane planes[VIDEO_MAX_PLANES];
+    memset(&buf, 0, sizeof(buf));
+    memset(planes, 0, sizeof(planes));
+    buf.type = bufType();
+    buf.memory = memoryType();
+    if (mplane) {
+        buf.m.planes = planes;
+        buf.length = VIDEO_MAX_PLANES;
+    }
+    if (xioctl(fd, VIDIOC_DQBUF, &buf) < 0) {
+        if (errno == ENODEV) {
+            ff_error_m("%s is gone\n", dev.c_str());
+            buffer->setActiveSize(0);
+            buffer->setEos(true);
+            return PRODUCE_EOS;
+        }
+        if (errno != EAGAIN)
+            ff_warn_m("VIDIOC_DQBUF failed: %s\n", strerror(errno));
+        return PRODUCE_EMPTY;
+    }
+
+    uint32_t flags = 0;
+    CaptureBuffer b;
+    {
+        std::lock_guard<std::mutex> lk(mtx);
+        buffers[buf.index].queued = false;
+        if (buf.flags & V4L2_BUF_FLAG_ERROR) {
+            errors++;
+            queueBuffer(buf.index);
+            return PRODUCE_EMPTY;
+        }
+        // the sequence counts every frame the driver captured, also those it had no buffer for
+        if (last_sequence >= 0) {
+            uint32_t step = buf.sequence - (uint32_t)last_sequence;
+            if (step > 1 && step < 0x80000000u) {
+                dropped += step - 1;
+                flags |= BUFFER_FLAG_DISCONTINUITY;
+            }
+        }
+        last_sequence = buf.sequence;
+        captured++;
+        slots[i] = buf.index;
+        b = buffers[buf.index];
+    }
+
+    size_t offset = 0, used = buf.bytesused;
+    if (mplane) {
+        offset = planes[0].data_offset;
+        used = planes[0].bytesused > offset ? planes[0].bytesused - offset : 0;
+    }
+    if (used == 0 || offset + used > b.length)
+        used = std::min(frame_size, b.length - offset);
+
+    int64_t pts;
+    if ((buf.flags & V4L2_BUF_FLAG_TIMESTAMP_MASK) == V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC)
+        pts = (int64_t)buf.timestamp.tv_sec * 1000000 + buf.timestamp.tv_usec;
+    else
+        pts = monotonicUs();
+
+    buffer->initWithExternalBuffer(b.data, b.length, b.fd);
+    buffer->setImagePara(output_para);
+    buffer->setActiveData((uint8_t*)b.data + offset);
+    buffer->setActiveSize(used);
+    buffer->setPUstimestamp(pts);
+    buffer->setDUstimestamp(pts);
+    buffer->setEos(false);
+    setBufferFlags(buffer.get(), flags);
+    setBufferSequence(buffer.get(), buf.sequence);
+    return PRODUCE_SUCCESS;
+}
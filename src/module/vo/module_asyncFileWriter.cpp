@@ -0,0 +1,509 @@
+#include "base/ff_bitstream.hpp"
+#include "base/ff_buffer_flags.hpp"
+#include "module/module_control.hpp"
+#include "module/vo/module_asyncFileWriter.hpp"
+
+#define DEFAULT_PREALLOCATE_SIZE (64 << 20)
+#define PACKET_POOL_SIZE 64
+
+static bool isFmp4Path(const string& path)
+{
+    size_t dot = path.rfind('.');
+    if (dot == string::npos)
+        return false;
+    string suffix = path.substr(dot + 1);
+    return suffix == "mp4" || suffix == "m4s";
+}
+
+ModuleAsyncFileWriter::ModuleAsyncFileWriter(string path)
+    : ModuleMedia("ModuleAsyncFileWriter"), filepath(path), fmp4(false), codec(MEDIA_CODEC_VIDEO_H264),
+      fragment_duration_ms(0), video_extra_flag(false), segment_duration_ms(0), segment_size(0), segment_index(0),
+      segment_start_pts(-1), key_requested(false), max_layer(-1), segment_max_layer(-1), pre_record_ms(0), pre_record_max_bytes(0), pre_roll_bytes(0),
+      recording(true), event_end_pts(INT64_MAX), event_request_ms(-1), event_stop_request(false), segment_thread(NULL),
+      segment_running(false)
+{
+    media_type = BUFFER_TYPE_VIDEO;
+    buffer_count = 0;
+    config.preallocate_size = DEFAULT_PREALLOCATE_SIZE;
+}
+
+ModuleAsyncFileWriter::ModuleAsyncFileWriter(const ImagePara& para, string path)
+    : ModuleAsyncFileWriter(path)
+{
+    setInputImagePara(para);
+}
+
+ModuleAsyncFileWriter::~ModuleAsyncFileWriter()
+{
+    closeSegment(true);
+    stopSegmentThread();
+}
+
+string ModuleAsyncFileWriter::segmentPath(uint32_t index) const
+{
+    char number[16];
+    size_t dot = filepath.rfind('.');
+    size_t slash = filepath.rfind('/');
+
+    if (!segmented())
+        return filepath;
+    snprintf(number, sizeof(number), "_%05u", index);
+    if (dot == string::npos || (slash != string::npos && dot < slash))
+        return filepath + number;
+    return filepath.substr(0, dot) + number + filepath.substr(dot);
+}
+
+int ModuleAsyncFileWriter::openSegment(int64_t pts_us)
+{
+    string path = segmentPath(segment_index);
+    shared_ptr<FFMedia::AsyncWriter> next;
+
+    {
+        // never open the file the segment thread is still opening, it would be truncated under us
+        unique_lock<mutex> lock(segment_mtx);
+        segment_cv.wait(lock, [&] { return spare_opening != path; });
+        if (spare && spare_path == path) {
+            next = spare;
+            spare = nullptr;
+        }
+    }
+    if (next == nullptr) {
+        next = make_shared<FFMedia::AsyncWriter>(config);
+        if (next->open(path) < 0)
+            return -1;
+    }
+
+    muxer = nullptr;
+    if (fmp4) {
+        FFMedia::AsyncWriter* w = next.get();
+        muxer = make_shared<FFMedia::Fmp4Muxer>(codec, input_para.width, input_para.height);
+        muxer->setFragmentDuration(fragment_duration_ms * 1000);
+        muxer->setWriteCallback([w](const uint8_t* data, size_t size) { return w->write(data, size) < 0 ? -1 : 0; });
+    }
+    {
+        lock_guard<mutex> lock(writer_mtx);
+        writer = next;
+        writer_path = path;
+    }
+    video_extra_flag = false;
+    segment_start_pts = pts_us;
+    segment_index++;
+    key_requested = false;
+    segment_max_layer = max_layer;
+
+    // let the segment thread open the next file while this one is written
+    if (segmented() && segment_thread) {
+        lock_guard<mutex> lock(segment_mtx);
+        spare_wanted = segmentPath(segment_index);
+        segment_cv.notify_all();
+    }
+    return 0;
+}
+
+void ModuleAsyncFileWriter::closeSegment(bool wait)
+{
+    shared_ptr<FFMedia::AsyncWriter> old;
+    string path;
+
+    if (writer == nullptr || !writer->isOpen())
+        return;
+    if (muxer)
+        muxer->flush();
+
+    if (wait || segment_thread == NULL) {
+        writer->close();
+        if (segment_cb)
+            segment_cb(writer_path);
+        return;
+    }
+
+    // close() drains the queue and syncs, leave it to the segment thread
+    {
+        lock_guard<mutex> lock(writer_mtx);
+        old = writer;
+        path = writer_path;
+        writer = nullptr;
+    }
+    muxer = nullptr;
+    lock_guard<mutex> lock(segment_mtx);
+    retired.push_back(make_pair(old, path));
+    segment_cv.notify_all();
+}
+
+int ModuleAsyncFileWriter::writePacket(const uint8_t* data, size_t size, int64_t pts_us)
+{
+    // raw streams carry the parameter sets in band, write them once at the start of every segment.
+    // The fmp4 muxer keeps them for the init segment.
+    if (!video_extra_flag) {
+        if (!extra_data.empty()) {
+            if (muxer)
+                muxer->setExtraData(extra_data.data(), extra_data.size());
+            else
+                writer->write(extra_data.data(), extra_data.size());
+        }
+        video_extra_flag = true;
+    }
+    if (segment_start_pts < 0)
+        segment_start_pts = pts_us;
+
+    if (muxer) {
+        int ret = muxer->writeFrame(data, size, pts_us);
+        if (ret < 0)
+            return -1;
+        // a finished fragment becomes visible to readers without waiting for the block to fill
+        if (ret > 0)
+            writer->commit();
+        return 0;
+    }
+    return writer->write(data, size) < 0 ? -1 : 0;
+}
+
+void ModuleAsyncFileWriter::pushPreRoll(const uint8_t* data, size_t size, int64_t pts_us, bool key)
+{
+    // the pre-roll always starts at a key frame
+    if (pre_roll.empty() && !key)
+        return;
+
+    Packet packet;
+    if (!packet_pool.empty()) {
+        packet.data = std::move(packet_pool.back());
+        packet_pool.pop_back();
+    }
+    packet.data.assign(data, data + size);
+    packet.pts_us = pts_us;
+    packet.key = key;
+    pre_roll.push_back(std::move(packet));
+    pre_roll_bytes += size;
+    if (key)
+        pre_roll_keys.push_back(pts_us);
+
+    // drop the oldest gop while the rest still covers pre_record_ms, or when over the memory cap
+    while (pre_roll_keys.size() >= 2
+           && (pts_us - pre_roll_keys[1] >= pre_record_ms * 1000 || pre_roll_bytes > pre_record_max_bytes)) {
+        do {
+            Packet& front = pre_roll.front();
+            pre_roll_bytes -= front.data.size();
+            if (packet_pool.size() < PACKET_POOL_SIZE)
+                packet_pool.push_back(std::move(front.data));
+            pre_roll.pop_front();
+        } while (!pre_roll.empty() && !pre_roll.front().key);
+        pre_roll_keys.pop_front();
+    }
+    if (pre_roll_bytes > pre_record_max_bytes) {
+        ff_warn_m("a single gop exceeds the pre-record limit of %zu bytes\n", pre_record_max_bytes);
+        dropPreRoll();
+    }
+}
+
+int ModuleAsyncFileWriter::flushPreRoll()
+{
+    int ret = 0;
+    for (auto& packet : pre_roll) {
+        if (ret == 0)
+            ret = writePacket(packet.data.data(), packet.data.size(), packet.pts_us);
+    }
+    dropPreRoll();
+    return ret;
+}
+
+void ModuleAsyncFileWriter::dropPreRoll()
+{
+    for (auto& packet : pre_roll) {
+        if (packet_pool.size() < PACKET_POOL_SIZE)
+            packet_pool.push_back(std::move(packet.data));
+    }
+    pre_roll.clear();
+    pre_roll_keys.clear();
+    pre_roll_bytes = 0;
+}
+
+void ModuleAsyncFileWriter::setVideoExtraData(const uint8_t* extra, unsigned extra_size)
+{
+    if (extra == NULL || extra_size == 0)
+        extra_data.clear();
+    else
+        extra_data.assign(extra, extra + extra_size);
+}
+
+void ModuleAsyncFileWriter::setPreRecord(int64_t pre_record_ms_, size_t max_bytes)
+{
+    pre_record_ms = pre_record_ms_;
+    pre_record_max_bytes = max_bytes;
+}
+
+void ModuleAsyncFileWriter::triggerEvent(int64_t duration_ms)
+{
+    lock_guard<mutex> lock(event_mtx);
+    if (duration_ms == 0 || event_request_ms < 0)
+        event_request_ms = duration_ms;
+    else if (event_request_ms != 0)
+        event_request_ms = std::max(event_request_ms, duration_ms);
+    event_stop_request = false;
+}
+
+void ModuleAsyncFileWriter::stopEvent()
+{
+    lock_guard<mutex> lock(event_mtx);
+    event_request_ms = -1;
+    event_stop_request = true;
+}
+
+void ModuleAsyncFileWriter::handleEventRequest(int64_t pts_us)
+{
+    int64_t request_ms;
+    bool stop;
+
+    {
+        lock_guard<mutex> lock(event_mtx);
+        request_ms = event_request_ms;
+        stop = event_stop_request;
+        event_request_ms = -1;
+        event_stop_request = false;
+    }
+
+    if (stop && recording)
+        event_end_pts = pts_us;
+    if (request_ms >= 0) {
+        int64_t end = request_ms == 0 ? INT64_MAX : pts_us + request_ms * 1000;
+        if (!recording)
+            event_end_pts = end;
+        else if (event_end_pts != INT64_MAX)
+            event_end_pts = end == INT64_MAX ? end : std::max(event_end_pts, end);
+        recording = true;
+    }
+}
+
+void ModuleAsyncFileWriter::startSegmentThread()
+{
+    if (segment_thread)
+        return;
+    segment_running = true;
+    segment_thread = new std::thread(&ModuleAsyncFileWriter::segmentLoop, this);
+}
+
+void ModuleAsyncFileWriter::stopSegmentThread()
+{
+    if (segment_thread == NULL)
+        return;
+    {
+        lock_guard<mutex> lock(segment_mtx);
+        segment_running = false;
+        segment_cv.notify_all();
+    }
+    segment_thread->join();
+    delete segment_thread;
+    segment_thread = NULL;
+
+    // the file opened ahead of time was never used
+    if (spare) {
+        spare->close();
+        unlink(spare_path.c_str());
+        spare = nullptr;
+    }
+    spare_path.clear();
+    spare_wanted.clear();
+}
+
+void ModuleAsyncFileWriter::segmentLoop()
+{
+    unique_lock<mutex> lock(segment_mtx);
+
+    while (true) {
+        segment_cv.wait(lock, [this] {
+            return !retired.empty() || !segment_running || (!spare_wanted.empty() && spare_path != spare_wanted);
+        });
+
+        if (!retired.empty()) {
+            auto item = retired.front();
+            retired.pop_front();
+            lock.unlock();
+            item.first->close();
+            if (segment_cb)
+                segment_cb(item.second);
+            item.first = nullptr;
+            lock.lock();
+            continue;
+        }
+        if (!segment_running)
+            break;
+
+        shared_ptr<FFMedia::AsyncWriter> old = spare;
+        string old_path = spare_path;
+        string path = spare_wanted;
+        spare = nullptr;
+        spare_path = path;
+        spare_opening = path;
+        lock.unlock();
+
+        if (old) {
+            old->close();
+            unlink(old_path.c_str());
+        }
+        shared_ptr<FFMedia::AsyncWriter> next = make_shared<FFMedia::AsyncWriter>(config);
+        if (next->open(path) < 0)
+            next = nullptr;
+
+        lock.lock();
+        // on failure the encode thread retries the open itself
+        spare = next;
+        spare_opening.clear();
+        segment_cv.notify_all();
+    }
+}
+
+int ModuleAsyncFileWriter::init()
+{
+    shared_ptr<ModuleMedia> productor = getProductor();
+    if (productor != nullptr)
+        input_para = productor->getOutputImagePara();
+
+    if (input_para.v4l2Fmt != V4L2_PIX_FMT_H264 && input_para.v4l2Fmt != V4L2_PIX_FMT_HEVC) {
+        ff_error_m("Format %s is not supported, only h264/h265 streams\n", v4l2GetFmtName(input_para.v4l2Fmt));
+        return -1;
+    }
+    codec = input_para.v4l2Fmt == V4L2_PIX_FMT_HEVC ? MEDIA_CODEC_VIDEO_H265 : MEDIA_CODEC_VIDEO_H264;
+    fmp4 = isFmp4Path(filepath);
+    if (fmp4 && config.drop_when_full) {
+        // a dropped piece of a fragment would break the whole file
+        ff_warn_m("drop_when_full is ignored for fragmented mp4\n");
+        config.drop_when_full = false;
+    }
+
+    closeSegment(true);
+    stopSegmentThread();
+    dropPreRoll();
+    segment_index = 0;
+    recording = pre_record_ms <= 0;
+    event_end_pts = INT64_MAX;
+    event_request_ms = -1;
+    event_stop_request = false;
+
+    if (segmented())
+        startSegmentThread();
+    if (recording && openSegment(-1) < 0)
+        return -1;
+    return 0;
+}
+
+bool ModuleAsyncFileWriter::setup()
+{
+    if (segmented())
+        startSegmentThread();
+    if (recording && writer && !writer->isOpen() && openSegment(-1) < 0)
+        return false;
+    return true;
+}
+
+bool ModuleAsyncFileWriter::teardown()
+{
+    closeSegment(true);
+    stopSegmentThread();
+    return true;
+}
+
+FFMedia::AsyncWriter::Stats ModuleAsyncFileWriter::getWriterStats()
+{
+    FFMedia::AsyncWriter::Stats stats;
+    shared_ptr<FFMedia::AsyncWriter> w;
+    {
+        lock_guard<mutex> lock(writer_mtx);
+        w = writer;
+    }
+    if (w)
+        return w->getStats();
+    memset(&stats, 0, sizeof(stats));
+    return stats;
+}
+
+void ModuleAsyncFileWriter::dumpWriterStats()
+{
+    FFMedia::AsyncWriter::Stats s = getWriterStats();
+    ff_info_m("%s: written %" PRIu64 " bytes, dropped %" PRIu64 " packets, queue %u/%u blocks, "
+              "write latency avg %" PRId64 " us max %" PRId64 " us, blocked %" PRId64 " us\n",
+              writer_path.c_str(), s.bytes_written, s.dropped_packets, s.queue_depth, s.max_queue_depth, s.avg_write_us,
+              s.max_write_us, s.blocked_us);
+    if (muxer)
+        ff_info_m("%s: %u fragments\n", writer_path.c_str(), muxer->getFragmentCount());
+    if (segmented())
+        ff_info_m("%u segments, pre-roll %zu packets %zu bytes\n", segment_index, pre_roll.size(), pre_roll_bytes);
+}
+
+ModuleMedia::ConsumeResult ModuleAsyncFileWriter::doConsume(shared_ptr<MediaBuffer> input_buffer, shared_ptr<MediaBuffer> output_buffer)
+{
+    (void)output_buffer;
+    if (input_buffer == NULL)
+        return CONSUME_SKIP;
+    if (input_buffer->getMediaBufferType() != BUFFER_TYPE_VIDEO)
+        return CONSUME_SKIP;
+
+    if (extra_data.empty()) {
+        shared_ptr<MediaBuffer> extra = input_buffer->getExtraData();
+        if (extra != nullptr && extra->getActiveSize() > 0) {
+            const uint8_t* p = (const uint8_t*)extra->getActiveData();
+            extra_data.assign(p, p + extra->getActiveSize());
+        }
+    }
+
+    const uint8_t* data = (const uint8_t*)input_buffer->getActiveData();
+    size_t size = input_buffer->getActiveSize();
+    int64_t pts = input_buffer->getPUstimestamp();
+    bool key = size > 0 && FFMedia::isKeyFrame(data, size, codec);
+    int layer = FFMedia::getBufferTemporalLayer(input_buffer.get());
+
+    if (pre_record_ms > 0) {
+        handleEventRequest(pts);
+        if (recording && pts >= event_end_pts) {
+            closeSegment(false);
+            recording = false;
+        }
+        if (!recording) {
+            if (size > 0 && (max_layer < 0 || layer <= max_layer))
+                pushPreRoll(data, size, pts, key);
+            if (input_buffer->getEos()) {
+                dropPreRoll();
+                return CONSUME_EOS;
+            }
+            return CONSUME_SUCCESS;
+        }
+    }
+
+    if (writer == nullptr || !writer->isOpen()) {
+        // an event starts with the pre-roll, otherwise wait for a key frame
+        if (!pre_roll.empty()) {
+            if (openSegment(pre_roll.front().pts_us) < 0 || flushPreRoll() < 0)
+                return CONSUME_FAILED;
+        } else {
+            if (!key) {
+                if (!key_requested)
+                    FFMedia::requestKeyFrame(shared_from_this(), FFMedia::KEY_FRAME_SEGMENT_START);
+                key_requested = true;
+                return input_buffer->getEos() ? CONSUME_EOS : CONSUME_SUCCESS;
+            }
+            if (openSegment(pts) < 0)
+                return CONSUME_FAILED;
+        }
+    } else if (segment_start_pts >= 0
+               && ((segment_duration_ms > 0 && pts - segment_start_pts >= segment_duration_ms * 1000)
+                   || (segment_size > 0 && writer->getSize() >= segment_size))) {
+        if (key) {
+            closeSegment(false);
+            if (openSegment(pts) < 0)
+                return CONSUME_FAILED;
+        } else if (!key_requested) {
+            // the segment is due, do not wait for the end of a long gop
+            FFMedia::requestKeyFrame(shared_from_this(), FFMedia::KEY_FRAME_SEGMENT_START);
+            key_requested = true;
+        }
+    }
+
+    // the upper layers of the segment are left out, the rest decodes without them
+    bool layer_dropped = segment_max_layer >= 0 && layer > segment_max_layer;
+    if (size > 0 && !layer_dropped && writePacket(data, size, pts) < 0)
+        return CONSUME_FAILED;
+
+    if (input_buffer->getEos()) {
+        closeSegment(true);
+        return CONSUME_EOS;
+    }
+    return CONSUME_SUCCESS;
+}
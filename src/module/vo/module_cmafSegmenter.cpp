@@ -0,0 +1,146 @@
+#include <map>
+
+#include "base/ff_bitstream.hpp"
+#include "module/module_control.hpp"
+#include "module/vo/module_cmafSegmenter.hpp"
+
+using namespace FFMedia;
+
+// Only taken in init(), the frames go to the segmenter without it
+static std::mutex servers_mtx;
+static std::map<int, weak_ptr<CmafHttpServer>> servers;
+
+static shared_ptr<CmafHttpServer> getSharedServer(int port)
+{
+    std::lock_guard<std::mutex> lock(servers_mtx);
+    shared_ptr<CmafHttpServer> server = servers[port].lock();
+    if (server == nullptr) {
+        CmafHttpServer::Config config;
+        config.port = port;
+        server = make_shared<CmafHttpServer>(config);
+        if (server->start() < 0)
+            return nullptr;
+        servers[port] = server;
+    }
+    return server;
+}
+
+ModuleCmafSegmenter::ModuleCmafSegmenter(const char* path, int port, shared_ptr<CmafHttpServer> http_server)
+    : ModuleMedia("ModuleCmafSegmenter"), stream_path(path), http_port(port), server(http_server), added(false),
+      extra_set(false), codec(MEDIA_CODEC_VIDEO_H264), last_key_pts(-1), key_requested(false)
+{
+    media_type = BUFFER_TYPE_VIDEO;
+    buffer_count = 0;
+    if (stream_path.empty() || stream_path[0] != '/')
+        stream_path = "/" + stream_path;
+}
+
+ModuleCmafSegmenter::ModuleCmafSegmenter(const ImagePara& para, const char* path, int port,
+                                         shared_ptr<CmafHttpServer> http_server)
+    : ModuleCmafSegmenter(path, port, http_server)
+{
+    input_para = para;
+}
+
+ModuleCmafSegmenter::~ModuleCmafSegmenter()
+{
+    closeStream();
+}
+
+void ModuleCmafSegmenter::closeStream()
+{
+    if (segmenter)
+        segmenter->close();
+    if (added)
+        server->removeStream(stream_path);
+    added = false;
+}
+
+int ModuleCmafSegmenter::init()
+{
+    shared_ptr<ModuleMedia> productor = getProductor();
+    if (productor != nullptr)
+        input_para = productor->getOutputImagePara();
+
+    if (input_para.v4l2Fmt != V4L2_PIX_FMT_H264 && input_para.v4l2Fmt != V4L2_PIX_FMT_HEVC) {
+        ff_error_m("Format %s is not supported, only h264/h265 streams\n", v4l2GetFmtName(input_para.v4l2Fmt));
+        return -1;
+    }
+    codec = input_para.v4l2Fmt == V4L2_PIX_FMT_HEVC ? MEDIA_CODEC_VIDEO_H265 : MEDIA_CODEC_VIDEO_H264;
+
+    closeStream();
+    if (server == nullptr && http_port > 0)
+        server = getSharedServer(http_port);
+    if (server == nullptr && http_port > 0) {
+        ff_error_m("Failed to start the http server on port %d\n", http_port);
+        return -1;
+    }
+
+    // the server holds blocking playlist reloads
+    CmafSegmenter::Config segmenter_config = config;
+    if (server)
+        segmenter_config.block_reload = true;
+    segmenter = make_shared<CmafSegmenter>(segmenter_config);
+    if (segmenter->open(codec, input_para.width, input_para.height) < 0)
+        return -1;
+    extra_set = false;
+    last_key_pts = -1;
+    key_requested = false;
+
+    if (server) {
+        if (server->addStream(stream_path, segmenter) < 0)
+            return -1;
+        added = true;
+        ff_info_m("http://<ip>:%d%s/%s\n", server->getPort(), stream_path.c_str(), CmafSegmenter::HLS_PLAYLIST);
+    }
+    if (!config.dir.empty())
+        ff_info_m("segments to %s\n", config.dir.c_str());
+    return 0;
+}
+
+bool ModuleCmafSegmenter::teardown()
+{
+    // the playlists are ended, players stop asking for more
+    if (segmenter)
+        segmenter->close();
+    return true;
+}
+
+ModuleMedia::ConsumeResult ModuleCmafSegmenter::doConsume(shared_ptr<MediaBuffer> input_buffer, shared_ptr<MediaBuffer> output_buffer)
+{
+    (void)output_buffer;
+    if (input_buffer == NULL || segmenter == nullptr)
+        return CONSUME_SKIP;
+    if (input_buffer->getMediaBufferType() != BUFFER_TYPE_VIDEO)
+        return CONSUME_SKIP;
+
+    if (!extra_set) {
+        shared_ptr<MediaBuffer> extra = input_buffer->getExtraData();
+        if (extra != nullptr && extra->getActiveSize() > 0)
+            segmenter->setExtraData((const uint8_t*)extra->getActiveData(), extra->getActiveSize());
+        extra_set = true;
+    }
+
+    const uint8_t* data = (const uint8_t*)input_buffer->getActiveData();
+    size_t size = input_buffer->getActiveSize();
+    int64_t pts = input_buffer->getPUstimestamp();
+    if (size > 0) {
+        if (isKeyFrame(data, size, codec)) {
+            last_key_pts = pts;
+            key_requested = false;
+        } else if (!key_requested
+                   && (last_key_pts < 0 || pts - last_key_pts >= config.segment_duration_ms * 1000)) {
+            // the first segment, or a gop longer than a segment, do not wait for the encoder
+            requestKeyFrame(shared_from_this(), KEY_FRAME_SEGMENT_START);
+            key_requested = true;
+        }
+        if (segmenter->writeFrame(data, size, pts) < 0)
+            return CONSUME_FAILED;
+    }
+
+    if (input_buffer->getEos()) {
+        segmenter->close();
+        return CONSUME_EOS;
+    }
+    return CONSUME_SUCCESS;
+}
@@ -0,0 +1,111 @@
+#include "module/vo/module_packetSpool.hpp"
+
+ModulePacketSpool::ModulePacketSpool(string path)
+    : ModuleMedia("ModulePacketSpool"), filepath(path), fp(NULL), header_written(false)
+{
+    media_type = BUFFER_TYPE_VIDEO;
+    buffer_count = 0;
+    memset(&header, 0, sizeof(header));
+}
+
+ModulePacketSpool::~ModulePacketSpool()
+{
+    close();
+}
+
+int ModulePacketSpool::init()
+{
+    shared_ptr<ModuleMedia> productor = getProductor();
+    if (productor == nullptr) {
+        ff_error_m("The productor is not set\n");
+        return -1;
+    }
+    input_para = productor->getOutputImagePara();
+    if (!v4l2fmtIsCompressed(input_para.v4l2Fmt)) {
+        ff_error_m("Format %s is not a compressed format\n", v4l2GetFmtName(input_para.v4l2Fmt));
+        return -1;
+    }
+
+    fp = fopen(filepath.c_str(), "wb");
+    if (fp == NULL) {
+        ff_error_m("open file %s failed, reason = %s\n", filepath.c_str(), strerror(errno));
+        return -1;
+    }
+
+    memcpy(header.magic, PACKET_SPOOL_MAGIC, sizeof(header.magic));
+    header.v4l2Fmt = input_para.v4l2Fmt;
+    header.width = input_para.width;
+    header.height = input_para.height;
+    header_written = false;
+    return 0;
+}
+
+int ModulePacketSpool::writeHeader(shared_ptr<MediaBuffer> buffer)
+{
+    shared_ptr<MediaBuffer> extra = buffer->getExtraData();
+    if (extra != nullptr && extra->getActiveSize() > 0)
+        header.extra_size = extra->getActiveSize();
+
+    if (fwrite(&header, sizeof(header), 1, fp) != 1)
+        return -1;
+    if (header.extra_size && fwrite(extra->getActiveData(), header.extra_size, 1, fp) != 1)
+        return -1;
+    header_written = true;
+    return 0;
+}
+
+void ModulePacketSpool::close()
+{
+    if (fp == NULL)
+        return;
+
+    if (!header_written) {
+        fwrite(&header, sizeof(header), 1, fp);
+    } else {
+        // patch the totals, the extra data size is already final
+        fseek(fp, 0, SEEK_SET);
+        fwrite(&header, sizeof(header), 1, fp);
+    }
+    fclose(fp);
+    fp = NULL;
+}
+
+bool ModulePacketSpool::teardown()
+{
+    close();
+    return true;
+}
+
+ModuleMedia::ConsumeResult ModulePacketSpool::doConsume(shared_ptr<MediaBuffer> input_buffer, shared_ptr<MediaBuffer> output_buffer)
+{
+    (void)output_buffer;
+    if (input_buffer == NULL || fp == NULL)
+        return CONSUME_SKIP;
+    if (input_buffer->getMediaBufferType() != BUFFER_TYPE_VIDEO)
+        return CONSUME_SKIP;
+
+    if (input_buffer->getActiveSize() > 0) {
+        if (!header_written && writeHeader(input_buffer) < 0) {
+            ff_error_m("write %s failed, reason = %s\n", filepath.c_str(), strerror(errno));
+            return CONSUME_FAILED;
+        }
+
+        PacketSpoolRecord record;
+        record.pts = input_buffer->getPUstimestamp();
+        record.dts = input_buffer->getDUstimestamp();
+        record.size = input_buffer->getActiveSize();
+        record.reserved = 0;
+        if (fwrite(&record, sizeof(record), 1, fp) != 1 || fwrite(input_buffer->getActiveData(), record.size, 1, fp) != 1) {
+            ff_error_m("write %s failed, reason = %s\n", filepath.c_str(), strerror(errno));
+            return CONSUME_FAILED;
+        }
+        header.packet_count++;
+        header.max_packet_size = std::max(header.max_packet_size, record.size);
+    }
+
+    if (input_buffer->getEos()) {
+        close();
+        return CONSUME_EOS;
+    }
+    return CONSUME_SUCCESS;
+}
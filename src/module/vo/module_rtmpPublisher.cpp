@@ -0,0 +1,84 @@
+#include "base/ff_buffer_flags.hpp"
+#include "module/module_control.hpp"
+#include "module/vo/module_rtmpPublisher.hpp"
+
+using namespace FFMedia;
+
+ModuleRtmpPublisher::ModuleRtmpPublisher(const char* url)
+    : ModuleMedia("ModuleRtmpPublisher"), codec(MEDIA_CODEC_VIDEO_H264), extra_set(false)
+{
+    media_type = BUFFER_TYPE_VIDEO;
+    buffer_count = 0;
+    config.url = url;
+}
+
+ModuleRtmpPublisher::ModuleRtmpPublisher(const ImagePara& para, const char* url)
+    : ModuleRtmpPublisher(url)
+{
+    input_para = para;
+}
+
+ModuleRtmpPublisher::~ModuleRtmpPublisher()
+{
+    // the callbacks run on the publisher thread, stop it first
+    if (publisher)
+        publisher->stop();
+}
+
+int ModuleRtmpPublisher::init()
+{
+    shared_ptr<ModuleMedia> productor = getProductor();
+    if (productor != nullptr)
+        input_para = productor->getOutputImagePara();
+
+    if (input_para.v4l2Fmt != V4L2_PIX_FMT_H264 && input_para.v4l2Fmt != V4L2_PIX_FMT_HEVC) {
+        ff_error_m("Format %s is not supported, only h264/h265 streams\n", v4l2GetFmtName(input_para.v4l2Fmt));
+        return -1;
+    }
+    codec = input_para.v4l2Fmt == V4L2_PIX_FMT_HEVC ? MEDIA_CODEC_VIDEO_H265 : MEDIA_CODEC_VIDEO_H264;
+
+    if (publisher)
+        publisher->stop();
+    publisher = make_shared<RtmpPublisher>(config);
+    weak_ptr<ModuleMedia> self = shared_from_this();
+    publisher->setBitrateCallback([self](int kbps) {
+        shared_ptr<ModuleMedia> module = self.lock();
+        if (module)
+            requestBitrate(module, kbps);
+    });
+    publisher->setKeyFrameCallback([self](bool congestion) {
+        shared_ptr<ModuleMedia> module = self.lock();
+        if (module)
+            requestKeyFrame(module, congestion ? KEY_FRAME_CONGESTION : KEY_FRAME_NEW_VIEWER);
+    });
+    extra_set = false;
+    if (publisher->start() < 0)
+        return -1;
+    ff_info_m("publish to %s\n", config.url.c_str());
+    return 0;
+}
+
+ModuleMedia::ConsumeResult ModuleRtmpPublisher::doConsume(shared_ptr<MediaBuffer> input_buffer, shared_ptr<MediaBuffer> output_buffer)
+{
+    (void)output_buffer;
+    if (input_buffer == NULL || publisher == nullptr)
+        return CONSUME_SKIP;
+    if (input_buffer->getMediaBufferType() != BUFFER_TYPE_VIDEO)
+        return CONSUME_SKIP;
+
+    if (!extra_set) {
+        shared_ptr<MediaBuffer> extra = input_buffer->getExtraData();
+        if (extra != nullptr && extra->getActiveSize() > 0)
+            publisher->setExtraData(codec, (const uint8_t*)extra->getActiveData(), extra->getActiveSize());
+        extra_set = true;
+    }
+
+    if (input_buffer->getActiveSize() > 0)
+        publisher->pushFrame(codec, (const uint8_t*)input_buffer->getActiveData(), input_buffer->getActiveSize(),
+                             input_buffer->getPUstimestamp(), input_buffer->getDUstimestamp(),
+                             getBufferTemporalLayer(input_buffer.get()));
+
+    if (input_buffer->getEos())
+        return CONSUME_EOS;
+    return CONSUME_SUCCESS;
+}
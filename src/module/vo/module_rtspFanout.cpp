@@ -0,0 +1,133 @@
+#include <map>
+
+#include "base/ff_buffer_flags.hpp"
+#include "module/module_control.hpp"
+#include "module/vo/module_rtspFanout.hpp"
+
+using namespace FFMedia;
+
+// Only taken in init(), the frames go to the server without it
+static std::mutex servers_mtx;
+static std::map<int, weak_ptr<RtspServer>> servers;
+
+static shared_ptr<RtspServer> getSharedServer(int port)
+{
+    std::lock_guard<std::mutex> lock(servers_mtx);
+    shared_ptr<RtspServer> server = servers[port].lock();
+    if (server == nullptr) {
+        RtspServer::Config config;
+        config.port = port;
+        server = make_shared<RtspServer>(config);
+        if (server->start() < 0)
+            return nullptr;
+        servers[port] = server;
+    }
+    return server;
+}
+
+ModuleRtspFanout::ModuleRtspFanout(const char* path, int port, shared_ptr<RtspServer> rtsp_server)
+    : ModuleMedia("ModuleRtspFanout"), push_path(path), push_port(port), server(rtsp_server), mounted(false),
+      extra_sent(false), multicast_port(0), multicast_ttl(16)
+{
+    media_type = BUFFER_TYPE_VIDEO;
+    buffer_count = 0;
+    if (push_path.empty() || push_path[0] != '/')
+        push_path = "/" + push_path;
+}
+
+ModuleRtspFanout::ModuleRtspFanout(const ImagePara& para, const char* path, int port, shared_ptr<RtspServer> rtsp_server)
+    : ModuleRtspFanout(path, port, rtsp_server)
+{
+    input_para = para;
+}
+
+ModuleRtspFanout::~ModuleRtspFanout()
+{
+    if (mounted)
+        server->removeMount(push_path);
+}
+
+int ModuleRtspFanout::init()
+{
+    shared_ptr<ModuleMedia> productor = getProductor();
+    if (productor != nullptr)
+        input_para = productor->getOutputImagePara();
+
+    if (input_para.v4l2Fmt != V4L2_PIX_FMT_H264 && input_para.v4l2Fmt != V4L2_PIX_FMT_HEVC) {
+        ff_error_m("Format %s is not supported, only h264/h265 streams\n", v4l2GetFmtName(input_para.v4l2Fmt));
+        return -1;
+    }
+    media_codec_t codec = input_para.v4l2Fmt == V4L2_PIX_FMT_HEVC ? MEDIA_CODEC_VIDEO_H265 : MEDIA_CODEC_VIDEO_H264;
+
+    if (server == nullptr)
+        server = getSharedServer(push_port);
+    if (server == nullptr) {
+        ff_error_m("Failed to start the rtsp server on port %d\n", push_port);
+        return -1;
+    }
+    if (mounted)
+        server->removeMount(push_path);
+    if (server->addMount(push_path, codec) < 0)
+        return -1;
+    mounted = true;
+    extra_sent = false;
+
+    // viewers that can not start from the gop cache and rtcp pli/fir ask the encoder above
+    weak_ptr<ModuleMedia> self = shared_from_this();
+    server->setKeyFrameCallback(push_path, [self](RtspServer::KeyRequest reason) {
+        shared_ptr<ModuleMedia> module = self.lock();
+        if (module == nullptr)
+            return;
+        if (reason == RtspServer::KEY_REQUEST_PLI)
+            requestKeyFrame(module, KEY_FRAME_PICTURE_LOSS);
+        else if (reason == RtspServer::KEY_REQUEST_FIR)
+            requestKeyFrame(module, KEY_FRAME_FULL_INTRA);
+        else
+            requestKeyFrame(module, KEY_FRAME_NEW_VIEWER);
+    });
+    if (!multicast_group.empty() && server->setMulticast(push_path, multicast_group, multicast_port, multicast_ttl) < 0)
+        ff_warn_m("multicast %s:%u is not available\n", multicast_group.c_str(), multicast_port);
+    ff_info_m("rtsp://<ip>:%d%s\n", server->getPort(), push_path.c_str());
+    return 0;
+}
+
+void ModuleRtspFanout::setMulticast(const string& group, uint16_t port, int ttl)
+{
+    multicast_group = group;
+    multicast_port = port;
+    multicast_ttl = ttl;
+}
+
+void ModuleRtspFanout::setMaxTemporalLayer(int layer)
+{
+    if (mounted)
+        server->setMaxTemporalLayer(push_path, layer);
+}
+
+uint32_t ModuleRtspFanout::getViewerCount()
+{
+    return mounted ? server->getViewerCount(push_path) : 0;
+}
+
+ModuleMedia::ConsumeResult ModuleRtspFanout::doConsume(shared_ptr<MediaBuffer> input_buffer, shared_ptr<MediaBuffer> output_buffer)
+{
+    (void)output_buffer;
+    if (input_buffer == NULL || !mounted)
+        return CONSUME_SKIP;
+    if (input_buffer->getMediaBufferType() != BUFFER_TYPE_VIDEO)
+        return CONSUME_SKIP;
+
+    if (!extra_sent) {
+        shared_ptr<MediaBuffer> extra = input_buffer->getExtraData();
+        if (extra != nullptr && extra->getActiveSize() > 0)
+            server->setExtraData(push_path, (const uint8_t*)extra->getActiveData(), extra->getActiveSize());
+        extra_sent = true;
+    }
+
+    if (input_buffer->getActiveSize() > 0)
+        server->pushFrame(push_path, (const uint8_t*)input_buffer->getActiveData(), input_buffer->getActiveSize(),
+                          input_buffer->getPUstimestamp(), getBufferTemporalLayer(input_buffer.get()));
+    if (input_buffer->getEos())
+        return CONSUME_EOS;
+    return CONSUME_SUCCESS;
+}
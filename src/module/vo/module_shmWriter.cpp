@@ -0,0 +1,95 @@
+#include "module/vo/module_shmWriter.hpp"
+#include "base/ff_bitstream.hpp"
+#include "base/ff_buffer_flags.hpp"
+
+using namespace FFMedia;
+
+ModuleShmWriter::ModuleShmWriter(string path_, uint32_t slot_count)
+    : ModuleMedia("ModuleShmWriter"), path(path_), codec(MEDIA_CODEC_VIDEO_H264), raw(true), frame_size(0)
+{
+    media_type = BUFFER_TYPE_VIDEO;
+    buffer_count = 0;
+    config.slot_count = slot_count;
+}
+
+ModuleShmWriter::~ModuleShmWriter()
+{
+    writer.close();
+}
+
+int ModuleShmWriter::init()
+{
+    shared_ptr<ModuleMedia> productor = getProductor();
+    if (productor == nullptr) {
+        ff_error_m("The productor is not set\n");
+        return -1;
+    }
+    input_para = productor->getOutputImagePara();
+
+    raw = !v4l2fmtIsCompressed(input_para.v4l2Fmt);
+    if (raw) {
+        frame_size = v4l2GetFrameSize(input_para.v4l2Fmt, input_para.hstride, input_para.vstride);
+        config.slot_size = frame_size;
+    } else if (input_para.v4l2Fmt == V4L2_PIX_FMT_H264 || input_para.v4l2Fmt == V4L2_PIX_FMT_HEVC
+               || input_para.v4l2Fmt == V4L2_PIX_FMT_MJPEG) {
+        codec = input_para.v4l2Fmt == V4L2_PIX_FMT_HEVC    ? MEDIA_CODEC_VIDEO_H265
+                : input_para.v4l2Fmt == V4L2_PIX_FMT_MJPEG ? MEDIA_CODEC_VIDEO_MJPEG
+                                                           : MEDIA_CODEC_VIDEO_H264;
+        if (config.slot_size == 0)
+            config.slot_size = std::max<size_t>((size_t)input_para.width * input_para.height * 3 / 8, 256 << 10);
+    } else {
+        ff_error_m("Format %s is not supported\n", v4l2GetFmtName(input_para.v4l2Fmt));
+        return -1;
+    }
+    if (raw && frame_size == 0) {
+        ff_error_m("Unknown frame size of %s\n", v4l2GetFmtName(input_para.v4l2Fmt));
+        return -1;
+    }
+
+    ShmStreamInfo info;
+    info.width = input_para.width;
+    info.height = input_para.height;
+    info.hstride = input_para.hstride;
+    info.vstride = input_para.vstride;
+    info.v4l2Fmt = input_para.v4l2Fmt;
+    return writer.open(path, info, config);
+}
+
+bool ModuleShmWriter::teardown()
+{
+    // the readers see eos once they caught up, the socket stays for a restart
+    writer.writeEos();
+    return true;
+}
+
+ModuleMedia::ConsumeResult ModuleShmWriter::doConsume(shared_ptr<MediaBuffer> input_buffer, shared_ptr<MediaBuffer> output_buffer)
+{
+    (void)output_buffer;
+    if (input_buffer == NULL || input_buffer->getMediaBufferType() != BUFFER_TYPE_VIDEO)
+        return CONSUME_SKIP;
+    if (input_buffer->getEos()) {
+        writer.writeEos();
+        return CONSUME_EOS;
+    }
+
+    const uint8_t* data;
+    size_t size;
+    uint32_t flags = getBufferFlags(input_buffer.get()) & 0xffff;
+    if (raw) {
+        shared_ptr<VideoBuffer> buffer = static_pointer_cast<VideoBuffer>(input_buffer);
+        if (buffer->getBufferType() == VideoBuffer::DRM_BUFFER_CACHEABLE)
+            buffer->invalidateDrmBuf();
+        data = (const uint8_t*)buffer->getData();
+        size = std::min(buffer->getSize(), frame_size);
+    } else {
+        data = (const uint8_t*)input_buffer->getActiveData();
+        size = input_buffer->getActiveSize();
+        if (size > 0 && isKeyFrame(data, size, codec))
+            flags |= SHM_FRAME_KEY;
+    }
+    if (data == NULL || size == 0)
+        return CONSUME_SKIP;
+
+    writer.write(data, size, input_buffer->getPUstimestamp(), flags);
+    return CONSUME_SUCCESS;
+}
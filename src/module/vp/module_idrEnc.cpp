@@ -0,0 +1,261 @@
+#include "base/ff_bitstream.hpp"
+#include "base/ff_buffer_flags.hpp"
+#include "base/ff_clock.hpp"
+#include "module/vp/module_idrEnc.hpp"
+
+using namespace FFMedia;
+
+#define DEFAULT_MIN_KEY_FRAME_INTERVAL_MS 1000
+#define DEFAULT_MIN_RESTART_INTERVAL_MS 2000
+#define CHANGE_FIELD_MASK 0xffffffffull
+
+ModuleIdrEnc::ModuleIdrEnc(EncodeType type, int fps_, int gop_, int bps_, EncodeRcMode mode_, EncodeQuality quality_,
+                           EncodeProfile profile_)
+    : ModuleMppEnc(type, fps_, gop_, bps_, mode_, quality_, profile_), encode_type(type), fps(fps_), gop(gop_),
+      bps(bps_), mode(mode_), quality(quality_), profile(profile_), min_interval_ms(DEFAULT_MIN_KEY_FRAME_INTERVAL_MS),
+      pending(false), pending_reason(0), last_key_us(0), requests(0), forced(0), pending_kbps(0), bitrate_changes(0),
+      change_state(0), change_first_us(0), next_bps(bps_), next_fps(fps_), next_gop(gop_),
+      next_quality(quality_), applied_id(0), min_restart_interval_ms(DEFAULT_MIN_RESTART_INTERVAL_MS),
+      last_restart_us(0), report(), report_pending(false)
+{
+}
+
+ModuleIdrEnc::ModuleIdrEnc(EncodeType type, const ImagePara& input_para, int fps_, int gop_, int bps_,
+                           EncodeRcMode mode_, EncodeQuality quality_, EncodeProfile profile_)
+    : ModuleMppEnc(type, input_para, fps_, gop_, bps_, mode_, quality_, profile_), encode_type(type), fps(fps_),
+      gop(gop_), bps(bps_), mode(mode_), quality(quality_), profile(profile_),
+      min_interval_ms(DEFAULT_MIN_KEY_FRAME_INTERVAL_MS), pending(false), pending_reason(0), last_key_us(0),
+      requests(0), forced(0), pending_kbps(0), bitrate_changes(0),
+      change_state(0), change_first_us(0), next_bps(bps_), next_fps(fps_), next_gop(gop_),
+      next_quality(quality_), applied_id(0), min_restart_interval_ms(DEFAULT_MIN_RESTART_INTERVAL_MS),
+      last_restart_us(0), report(), report_pending(false)
+{
+}
+
+ModuleIdrEnc::~ModuleIdrEnc()
+{
+}
+
+int ModuleIdrEnc::changeEncodeParameter(EncodeType type, int fps_, int gop_, int bps_, EncodeRcMode mode_,
+                                        EncodeQuality quality_, EncodeProfile profile_)
+{
+    encode_type = type;
+    fps = fps_;
+    gop = gop_;
+    bps = bps_;
+    mode = mode_;
+    quality = quality_;
+    profile = profile_;
+    return ModuleMppEnc::changeEncodeParameter(type, fps, gop, bps, mode, quality, profile);
+}
+
+bool ModuleIdrEnc::onControlEvent(const ControlEvent& event)
+{
+    if (event.type == CONTROL_EVENT_BITRATE) {
+        if (event.kbps <= 0)
+            return false;
+        pending_kbps = event.kbps;
+        return true;
+    }
+    if (event.type != CONTROL_EVENT_KEY_FRAME || encode_type == ENCODE_TYPE_MJPEG)
+        return false;
+    requests++;
+    pending_reason = event.reason;
+    pending = true;
+    return true;
+}
+
+uint32_t ModuleIdrEnc::queueChange(ChangeField field)
+{
+    // the value is stored before, the field and the id are marked together, so the encode
+    // thread takes the value with the field and reports the id with it
+    int64_t none = 0;
+    change_first_us.compare_exchange_strong(none, monotonicUs());
+    uint64_t state = change_state;
+    uint64_t next;
+    do {
+        next = (((state >> 32) + 1) << 32) | (state & CHANGE_FIELD_MASK) | field;
+    } while (!change_state.compare_exchange_weak(state, next));
+    return next >> 32;
+}
+
+uint32_t ModuleIdrEnc::setBitrate(int kbps)
+{
+    if (kbps <= 0)
+        return 0;
+    next_bps = kbps;
+    return queueChange(CHANGE_BITRATE);
+}
+
+uint32_t ModuleIdrEnc::setFps(int frame_rate)
+{
+    if (frame_rate <= 0)
+        return 0;
+    next_fps = frame_rate;
+    return queueChange(CHANGE_FPS);
+}
+
+uint32_t ModuleIdrEnc::setGop(int frames)
+{
+    if (frames <= 0)
+        return 0;
+    next_gop = frames;
+    return queueChange(CHANGE_GOP);
+}
+
+uint32_t ModuleIdrEnc::setQpRange(int min_qp, int max_qp)
+{
+    if (min_qp < 0 || max_qp > 51 || min_qp > max_qp)
+        return 0;
+    EncodeQuality q;
+    if (max_qp <= 30)
+        q = ENCODE_QUALITY_BEST;
+    else if (max_qp <= 34)
+        q = ENCODE_QUALITY_BETTER;
+    else if (max_qp <= 38)
+        q = ENCODE_QUALITY_MEDIUM;
+    else if (max_qp <= 42)
+        q = ENCODE_QUALITY_WORSE;
+    else
+        q = ENCODE_QUALITY_WORST;
+    next_quality = q;
+    return queueChange(CHANGE_QP_RANGE);
+}
+
+uint32_t ModuleIdrEnc::requestIdr()
+{
+    if (encode_type == ENCODE_TYPE_MJPEG)
+        return 0;
+    return queueChange(CHANGE_IDR);
+}
+
+void ModuleIdrEnc::applyChanges(int64_t now)
+{
+    // a restart is a key frame: the changes wait for one that is due anyway, or for the interval
+    bool key_due = ((change_state & CHANGE_IDR) != 0) || (pending && now - last_key_us >= min_interval_ms * 1000ll);
+    if (!key_due && now - last_restart_us < min_restart_interval_ms * 1000ll)
+        return;
+
+    // the id and the fields in one step, every change up to the id is in the fields
+    uint64_t state = change_state;
+    while (!change_state.compare_exchange_weak(state, state & ~CHANGE_FIELD_MASK))
+        ;
+    uint32_t id = state >> 32;
+    uint32_t fields = state & CHANGE_FIELD_MASK;
+    int new_bps = bps, new_fps = fps, new_gop = gop;
+    EncodeQuality new_quality = quality;
+    bool idr = false;
+
+    if (fields & CHANGE_BITRATE)
+        new_bps = next_bps;
+    if (fields & CHANGE_FPS)
+        new_fps = next_fps;
+    if (fields & CHANGE_GOP)
+        new_gop = next_gop;
+    if (fields & CHANGE_QP_RANGE)
+        new_quality = (EncodeQuality)next_quality.load();
+    if (fields & CHANGE_IDR)
+        idr = true;
+
+    // the feedback of a congestion controlled sink, the latest since the last restart, a set
+    // bitrate takes its place
+    int kbps = pending_kbps.exchange(0);
+    if (kbps && !(fields & CHANGE_BITRATE))
+        new_bps = kbps;
+
+    if (pending && !idr && now - last_key_us >= min_interval_ms * 1000ll) {
+        idr = true;
+        forced++;
+        ff_info_m("force a key frame, %s\n", keyFrameReasonName(pending_reason));
+    }
+
+    if (new_bps != bps || new_fps != fps || new_gop != gop || new_quality != quality || idr) {
+        // one restart for all of them, the same type keeps the pipe as it is
+        if (ModuleMppEnc::changeEncodeParameter(encode_type, new_fps, new_gop, new_bps, mode, new_quality, profile)
+            < 0) {
+            // the encoder runs on with the old parameters, these change ids are never reported
+            ff_warn_m("Failed to change the encoder parameters\n");
+            change_first_us = 0;
+            last_restart_us = now;
+            // a pending key frame is tried again after the interval, not on every frame
+            last_key_us = now;
+            return;
+        }
+        if (new_bps != bps) {
+            ff_info_m("bitrate %d -> %d kbps\n", bps, new_bps);
+            bitrate_changes++;
+        }
+        if (new_fps != fps || new_gop != gop || new_quality != quality)
+            ff_info_m("fps %d -> %d, gop %d -> %d, quality %d -> %d\n", fps, new_fps, gop, new_gop, quality,
+                      new_quality);
+        bps = new_bps;
+        fps = new_fps;
+        gop = new_gop;
+        quality = new_quality;
+        // the restart begins with a key frame
+        pending = false;
+        last_key_us = now;
+        last_restart_us = now;
+    }
+
+    if (fields) {
+        int64_t first_us = change_first_us.exchange(0);
+        if (!report_pending) {
+            report.fields = 0;
+            report.latency_us = first_us ? first_us : now;
+        }
+        report.id = id;
+        report.fields |= fields;
+        report.bps = bps;
+        report.fps = fps;
+        report.gop = gop;
+        report.quality = quality;
+        report_pending = true;
+    }
+}
+
+void ModuleIdrEnc::checkOutput(const shared_ptr<MediaBuffer>& buffer)
+{
+    if (buffer == nullptr || buffer->getActiveSize() == 0)
+        return;
+    media_codec_t codec = encode_type == ENCODE_TYPE_H265 ? MEDIA_CODEC_VIDEO_H265 : MEDIA_CODEC_VIDEO_H264;
+    if (encode_type != ENCODE_TYPE_MJPEG) {
+        const uint8_t* data = (const uint8_t*)buffer->getActiveData();
+        if (isKeyFrame(data, buffer->getActiveSize(), codec)) {
+            // also serves the requests that came since
+            last_key_us = monotonicUs();
+            pending = false;
+        }
+        setBufferTemporalLayer(buffer.get(), temporalLayerId(data, buffer->getActiveSize(), codec));
+    }
+
+    if (report_pending) {
+        // latency_us holds the time of the oldest call until here
+        report_pending = false;
+        report.pts = buffer->getPUstimestamp();
+        report.latency_us = monotonicUs() - report.latency_us;
+        applied_id = report.id;
+        if (change_cb)
+            change_cb(report);
+    }
+}
+
+ModuleMedia::ConsumeResult ModuleIdrEnc::doConsume(shared_ptr<MediaBuffer> input_buffer, shared_ptr<MediaBuffer> output_buffer)
+{
+    // between two frames, the encoder holds no input
+    if (((change_state & CHANGE_FIELD_MASK) || pending_kbps || pending) && input_buffer != nullptr && !input_buffer->getEos())
+        applyChanges(monotonicUs());
+
+    ConsumeResult ret = ModuleMppEnc::doConsume(input_buffer, output_buffer);
+    if (ret == CONSUME_SUCCESS)
+        checkOutput(output_buffer);
+    return ret;
+}
+
+ModuleMedia::ProduceResult ModuleIdrEnc::doProduce(shared_ptr<MediaBuffer> buffer)
+{
+    ProduceResult ret = ModuleMppEnc::doProduce(buffer);
+    if (ret == PRODUCE_SUCCESS)
+        checkOutput(buffer);
+    return ret;
+}
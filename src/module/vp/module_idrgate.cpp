@@ -0,0 +1,95 @@
+#include <unistd.h>
+
+#include "module/vp/module_idrgate.hpp"
+#include "base/ff_bitstream.hpp"
+
+using namespace FFMedia;
+
+// The packets after the end are held this long each, so the reader idles
+#define IDRGATE_CLOSED_HOLD_US 20000
+
+ModuleIdrGate::ModuleIdrGate(size_t idr_limit_)
+    : ModuleMedia("ModuleIdrGate"), idr_limit(idr_limit_), idr_seen(0), end_pts(INT64_MIN), first_pts(INT64_MIN),
+      closed(false), codec(MEDIA_CODEC_VIDEO_H264)
+{
+    media_type = BUFFER_TYPE_VIDEO;
+}
+
+ModuleIdrGate::~ModuleIdrGate()
+{
+}
+
+int ModuleIdrGate::init()
+{
+    shared_ptr<ModuleMedia> productor = getProductor();
+    if (productor == nullptr) {
+        ff_error_m("The productor is not set\n");
+        return -1;
+    }
+
+    input_para = productor->getOutputImagePara();
+    output_para = input_para;
+    if (input_para.v4l2Fmt == V4L2_PIX_FMT_HEVC) {
+        codec = MEDIA_CODEC_VIDEO_H265;
+    } else if (input_para.v4l2Fmt == V4L2_PIX_FMT_H264) {
+        codec = MEDIA_CODEC_VIDEO_H264;
+    } else {
+        ff_error_m("Format %s is not supported\n", v4l2GetFmtName(input_para.v4l2Fmt));
+        return -1;
+    }
+
+    // only the eos buffer is produced, the data is bypassed
+    buffer_count = 1;
+    buffer_size = 16;
+    return ModuleMedia::initBuffer(VideoBuffer::MALLOC_BUFFER);
+}
+
+void ModuleIdrGate::reset()
+{
+    ModuleMedia::reset();
+    idr_seen = 0;
+    first_pts = INT64_MIN;
+    closed = false;
+}
+
+ModuleMedia::ConsumeResult ModuleIdrGate::doConsume(shared_ptr<MediaBuffer> input_buffer, shared_ptr<MediaBuffer> output_buffer)
+{
+    if (input_buffer == NULL)
+        return CONSUME_SKIP;
+    if (closed) {
+        usleep(IDRGATE_CLOSED_HOLD_US);
+        return CONSUME_SKIP;
+    }
+    if (input_buffer->getMediaBufferType() != BUFFER_TYPE_VIDEO)
+        return CONSUME_SKIP;
+    if (input_buffer->getEos()) {
+        closed = true;
+        return CONSUME_BYPASS;
+    }
+    if (first_pts == INT64_MIN)
+        first_pts = input_buffer->getPUstimestamp();
+
+    if (end_pts != INT64_MIN) {
+        if (input_buffer->getPUstimestamp() != end_pts)
+            return CONSUME_BYPASS;
+    } else {
+        if (isKeyFrame((const uint8_t*)input_buffer->getActiveData(), input_buffer->getActiveSize(), codec))
+            idr_seen++;
+        if (idr_limit == 0 || idr_seen <= idr_limit)
+            return CONSUME_BYPASS;
+    }
+
+    // the first frame of the next chunk
+    closed = true;
+    if (output_buffer == NULL)
+        return CONSUME_SKIP;
+
+    shared_ptr<VideoBuffer> eos = static_pointer_cast<VideoBuffer>(output_buffer);
+    eos->setImagePara(output_para);
+    eos->setActiveData(eos->getData());
+    eos->setActiveSize(0);
+    eos->setPUstimestamp(input_buffer->getPUstimestamp());
+    eos->setDUstimestamp(input_buffer->getDUstimestamp());
+    eos->setEos(true);
+    return CONSUME_SUCCESS;
+}
@@ -0,0 +1,77 @@
+#include "base/ff_clock.hpp"
+#include "module/vp/module_newestFrame.hpp"
+
+// A lag above this is a pts jump of the stream, not a backlog
+static const int64_t PTS_JUMP_US = 2000000;
+static const int64_t WINDOW_US = 1000000;
+
+ModuleNewestFrame::ModuleNewestFrame(int max_lag_ms, int max_hold_ms)
+    : ModuleMedia("ModuleNewestFrame"), max_lag_us((int64_t)max_lag_ms * 1000), max_hold_us((int64_t)max_hold_ms * 1000),
+      window_start_us(0), window_min(INT64_MAX), last_window_min(INT64_MAX), last_pass_us(0), passed(0), dropped(0)
+{
+    media_type = BUFFER_TYPE_VIDEO;
+}
+
+ModuleNewestFrame::~ModuleNewestFrame()
+{
+}
+
+int ModuleNewestFrame::init()
+{
+    shared_ptr<ModuleMedia> productor = getProductor();
+    if (productor == nullptr) {
+        ff_error_m("The productor is not set\n");
+        return -1;
+    }
+
+    input_para = productor->getOutputImagePara();
+    output_para = input_para;
+
+    // the frames are bypassed, nothing is produced
+    buffer_count = 1;
+    buffer_size = 16;
+    return ModuleMedia::initBuffer(VideoBuffer::MALLOC_BUFFER);
+}
+
+void ModuleNewestFrame::reset()
+{
+    ModuleMedia::reset();
+    window_start_us = 0;
+    window_min = INT64_MAX;
+    last_window_min = INT64_MAX;
+    last_pass_us = 0;
+}
+
+ModuleMedia::ConsumeResult ModuleNewestFrame::doConsume(shared_ptr<MediaBuffer> input_buffer, shared_ptr<MediaBuffer> output_buffer)
+{
+    (void)output_buffer;
+    if (input_buffer == NULL)
+        return CONSUME_SKIP;
+    if (input_buffer->getMediaBufferType() != BUFFER_TYPE_VIDEO || input_buffer->getEos())
+        return CONSUME_BYPASS;
+
+    int64_t now = FFMedia::monotonicUs();
+    int64_t offset = now - input_buffer->getPUstimestamp();
+
+    // the smallest offset of the last two windows is the on time frame
+    if (now - window_start_us >= WINDOW_US) {
+        last_window_min = window_min;
+        window_min = INT64_MAX;
+        window_start_us = now;
+    }
+    window_min = std::min(window_min, offset);
+    int64_t lag = offset - std::min(window_min, last_window_min);
+
+    if (lag > PTS_JUMP_US) {
+        window_min = last_window_min = offset;
+        lag = 0;
+    }
+
+    if (lag > max_lag_us && now - last_pass_us < max_hold_us) {
+        dropped++;
+        return CONSUME_SKIP;
+    }
+    last_pass_us = now;
+    passed++;
+    return CONSUME_BYPASS;
+}
@@ -0,0 +1,176 @@
+#include "base/ff_buffer_flags.hpp"
+#include "module/vp/module_nullcodec.hpp"
+
+ModuleNullDec::ModuleNullDec()
+    : ModuleMedia("ModuleNullDec")
+{
+    media_type = BUFFER_TYPE_VIDEO;
+}
+
+ModuleNullDec::ModuleNullDec(const ImagePara& input_para)
+    : ModuleNullDec()
+{
+    setInputImagePara(input_para);
+}
+
+ModuleNullDec::~ModuleNullDec()
+{
+}
+
+int ModuleNullDec::initBuffer()
+{
+    if (ModuleMedia::initBuffer(VideoBuffer::DRM_BUFFER_CACHEABLE) == 0)
+        return 0;
+    ff_warn_m("drm buffer is not available, use malloc buffer\n");
+    return ModuleMedia::initBuffer(VideoBuffer::MALLOC_BUFFER);
+}
+
+int ModuleNullDec::init()
+{
+    shared_ptr<ModuleMedia> productor = getProductor();
+    if (productor != nullptr)
+        input_para = productor->getOutputImagePara();
+
+    if (input_para.width == 0 || input_para.height == 0) {
+        ff_error_m("The stream size is unknown\n");
+        return -1;
+    }
+
+    output_para.width = input_para.width;
+    output_para.height = input_para.height;
+    output_para.hstride = ALIGN(input_para.width, 16);
+    output_para.vstride = ALIGN(input_para.height, 16);
+    output_para.v4l2Fmt = V4L2_PIX_FMT_NV12;
+
+    if (initBuffer() < 0)
+        return -1;
+
+    for (uint16_t i = 0; i < buffer_count; i++)
+        getBufferFromIndex(i)->fillWithBlack();
+    return 0;
+}
+
+ModuleMedia::ConsumeResult ModuleNullDec::doConsume(shared_ptr<MediaBuffer> input_buffer, shared_ptr<MediaBuffer> output_buffer)
+{
+    if (input_buffer == NULL || output_buffer == NULL)
+        return CONSUME_SKIP;
+    if (input_buffer->getMediaBufferType() != BUFFER_TYPE_VIDEO)
+        return CONSUME_SKIP;
+
+    shared_ptr<VideoBuffer> dst = static_pointer_cast<VideoBuffer>(output_buffer);
+    dst->setImagePara(output_para);
+    dst->setActiveData(dst->getData());
+    dst->setActiveSize(output_para.hstride * output_para.vstride * 3 / 2);
+    dst->setPUstimestamp(input_buffer->getPUstimestamp());
+    dst->setDUstimestamp(input_buffer->getDUstimestamp());
+    dst->setEos(input_buffer->getEos());
+    return CONSUME_SUCCESS;
+}
+
+ModuleNullEnc::ModuleNullEnc(EncodeType type)
+    : ModuleMedia("ModuleNullEnc"), encode_type(type), gop(0), temporal_layers(1), frame_count(0), key_frame(false)
+{
+    media_type = BUFFER_TYPE_VIDEO;
+}
+
+ModuleNullEnc::ModuleNullEnc(EncodeType type, const ImagePara& input_para)
+    : ModuleNullEnc(type)
+{
+    setInputImagePara(input_para);
+}
+
+ModuleNullEnc::~ModuleNullEnc()
+{
+}
+
+int ModuleNullEnc::init()
+{
+    shared_ptr<ModuleMedia> productor = getProductor();
+    if (productor != nullptr)
+        input_para = productor->getOutputImagePara();
+
+    output_para = input_para;
+    switch (encode_type) {
+        case ENCODE_TYPE_H264:
+            output_para.v4l2Fmt = V4L2_PIX_FMT_H264;
+            break;
+        case ENCODE_TYPE_H265:
+            output_para.v4l2Fmt = V4L2_PIX_FMT_HEVC;
+            break;
+        default:
+            ff_error_m("Encode type %d is not supported\n", encode_type);
+            return -1;
+    }
+
+    buffer_size = 32;
+    frame_count = 0;
+    if (ModuleMedia::initBuffer(VideoBuffer::MALLOC_BUFFER) < 0)
+        return -1;
+    return 0;
+}
+
+ModuleMedia::ConsumeResult ModuleNullEnc::doConsume(shared_ptr<MediaBuffer> input_buffer, shared_ptr<MediaBuffer> output_buffer)
+{
+    static const uint8_t h264_aud[] = {0x00, 0x00, 0x00, 0x01, 0x09, 0xf0};
+    static const uint8_t h265_aud[] = {0x00, 0x00, 0x00, 0x01, 0x46, 0x01, 0x50};
+    static const uint8_t start_code[] = {0x00, 0x00, 0x00, 0x01};
+
+    if (input_buffer == NULL || output_buffer == NULL)
+        return CONSUME_SKIP;
+    if (input_buffer->getMediaBufferType() != BUFFER_TYPE_VIDEO)
+        return CONSUME_SKIP;
+
+    bool h264 = encode_type == ENCODE_TYPE_H264;
+    uint8_t* out = (uint8_t*)output_buffer->getData();
+    size_t size = h264 ? sizeof(h264_aud) : sizeof(h265_aud);
+    memcpy(out, h264 ? h264_aud : h265_aud, size);
+
+    int layer = 0;
+    if (gop > 0 && !input_buffer->getEos()) {
+        bool idr = key_frame.exchange(false) || frame_count % gop == 0;
+        frame_count = idr ? 1 : frame_count + 1;
+        // hierarchical p: with 3 layers the frames after a key frame are on 2 1 2 0 2 1 2 0 ...
+        int pos = (frame_count - 1) % (1 << (temporal_layers - 1));
+        layer = pos == 0 ? 0 : temporal_layers - 1 - __builtin_ctz(pos);
+        bool top = temporal_layers > 1 && layer == temporal_layers - 1;
+
+        // empty slice headers, first_mb_in_slice/first_slice_segment_in_pic_flag set; the top
+        // layer is not referenced
+        uint8_t nal[4];
+        size_t nal_size;
+        if (h264) {
+            if (temporal_layers > 1) {
+                // svc prefix nal with the temporal_id, output_flag and the reserved bits set
+                nal[0] = top ? 0x0e : 0x6e;
+                nal[1] = idr ? 0xc0 : 0x80;
+                nal[2] = 0x80;
+                nal[3] = (layer << 5) | 0x07;
+                memcpy(out + size, start_code, 4);
+                memcpy(out + size + 4, nal, 4);
+                size += 8;
+            }
+            nal[0] = idr ? 0x65 : top ? 0x01 : 0x41;
+            nal[1] = idr ? 0x88 : 0x9a;
+            nal_size = 2;
+        } else {
+            // IDR_W_RADL, TRAIL_N or TRAIL_R, nuh_temporal_id_plus1 = layer + 1
+            nal[0] = idr ? 0x26 : top ? 0x00 : 0x02;
+            nal[1] = layer + 1;
+            nal[2] = idr ? 0xaf : 0xd0;
+            nal_size = 3;
+        }
+        memcpy(out + size, start_code, 4);
+        memcpy(out + size + 4, nal, nal_size);
+        size += 4 + nal_size;
+    }
+
+    shared_ptr<VideoBuffer> dst = static_pointer_cast<VideoBuffer>(output_buffer);
+    dst->setImagePara(output_para);
+    dst->setActiveData(dst->getData());
+    dst->setActiveSize(size);
+    dst->setPUstimestamp(input_buffer->getPUstimestamp());
+    dst->setDUstimestamp(input_buffer->getDUstimestamp());
+    dst->setEos(input_buffer->getEos());
+    FFMedia::setBufferTemporalLayer(dst.get(), layer);
+    return CONSUME_SUCCESS;
+}
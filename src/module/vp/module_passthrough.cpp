@@ -0,0 +1,239 @@
+#include "module/vp/module_passthrough.hpp"
+#include "base/ff_bitstream.hpp"
+#include "module/vi/module_fileReader.hpp"
+#include "module/vi/module_packetReplay.hpp"
+#include "module/vi/module_rtmpClient.hpp"
+#include "module/vi/module_rtspClient.hpp"
+#include "module/vi/module_rtspIngest.hpp"
+
+using namespace FFMedia;
+
+// one frame interval until the stream shows its own
+#define PASSTHROUGH_DEFAULT_INTERVAL_US 40000
+
+template <typename Source>
+static bool sourceExtraData(const shared_ptr<ModuleMedia>& module, vector<uint8_t>& extra_data)
+{
+    shared_ptr<Source> source = dynamic_pointer_cast<Source>(module);
+    if (source == nullptr || source->videoExtraData() == NULL || source->videoExtraDataSize() == 0)
+        return false;
+    extra_data.assign(source->videoExtraData(), source->videoExtraData() + source->videoExtraDataSize());
+    return true;
+}
+
+ModulePassthrough::ModulePassthrough(OutputFormat format_)
+    : ModuleMedia("ModulePassthrough"), format(format_), codec(MEDIA_CODEC_VIDEO_H264), inject(true), wait_key(true),
+      rebase(false), base_us(0), max_gap_us(1000000), length_size(4), started(false), rebased(false), offset_us(0),
+      last_in_us(0), last_out_us(0), interval_us(PASSTHROUGH_DEFAULT_INTERVAL_US), bypassed(0), copied(0), injected(0),
+      dropped(0), discontinuities(0)
+{
+    media_type = BUFFER_TYPE_VIDEO;
+}
+
+ModulePassthrough::~ModulePassthrough()
+{
+}
+
+void ModulePassthrough::setExtraData(const uint8_t* extra_data, unsigned extra_size)
+{
+    updateParameterSets(extra_data, extra_size);
+}
+
+void ModulePassthrough::setTimestampRebase(bool enable, int64_t base_us_, int max_gap_ms)
+{
+    rebase = enable;
+    base_us = base_us_;
+    max_gap_us = max_gap_ms * 1000ll;
+}
+
+int ModulePassthrough::init()
+{
+    shared_ptr<ModuleMedia> productor = getProductor();
+    if (productor == nullptr) {
+        ff_error_m("The productor is not set\n");
+        return -1;
+    }
+
+    input_para = productor->getOutputImagePara();
+    output_para = input_para;
+    if (input_para.v4l2Fmt == V4L2_PIX_FMT_HEVC) {
+        codec = MEDIA_CODEC_VIDEO_H265;
+    } else if (input_para.v4l2Fmt == V4L2_PIX_FMT_H264) {
+        codec = MEDIA_CODEC_VIDEO_H264;
+    } else if (input_para.v4l2Fmt == V4L2_PIX_FMT_MJPEG) {
+        codec = MEDIA_CODEC_VIDEO_MJPEG;
+    } else {
+        ff_error_m("Format %s is not supported\n", v4l2GetFmtName(input_para.v4l2Fmt));
+        return -1;
+    }
+
+    if (sets.empty() && codec != MEDIA_CODEC_VIDEO_MJPEG) {
+        vector<uint8_t> extra_data;
+        if (sourceExtraData<ModuleRtspClient>(productor, extra_data)
+            || sourceExtraData<ModuleRtspIngest>(productor, extra_data)
+            || sourceExtraData<ModuleRtmpClient>(productor, extra_data)
+            || sourceExtraData<ModuleFileReader>(productor, extra_data)
+            || sourceExtraData<ModulePacketReplay>(productor, extra_data))
+            updateParameterSets(extra_data.data(), extra_data.size());
+    }
+    if (sets.empty() && codec != MEDIA_CODEC_VIDEO_MJPEG)
+        ff_info_m("No parameter sets yet, they are taken from the first key frame\n");
+
+    frames.assign(buffer_count, vector<uint8_t>());
+    buffer_size = 16;
+    return ModuleMedia::initBuffer(VideoBuffer::MALLOC_BUFFER);
+}
+
+void ModulePassthrough::reset()
+{
+    ModuleMedia::reset();
+    started = false;
+    rebased = false;
+    interval_us = PASSTHROUGH_DEFAULT_INTERVAL_US;
+}
+
+void ModulePassthrough::updateParameterSets(const uint8_t* data, size_t size)
+{
+    vector<uint8_t> annexb_sets;
+    int record_length_size = 4;
+
+    if (data == NULL || size == 0)
+        return;
+    if (isDecoderConfig(data, size)) {
+        parseDecoderConfig(data, size, codec, annexb_sets, &record_length_size);
+        length_size = record_length_size;
+    } else {
+        getParameterSets(data, size, codec, annexb_sets);
+    }
+    if (annexb_sets.empty() || annexb_sets == sets)
+        return;
+    sets.swap(annexb_sets);
+
+    // a new buffer, the old one may still be attached to frames downstream
+    vector<uint8_t> record;
+    const vector<uint8_t>* extra = &sets;
+    if (format == OUTPUT_LENGTH_PREFIXED) {
+        vector<NalUnit> nals;
+        vector<uint8_t> vps, sps, pps;
+        bool hevc = codec == MEDIA_CODEC_VIDEO_H265;
+        splitNalUnits(sets.data(), sets.size(), nals);
+        for (auto& nal : nals) {
+            int type = nalUnitType(nal.data, codec);
+            if (hevc && type == 32)
+                vps.assign(nal.data, nal.data + nal.size);
+            else if (type == (hevc ? 33 : 7))
+                sps.assign(nal.data, nal.data + nal.size);
+            else if (type == (hevc ? 34 : 8))
+                pps.assign(nal.data, nal.data + nal.size);
+        }
+        if (!buildDecoderConfig(codec, vps, sps, pps, record)) {
+            ff_warn_m("Incomplete parameter sets, no avcC/hvcC record\n");
+            return;
+        }
+        extra = &record;
+    }
+    extra_buffer = make_shared<MediaBuffer>(extra->size());
+    memcpy(extra_buffer->getData(), extra->data(), extra->size());
+    extra_buffer->setActiveData(extra_buffer->getData());
+    extra_buffer->setActiveSize(extra->size());
+}
+
+int64_t ModulePassthrough::rebaseTimestamp(int64_t pts)
+{
+    if (!rebased) {
+        offset_us = base_us - pts;
+        rebased = true;
+    } else {
+        int64_t step = pts - last_in_us;
+        // b frames step back a little, a new source or a looped file jumps
+        if (step > max_gap_us || step < -max_gap_us) {
+            offset_us = last_out_us + interval_us - pts;
+            discontinuities++;
+        } else if (step > 0) {
+            interval_us = step;
+        }
+    }
+    last_in_us = pts;
+    last_out_us = pts + offset_us;
+    return offset_us;
+}
+
+ModuleMedia::ConsumeResult ModulePassthrough::doConsume(shared_ptr<MediaBuffer> input_buffer, shared_ptr<MediaBuffer> output_buffer)
+{
+    if (input_buffer == NULL || output_buffer == NULL)
+        return CONSUME_SKIP;
+    if (input_buffer->getMediaBufferType() != BUFFER_TYPE_VIDEO)
+        return CONSUME_SKIP;
+    if (input_buffer->getEos())
+        return CONSUME_BYPASS;
+
+    const uint8_t* data = (const uint8_t*)input_buffer->getActiveData();
+    size_t size = input_buffer->getActiveSize();
+    if (data == NULL || size == 0)
+        return CONSUME_SKIP;
+
+    bool is_annexb = true;
+    bool add_sets = false;
+    if (codec != MEDIA_CODEC_VIDEO_MJPEG) {
+        if (sets.empty()) {
+            shared_ptr<MediaBuffer> extra = input_buffer->getExtraData();
+            if (extra != nullptr && extra->getActiveSize() > 0)
+                updateParameterSets((const uint8_t*)extra->getActiveData(), extra->getActiveSize());
+        }
+
+        is_annexb = isAnnexB(data, size);
+        if (!is_annexb) {
+            annexb.clear();
+            lengthPrefixedToAnnexB(data, size, length_size, annexb);
+            data = annexb.data();
+            size = annexb.size();
+        }
+
+        bool key = isKeyFrame(data, size, codec);
+        if (!started && wait_key && !key) {
+            dropped++;
+            return CONSUME_SKIP;
+        }
+        if (key) {
+            // the stream may change its parameter sets, e.g. a new resolution
+            if (getParameterSets(data, size, codec, found) > 0)
+                updateParameterSets(found.data(), found.size());
+            else
+                add_sets = inject && !sets.empty();
+        }
+    }
+    started = true;
+
+    int64_t offset = rebase ? rebaseTimestamp(input_buffer->getPUstimestamp()) : 0;
+    bool as_annexb = format == OUTPUT_ANNEXB || codec == MEDIA_CODEC_VIDEO_MJPEG;
+    if (is_annexb && as_annexb && !add_sets && offset == 0) {
+        bypassed++;
+        return CONSUME_BYPASS;
+    }
+
+    // copied, the input goes back to the source once every consumer is done with it
+    vector<uint8_t>& out = frames[output_buffer->getIndex() % frames.size()];
+    out.clear();
+    if (as_annexb) {
+        if (add_sets)
+            out.insert(out.end(), sets.begin(), sets.end());
+        out.insert(out.end(), data, data + size);
+    } else {
+        if (add_sets)
+            annexBToLengthPrefixed(sets.data(), sets.size(), out);
+        annexBToLengthPrefixed(data, size, out);
+    }
+    if (add_sets)
+        injected++;
+    copied++;
+
+    shared_ptr<VideoBuffer> dst = static_pointer_cast<VideoBuffer>(output_buffer);
+    dst->setImagePara(output_para);
+    dst->setActiveData(out.data());
+    dst->setActiveSize(out.size());
+    dst->setPUstimestamp(input_buffer->getPUstimestamp() + offset);
+    dst->setDUstimestamp(input_buffer->getDUstimestamp() + offset);
+    dst->setExtraData(extra_buffer);
+    dst->setEos(false);
+    return CONSUME_SUCCESS;
+}
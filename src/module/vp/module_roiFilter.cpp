@@ -0,0 +1,145 @@
+#include "base/ff_clock.hpp"
+#include "module/vp/module_roiFilter.hpp"
+
+using namespace FFMedia;
+
+#define DEFAULT_MARGIN 16
+#define DEFAULT_HOLD_MS 1000
+
+ModuleRoiFilter::ModuleRoiFilter(int background_delta_)
+    : ModuleMedia("ModuleRoiFilter"), regions_us(0), regions_set(false), background_delta(background_delta_),
+      margin(DEFAULT_MARGIN), hold_ms(DEFAULT_HOLD_MS), filtered(0), buffers_ready(false)
+{
+    media_type = BUFFER_TYPE_VIDEO;
+}
+
+ModuleRoiFilter::ModuleRoiFilter(const ImagePara& input_para, int background_delta_)
+    : ModuleRoiFilter(background_delta_)
+{
+    setInputImagePara(input_para);
+}
+
+ModuleRoiFilter::~ModuleRoiFilter()
+{
+    // the maps of the output frames must not outlive the buffers
+    if (buffers_ready) {
+        for (uint16_t i = 0; i < getBufferCount(); i++) {
+            shared_ptr<MediaBuffer> buffer = getBufferFromIndex(i);
+            if (buffer)
+                setBufferQpMap(buffer.get(), nullptr);
+        }
+    }
+}
+
+int ModuleRoiFilter::initBuffer()
+{
+    int ret = ModuleMedia::initBuffer(VideoBuffer::DRM_BUFFER_CACHEABLE);
+    if (ret != 0) {
+        ff_warn_m("drm buffer is not available, use malloc buffer\n");
+        ret = ModuleMedia::initBuffer(VideoBuffer::MALLOC_BUFFER);
+    }
+    buffers_ready = ret == 0;
+    return ret;
+}
+
+int ModuleRoiFilter::init()
+{
+    shared_ptr<ModuleMedia> productor = getProductor();
+    if (productor != nullptr)
+        input_para = productor->getOutputImagePara();
+
+    if (input_para.v4l2Fmt != V4L2_PIX_FMT_NV12) {
+        ff_error_m("Input format %s is not supported, only NV12\n", v4l2GetFmtName(input_para.v4l2Fmt));
+        return -1;
+    }
+    output_para = input_para;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        map.reset();
+    }
+    if (initBuffer() < 0)
+        return -1;
+    return 0;
+}
+
+void ModuleRoiFilter::setRegions(const vector<RoiRegion>& roi_regions)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    regions = roi_regions;
+    regions_us = monotonicUs();
+    regions_set = true;
+    map.reset();
+}
+
+void ModuleRoiFilter::setBackgroundDelta(int delta)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    background_delta = delta;
+    map.reset();
+}
+
+void ModuleRoiFilter::setMargin(int pixels)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    margin = pixels;
+    map.reset();
+}
+
+ModuleMedia::ConsumeResult ModuleRoiFilter::doConsume(shared_ptr<MediaBuffer> input_buffer, shared_ptr<MediaBuffer> output_buffer)
+{
+    if (input_buffer == NULL || output_buffer == NULL)
+        return CONSUME_SKIP;
+    if (input_buffer->getMediaBufferType() != BUFFER_TYPE_VIDEO)
+        return CONSUME_BYPASS;
+
+    shared_ptr<VideoBuffer> src = static_pointer_cast<VideoBuffer>(input_buffer);
+    shared_ptr<VideoBuffer> dst = static_pointer_cast<VideoBuffer>(output_buffer);
+    ImagePara para = src->getImagePara();
+    if (para.width == 0 || para.height == 0)
+        para = input_para;
+
+    shared_ptr<const QpMap> frame_map = getBufferQpMap(input_buffer.get());
+    if (frame_map == nullptr) {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (regions_set && !regions.empty() && monotonicUs() - regions_us > hold_ms * 1000ll) {
+            regions.clear();
+            map.reset();
+        }
+        if (regions_set && map == nullptr) {
+            shared_ptr<QpMap> next = make_shared<QpMap>(para.width, para.height, background_delta);
+            for (auto& region : regions)
+                next->addRegion(region, margin);
+            map = next;
+        }
+        frame_map = map;
+    }
+    if (frame_map
+        && ((uint32_t)frame_map->getWidth() != para.width || (uint32_t)frame_map->getHeight() != para.height)) {
+        ff_warn_m("qp map %dx%d does not match the frame %ux%u\n", frame_map->getWidth(), frame_map->getHeight(),
+                  para.width, para.height);
+        frame_map.reset();
+    }
+
+    if (src->getBufferType() == VideoBuffer::DRM_BUFFER_CACHEABLE)
+        src->invalidateDrmBuf();
+
+    size_t size = para.hstride * para.vstride * 3 / 2;
+    if (frame_map) {
+        filterNv12Roi((const uint8_t*)src->getActiveData(), (uint8_t*)dst->getData(), para, *frame_map);
+        filtered++;
+    } else {
+        memcpy(dst->getData(), src->getActiveData(), size);
+    }
+
+    if (dst->getBufferType() == VideoBuffer::DRM_BUFFER_CACHEABLE)
+        dst->flushDrmBuf();
+
+    dst->setImagePara(para);
+    dst->setActiveData(dst->getData());
+    dst->setActiveSize(size);
+    dst->setPUstimestamp(src->getPUstimestamp());
+    dst->setDUstimestamp(src->getDUstimestamp());
+    dst->setEos(src->getEos());
+    setBufferQpMap(dst.get(), frame_map);
+    return CONSUME_SUCCESS;
+}
@@ -0,0 +1,367 @@
+#include "base/ff_bitstream.hpp"
+#include "base/ff_clock.hpp"
+#include "module/vp/module_idrEnc.hpp"
+#include "module/vp/module_nullcodec.hpp"
+#include "module/vp/module_rga.hpp"
+#include "module/vp/module_simulcastEnc.hpp"
+#include "module/vp/module_swscale.hpp"
+
+using namespace FFMedia;
+
+#define DEFAULT_MIN_KEY_FRAME_INTERVAL_MS 1000
+#define SIMULCAST_SCALER_BUFFERS 2
+
+// A module run by ModuleSimulcastEnc on its own thread: initialised, never started.
+class SimulcastStage
+{
+public:
+    virtual ~SimulcastStage() {}
+    virtual int initStage() = 0;
+    virtual ImagePara stageOutputPara() const = 0;
+    // Run the module on input as its work thread would and append its outputs, none when it
+    // holds the input back, several when an encoder had packets queued.
+    virtual void process(shared_ptr<MediaBuffer> input, vector<shared_ptr<MediaBuffer>>& outputs) = 0;
+    // Done with an output of process()
+    virtual void release(shared_ptr<MediaBuffer> output) = 0;
+    virtual void forceKeyFrame() = 0;
+};
+
+static void forceStageKeyFrame(ModuleIdrEnc* enc)
+{
+    enc->requestIdr();
+}
+
+static void forceStageKeyFrame(ModuleNullEnc* enc)
+{
+    enc->requestKeyFrame();
+}
+
+static void forceStageKeyFrame(ModuleMedia*)
+{
+}
+
+template <class Module>
+class SimulcastStageOf : public Module, public SimulcastStage
+{
+private:
+    // outputs of mpp modules hold a mpp buffer until they are released
+    bool release_outputs;
+    uint16_t next;
+
+public:
+    template <typename... Args>
+    SimulcastStageOf(bool release, Args&&... args)
+        : Module(std::forward<Args>(args)...), release_outputs(release), next(0)
+    {
+    }
+
+    int initStage() override { return Module::init(); }
+    ImagePara stageOutputPara() const override { return Module::getOutputImagePara(); }
+
+    void process(shared_ptr<MediaBuffer> input, vector<shared_ptr<MediaBuffer>>& outputs) override
+    {
+        uint16_t count = Module::getBufferCount();
+        size_t first = outputs.size();
+        shared_ptr<MediaBuffer> output = Module::getBufferFromIndex(next);
+        typename Module::ConsumeResult ret = Module::doConsume(input, output);
+        // the module wants the same input once more, e.g. an encoder whose queue was full
+        for (uint16_t i = 0; ret == Module::CONSUME_NEED_REPEAT && i < count; i++)
+            ret = Module::doConsume(input, output);
+        if (ret == Module::CONSUME_SUCCESS) {
+            outputs.push_back(output);
+            next = (next + 1) % count;
+        } else if (ret != Module::CONSUME_WAIT_FOR_PRODUCTOR) {
+            // WAIT_FOR_PRODUCTOR took the input, its output follows from doProduce()
+            return;
+        }
+
+        // mpp encoders return their packets here, the base module has none (PRODUCE_BYPASS)
+        while (outputs.size() - first < count) {
+            output = Module::getBufferFromIndex(next);
+            typename Module::ProduceResult produced = Module::doProduce(output);
+            if (produced == Module::PRODUCE_SUCCESS) {
+                outputs.push_back(output);
+                next = (next + 1) % count;
+            } else if (produced != Module::PRODUCE_CONTINUE) {
+                break;
+            }
+        }
+    }
+
+    void release(shared_ptr<MediaBuffer> output) override
+    {
+        if (release_outputs)
+            Module::bufferReleaseCallBack(output);
+    }
+
+    void forceKeyFrame() override { forceStageKeyFrame(this); }
+};
+
+template <class Module, typename... Args>
+static shared_ptr<SimulcastStage> makeStage(uint16_t buffer_count, bool release, Args&&... args)
+{
+    auto stage = make_shared<SimulcastStageOf<Module>>(release, std::forward<Args>(args)...);
+    if (buffer_count)
+        stage->setBufferCount(buffer_count);
+    return stage;
+}
+
+ModuleSimulcastEnc::ModuleSimulcastEnc(EncodeType type, const vector<SimulcastRendition>& renditions_, int fps_,
+                                       int gop_, bool software_)
+    : ModuleMedia("ModuleSimulcastEnc"), encode_type(type), renditions(renditions_), fps(fps_), gop(gop_),
+      software(software_), frame_count(0), min_interval_ms(DEFAULT_MIN_KEY_FRAME_INTERVAL_MS), pending(false),
+      last_key_us(0), realign(false), requests(0), aligned_key_frames(0), misaligned_key_frames(0)
+{
+    media_type = BUFFER_TYPE_VIDEO;
+    buffer_count = 4;
+}
+
+ModuleSimulcastEnc::ModuleSimulcastEnc(EncodeType type, const ImagePara& input_para,
+                                       const vector<SimulcastRendition>& renditions_, int fps_, int gop_,
+                                       bool software_)
+    : ModuleSimulcastEnc(type, renditions_, fps_, gop_, software_)
+{
+    setInputImagePara(input_para);
+}
+
+ModuleSimulcastEnc::~ModuleSimulcastEnc()
+{
+}
+
+int ModuleSimulcastEnc::init()
+{
+    shared_ptr<ModuleMedia> productor = getProductor();
+    if (productor != nullptr)
+        input_para = productor->getOutputImagePara();
+
+    if (renditions.empty()) {
+        ff_error_m("No rendition\n");
+        return -1;
+    }
+    if (encode_type != ENCODE_TYPE_H264 && encode_type != ENCODE_TYPE_H265) {
+        ff_error_m("Encode type %d is not supported\n", encode_type);
+        return -1;
+    }
+
+    scalers.clear();
+    encoders.clear();
+    for (size_t i = 0; i < renditions.size(); i++) {
+        const SimulcastRendition& r = renditions[i];
+        if (r.width == 0 || r.height == 0 || r.bps <= 0) {
+            ff_error_m("Rendition %zu: invalid %ux%u %d kbps\n", i, r.width, r.height, r.bps);
+            return -1;
+        }
+        ImagePara scaled(r.width, r.height, r.width, r.height, V4L2_PIX_FMT_NV12);
+
+        shared_ptr<SimulcastStage> scaler;
+        if (software)
+            scaler = makeStage<ModuleSwScale>(SIMULCAST_SCALER_BUFFERS, false, input_para, scaled);
+        else
+            scaler = makeStage<ModuleRga>(SIMULCAST_SCALER_BUFFERS, false, input_para, scaled, RGA_ROTATE_NONE);
+        if (scaler->initStage() < 0) {
+            ff_error_m("Rendition %zu: scaler init failed\n", i);
+            return -1;
+        }
+
+        shared_ptr<SimulcastStage> encoder;
+        if (software) {
+            auto enc = make_shared<SimulcastStageOf<ModuleNullEnc>>(false, encode_type, scaler->stageOutputPara());
+            enc->setGop(gop);
+            encoder = enc;
+        } else {
+            encoder = makeStage<ModuleIdrEnc>(0, true, encode_type, scaler->stageOutputPara(), fps, gop, r.bps);
+        }
+        if (encoder->initStage() < 0) {
+            ff_error_m("Rendition %zu: encoder init failed\n", i);
+            return -1;
+        }
+
+        scalers.push_back(scaler);
+        encoders.push_back(encoder);
+        ff_info_m("rendition %zu: %ux%u %d kbps\n", i, r.width, r.height, r.bps);
+    }
+
+    output_para = encoders[0]->stageOutputPara();
+
+    // the buffers only carry the metadata, the packets stay in frames
+    frames.assign(buffer_count, Frame());
+    for (auto& frame : frames) {
+        frame.packets.resize(renditions.size());
+        frame.extra_data.resize(renditions.size());
+        frame.key_frames.resize(renditions.size());
+    }
+    frame_count = 0;
+    buffer_size = 16;
+    return ModuleMedia::initBuffer(VideoBuffer::MALLOC_BUFFER);
+}
+
+void ModuleSimulcastEnc::reset()
+{
+    ModuleMedia::reset();
+    frame_count = 0;
+    realign = false;
+    // the renditions start again together
+    pending = true;
+    last_key_us = 0;
+}
+
+bool ModuleSimulcastEnc::onControlEvent(const ControlEvent& event)
+{
+    // a bitrate does not say which rendition it is for, ModuleIdrEnc above may take it
+    if (event.type != CONTROL_EVENT_KEY_FRAME)
+        return false;
+    requests++;
+    pending = true;
+    return true;
+}
+
+ImagePara ModuleSimulcastEnc::getRenditionPara(int rendition) const
+{
+    if (rendition < 0 || rendition >= (int)encoders.size())
+        return ImagePara(0, 0, 0, 0, 0);
+    return encoders[rendition]->stageOutputPara();
+}
+
+const vector<uint8_t>& ModuleSimulcastEnc::getPacket(const shared_ptr<MediaBuffer>& buffer, int rendition) const
+{
+    return frames[buffer->getIndex() % frames.size()].packets[rendition];
+}
+
+shared_ptr<MediaBuffer> ModuleSimulcastEnc::getPacketExtraData(const shared_ptr<MediaBuffer>& buffer,
+                                                              int rendition) const
+{
+    return frames[buffer->getIndex() % frames.size()].extra_data[rendition];
+}
+
+ModuleMedia::ConsumeResult ModuleSimulcastEnc::doConsume(shared_ptr<MediaBuffer> input_buffer, shared_ptr<MediaBuffer> output_buffer)
+{
+    if (input_buffer == NULL || output_buffer == NULL)
+        return CONSUME_SKIP;
+    if (input_buffer->getMediaBufferType() != BUFFER_TYPE_VIDEO)
+        return CONSUME_SKIP;
+
+    // the buffer is only produced again once every output released it
+    Frame& frame = frames[output_buffer->getIndex() % frames.size()];
+    media_codec_t codec = encode_type == ENCODE_TYPE_H265 ? MEDIA_CODEC_VIDEO_H265 : MEDIA_CODEC_VIDEO_H264;
+    bool eos = input_buffer->getEos();
+    int64_t now = monotonicUs();
+
+    if (!eos && (realign || (pending && now - last_key_us >= min_interval_ms * 1000ll))) {
+        pending = false;
+        realign = false;
+        last_key_us = now;
+        for (auto& encoder : encoders)
+            encoder->forceKeyFrame();
+    }
+
+    size_t coded = 0, keys = 0;
+    vector<shared_ptr<MediaBuffer>> scaled, packets;
+    for (size_t i = 0; i < encoders.size(); i++) {
+        frame.packets[i].clear();
+        frame.extra_data[i] = nullptr;
+        frame.key_frames[i] = false;
+        if (eos)
+            continue;
+
+        scaled.clear();
+        scalers[i]->process(input_buffer, scaled);
+        packets.clear();
+        for (auto& buffer : scaled)
+            encoders[i]->process(buffer, packets);
+        if (packets.empty())
+            continue;
+
+        // an encoder that was behind may return the packets of more than one frame
+        for (auto& packet : packets) {
+            const uint8_t* data = (const uint8_t*)packet->getActiveData();
+            frame.packets[i].insert(frame.packets[i].end(), data, data + packet->getActiveSize());
+            if (packet->getExtraData() != nullptr)
+                frame.extra_data[i] = packet->getExtraData();
+            if (isKeyFrame(data, packet->getActiveSize(), codec))
+                frame.key_frames[i] = true;
+            encoders[i]->release(packet);
+        }
+        coded++;
+        if (frame.key_frames[i])
+            keys++;
+    }
+
+    if (keys > 0 && keys < coded) {
+        misaligned_key_frames++;
+        realign = true;
+        ff_warn_m("frame %" PRIu64 ": %zu of %zu renditions are key frames, align on the next frame\n", frame_count,
+                  keys, coded);
+    } else if (keys > 0) {
+        // also serves the requests that came since
+        aligned_key_frames++;
+        last_key_us = now;
+        pending = false;
+    }
+    frame_count++;
+
+    shared_ptr<VideoBuffer> dst = static_pointer_cast<VideoBuffer>(output_buffer);
+    dst->setImagePara(output_para);
+    dst->setActiveData(frame.packets[0].data());
+    dst->setActiveSize(frame.packets[0].size());
+    dst->setPUstimestamp(input_buffer->getPUstimestamp());
+    dst->setDUstimestamp(input_buffer->getDUstimestamp());
+    dst->setExtraData(frame.extra_data[0]);
+    dst->setEos(eos);
+    return CONSUME_SUCCESS;
+}
+
+ModuleSimulcastOutput::ModuleSimulcastOutput(int rendition_)
+    : ModuleMedia("ModuleSimulcastOutput"), rendition(rendition_)
+{
+    media_type = BUFFER_TYPE_VIDEO;
+}
+
+ModuleSimulcastOutput::~ModuleSimulcastOutput()
+{
+}
+
+int ModuleSimulcastOutput::init()
+{
+    shared_ptr<ModuleSimulcastEnc> simulcast = dynamic_pointer_cast<ModuleSimulcastEnc>(getProductor());
+    if (simulcast == nullptr) {
+        ff_error_m("The productor is not a ModuleSimulcastEnc\n");
+        return -1;
+    }
+    if (rendition < 0 || rendition >= simulcast->getRenditionCount()) {
+        ff_error_m("Rendition %d is out of range\n", rendition);
+        return -1;
+    }
+    input_para = simulcast->getOutputImagePara();
+    output_para = simulcast->getRenditionPara(rendition);
+
+    packets.assign(buffer_count, vector<uint8_t>());
+    buffer_size = 16;
+    return ModuleMedia::initBuffer(VideoBuffer::MALLOC_BUFFER);
+}
+
+ModuleMedia::ConsumeResult ModuleSimulcastOutput::doConsume(shared_ptr<MediaBuffer> input_buffer, shared_ptr<MediaBuffer> output_buffer)
+{
+    if (input_buffer == NULL || output_buffer == NULL)
+        return CONSUME_SKIP;
+    shared_ptr<ModuleSimulcastEnc> simulcast = static_pointer_cast<ModuleSimulcastEnc>(getProductor());
+    if (simulcast == nullptr)
+        return CONSUME_SKIP;
+
+    const vector<uint8_t>& packet = simulcast->getPacket(input_buffer, rendition);
+    if (packet.empty() && !input_buffer->getEos())
+        return CONSUME_SKIP;
+
+    // copied, the input goes back to the simulcast module when every output is done with it
+    vector<uint8_t>& data = packets[output_buffer->getIndex() % packets.size()];
+    data.assign(packet.begin(), packet.end());
+
+    shared_ptr<VideoBuffer> dst = static_pointer_cast<VideoBuffer>(output_buffer);
+    dst->setImagePara(output_para);
+    dst->setActiveData(data.data());
+    dst->setActiveSize(data.size());
+    dst->setPUstimestamp(input_buffer->getPUstimestamp());
+    dst->setDUstimestamp(input_buffer->getDUstimestamp());
+    dst->setExtraData(simulcast->getPacketExtraData(input_buffer, rendition));
+    dst->setEos(input_buffer->getEos());
+    return CONSUME_SUCCESS;
+}
@@ -0,0 +1,129 @@
+#include "module/vp/module_swscale.hpp"
+
+ModuleSwScale::ModuleSwScale(const ImagePara& output_para)
+    : ModuleMedia("ModuleSwScale")
+{
+    media_type = BUFFER_TYPE_VIDEO;
+    setOutputImagePara(output_para);
+}
+
+ModuleSwScale::ModuleSwScale(const ImagePara& input_para, const ImagePara& output_para)
+    : ModuleSwScale(output_para)
+{
+    setInputImagePara(input_para);
+}
+
+ModuleSwScale::~ModuleSwScale()
+{
+}
+
+int ModuleSwScale::initBuffer()
+{
+    // drm is preferred so that mpp modules downstream can import the buffer,
+    // fall back to plain memory on machines without a drm device
+    if (ModuleMedia::initBuffer(VideoBuffer::DRM_BUFFER_CACHEABLE) == 0)
+        return 0;
+    ff_warn_m("drm buffer is not available, use malloc buffer\n");
+    return ModuleMedia::initBuffer(VideoBuffer::MALLOC_BUFFER);
+}
+
+int ModuleSwScale::init()
+{
+    shared_ptr<ModuleMedia> productor = getProductor();
+    if (productor != nullptr)
+        input_para = productor->getOutputImagePara();
+
+    if (input_para.v4l2Fmt != V4L2_PIX_FMT_NV12) {
+        ff_error_m("Input format %s is not supported, only NV12\n", v4l2GetFmtName(input_para.v4l2Fmt));
+        return -1;
+    }
+
+    if (output_para.width == 0 || output_para.height == 0) {
+        output_para.width = input_para.width;
+        output_para.height = input_para.height;
+    }
+    output_para.width = ALIGN(output_para.width, 2);
+    output_para.height = ALIGN(output_para.height, 2);
+    output_para.hstride = std::max(output_para.hstride, output_para.width);
+    output_para.vstride = std::max(output_para.vstride, output_para.height);
+    output_para.v4l2Fmt = V4L2_PIX_FMT_NV12;
+
+    x_map.clear();
+    y_map.clear();
+
+    if (initBuffer() < 0)
+        return -1;
+    return 0;
+}
+
+void ModuleSwScale::scaleNv12(const uint8_t* src, const ImagePara& src_para, uint8_t* dst, const ImagePara& dst_para,
+                              vector<uint32_t>& x_map, vector<uint32_t>& y_map)
+{
+    if (x_map.size() != dst_para.width || y_map.size() != dst_para.height) {
+        x_map.resize(dst_para.width);
+        y_map.resize(dst_para.height);
+        for (uint32_t x = 0; x < dst_para.width; x++)
+            x_map[x] = (uint64_t)x * src_para.width / dst_para.width;
+        for (uint32_t y = 0; y < dst_para.height; y++)
+            y_map[y] = (uint64_t)y * src_para.height / dst_para.height;
+    }
+
+    const uint8_t* src_uv = src + src_para.hstride * src_para.vstride;
+    uint8_t* dst_uv = dst + dst_para.hstride * dst_para.vstride;
+
+    if (src_para.width == dst_para.width && src_para.height == dst_para.height) {
+        for (uint32_t y = 0; y < dst_para.height; y++)
+            memcpy(dst + y * dst_para.hstride, src + y * src_para.hstride, dst_para.width);
+        for (uint32_t y = 0; y < dst_para.height / 2; y++)
+            memcpy(dst_uv + y * dst_para.hstride, src_uv + y * src_para.hstride, dst_para.width);
+        return;
+    }
+
+    for (uint32_t y = 0; y < dst_para.height; y++) {
+        const uint8_t* s = src + y_map[y] * src_para.hstride;
+        uint8_t* d = dst + y * dst_para.hstride;
+        for (uint32_t x = 0; x < dst_para.width; x++)
+            d[x] = s[x_map[x]];
+    }
+
+    // chroma is subsampled 2x2, the uv pair of dst column x comes from the pair holding src column x_map[x]
+    for (uint32_t y = 0; y < dst_para.height / 2; y++) {
+        const uint8_t* s = src_uv + (y_map[y * 2] / 2) * src_para.hstride;
+        uint8_t* d = dst_uv + y * dst_para.hstride;
+        for (uint32_t x = 0; x < dst_para.width; x += 2) {
+            uint32_t sx = x_map[x] & ~1u;
+            d[x] = s[sx];
+            d[x + 1] = s[sx + 1];
+        }
+    }
+}
+
+ModuleMedia::ConsumeResult ModuleSwScale::doConsume(shared_ptr<MediaBuffer> input_buffer, shared_ptr<MediaBuffer> output_buffer)
+{
+    if (input_buffer == NULL || output_buffer == NULL)
+        return CONSUME_SKIP;
+    if (input_buffer->getMediaBufferType() != BUFFER_TYPE_VIDEO)
+        return CONSUME_BYPASS;
+
+    shared_ptr<VideoBuffer> src = static_pointer_cast<VideoBuffer>(input_buffer);
+    shared_ptr<VideoBuffer> dst = static_pointer_cast<VideoBuffer>(output_buffer);
+    ImagePara src_para = src->getImagePara();
+    if (src_para.width == 0 || src_para.height == 0)
+        src_para = input_para;
+
+    if (src->getBufferType() == VideoBuffer::DRM_BUFFER_CACHEABLE)
+        src->invalidateDrmBuf();
+
+    scaleNv12((const uint8_t*)src->getActiveData(), src_para, (uint8_t*)dst->getData(), output_para, x_map, y_map);
+
+    if (dst->getBufferType() == VideoBuffer::DRM_BUFFER_CACHEABLE)
+        dst->flushDrmBuf();
+
+    dst->setImagePara(output_para);
+    dst->setActiveData(dst->getData());
+    dst->setActiveSize(output_para.hstride * output_para.vstride * 3 / 2);
+    dst->setPUstimestamp(src->getPUstimestamp());
+    dst->setDUstimestamp(src->getDUstimestamp());
+    dst->setEos(src->getEos());
+    return CONSUME_SUCCESS;
+}